@@ -0,0 +1,81 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Node ids are below this (firmware MAX_NODES may be smaller) */
+#define MAX_NODES 64
+
+#define MAX_SOURCES 64
+#define MAX_CLIENTS 16
+#define MAX_LINE_LEN 1024
+#define MAX_FRAME_LEN 256
+
+/* Changes a viewer may lag behind before it is sent a snapshot instead */
+#define CHANGE_LOG_SIZE 4096
+#define CLIENT_BUF_SIZE (128 * 1024)
+
+#define DEFAULT_SOCKET_PATH "/tmp/irfence-collector.sock"
+
+/* Edge flags: RF and IR links from the topology graphs, fence sections
+ * from the fence record */
+#define EDGE_RF       0x01
+#define EDGE_IR       0x02
+#define EDGE_BEAM     0x04
+#define EDGE_BREACHED 0x08
+
+/* Mirrors section_state_t in node/fence.h */
+typedef enum {
+    SECTION_STATE_NONE = 0,
+    SECTION_STATE_ACTIVE,
+    SECTION_STATE_BREACHED,
+} section_state_t;
+
+extern bool verbose;
+
+/* model.c: topology with a version that grows with every record that changes
+ * it. Records replace the whole set of edges of their kind: begin, add the
+ * edges, end. Only differences are logged as changes. */
+void model_begin(uint8_t flags);
+void model_edge(uint8_t u, uint8_t v, uint8_t flags,
+                uint16_t dist, uint16_t angle);
+void model_end();
+
+void model_begin_locations();
+void model_location(uint8_t node, int16_t x, int16_t y);
+void model_dims(uint16_t x, uint16_t y);
+void model_end_locations();
+
+uint32_t model_version();
+uint32_t model_log_pos();
+
+/* Write the changes since log position *pos, or the whole model when *pos
+ * has fallen out of the change log, and advance *pos. Returns the length
+ * written, or -1 when buf is too small. */
+int model_write_delta(char *buf, size_t size, uint32_t *pos);
+int model_write_snapshot(char *buf, size_t size);
+
+/* parse.c: one CTRL record (without the prefix), parsed in place */
+int parse_record(const char *line, size_t len);
+
+/* serve.c: viewers on a local socket */
+int serve_open(const char *path, int epfd);
+void serve_close(const char *path);
+void serve_accept(int epfd);
+void serve_event(int epfd, int client, uint32_t events);
+void serve_publish(int epfd);
+
+/* epoll_event.data.u64: what the fd is, and its index */
+#define WATCH(kind, idx) (((uint64_t)(kind) << 32) | (uint32_t)(idx))
+#define WATCH_KIND(data) ((uint32_t)((data) >> 32))
+#define WATCH_IDX(data) ((uint32_t)(data))
+
+enum {
+    WATCH_SOURCE = 1,
+    WATCH_LISTEN,
+    WATCH_CLIENT,
+};
+
+#endif // COLLECTOR_H
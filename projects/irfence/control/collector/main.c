@@ -0,0 +1,360 @@
+/* Collects the CTRL records that nodes print on their UARTs (see
+ * node/output.h) from many nodes at once, keeps the RF and IR topology,
+ * node locations and fence state in memory, and serves the changes to
+ * viewers on a local socket (see serve.c).
+ *
+ *   collector [-s <socket>] [-b <baud>] [-v] <source>...
+ *
+ * A source is a UART device, a fifo, or '-' for stdin. Text lines and
+ * SLIPstream frames (the framing of tools/SLIPstream) may be mixed on one
+ * source, a frame carries one line. Regular files are read to the end when
+ * the collector starts, to replay a log. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/epoll.h>
+
+#include "collector.h"
+
+#define CTRL_PREFIX "CTRL: "
+
+#define READ_BUF_SIZE 4096
+#define MAX_EVENTS 64
+
+/* SLIP control bytes, as in tools/SLIPstream */
+#define SLIP_END     192
+#define SLIP_START   193
+#define SLIP_ESC     219
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+typedef enum {
+    RX_TEXT = 0,
+    RX_SLIP,
+    RX_SLIP_ESC,
+} rx_state_t;
+
+typedef struct {
+    const char *path;
+    int fd; /* -1 when closed */
+
+    char line[MAX_LINE_LEN];
+    size_t line_len;
+    bool line_overflow; /* drop the rest of the line */
+
+    rx_state_t rx_state;
+    uint8_t frame[MAX_FRAME_LEN];
+    size_t frame_len;
+
+    unsigned long records;
+    unsigned long bad_records;
+    unsigned long bad_frames;
+} source_t;
+
+bool verbose;
+
+static source_t sources[MAX_SOURCES];
+static int num_sources;
+static volatile sig_atomic_t quit;
+
+static void print_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s <socket>] [-b <baud>] [-v] <source>...\n"
+            "  -s  socket for viewers (default " DEFAULT_SOCKET_PATH ")\n"
+            "  -b  UART baud rate (default 115200)\n"
+            "  -v  log records and viewers\n", name);
+}
+
+static speed_t baud_to_speed(long baud)
+{
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 500000: return B500000;
+        default: return 0;
+    }
+}
+
+static int setup_tty(int fd, speed_t speed)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio))
+        return -1;
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cflag |= CLOCAL | CREAD;
+    return tcsetattr(fd, TCSANOW, &tio);
+}
+
+static void handle_line(source_t *src, const char *line, size_t len)
+{
+    size_t prefix_len = strlen(CTRL_PREFIX);
+    int rc;
+
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+        len--;
+    if (len < prefix_len || memcmp(line, CTRL_PREFIX, prefix_len))
+        return;
+
+    line += prefix_len;
+    len -= prefix_len;
+
+    rc = parse_record(line, len);
+    if (rc < 0) {
+        src->bad_records++;
+        fprintf(stderr, "%s: bad record: %.*s\n", src->path, (int)len, line);
+    } else if (rc == 0) {
+        src->records++;
+        if (verbose)
+            fprintf(stderr, "%s: %.*s\n", src->path, (int)len, line);
+    }
+}
+
+/* [size][payload...][checksum] between START and END */
+static void handle_frame(source_t *src)
+{
+    uint8_t checksum = 0;
+    size_t i;
+
+    if (src->frame_len < 2 || src->frame[0] != src->frame_len - 2) {
+        src->bad_frames++;
+        return;
+    }
+    for (i = 1; i < src->frame_len - 1; ++i)
+        checksum += src->frame[i];
+    if ((checksum & 0x7f) != src->frame[src->frame_len - 1]) {
+        src->bad_frames++;
+        return;
+    }
+    handle_line(src, (const char *)&src->frame[1], src->frame[0]);
+}
+
+static void frame_byte(source_t *src, uint8_t c)
+{
+    if (src->frame_len < sizeof(src->frame))
+        src->frame[src->frame_len++] = c;
+    else
+        src->rx_state = RX_TEXT; /* runaway frame: resync on text */
+}
+
+static void handle_bytes(source_t *src, const uint8_t *buf, size_t len)
+{
+    uint8_t c;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        c = buf[i];
+        switch (src->rx_state) {
+            case RX_TEXT:
+                if (c == SLIP_START) {
+                    src->rx_state = RX_SLIP;
+                    src->frame_len = 0;
+                } else if (c == '\n') {
+                    if (!src->line_overflow)
+                        handle_line(src, src->line, src->line_len);
+                    src->line_len = 0;
+                    src->line_overflow = false;
+                } else if (src->line_len < sizeof(src->line)) {
+                    src->line[src->line_len++] = c;
+                } else {
+                    src->line_overflow = true;
+                }
+                break;
+
+            case RX_SLIP:
+                if (c == SLIP_END) {
+                    handle_frame(src);
+                    src->rx_state = RX_TEXT;
+                } else if (c == SLIP_ESC) {
+                    src->rx_state = RX_SLIP_ESC;
+                } else {
+                    frame_byte(src, c);
+                }
+                break;
+
+            case RX_SLIP_ESC:
+                src->rx_state = RX_SLIP;
+                frame_byte(src, c == SLIP_ESC_END ? SLIP_END :
+                                c == SLIP_ESC_ESC ? SLIP_ESC : c);
+                break;
+        }
+    }
+}
+
+static void close_source(int epfd, source_t *src)
+{
+    fprintf(stderr, "%s: closed: %lu records, %lu bad, %lu bad frames\n",
+            src->path, src->records, src->bad_records, src->bad_frames);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    if (src->fd != STDIN_FILENO)
+        close(src->fd);
+    src->fd = -1;
+}
+
+/* Returns -1 when the source is done */
+static int read_source(source_t *src)
+{
+    uint8_t buf[READ_BUF_SIZE];
+    ssize_t n;
+
+    while (1) {
+        n = read(src->fd, buf, sizeof(buf));
+        if (n > 0) {
+            handle_bytes(src, buf, n);
+            continue;
+        }
+        if (n == 0)
+            return -1;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        perror(src->path);
+        return -1;
+    }
+}
+
+static int open_source(int epfd, source_t *src, speed_t speed)
+{
+    struct epoll_event ev;
+    int flags;
+
+    if (!strcmp(src->path, "-")) {
+        src->fd = STDIN_FILENO;
+        flags = fcntl(src->fd, F_GETFL);
+        fcntl(src->fd, F_SETFL, flags | O_NONBLOCK);
+    } else {
+        src->fd = open(src->path, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+        if (src->fd < 0) {
+            perror(src->path);
+            return -1;
+        }
+    }
+
+    if (isatty(src->fd) && setup_tty(src->fd, speed)) {
+        perror(src->path);
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = WATCH(WATCH_SOURCE, src - sources);
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, src->fd, &ev)) {
+        if (errno != EPERM) {
+            perror("epoll_ctl");
+            return -1;
+        }
+        /* regular file: replay it now */
+        read_source(src);
+        close_source(epfd, src);
+    }
+    return 0;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = DEFAULT_SOCKET_PATH;
+    struct epoll_event events[MAX_EVENTS];
+    long baud = 115200;
+    speed_t speed;
+    uint32_t kind, idx;
+    int epfd, opt, n, i;
+    bool published;
+
+    while ((opt = getopt(argc, argv, "s:b:vh")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'b':
+                baud = atol(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    speed = baud_to_speed(baud);
+    if (!speed || optind == argc || argc - optind > MAX_SOURCES) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    if (serve_open(socket_path, epfd))
+        return 1;
+
+    for (i = optind; i < argc; ++i) {
+        sources[num_sources].path = argv[i];
+        if (open_source(epfd, &sources[num_sources], speed))
+            return 1;
+        num_sources++;
+    }
+
+    while (!quit) {
+        n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        /* Publish once per wakeup: records that arrive together go out to
+         * the viewers in one update */
+        published = false;
+        for (i = 0; i < n; ++i) {
+            kind = WATCH_KIND(events[i].data.u64);
+            idx = WATCH_IDX(events[i].data.u64);
+            switch (kind) {
+                case WATCH_SOURCE:
+                    if (read_source(&sources[idx]) ||
+                        (events[i].events & (EPOLLHUP | EPOLLERR)))
+                        close_source(epfd, &sources[idx]);
+                    published = true;
+                    break;
+                case WATCH_LISTEN:
+                    serve_accept(epfd);
+                    break;
+                case WATCH_CLIENT:
+                    serve_event(epfd, idx, events[i].events);
+                    break;
+            }
+        }
+        if (published)
+            serve_publish(epfd);
+    }
+
+    serve_close(socket_path);
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "collector.h"
+
+/* The next_* fields collect the record being parsed, and are compared
+ * against the current state when the record ends */
+typedef struct {
+    uint8_t flags;
+    uint16_t dist;
+    uint16_t angle;
+    uint8_t next_flags;
+    uint16_t next_dist;
+    uint16_t next_angle;
+} edge_t;
+
+typedef struct {
+    bool located;
+    int16_t x, y;
+    bool next_located;
+    int16_t next_x, next_y;
+} node_t;
+
+typedef enum {
+    CHANGE_EDGE = 0,
+    CHANGE_NODE,
+    CHANGE_DIMS,
+} change_kind_t;
+
+typedef struct {
+    uint8_t kind; /* change_kind_t */
+    uint8_t a, b;
+} change_t;
+
+static edge_t edges[MAX_NODES][MAX_NODES];
+static node_t nodes[MAX_NODES];
+static uint16_t dim_x, dim_y, next_dim_x, next_dim_y;
+
+/* Ring of the elements that changed: the log position counts all changes
+ * ever logged, a viewer remembers the position it has seen up to */
+static change_t change_log[CHANGE_LOG_SIZE];
+static uint32_t log_pos;
+static uint32_t version;
+static bool record_changed;
+
+static void log_change(change_kind_t kind, uint8_t a, uint8_t b)
+{
+    change_t *change = &change_log[log_pos % CHANGE_LOG_SIZE];
+
+    change->kind = kind;
+    change->a = a;
+    change->b = b;
+    log_pos++;
+    record_changed = true;
+}
+
+static void end_record()
+{
+    if (record_changed) {
+        version++;
+        if (verbose)
+            fprintf(stderr, "model: ver %u\n", version);
+    }
+    record_changed = false;
+}
+
+void model_begin(uint8_t flags)
+{
+    uint8_t u, v;
+    edge_t *e;
+
+    for (u = 0; u < MAX_NODES; ++u) {
+        for (v = 0; v < MAX_NODES; ++v) {
+            e = &edges[u][v];
+            e->next_flags = e->flags & ~flags;
+            e->next_dist = flags & EDGE_IR ? 0 : e->dist;
+            e->next_angle = flags & EDGE_IR ? 0 : e->angle;
+        }
+    }
+}
+
+void model_edge(uint8_t u, uint8_t v, uint8_t flags,
+                uint16_t dist, uint16_t angle)
+{
+    edge_t *e = &edges[u][v];
+
+    e->next_flags |= flags;
+    if (flags & EDGE_IR) {
+        e->next_dist = dist;
+        e->next_angle = angle;
+    }
+}
+
+void model_end()
+{
+    uint8_t u, v;
+    edge_t *e;
+
+    for (u = 0; u < MAX_NODES; ++u) {
+        for (v = 0; v < MAX_NODES; ++v) {
+            e = &edges[u][v];
+            if (e->next_flags == e->flags && e->next_dist == e->dist &&
+                e->next_angle == e->angle)
+                continue;
+            e->flags = e->next_flags;
+            e->dist = e->next_dist;
+            e->angle = e->next_angle;
+            log_change(CHANGE_EDGE, u, v);
+        }
+    }
+    end_record();
+}
+
+void model_begin_locations()
+{
+    uint8_t i;
+
+    for (i = 0; i < MAX_NODES; ++i)
+        nodes[i].next_located = false;
+    next_dim_x = dim_x;
+    next_dim_y = dim_y;
+}
+
+void model_location(uint8_t node, int16_t x, int16_t y)
+{
+    nodes[node].next_located = true;
+    nodes[node].next_x = x;
+    nodes[node].next_y = y;
+}
+
+void model_dims(uint16_t x, uint16_t y)
+{
+    next_dim_x = x;
+    next_dim_y = y;
+}
+
+void model_end_locations()
+{
+    uint8_t i;
+    node_t *n;
+
+    for (i = 0; i < MAX_NODES; ++i) {
+        n = &nodes[i];
+        if (n->next_located == n->located &&
+            (!n->located || (n->next_x == n->x && n->next_y == n->y)))
+            continue;
+        n->located = n->next_located;
+        n->x = n->next_x;
+        n->y = n->next_y;
+        log_change(CHANGE_NODE, i, 0);
+    }
+
+    if (next_dim_x != dim_x || next_dim_y != dim_y) {
+        dim_x = next_dim_x;
+        dim_y = next_dim_y;
+        log_change(CHANGE_DIMS, 0, 0);
+    }
+    end_record();
+}
+
+uint32_t model_version()
+{
+    return version;
+}
+
+uint32_t model_log_pos()
+{
+    return log_pos;
+}
+
+/* Appends to buf at *len, fails when out of space */
+#define APPEND(buf, size, len, ...) do { \
+        int written = snprintf((buf) + *(len), (size) - *(len), __VA_ARGS__); \
+        if (written < 0 || (size_t)written >= (size) - *(len)) \
+            return -1; \
+        *(len) += written; \
+    } while (0)
+
+static int write_edge(char *buf, size_t size, size_t *len,
+                      uint8_t u, uint8_t v)
+{
+    edge_t *e = &edges[u][v];
+
+    APPEND(buf, size, len, "E %u %u %u %u %u\n",
+           u, v, e->flags, e->dist, e->angle);
+    return 0;
+}
+
+static int write_node(char *buf, size_t size, size_t *len, uint8_t i)
+{
+    node_t *n = &nodes[i];
+
+    if (n->located)
+        APPEND(buf, size, len, "N %u %d %d\n", i, n->x, n->y);
+    else
+        APPEND(buf, size, len, "N %u -\n", i);
+    return 0;
+}
+
+static int write_dims(char *buf, size_t size, size_t *len)
+{
+    APPEND(buf, size, len, "D %u %u\n", dim_x, dim_y);
+    return 0;
+}
+
+int model_write_snapshot(char *buf, size_t size)
+{
+    size_t len = 0;
+    uint8_t u, v;
+
+    APPEND(buf, size, &len, "S\n");
+    if (write_dims(buf, size, &len))
+        return -1;
+    for (u = 0; u < MAX_NODES; ++u) {
+        if (nodes[u].located && write_node(buf, size, &len, u))
+            return -1;
+        for (v = 0; v < MAX_NODES; ++v)
+            if (edges[u][v].flags && write_edge(buf, size, &len, u, v))
+                return -1;
+    }
+    APPEND(buf, size, &len, "V %u\n", version);
+    return len;
+}
+
+int model_write_delta(char *buf, size_t size, uint32_t *pos)
+{
+    size_t len = 0;
+    change_t *change;
+    uint32_t p;
+    int rc;
+
+    if (*pos == log_pos)
+        return 0;
+
+    if (log_pos - *pos > CHANGE_LOG_SIZE) {
+        rc = model_write_snapshot(buf, size);
+        if (rc >= 0)
+            *pos = log_pos;
+        return rc;
+    }
+
+    /* The log names the elements, the lines carry their current state */
+    for (p = *pos; p != log_pos; ++p) {
+        change = &change_log[p % CHANGE_LOG_SIZE];
+        switch (change->kind) {
+            case CHANGE_EDGE:
+                rc = write_edge(buf, size, &len, change->a, change->b);
+                break;
+            case CHANGE_NODE:
+                rc = write_node(buf, size, &len, change->a);
+                break;
+            case CHANGE_DIMS:
+                rc = write_dims(buf, size, &len);
+                break;
+            default:
+                rc = -1;
+        }
+        if (rc)
+            return -1;
+    }
+    APPEND(buf, size, &len, "V %u\n", version);
+    *pos = log_pos;
+    return len;
+}
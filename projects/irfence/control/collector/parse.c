@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "collector.h"
+
+/* Records, as printed by the COUT calls in the node code:
+ *
+ *   digraph RF { 3; 1 -> 2; 2 -> 1; }
+ *   digraph IR { 1 -> 2 [d=40,a=90]; }
+ *   digraph LOC { dim_x=100; dim_y=80; 3 [x=10,y=-5]; 1 -> 2 [d=40,a=90]; }
+ *   fence: 1:1 2:2 3:0
+ *
+ * The line is scanned in place, without copies or allocation. Each record
+ * is scanned twice: once to validate it, then to apply it to the model, so
+ * that a truncated line does not leave half a graph in the model. */
+
+typedef struct {
+    const char *p;
+    const char *end;
+    bool apply;
+} cursor_t;
+
+typedef struct {
+    long d, a, x, y;
+    bool has_x, has_y;
+} attrs_t;
+
+typedef enum {
+    GRAPH_RF = 0,
+    GRAPH_IR,
+    GRAPH_LOC,
+} graph_kind_t;
+
+static void skip_ws(cursor_t *c)
+{
+    while (c->p < c->end && isspace((unsigned char)*c->p))
+        c->p++;
+}
+
+static bool accept(cursor_t *c, const char *s)
+{
+    size_t n = strlen(s);
+
+    skip_ws(c);
+    if ((size_t)(c->end - c->p) < n || memcmp(c->p, s, n))
+        return false;
+    c->p += n;
+    return true;
+}
+
+static bool parse_int(cursor_t *c, long min, long max, long *val)
+{
+    bool neg = false;
+    long v = 0;
+
+    skip_ws(c);
+    if (c->p < c->end && *c->p == '-') {
+        neg = true;
+        c->p++;
+    }
+    if (c->p >= c->end || !isdigit((unsigned char)*c->p))
+        return false;
+    while (c->p < c->end && isdigit((unsigned char)*c->p)) {
+        v = v * 10 + (*c->p++ - '0');
+        if (v > max - min) /* both bounds are small */
+            return false;
+    }
+    if (neg)
+        v = -v;
+    if (v < min || v > max)
+        return false;
+    *val = v;
+    return true;
+}
+
+static bool parse_node(cursor_t *c, uint8_t *node)
+{
+    long v;
+
+    if (!parse_int(c, 0, MAX_NODES - 1, &v))
+        return false;
+    *node = v;
+    return true;
+}
+
+/* Identifier, not terminated: returns its length */
+static size_t parse_word(cursor_t *c, const char **word)
+{
+    skip_ws(c);
+    *word = c->p;
+    while (c->p < c->end && (isalnum((unsigned char)*c->p) || *c->p == '_'))
+        c->p++;
+    return c->p - *word;
+}
+
+static bool word_is(const char *word, size_t len, const char *s)
+{
+    return strlen(s) == len && !memcmp(word, s, len);
+}
+
+/* [key=val,...], optional */
+static bool parse_attrs(cursor_t *c, attrs_t *attrs)
+{
+    const char *key;
+    size_t len;
+    long val;
+
+    memset(attrs, 0, sizeof(attrs_t));
+    if (!accept(c, "["))
+        return true;
+
+    do {
+        len = parse_word(c, &key);
+        if (!len || !accept(c, "=") || !parse_int(c, -32768, 65535, &val))
+            return false;
+        if (word_is(key, len, "d")) {
+            attrs->d = val;
+        } else if (word_is(key, len, "a")) {
+            attrs->a = val;
+        } else if (word_is(key, len, "x")) {
+            attrs->x = val;
+            attrs->has_x = true;
+        } else if (word_is(key, len, "y")) {
+            attrs->y = val;
+            attrs->has_y = true;
+        } /* else: ignore */
+    } while (accept(c, ","));
+
+    return accept(c, "]");
+}
+
+static int parse_digraph(cursor_t *c)
+{
+    graph_kind_t kind;
+    const char *name;
+    size_t len;
+    uint8_t u, v;
+    attrs_t attrs;
+    long val, dim_x = 0, dim_y = 0;
+    uint8_t flag;
+
+    len = parse_word(c, &name);
+    if (word_is(name, len, "RF") || word_is(name, len, "G"))
+        kind = GRAPH_RF;
+    else if (word_is(name, len, "IR"))
+        kind = GRAPH_IR;
+    else if (word_is(name, len, "LOC"))
+        kind = GRAPH_LOC;
+    else
+        return 1;
+
+    if (!accept(c, "{"))
+        return -1;
+
+    flag = kind == GRAPH_RF ? EDGE_RF : EDGE_IR;
+    if (c->apply) {
+        if (kind == GRAPH_LOC)
+            model_begin_locations();
+        else
+            model_begin(flag);
+    }
+
+    while (!accept(c, "}")) {
+        skip_ws(c);
+        if (c->p >= c->end)
+            return -1;
+
+        if (isdigit((unsigned char)*c->p)) {
+            if (!parse_node(c, &u))
+                return -1;
+            if (accept(c, "->")) {
+                if (!parse_node(c, &v) || !parse_attrs(c, &attrs))
+                    return -1;
+                /* edges in LOC are the IR graph it was computed from */
+                if (c->apply && kind != GRAPH_LOC)
+                    model_edge(u, v, flag, attrs.d, attrs.a);
+            } else {
+                if (!parse_attrs(c, &attrs))
+                    return -1;
+                if (c->apply && kind == GRAPH_LOC &&
+                    attrs.has_x && attrs.has_y)
+                    model_location(u, attrs.x, attrs.y);
+            }
+        } else {
+            len = parse_word(c, &name);
+            if (!len || !accept(c, "=") || !parse_int(c, 0, 65535, &val))
+                return -1;
+            if (word_is(name, len, "dim_x"))
+                dim_x = val;
+            else if (word_is(name, len, "dim_y"))
+                dim_y = val;
+        }
+
+        if (!accept(c, ";"))
+            return -1;
+    }
+
+    if (c->apply) {
+        if (kind == GRAPH_LOC) {
+            model_dims(dim_x, dim_y);
+            model_end_locations();
+        } else {
+            model_end();
+        }
+    }
+    return 0;
+}
+
+/* Section i runs from post i to post i + 1, in the state of post i */
+static int parse_fence(cursor_t *c)
+{
+    uint8_t post, prev_post = 0;
+    section_state_t prev_state = SECTION_STATE_NONE;
+    bool first = true;
+    long state;
+    uint8_t flags;
+
+    if (c->apply)
+        model_begin(EDGE_BEAM | EDGE_BREACHED);
+
+    skip_ws(c);
+    while (c->p < c->end) {
+        if (!parse_node(c, &post) || !accept(c, ":") ||
+            !parse_int(c, SECTION_STATE_NONE, SECTION_STATE_BREACHED, &state))
+            return -1;
+
+        if (!first && c->apply) {
+            flags = prev_state == SECTION_STATE_ACTIVE ? EDGE_BEAM :
+                    prev_state == SECTION_STATE_BREACHED ? EDGE_BREACHED : 0;
+            if (flags)
+                model_edge(prev_post, post, flags, 0, 0);
+        }
+
+        first = false;
+        prev_post = post;
+        prev_state = state;
+        skip_ws(c);
+    }
+
+    if (c->apply)
+        model_end();
+    return 0;
+}
+
+static int parse(cursor_t *c)
+{
+    if (accept(c, "digraph"))
+        return parse_digraph(c);
+    if (accept(c, "fence:"))
+        return parse_fence(c);
+    return 1;
+}
+
+int parse_record(const char *line, size_t len)
+{
+    cursor_t c;
+    int rc;
+
+    c.p = line;
+    c.end = line + len;
+    c.apply = false;
+    rc = parse(&c);
+    if (rc)
+        return rc;
+
+    c.p = line;
+    c.apply = true;
+    return parse(&c);
+}
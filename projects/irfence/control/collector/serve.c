@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "collector.h"
+
+/* Viewers connect to a unix socket and get a snapshot of the model, then
+ * the elements that changed after each record, as text lines:
+ *
+ *   S                           snapshot follows: forget the model
+ *   E <u> <v> <flags> <d> <a>   edge u -> v (EDGE_* flags, 0 if gone)
+ *   N <node> <x> <y>            node location, or '-' if unknown
+ *   D <x> <y>                   map dimensions
+ *   V <ver>                     end of update: the model is at ver
+ *
+ * A viewer that does not keep up is sent the changes it missed in one go
+ * when its socket drains, or a new snapshot when they are no longer in the
+ * change log, so it never slows down the sources. */
+
+typedef struct {
+    int fd; /* -1 when the slot is free */
+    bool synced; /* sent a snapshot */
+    uint32_t pos; /* change log position sent up to */
+    char buf[CLIENT_BUF_SIZE];
+    size_t len;
+    size_t off;
+    bool blocked; /* waiting for EPOLLOUT */
+} client_t;
+
+static int listen_fd = -1;
+static client_t clients[MAX_CLIENTS];
+
+static void set_nonblock(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void drop_client(int epfd, client_t *client)
+{
+    if (verbose)
+        fprintf(stderr, "serve: viewer %ld left\n", (long)(client - clients));
+    epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void watch_client(int epfd, client_t *client, bool out)
+{
+    struct epoll_event ev;
+
+    if (client->blocked == out)
+        return;
+    client->blocked = out;
+    ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+    ev.data.u64 = WATCH(WATCH_CLIENT, client - clients);
+    epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+/* Queue what the client has not seen yet, into its empty buffer */
+static int fill(client_t *client)
+{
+    int rc = -1;
+
+    client->off = client->len = 0;
+
+    if (client->synced)
+        rc = model_write_delta(client->buf, sizeof(client->buf), &client->pos);
+    if (rc < 0) { /* first time, or the delta does not fit */
+        rc = model_write_snapshot(client->buf, sizeof(client->buf));
+        if (rc < 0) {
+            fprintf(stderr, "serve: snapshot too large\n");
+            return -1;
+        }
+        client->pos = model_log_pos();
+        client->synced = true;
+    }
+    client->len = rc;
+    return 0;
+}
+
+static int flush(int epfd, client_t *client)
+{
+    ssize_t n;
+
+    while (client->off < client->len) {
+        n = send(client->fd, client->buf + client->off,
+                 client->len - client->off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watch_client(epfd, client, true);
+                return 0;
+            }
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        client->off += n;
+    }
+    return 0;
+}
+
+/* Send what is queued, then what changed meanwhile */
+static void update(int epfd, client_t *client)
+{
+    while (1) {
+        if (flush(epfd, client)) {
+            drop_client(epfd, client);
+            return;
+        }
+        if (client->off != client->len)
+            return; /* socket full */
+        if (client->synced && client->pos == model_log_pos())
+            break;
+        if (fill(client)) {
+            drop_client(epfd, client);
+            return;
+        }
+    }
+    watch_client(epfd, client, false);
+}
+
+int serve_open(const char *path, int epfd)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    int i;
+
+    for (i = 0; i < MAX_CLIENTS; ++i)
+        clients[i].fd = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "serve: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(listen_fd, MAX_CLIENTS)) {
+        perror(path);
+        close(listen_fd);
+        return -1;
+    }
+    set_nonblock(listen_fd);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = WATCH(WATCH_LISTEN, 0);
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+void serve_close(const char *path)
+{
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path);
+    }
+}
+
+void serve_accept(int epfd)
+{
+    struct epoll_event ev;
+    client_t *client = NULL;
+    int fd, i;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        for (i = 0; i < MAX_CLIENTS; ++i) {
+            if (clients[i].fd < 0) {
+                client = &clients[i];
+                break;
+            }
+        }
+        if (!client) {
+            fprintf(stderr, "serve: too many viewers\n");
+            close(fd);
+            continue;
+        }
+
+        set_nonblock(fd);
+        client->fd = fd;
+        client->synced = false;
+        client->blocked = false;
+        client->len = client->off = 0;
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = WATCH(WATCH_CLIENT, i);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+            perror("epoll_ctl");
+            close(fd);
+            client->fd = -1;
+            continue;
+        }
+
+        if (verbose)
+            fprintf(stderr, "serve: viewer %d joined\n", i);
+        update(epfd, client);
+        client = NULL;
+    }
+}
+
+void serve_event(int epfd, int idx, uint32_t events)
+{
+    client_t *client = &clients[idx];
+    char discard[256];
+    ssize_t n;
+
+    if (client->fd < 0)
+        return;
+
+    if (events & EPOLLIN) { /* viewers have nothing to say */
+        n = recv(client->fd, discard, sizeof(discard), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            drop_client(epfd, client);
+            return;
+        }
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        drop_client(epfd, client);
+        return;
+    }
+    if (events & EPOLLOUT)
+        update(epfd, client);
+}
+
+void serve_publish(int epfd)
+{
+    int i;
+
+    for (i = 0; i < MAX_CLIENTS; ++i) {
+        if (clients[i].fd < 0)
+            continue;
+        /* behind on a slow socket: catches up on EPOLLOUT */
+        if (clients[i].blocked)
+            continue;
+        if (clients[i].pos != model_log_pos())
+            update(epfd, &clients[i]);
+    }
+}
@@ -0,0 +1,160 @@
+#!/usr/bin/python
+
+# Turns the deferred log records of a node (ENABLE_DEFERRED_LOG, see
+# node/deflog.h) back into text. Reads UART output on stdin, or from a
+# device, and passes through any line that is not a record.
+#
+#   logdecode.py ../node/main.elf < screenlog.0
+#   logdecode.py ../node/main.elf -d /dev/ttyUSB0
+
+from __future__ import print_function
+
+import sys
+import struct
+import argparse
+import re
+
+parser = argparse.ArgumentParser(description=\
+        'Decode deferred log records using the strings in the firmware ELF')
+parser.add_argument('elf',
+        help="firmware image the node is running")
+parser.add_argument('-d', '--dev',
+        help="UART device to read from instead of stdin")
+args = parser.parse_args()
+
+REC_PREFIX = '@'
+PREAMBLE = 0x80
+LEN_MASK = 0x3f
+REC_HDR_LEN = 3
+INT_SIZE = 2 # AVR
+LOG_TIMESTAMP = True # mirror node/cfg.h
+
+SPEC_RE = re.compile(r'%([-+ #0-9.]*)(l?)([a-zA-Z%])')
+
+class Flash:
+    """Loadable sections of an ELF32 (little endian) image by address"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        if data[:4] != b'\x7fELF' or data[4:5] != b'\x01':
+            raise ValueError("not an ELF32 image: " + path)
+
+        shoff, = struct.unpack_from('<I', data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', data, 0x2e)
+
+        self.sections = []
+        for i in range(shnum):
+            (name, typ, flags, addr, offset, size) = \
+                struct.unpack_from('<IIIIII', data, shoff + i * shentsize)
+            SHT_PROGBITS = 1
+            SHF_ALLOC = 0x2
+            if typ == SHT_PROGBITS and flags & SHF_ALLOC:
+                self.sections.append((addr, data[offset:offset + size]))
+
+        self.cache = {}
+
+    def string(self, addr):
+        if addr in self.cache:
+            return self.cache[addr]
+        for (base, content) in self.sections:
+            if base <= addr < base + len(content):
+                end = content.index(b'\0', addr - base)
+                s = content[addr - base:end].decode('ascii', 'replace')
+                self.cache[addr] = s
+                return s
+        return None
+
+def unpack_int(buf, pos, size, signed):
+    fmt = {(2, False): '<H', (2, True): '<h',
+           (4, False): '<I', (4, True): '<i'}[(size, signed)]
+    return struct.unpack_from(fmt, buf, pos)[0]
+
+def format_args(fmt, payload, pos):
+    """Same walk over the format as pack_args on the node"""
+    out = []
+    last = 0
+    for m in SPEC_RE.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, is_long, conv = m.groups()
+
+        if conv == '%':
+            out.append('%')
+            continue
+
+        if conv == 's':
+            if pos + 1 > len(payload):
+                break
+            n = bytearray(payload)[pos]
+            if pos + 1 + n > len(payload):
+                break
+            val = payload[pos + 1:pos + 1 + n].decode('ascii', 'replace')
+            pos += 1 + n
+        else:
+            size = 4 if is_long else INT_SIZE
+            if pos + size > len(payload):
+                break
+            val = unpack_int(payload, pos, size, conv in 'di')
+            pos += size
+            if conv == 'c':
+                val = chr(val & 0xff)
+
+        out.append(('%' + flags + conv) % val)
+    else:
+        out.append(fmt[last:])
+    return ''.join(out)
+
+def decode(flash, rec):
+    hdr = bytearray(rec)[0]
+    addr = unpack_int(rec, 1, 2, False)
+    payload = rec[REC_HDR_LEN:REC_HDR_LEN + (hdr & LEN_MASK)]
+    pos = 0
+
+    text = ''
+    if hdr & PREAMBLE:
+        node = bytearray(payload)[0]
+        pos += 1
+        if LOG_TIMESTAMP:
+            secs, ms = struct.unpack_from('<IH', payload, pos)
+            pos += 6
+            text += '%u| %u.%u: ' % (node, secs, ms)
+        else:
+            text += '%u| ' % node
+
+    fmt = flash.string(addr)
+    if fmt is None:
+        return text + '<unknown log id 0x%04x>' % addr
+    return text + format_args(fmt, payload, pos)
+
+def main():
+    flash = Flash(args.elf)
+    src = open(args.dev, 'rb') if args.dev else sys.stdin
+
+    line_buf = ''
+    for line in iter(src.readline, ''):
+        if isinstance(line, bytes):
+            line = line.decode('ascii', 'replace')
+            if not line:
+                break
+        line = line.rstrip('\r\n')
+
+        if not line.startswith(REC_PREFIX):
+            print(line)
+            continue
+
+        try:
+            rec = bytes(bytearray.fromhex(line[len(REC_PREFIX):]))
+            line_buf += decode(flash, rec)
+        except (ValueError, IndexError, struct.error) as e:
+            print("WARN: bad record: " + line + ": " + str(e))
+            continue
+
+        # Records are fragments of a log line, like the LOG* calls
+        while '\n' in line_buf:
+            text, line_buf = line_buf.split('\n', 1)
+            print(text.rstrip('\r'))
+        sys.stdout.flush()
+
+if __name__ == '__main__':
+    main()
@@ -11,6 +11,7 @@
 #include "position.h"
 #include "fence.h"
 #include "irtop.h"
+#include "bitset.h"
 
 #include "autofence.h"
 
@@ -20,63 +21,151 @@
 /* TODO: this is a bit superfluous, used by cmd for testing only */
 static fence_t max_fence;
 
-int8_t calc_max_fence(fence_t *fence)
+static location_t *sort_locs; /* for the qsort comparator */
+
+static int cmp_location(const void *a, const void *b)
 {
-    uint8_t i;
-    LOG("calculating max area fence\r\n");
+    point_t *pt_a = &sort_locs[*(const node_id_t *)a].pt;
+    point_t *pt_b = &sort_locs[*(const node_id_t *)b].pt;
 
-    ir_graph_t *ir_graph = get_ir_graph();
-    location_t *locations = get_locations();
-    node_id_t node, next_node;
-    uint8_t used_nodes = 0x0;
-    uint16_t max_angle;
-    uint8_t min_y = 0;
-    ir_edge_t *edge;
-    location_t *loc;
-
-    memset(&max_fence, 0, sizeof(max_fence));
-
-    next_node = INVALID_NODE_ID;
-    for (i = 0; i < MAX_NODES; ++i) {
-        loc = &locations[i];
-        if (loc->valid) {
-            if (next_node == INVALID_NODE_ID || min_y > loc->pt.y) {
-                min_y = loc->pt.y;
-                next_node = i;
-            }
+    if (pt_a->x != pt_b->x)
+        return pt_a->x - pt_b->x;
+    return pt_a->y - pt_b->y;
+}
+
+/* Positive if o -> a -> b turns counter-clockwise, zero if collinear */
+static int32_t cross(point_t *o, point_t *a, point_t *b)
+{
+    return (int32_t)(a->x - o->x) * (b->y - o->y) -
+           (int32_t)(a->y - o->y) * (b->x - o->x);
+}
+
+/* Andrew's monotone chain: the hull of the located posts in
+ * counter-clockwise order, without collinear posts. The hull buffer needs
+ * one slot more than there are posts. */
+static uint8_t calc_hull(location_t *locs, node_id_t *hull)
+{
+    node_id_t sorted[MAX_NODES];
+    uint8_t n = 0, len = 0, lower_len;
+    node_id_t i;
+
+    for (i = 0; i < MAX_NODES; ++i)
+        if (locs[i].valid)
+            sorted[n++] = i;
+
+    if (n < 3) {
+        memcpy(hull, sorted, n * sizeof(node_id_t));
+        return n;
+    }
+
+    sort_locs = locs;
+    qsort(sorted, n, sizeof(node_id_t), cmp_location);
+
+    for (i = 0; i < n; ++i) { /* lower hull */
+        while (len >= 2 && cross(&locs[hull[len - 2]].pt,
+                                 &locs[hull[len - 1]].pt,
+                                 &locs[sorted[i]].pt) <= 0)
+            --len;
+        hull[len++] = sorted[i];
+    }
+
+    lower_len = len + 1;
+    for (i = n - 1; i-- > 0; ) { /* upper hull */
+        while (len >= lower_len && cross(&locs[hull[len - 2]].pt,
+                                         &locs[hull[len - 1]].pt,
+                                         &locs[sorted[i]].pt) <= 0)
+            --len;
+        hull[len++] = sorted[i];
+    }
+
+    return len - 1; /* the last post is the first one again */
+}
+
+static void add_post(fence_t *fence, uint8_t *used, node_id_t node)
+{
+    fence->posts[fence->len++] = node;
+    BITSET_ADD(used, node);
+    LOG("added fence pole: "); LOGP("%u\r\n", node);
+}
+
+/* Breadth-first search for the shortest IR path from the last post to the
+ * given one through posts not on the fence yet. Appends the path. */
+static int8_t add_ir_path(fence_t *fence, uint8_t *used,
+                          ir_graph_t *ir_graph, node_id_t to)
+{
+    node_id_t from = fence->posts[fence->len - 1];
+    node_id_t prev[MAX_NODES];
+    node_id_t queue[MAX_NODES];
+    node_id_t path[MAX_NODES];
+    uint8_t visited[BITSET_BYTES(MAX_NODES)];
+    uint8_t head = 0, tail = 0, len = 0;
+    node_id_t node, i;
+
+    BITSET_INIT(visited, MAX_NODES);
+    BITSET_ADD(visited, from);
+    queue[tail++] = from;
+
+    while (head < tail && !BITSET_IN(visited, to)) {
+        node = queue[head++];
+        for (i = 0; i < MAX_NODES; ++i) {
+            if (!(*ir_graph)[node][i].valid || BITSET_IN(visited, i) ||
+                BITSET_IN(used, i))
+                continue;
+            BITSET_ADD(visited, i);
+            prev[i] = node;
+            queue[tail++] = i;
         }
     }
 
-    if (next_node == INVALID_NODE_ID) {
+    if (!BITSET_IN(visited, to))
+        return NRK_ERROR;
+
+    for (node = to; node != from; node = prev[node])
+        path[len++] = node;
+    while (len > 0)
+        add_post(fence, used, path[--len]);
+    return NRK_OK;
+}
+
+/* The fence runs along the hull of the post locations. Hull neighbors
+ * without an IR edge between them are joined through the posts in between,
+ * and a hull post that IR cannot reach at all is left out. */
+int8_t calc_max_fence(fence_t *fence)
+{
+    ir_graph_t *ir_graph = get_ir_graph();
+    location_t *locations = get_locations();
+    node_id_t hull[MAX_NODES + 1];
+    uint8_t used[BITSET_BYTES(MAX_NODES)];
+    uint8_t hull_len, i;
+    int8_t rc;
+
+    LOG("calculating max area fence\r\n");
+
+    memset(fence, 0, sizeof(fence_t));
+    BITSET_INIT(used, MAX_NODES);
+
+    hull_len = calc_hull(locations, hull);
+    if (hull_len == 0) {
         WARN("no nodes in IR graph\r\n");
         return NRK_ERROR;
     }
 
-    do {
-        node = next_node;
-        used_nodes |= 1 << node;
-        fence->posts[fence->len++] = node;
-        LOG("added fence pole: "); LOGP("%u\r\n", node);
-
-        max_angle = 0;
-        next_node = INVALID_NODE_ID;
-        for (i = 0; i < MAX_NODES; ++i) { /* find "right-most" neighbor */
-            edge = &(*ir_graph)[node][i];
-
-            if (edge->valid) {
-                LOG("checking neighbor: "); LOGP("%u", i);
-                LOGA(" angle "); LOGP("%u", edge->angle);
-                LOGA(" max "); LOGP("%u", max_angle);
-                LOGA(" used "); LOGP("%x", used_nodes);
-                LOGA("\r\n");
-
-                if ((!(used_nodes & (1 << i))) && edge->angle > max_angle) {
-                    max_angle = edge->angle;
-                    next_node = i;
-                }
-            }
+    LOG("hull: ");
+    for (i = 0; i < hull_len; ++i)
+        LOGP("%u ", hull[i]);
+    LOGNL();
+
+    add_post(fence, used, hull[0]);
+    for (i = 1; i < hull_len; ++i) {
+        if (BITSET_IN(used, hull[i])) /* a detour already took it */
+            continue;
+
+        rc = add_ir_path(fence, used, ir_graph, hull[i]);
+        if (rc != NRK_OK) {
+            LOG("WARN: hull post unreachable by IR: ");
+            LOGP("%u\r\n", hull[i]);
         }
-    } while (next_node != INVALID_NODE_ID);
+    }
 
     return NRK_OK;
 }
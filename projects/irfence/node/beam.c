@@ -39,6 +39,7 @@ typedef struct {
     uint8_t device; /* led idx OR receivers bitmask */
     bool active;
     bool broken; /* for incoming beam only */
+    nrk_time_t changed; /* when broken last changed, incoming beam only */
 } beam_t;
 
 enum {
@@ -101,6 +102,12 @@ bool get_beam_state()
     return !in_beam.broken;
 }
 
+/* Receiver time of the last break or restore of the incoming beam */
+void get_beam_change_time(nrk_time_t *time)
+{
+    *time = in_beam.changed;
+}
+
 static int8_t rpc_receive_beam(node_id_t node)
 {
     int8_t rc = NRK_OK;
@@ -294,12 +301,16 @@ static void beam_task()
             if (!(ir_rcv_state(in_beam.device))) {
                 if (!in_beam.broken) {
                     in_beam.broken = true;
+                    ir_rcv_change_time(in_beam.device, &in_beam.changed);
                     nrk_event_signal(beam_signal);
-                    LOG("beam broken\r\n");
+                    LOG("beam broken at ");
+                    LOGP("%lu:%lu\r\n", in_beam.changed.secs,
+                         in_beam.changed.nano_secs);
                 }
             } else {
                 if (in_beam.broken) {
                     in_beam.broken = false;
+                    ir_rcv_change_time(in_beam.device, &in_beam.changed);
                     nrk_event_signal(beam_signal);
                     LOG("beam restored\r\n");
                 }
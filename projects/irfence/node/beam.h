@@ -7,6 +7,7 @@ uint8_t init_beam(uint8_t priority);
 int8_t create_beam(node_id_t receiver);
 int8_t destroy_beam();
 bool get_beam_state();
+void get_beam_change_time(nrk_time_t *time);
 
 int8_t cmd_beam(uint8_t argc, char **argv);
 
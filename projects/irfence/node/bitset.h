@@ -0,0 +1,15 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <string.h>
+
+/* Bit sets in a uint8_t array sized for the number of members. node_set_t
+ * wraps one sized for MAX_NODES. */
+#define BITSET_BYTES(bits) (((bits) + 7) / 8)
+
+#define BITSET_INIT(set, bits) memset(set, 0, BITSET_BYTES(bits))
+#define BITSET_ADD(set, i) do { (set)[(i) >> 3] |= 1 << ((i) & 7); } while (0)
+#define BITSET_REMOVE(set, i) do { (set)[(i) >> 3] &= ~(1 << ((i) & 7)); } while (0)
+#define BITSET_IN(set, i) ((set)[(i) >> 3] & (1 << ((i) & 7)))
+
+#endif
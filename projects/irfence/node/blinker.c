@@ -32,14 +32,9 @@ static int8_t blinker_config(uint8_t argc, char **argv)
 static void blinker_process(bool enabled, nrk_time_t *next_event,
                             nrk_sig_mask_t *wait_mask)
 {
-    nrk_time_t now;
-
     if (enabled) {
         nrk_led_toggle(blinker_led);
         blinker_led_on = !blinker_led_on;
-
-        nrk_time_get(&now);
-        nrk_time_add(next_event, now, blinker_period);
     } else {
         nrk_led_clr(blinker_led);
     }
@@ -49,4 +44,5 @@ periodic_func_t func_blinker = {
     .name = blinker_name,
     .proc = blinker_process,
     .config = blinker_config,
+    .period = &blinker_period,
 };
@@ -28,6 +28,7 @@
 #define ENABLE_LOCALIZATION 1
 #define ENABLE_POSITION     1
 #define ENABLE_TIME_CONV    0
+#define ENABLE_DEFERRED_LOG 0 /* binary log records, see deflog.h */
 
 /* Task counts for modules for compile-time info */
 #define NUM_TASKS_LED 1
@@ -47,6 +48,7 @@
 #define NUM_TASKS_IRTOP 2
 #define NUM_TASKS_BEAM 1
 #define NUM_TASKS_FENCE 1
+#define NUM_TASKS_DEFERRED_LOG 1
 
 
 /* NUM_TASKS = NUM_TASKS & (ENABLED_module ? 0x0 : 0xF) */
@@ -75,6 +77,7 @@
     + NUM_TASKS(IRTOP) \
     + NUM_TASKS(BEAM) \
     + NUM_TASKS(FENCE) \
+    + NUM_TASKS(DEFERRED_LOG) \
 )
 
 #define BROADCAST_NODE_ID 0xff
@@ -87,13 +90,18 @@
 #define NUM_ADC_CHANS 7
 #define RANDOM_SEED_ADC_READS 32
 
+#ifndef MAX_NODES /* rfsim builds larger networks */
 #define MAX_NODES 6
+#endif
 #define MAX_NEIGHBORS MAX_NODES
 #define MAX_PEERS MAX_NODES
 #define MAX_PATH_LEN 6
 
 #define MAX_ENUM_NAME_LEN 24
 
+#define DEFLOG_RING_SIZE 256 /* power of 2, at most 256 */
+#define DEFLOG_DRAIN_PERIOD_MS 50
+
 /* LEDs which are too low-level to be configurable as options */
 #define LED_ABORTED RED_LED
 #define LED_WARN    RED_LED
@@ -115,17 +123,20 @@
 #define STACKSIZE_FENCE STACKSIZE_DEFAULT
 #define STACKSIZE_IRTOP STACKSIZE_DEFAULT
 #define STACKSIZE_IRTOP_PROBE STACKSIZE_DEFAULT
+#define STACKSIZE_DEFLOG STACKSIZE_DEFAULT
 
 #define TWI_MSG_BUF_SIZE 8
 
 #define TX_QUEUE_SIZE 6
+#define TX_BREACH_QUEUE_SIZE 2
 #define RX_QUEUE_SIZE 6
 #define RCV_QUEUE_SIZE 4
 #define TX_MSG_QUEUE_SIZE 4
+#define TX_MSG_BREACH_RESERVE 1 /* slots bulk msgs may not take */
 #define RX_MSG_QUEUE_SIZE 4
 
 #define MAX_MSG_SIZE 64
-#define MAX_LISTENERS 18 /* TODO: count listeners */
+#define MAX_LISTENERS 19 /* TODO: count listeners */
 
 #define PKT_POOL_SIZE 8
 
@@ -135,6 +146,22 @@
 #define MAX_CMD_LEN 64
 #define MAX_ARGS 16
 
+#define MAX_PERIODIC_FUNCS 8
+
+/* Option store: options are appended as records to one of two eeprom
+ * regions, and compacted into the other when it fills up. Options below
+ * OPTION_FIXED_ADDR_END are owned by NRK and stay at their fixed addrs. */
+#define MAX_OPTIONS 64
+#define OPTION_FIXED_ADDR_END 16
+#define OPTION_LOG_ADDR 2048
+#define OPTION_LOG_REGION_SIZE 1024
+
+/* Route distribution: entries of a routing table per pkt, and slack per
+ * B-MAC transmission on top of the check interval when waiting for the
+ * ack of a chunk (see wait_routes_ack) */
+#define ROUTES_CHUNK_SIZE 32
+#define ROUTES_ACK_MARGIN_PER_TX_MS 100
+
 #define PING_LISTENER_QUEUE_SIZE 2
 #define BEAM_LISTENER_QUEUE_SIZE 2
 #define FENCE_LISTENER_QUEUE_SIZE 2
@@ -143,12 +170,19 @@
 /* common accross all rpc clients */
 #define RPC_CLIENT_QUEUE_SIZE 2
 
+/* rpc clients that issue async calls: one reply slot per call in flight */
+#define RPC_MAX_PENDING_CALLS 4
+#define RPC_ASYNC_CLIENT_QUEUE_SIZE RPC_MAX_PENDING_CALLS
+
 #define PING_RPC_SERVER_QUEUE_SIZE 2
 #define BEAM_RPC_SERVER_QUEUE_SIZE 2
 #define FENCE_RPC_SERVER_QUEUE_SIZE 2
 #define RCMD_RPC_SERVER_QUEUE_SIZE 2
 #define IRTOP_RPC_SERVER_QUEUE_SIZE 2
 #define IRTOP_QUEUE_SIZE 2
+
+/* Nodes probing in the same slot of a slotted IR discovery */
+#define IRTOP_MAX_PARALLEL_PROBES RPC_MAX_PENDING_CALLS
 #define COMPASS_RPC_SERVER_QUEUE_SIZE 2
 
 /* Period of discover state machine transitions. This is not
@@ -369,7 +369,6 @@ static void periodic_heading_process(bool enabled,
 {
     int16_t heading;
     int8_t rc;
-    nrk_time_t now;
 
     if (!enabled)
         return;
@@ -377,9 +376,6 @@ static void periodic_heading_process(bool enabled,
     rc = get_heading(&heading);
     OUT("heading: ");
     show_heading(rc == NRK_OK ? &heading : NULL);
-
-    nrk_time_get(&now);
-    nrk_time_add(next_event, now, heading_period);
 }
 
 uint8_t init_compass(uint8_t priority)
@@ -412,4 +408,5 @@ uint8_t init_compass(uint8_t priority)
 periodic_func_t func_heading = {
     .name = compass_name,
     .proc = periodic_heading_process,
+    .period = &heading_period,
 };
@@ -40,11 +40,13 @@ bool auto_discover = false;
 uint8_t discover_period_s = 30;  // a multiple of DISCOVER_TASK_PERIOD_S
 nrk_time_t discover_time_out = {20, 0 * NANOS_PER_MS};
 nrk_time_t discover_req_delay = {1, 0 * NANOS_PER_MS}; /* max */
-uint8_t route_broadcast_attempts = 1;
+uint8_t route_broadcast_attempts = 3; /* per routes chunk */
 uint8_t discover_send_attempts = 2;
 
 bool heal_routes = false;
 
+bool bmac_strobe = false;
+
 uint8_t rssi_dist_intercept = 60;
 uint8_t rssi_dist_slope_inverse = 15;
 
@@ -57,6 +59,7 @@ nrk_time_t pong_delay = {1, 0 * NANOS_PER_MS};
 nrk_time_t ping_period = {2, 0 * NANOS_PER_MS};
 nrk_time_t potato_hold_time = {2, 0 * NANOS_PER_MS};
 nrk_time_t bmac_rx_check_rate = {0, 200 * NANOS_PER_MS};
+nrk_time_t bmac_rx_check_max = {0, 0 * NANOS_PER_MS}; /* 0: fixed rate */
 nrk_time_t beam_rpc_time_out = {10, 0 * NANOS_PER_MS};
 nrk_time_t beam_sense_time = {1, 0 * NANOS_PER_MS};
 nrk_time_t fence_rpc_time_out = {10, 0 * NANOS_PER_MS};
@@ -65,6 +68,8 @@ nrk_time_t rcmd_rpc_time_out = {10, 0 * NANOS_PER_MS};
 nrk_time_t ir_probe_time = {2, 0 * NANOS_PER_MS};
 nrk_time_t ir_direction_time = {5, 0 * NANOS_PER_MS};
 nrk_time_t irtop_rpc_timeout = {2, 0 * NANOS_PER_MS};
+nrk_time_t ir_glitch_time = {0, 1 * NANOS_PER_MS};
+nrk_time_t ir_debounce_time = {0, 10 * NANOS_PER_MS};
 nrk_time_t twi_tx_poll_interval = {0, 100 * NANOS_PER_MS};
 nrk_time_t twi_tx_timeout = {0, 500 * NANOS_PER_MS};
 nrk_time_t compass_measure_timeout = {0, 100 * NANOS_PER_MS};
@@ -126,8 +131,7 @@ static const option_t options[] PROGMEM = {
     { "logcat", OPT_TYPE_UINT16, 50, &logcat},
     { "ping_time_out", OPT_TYPE_TIME, 52 /* +2 */, &ping_time_out},
 
-    /* EMPTY SLOT: 54 */
-    /* EMPTY SLOT: 55 */
+    { "bmac_rx_check_max", OPT_TYPE_TIME, 54 /* +2 */, &bmac_rx_check_max},
     { "ir_carrier_freq_khz",  OPT_TYPE_UINT8, 56, &ir_carrier_freq_khz},
     { "ir_pulse_duty_cycle",  OPT_TYPE_UINT8, 57, &ir_pulse_duty_cycle},
     { "ir_pulse_ticks",       OPT_TYPE_UINT8, 58, &ir_pulse_ticks},
@@ -140,7 +144,8 @@ static const option_t options[] PROGMEM = {
     { "compass_poll_interval",   OPT_TYPE_TIME, 72, &compass_poll_interval},
     { "compass_measure_timeout",   OPT_TYPE_TIME, 74, &compass_measure_timeout},
     { "twi_tx_timeout",    OPT_TYPE_TIME, 76, &twi_tx_timeout},
-    /* EMPTY SLOT: 78-80 */
+    { "bmac_strobe", OPT_TYPE_BOOL, 78, &bmac_strobe},
+    /* EMPTY SLOT: 79 */
     { "rssi_dist_intercept", OPT_TYPE_UINT8, 80, &rssi_dist_intercept},
     { "rssi_dist_slope_inverse", OPT_TYPE_UINT8, 81, &rssi_dist_slope_inverse},
     { "compass_rpc_time_out", OPT_TYPE_TIME, 82, &compass_rpc_time_out},
@@ -151,6 +156,8 @@ static const option_t options[] PROGMEM = {
     { "discover_send_attempts", OPT_TYPE_UINT8, 92, &discover_send_attempts},
     { "heal_routes", OPT_TYPE_BOOL, 93, &heal_routes},
     { "ir_probe_broadcasts", OPT_TYPE_UINT8, 94, &ir_probe_broadcasts},
+    { "ir_glitch_time", OPT_TYPE_TIME, 95 /* +2 */, &ir_glitch_time},
+    { "ir_debounce_time", OPT_TYPE_TIME, 97 /* +2 */, &ir_debounce_time},
 
 
     /* EE_ROUTES (see addr below) */
@@ -182,30 +189,42 @@ static const option_t options[] PROGMEM = {
 
 int8_t cmd_set(uint8_t argc, char **argv)
 {
-    const char *name;
-    const char *value;
     const option_t *opt;
-    bool save;
+    uint8_t num_args;
+    uint8_t i;
+    bool save = true;
+
+    /* pairs of option and value, then the optional flag */
+    num_args = argc - 1;
+    if (num_args % 2 && !strcmp(argv[argc - 1], "t")) {
+        save = false;
+        num_args--;
+    }
 
-    if (!(argc == 3 || argc == 4)) {
-        OUT("usage: set <option> <value> [t]\r\n");
+    if (!num_args || num_args % 2) {
+        OUT("usage: set <option> <value> [<option> <value>...] [t]\r\n");
         return NRK_ERROR;
     }
 
-    name = argv[1];
-    value = argv[2];
-    save = argc == 4 ? argv[3][0] != 't' : true;
-
-    opt = find_option(name);
-    if (!opt) {
-        OUT("ERROR: option not found\r\n");
-        return NRK_ERROR;
+    /* all or nothing */
+    for (i = 1; i < num_args; i += 2) {
+        if (!find_option(argv[i])) {
+            OUT("ERROR: option not found: ");
+            OUTP("%s\r\n", argv[i]);
+            return NRK_ERROR;
+        }
     }
-    set_option(opt, value);
+
     if (save)
-        save_option(opt);
-    print_option(opt);
-    return NRK_OK;
+        begin_options_batch();
+    for (i = 1; i < num_args; i += 2) {
+        opt = find_option(argv[i]);
+        set_option(opt, argv[i + 1]);
+        if (save)
+            save_option(opt);
+        print_option(opt);
+    }
+    return save ? commit_options_batch() : NRK_OK;
 }
 
 int8_t cmd_get(uint8_t argc, char **argv)
@@ -23,6 +23,8 @@ extern uint8_t discover_send_attempts;
 
 extern bool heal_routes;
 
+extern bool bmac_strobe;
+
 extern uint8_t rssi_dist_intercept;
 extern uint8_t rssi_dist_slope_inverse;
 
@@ -35,6 +37,7 @@ extern nrk_time_t pong_delay;
 extern nrk_time_t ping_period;
 extern nrk_time_t potato_hold_time;
 extern nrk_time_t bmac_rx_check_rate;
+extern nrk_time_t bmac_rx_check_max;
 extern nrk_time_t beam_rpc_time_out;
 extern nrk_time_t beam_sense_time;
 extern nrk_time_t fence_rpc_time_out;
@@ -43,6 +46,8 @@ extern nrk_time_t rcmd_rpc_time_out;
 extern nrk_time_t ir_probe_time;
 extern nrk_time_t ir_direction_time;
 extern nrk_time_t irtop_rpc_timeout;
+extern nrk_time_t ir_glitch_time;
+extern nrk_time_t ir_debounce_time;
 extern nrk_time_t twi_tx_poll_interval;
 extern nrk_time_t twi_tx_timeout;
 extern nrk_time_t compass_measure_timeout;
@@ -0,0 +1,220 @@
+#include <nrk.h>
+#include <nrk_error.h>
+#include <avr/pgmspace.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "config.h"
+#include "output.h"
+
+#include "deflog.h"
+
+#if (DEFLOG_RING_SIZE & (DEFLOG_RING_SIZE - 1)) || DEFLOG_RING_SIZE > 256
+#error DEFLOG_RING_SIZE must be a power of 2 no larger than 256
+#endif
+
+#define RING_IDX(i) ((i) & (DEFLOG_RING_SIZE - 1))
+
+static nrk_task_type DEFLOG_TASK;
+static NRK_STK deflog_task_stack[STACKSIZE_DEFLOG];
+
+/* Byte indices are free running: one byte wide, so that reads are atomic */
+static uint8_t ring[DEFLOG_RING_SIZE];
+static uint8_t ring_head;
+static uint8_t ring_tail;
+static uint16_t dropped;
+
+static const char hex_digits[] PROGMEM = "0123456789abcdef";
+
+static bool is_fmt_flag(char c)
+{
+    return (c >= '0' && c <= '9') ||
+           c == '-' || c == '+' || c == ' ' || c == '#' || c == '.';
+}
+
+/* Walks the format in flash and copies each argument's bytes. Stops at the
+ * first argument that does not fit, the decoder does the same. */
+static uint8_t pack_args(uint8_t *buf, uint8_t size, const char *fmt,
+                         va_list ap)
+{
+    uint8_t len = 0;
+    uint8_t str_len;
+    unsigned int val;
+    uint32_t long_val;
+    const char *str;
+    bool is_long;
+    char c;
+
+    while ((c = pgm_read_byte(fmt++))) {
+        if (c != '%')
+            continue;
+
+        do {
+            c = pgm_read_byte(fmt++);
+        } while (is_fmt_flag(c));
+
+        is_long = (c == 'l');
+        if (is_long)
+            c = pgm_read_byte(fmt++);
+
+        switch (c) {
+            case '\0':
+                return len;
+            case '%':
+                break;
+            case 's':
+                str = va_arg(ap, const char *);
+                str_len = strnlen(str, DEFLOG_MAX_STR_LEN);
+                if (len + 1 + str_len > size)
+                    return len;
+                buf[len++] = str_len;
+                memcpy(buf + len, str, str_len);
+                len += str_len;
+                break;
+            default:
+                if (is_long) {
+                    long_val = va_arg(ap, uint32_t);
+                    if (len + sizeof(long_val) > size)
+                        return len;
+                    memcpy(buf + len, &long_val, sizeof(long_val));
+                    len += sizeof(long_val);
+                } else {
+                    val = va_arg(ap, unsigned int);
+                    if (len + sizeof(val) > size)
+                        return len;
+                    memcpy(buf + len, &val, sizeof(val));
+                    len += sizeof(val);
+                }
+                break;
+        }
+    }
+    return len;
+}
+
+void deflog(uint8_t flags, const char *fmt, ...)
+{
+    uint8_t rec[DEFLOG_REC_HDR_LEN + DEFLOG_MAX_PAYLOAD];
+    uint8_t *payload = rec + DEFLOG_REC_HDR_LEN;
+    uint8_t len = 0;
+    uint8_t rec_len, i;
+    uint16_t id = (uint16_t)fmt;
+    va_list ap;
+#ifdef LOG_TIMESTAMP
+    nrk_time_t now;
+    uint16_t ms;
+#endif
+
+    if (flags & DEFLOG_PREAMBLE) {
+        payload[len++] = this_node_id;
+#ifdef LOG_TIMESTAMP
+        nrk_time_get(&now);
+        ms = now.nano_secs / NANOS_PER_MS;
+        memcpy(payload + len, &now.secs, sizeof(uint32_t));
+        len += sizeof(uint32_t);
+        memcpy(payload + len, &ms, sizeof(ms));
+        len += sizeof(ms);
+#endif
+    }
+
+    va_start(ap, fmt);
+    len += pack_args(payload + len, DEFLOG_MAX_PAYLOAD - len, fmt, ap);
+    va_end(ap);
+
+    rec[0] = len | (flags & DEFLOG_PREAMBLE);
+    rec[1] = id;
+    rec[2] = id >> 8;
+    rec_len = DEFLOG_REC_HDR_LEN + len;
+
+    /* One byte is left unused so that a full ring does not look empty */
+    nrk_int_disable();
+    if ((uint8_t)(ring_head - ring_tail) + rec_len >= DEFLOG_RING_SIZE) {
+        dropped++;
+    } else {
+        for (i = 0; i < rec_len; ++i)
+            ring[RING_IDX(ring_head++)] = rec[i];
+    }
+    nrk_int_enable();
+}
+
+static void put_hex(uint8_t byte)
+{
+    putchar(pgm_read_byte(&hex_digits[byte >> 4]));
+    putchar(pgm_read_byte(&hex_digits[byte & 0xf]));
+}
+
+/* Only the drain advances the tail, so the record stays put while it is
+ * printed; the tail moves only after, for producers to reuse the space */
+static bool drain_record()
+{
+    uint8_t tail = ring_tail;
+    uint8_t rec_len, i;
+
+    if (tail == ring_head)
+        return false;
+
+    rec_len = DEFLOG_REC_HDR_LEN + (ring[RING_IDX(tail)] & DEFLOG_LEN_MASK);
+
+    putchar('@');
+    for (i = 0; i < rec_len; ++i)
+        put_hex(ring[RING_IDX(tail + i)]);
+    putchar('\r');
+    putchar('\n');
+
+    ring_tail = tail + rec_len;
+    return true;
+}
+
+void deflog_flush()
+{
+    uint16_t lost;
+
+    while (drain_record())
+        ;
+
+    nrk_int_disable();
+    lost = dropped;
+    dropped = 0;
+    nrk_int_enable();
+
+    if (lost) {
+        log_preamble();
+        printf("log: dropped %u records\r\n", lost);
+    }
+}
+
+static void deflog_task()
+{
+    while (1) {
+        deflog_flush();
+        nrk_wait_until_next_period();
+    }
+    ABORT("deflog task exited\r\n");
+}
+
+uint8_t init_deflog(uint8_t priority)
+{
+    uint8_t num_tasks = 0;
+
+    LOG("init: prio "); LOGP("%u\r\n", priority);
+
+    num_tasks++;
+    DEFLOG_TASK.task = deflog_task;
+    DEFLOG_TASK.Ptos = (void *) &deflog_task_stack[STACKSIZE_DEFLOG - 1];
+    DEFLOG_TASK.Pbos = (void *) &deflog_task_stack[0];
+    DEFLOG_TASK.prio = priority;
+    DEFLOG_TASK.FirstActivation = TRUE;
+    DEFLOG_TASK.Type = BASIC_TASK;
+    DEFLOG_TASK.SchType = PREEMPTIVE;
+    DEFLOG_TASK.period.secs = 0;
+    DEFLOG_TASK.period.nano_secs = DEFLOG_DRAIN_PERIOD_MS * NANOS_PER_MS;
+    DEFLOG_TASK.cpu_reserve.secs = 0;
+    DEFLOG_TASK.cpu_reserve.nano_secs = 0;
+    DEFLOG_TASK.offset.secs = 0;
+    DEFLOG_TASK.offset.nano_secs = 0;
+    nrk_activate_task (&DEFLOG_TASK);
+
+    ASSERT(num_tasks == NUM_TASKS_DEFERRED_LOG);
+    return num_tasks;
+}
@@ -0,0 +1,30 @@
+#ifndef DEFLOG_H
+#define DEFLOG_H
+
+#include <nrk.h>
+
+/* Deferred logging: a log call stores the flash address of its format string
+ * (the message id) and the raw arguments in a RAM ring. A low priority task
+ * drains the ring to the UART as '@' followed by the record in hex, and
+ * control/logdecode.py turns the records back into text using the strings
+ * in the firmware ELF.
+ *
+ * Record: header byte, id (2 bytes, LE), payload. The header holds the
+ * payload length and the preamble flag. A preamble record carries the node
+ * id (and the time, with LOG_TIMESTAMP) ahead of the arguments. Arguments
+ * are packed as passed: ints in 2 bytes, longs in 4, strings as a length
+ * byte and at most DEFLOG_MAX_STR_LEN chars. */
+
+#define DEFLOG_PREAMBLE  0x80
+#define DEFLOG_LEN_MASK  0x3f
+
+#define DEFLOG_REC_HDR_LEN 3
+#define DEFLOG_MAX_PAYLOAD DEFLOG_LEN_MASK
+#define DEFLOG_MAX_STR_LEN 16
+
+void deflog(uint8_t flags, const char *fmt, ...);
+void deflog_flush();
+
+uint8_t init_deflog(uint8_t priority);
+
+#endif
@@ -8,6 +8,7 @@
 #include "output.h"
 #include "enum.h"
 #include "config.h"
+#include "time.h"
 #include "router.h"
 #include "beam.h"
 #include "ports.h"
@@ -24,6 +25,15 @@
 #define RPC_CREATE_SECTION_REQ_OUT_NODE_OFFSET  0
 #define RPC_CREATE_SECTION_REQ_OUT_NODE_LEN     1
 
+/* A wave of sections goes out as one request to all of its in nodes: a
+ * list of (in node, out node) pairs, each in node takes its own */
+#define RPC_CREATE_SECTION_REQ_PAIR_IN_OFFSET   0
+#define RPC_CREATE_SECTION_REQ_PAIR_OUT_OFFSET  1
+#define RPC_CREATE_SECTION_REQ_PAIR_LEN         2
+/* Sections in a wave share no post */
+#define RPC_CREATE_SECTION_WAVE_REQ_LEN \
+    (RPC_CREATE_SECTION_REQ_PAIR_LEN * (MAX_NODES / 2))
+
 #define RPC_CREATE_SECTION_REPLY_STATUS_OFFSET  0
 #define RPC_CREATE_SECTION_REPLY_STATUS_LEN     1
 
@@ -50,10 +60,13 @@
 #define RPC_BREACH_REQ_IN_NODE_LEN     1
 #define RPC_BREACH_REQ_OUT_NODE_OFFSET 1
 #define RPC_BREACH_REQ_OUT_NODE_LEN    1
+#define RPC_BREACH_REQ_AGE_OFFSET      2 /* ms since the beam broke */
+#define RPC_BREACH_REQ_AGE_LEN         2
 
 #define RPC_BREACH_REQ_LEN (\
     RPC_BREACH_REQ_IN_NODE_LEN + \
-    RPC_BREACH_REQ_OUT_NODE_LEN)
+    RPC_BREACH_REQ_OUT_NODE_LEN + \
+    RPC_BREACH_REQ_AGE_LEN)
 
 #define RPC_BREACH_REPLY_LEN 0
 
@@ -70,7 +83,7 @@
 
 
 #define MAX_FENCE_RPC_REQ_LEN MAX(\
-    RPC_CREATE_SECTION_REQ_LEN, \
+    RPC_CREATE_SECTION_WAVE_REQ_LEN, \
     MAX(\
     RPC_DESTROY_SECTION_REQ_LEN, \
     MAX(\
@@ -142,7 +155,8 @@ static rpc_proc_t *procedures[] = {
     [RPC_RESTORE] = &proc_restore,
 };
 static msg_t server_queue[FENCE_RPC_SERVER_QUEUE_SIZE];
-static msg_t client_queue[RPC_CLIENT_QUEUE_SIZE];
+static msg_t client_queue[RPC_ASYNC_CLIENT_QUEUE_SIZE];
+static rpc_pending_t client_calls[RPC_MAX_PENDING_CALLS];
 static rpc_endpoint_t endpoint = {
     .server = {
         .name = fence_name,
@@ -159,12 +173,27 @@ static rpc_endpoint_t endpoint = {
         .name = fence_name,
         .listener = {
             .port = PORT_RPC_CLIENT_FENCE,
-            .queue = { .size = RPC_CLIENT_QUEUE_SIZE },
+            .queue = { .size = RPC_ASYNC_CLIENT_QUEUE_SIZE },
             .queue_data = client_queue,
-        }
+        },
+        .pending = client_calls,
+        .max_pending = RPC_MAX_PENDING_CALLS,
     }
 };
 
+/* Alarms have a client of their own: breach class, and never stuck behind
+ * a call of the endpoint's client */
+static msg_t alarm_client_queue[RPC_CLIENT_QUEUE_SIZE];
+static rpc_client_t alarm_client = {
+    .name = fence_name,
+    .listener = {
+        .port = PORT_RPC_CLIENT_FENCE_ALARM,
+        .queue = { .size = RPC_CLIENT_QUEUE_SIZE },
+        .queue_data = alarm_client_queue,
+    },
+    .class = TRAFFIC_CLASS_BREACH,
+};
+
 static nrk_task_type FENCE_TASK;
 static NRK_STK fence_task_stack[STACKSIZE_FENCE];
 
@@ -200,31 +229,79 @@ static void print_fence(fence_t *fence)
     COUTA("\r\n");
 }
 
-static int8_t rpc_create_section(node_id_t out_node, node_id_t in_node)
+typedef struct {
+    fence_t *fence;
+    bool *in_wave; /* by section */
+} wave_t;
+
+static void create_section_reply(node_id_t in_node, int8_t rc,
+                                 uint8_t *reply_buf, uint8_t reply_len,
+                                 void *arg)
 {
-    int8_t rc = NRK_OK;
-    uint8_t reply_len = sizeof(reply_buf);
-    uint8_t req_len = 0;
-    bool section_status;
+    wave_t *wave = arg;
+    fence_t *fence = wave->fence;
+    uint8_t i;
 
-    req_buf[RPC_CREATE_SECTION_REQ_OUT_NODE_OFFSET] = out_node;
-    req_len += RPC_CREATE_SECTION_REQ_OUT_NODE_LEN;
+    for (i = 0; i < fence->len - 1; ++i)
+        if (wave->in_wave[i] && fence->posts[i + 1] == in_node)
+            break;
+    if (i == fence->len - 1) {
+        LOG("WARN: create section reply from node not in wave: ");
+        LOGP("%d\r\n", in_node);
+        return;
+    }
 
-    rc = rpc_call(&endpoint.client, in_node, PORT_RPC_SERVER_FENCE, RPC_CREATE_SECTION,
-                  &fence_rpc_time_out, req_buf, req_len, reply_buf, &reply_len);
-    if (rc != NRK_OK) {
+    if (rc == RPC_SELF) {
+        LOG("WARN: create section: in node is self\r\n");
+        rc = NRK_ERROR;
+    } else if (rc != NRK_OK) {
         LOG("WARN: create section rpc failed\r\n");
-        return rc;
-    }
-    if (reply_len != RPC_CREATE_SECTION_REPLY_LEN) {
+    } else if (reply_len != RPC_CREATE_SECTION_REPLY_LEN) {
         LOG("WARN: beam reply of unexpected length\r\n");
-        return NRK_ERROR;
+        rc = NRK_ERROR;
+    } else {
+        LOG("rpc section status: ");
+        LOGP("%d\r\n", reply_buf[RPC_CREATE_SECTION_REPLY_STATUS_OFFSET]);
+        if (!reply_buf[RPC_CREATE_SECTION_REPLY_STATUS_OFFSET])
+            rc = NRK_ERROR;
     }
 
-    section_status = reply_buf[RPC_CREATE_SECTION_REPLY_STATUS_OFFSET];
-    LOG("rpc section status: "); LOGP("%d\r\n", section_status);
+    LOG("create section: ");
+    LOGP("%d -> %d: %c\r\n", fence->posts[i], in_node,
+         rc == NRK_OK ? 'S' : 'F');
+
+    if (rc == NRK_OK)
+        fence->section_state[i] = SECTION_STATE_ACTIVE;
+}
+
+/* Creates all sections of the wave at once, results go to section_state */
+static void rpc_create_sections(fence_t *fence, bool *in_wave)
+{
+    uint8_t i;
+    uint8_t req_len = 0;
+    node_set_t in_nodes;
+    wave_t wave = {
+        .fence = fence,
+        .in_wave = in_wave,
+    };
 
-    return section_status ? NRK_OK : NRK_ERROR;
+    NODE_SET_INIT(in_nodes);
+    for (i = 0; i < fence->len - 1; ++i) {
+        if (!in_wave[i])
+            continue;
+
+        ASSERT(req_len + RPC_CREATE_SECTION_REQ_PAIR_LEN <= sizeof(req_buf));
+        req_buf[req_len + RPC_CREATE_SECTION_REQ_PAIR_IN_OFFSET] =
+            fence->posts[i + 1];
+        req_buf[req_len + RPC_CREATE_SECTION_REQ_PAIR_OUT_OFFSET] =
+            fence->posts[i];
+        req_len += RPC_CREATE_SECTION_REQ_PAIR_LEN;
+        NODE_SET_ADD(in_nodes, fence->posts[i + 1]);
+    }
+
+    rpc_call_all(&endpoint.client, in_nodes, PORT_RPC_SERVER_FENCE,
+                 RPC_CREATE_SECTION, &fence_rpc_time_out, req_buf, req_len,
+                 create_section_reply, &wave);
 }
 
 static int8_t rpc_destroy_section(node_id_t out_node, node_id_t in_node)
@@ -300,13 +377,26 @@ static int8_t rpc_breach(node_id_t master, node_id_t out_node, node_id_t in_node
     int8_t rc = NRK_OK;
     uint8_t reply_len = sizeof(reply_buf);
     uint8_t req_len = 0;
+    nrk_time_t now, broken, age;
+    uint32_t age_ms;
+
+    /* Clocks are not synchronized: the master dates the breach by age */
+    get_beam_change_time(&broken);
+    nrk_time_get(&now);
+    nrk_time_sub(&age, now, broken);
+    age_ms = TIME_TO_MS(age);
+    if (age_ms > 0xffff)
+        age_ms = 0xffff;
 
     req_buf[RPC_BREACH_REQ_OUT_NODE_OFFSET] = out_node;
     req_len += RPC_BREACH_REQ_OUT_NODE_LEN;
     req_buf[RPC_BREACH_REQ_IN_NODE_OFFSET] = in_node;
     req_len += RPC_BREACH_REQ_IN_NODE_LEN;
+    req_buf[RPC_BREACH_REQ_AGE_OFFSET] = age_ms;
+    req_buf[RPC_BREACH_REQ_AGE_OFFSET + 1] = age_ms >> 8;
+    req_len += RPC_BREACH_REQ_AGE_LEN;
 
-    rc = rpc_call(&endpoint.client, master, PORT_RPC_SERVER_FENCE, RPC_BREACH,
+    rc = rpc_call(&alarm_client, master, PORT_RPC_SERVER_FENCE, RPC_BREACH,
                   &fence_rpc_time_out, req_buf, req_len, reply_buf, &reply_len);
     if (rc != NRK_OK) {
         LOG("WARN: breach rpc failed\r\n");
@@ -331,7 +421,7 @@ static int8_t rpc_restore(node_id_t master, node_id_t out_node, node_id_t in_nod
     req_buf[RPC_RESTORE_REQ_IN_NODE_OFFSET] = in_node;
     req_len += RPC_RESTORE_REQ_IN_NODE_LEN;
 
-    rc = rpc_call(&endpoint.client, master, PORT_RPC_SERVER_FENCE, RPC_RESTORE,
+    rc = rpc_call(&alarm_client, master, PORT_RPC_SERVER_FENCE, RPC_RESTORE,
                   &fence_rpc_time_out, req_buf, req_len, reply_buf, &reply_len);
     if (rc != NRK_OK) {
         LOG("WARN: restore rpc failed\r\n");
@@ -352,6 +442,7 @@ static int8_t proc_create_section(node_id_t requester,
 {
     int8_t rc;
     node_id_t out_node;
+    uint8_t offset;
 
     LOG("create section req from: "); LOGP("%u\r\n", requester);
 
@@ -367,7 +458,21 @@ static int8_t proc_create_section(node_id_t requester,
         return NRK_ERROR;
     }
 
-    out_node = req_buf[RPC_CREATE_SECTION_REQ_OUT_NODE_OFFSET];
+    if (req_len == RPC_CREATE_SECTION_REQ_LEN) {
+        out_node = req_buf[RPC_CREATE_SECTION_REQ_OUT_NODE_OFFSET];
+    } else {
+        for (offset = 0;
+             offset + RPC_CREATE_SECTION_REQ_PAIR_LEN <= req_len;
+             offset += RPC_CREATE_SECTION_REQ_PAIR_LEN)
+            if (req_buf[offset + RPC_CREATE_SECTION_REQ_PAIR_IN_OFFSET] ==
+                this_node_id)
+                break;
+        if (offset + RPC_CREATE_SECTION_REQ_PAIR_LEN > req_len) {
+            LOG("WARN: not an in node of the wave\r\n");
+            return NRK_ERROR;
+        }
+        out_node = req_buf[offset + RPC_CREATE_SECTION_REQ_PAIR_OUT_OFFSET];
+    }
     rc = rpc_req_create_beam(out_node);
 
     if (rc == NRK_OK) {
@@ -386,8 +491,11 @@ static int8_t proc_create_section(node_id_t requester,
 
 int8_t create_fence(fence_t *fence)
 {
-    int8_t rc;
     uint8_t i;
+    bool issued[MAX_NODES];
+    bool in_wave[MAX_NODES];
+    bool pending;
+    node_set_t busy;
 
     if (master_state.active) {
         WARN("ERROR: a fence is already active\r\n");
@@ -404,21 +512,35 @@ int8_t create_fence(fence_t *fence)
         return NRK_ERROR;
     }
 
-    for (i = 0; i < fence->len - 1; ++i) {
-        rc = rpc_create_section(fence->posts[i], fence->posts[i + 1]);
-        LOGP("create section: ");
-        LOGP("%d -> %d: %c\r\n",
-             fence->posts[i], fence->posts[i + 1],
-             rc == NRK_OK ? 'S' : 'F');
+    /* A post serves one section at a time, so sections are created in
+     * waves of sections that share no post, each wave in parallel */
+    memset(issued, 0, sizeof(issued));
+    do {
+        NODE_SET_INIT(busy);
+        memset(in_wave, 0, sizeof(in_wave));
+        pending = false;
+
+        for (i = 0; i < fence->len - 1; ++i) {
+            if (issued[i])
+                continue;
+            if (NODE_SET_IN(busy, fence->posts[i]) ||
+                NODE_SET_IN(busy, fence->posts[i + 1])) {
+                pending = true;
+                continue;
+            }
 
-        if (rc == NRK_OK) {
-            fence->section_state[i] = SECTION_STATE_ACTIVE;
-        } /* continue: don't give up */
+            issued[i] = true;
+            in_wave[i] = true;
+            NODE_SET_ADD(busy, fence->posts[i]);
+            NODE_SET_ADD(busy, fence->posts[i + 1]);
+        }
 
+        rpc_create_sections(fence, in_wave);
         print_fence(fence);
 
-        nrk_wait(fence_section_delay);
-    }
+        if (pending)
+            nrk_wait(fence_section_delay);
+    } while (pending);
 
     master_state.active = true;
 
@@ -584,6 +706,7 @@ static int8_t proc_breach(node_id_t requester,
     node_id_t in_node, out_node;
     bool found;
     uint8_t i;
+    uint16_t age_ms;
 
     LOG("breach req from: "); LOGP("%u\r\n", requester);
 
@@ -607,9 +730,12 @@ static int8_t proc_breach(node_id_t requester,
 
     in_node = req_buf[RPC_BREACH_REQ_IN_NODE_OFFSET];
     out_node = req_buf[RPC_BREACH_REQ_OUT_NODE_OFFSET];
+    age_ms = req_buf[RPC_BREACH_REQ_AGE_OFFSET + 1];
+    age_ms <<= 8;
+    age_ms |= req_buf[RPC_BREACH_REQ_AGE_OFFSET];
 
     LOG("section breached: ");
-    LOGP("%d -> %d\r\n", out_node, in_node);
+    LOGP("%d -> %d, %u ms ago\r\n", out_node, in_node, age_ms);
 
     found = false;
     for (i = 0; i < master_state.fence.len - 1; ++i) {
@@ -802,6 +928,7 @@ uint8_t init_fence(uint8_t priority)
     LOG("init: prio "); LOGP("%u\r\n", priority);
 
     rpc_init_endpoint(&endpoint);
+    rpc_init_client(&alarm_client);
 
     beam_signal = nrk_signal_create();
     if (beam_signal == NRK_ERROR)
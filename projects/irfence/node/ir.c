@@ -15,6 +15,8 @@
 
 #include "cfg.h"
 #include "output.h"
+#include "config.h"
+#include "time.h"
 
 #include "ir.h"
 
@@ -29,7 +31,11 @@
 
 #define SYS_CLOCK_KHZ 16000
 
-/* Signal raised whenever a change in receiver signal is detected */
+/* Safety net for an edge signal that arrives before the monitor task
+ * waits on it: the edge is then only seen at this wakeup */
+#define MONITOR_IDLE_WAKEUP_MS 500
+
+/* Signal raised whenever the debounced state of a receiver changes */
 nrk_sig_t ir_rcv_signal;
 
 static nrk_task_type MONITOR_TASK;
@@ -40,8 +46,18 @@ static uint16_t pulse_on_ticks;
 
 static uint8_t armed = 0;
 
-/* Poor man's event (signaling an event from ISR crashes)*/
-static bool rcv_state_changed = false;
+/* Edges, written by the ISR: the monitor task reads them with interrupts
+ * disabled. Bitmasks of receivers, 1 = receiving. */
+static volatile uint8_t pin_state;
+static volatile uint8_t pulse_ended; /* since the monitor task last looked */
+static nrk_time_t rise_time[NUM_IR_RECEIVERS]; /* of the current pulse */
+static nrk_time_t pulse_start[NUM_IR_RECEIVERS]; /* of the last real pulse */
+static nrk_time_t pulse_end[NUM_IR_RECEIVERS];
+static nrk_sig_t edge_signal;
+
+/* Debounced state, written by the monitor task */
+static volatile uint8_t rcv_state;
+static nrk_time_t rcv_changed[NUM_IR_RECEIVERS];
 
 static void set_pwm_freq(uint8_t freq_khz)
 {
@@ -133,7 +149,7 @@ static inline void select_led(uint8_t led)
     PORTF |= led & 0x0F;
 }
 
-uint8_t ir_rcv_state(uint8_t rcvers)
+static inline uint8_t read_rcv_pins(uint8_t rcvers)
 {
     uint8_t state = 0;
     if (rcvers & (1 << 0))
@@ -147,6 +163,24 @@ uint8_t ir_rcv_state(uint8_t rcvers)
     return state;
 }
 
+uint8_t ir_rcv_state(uint8_t rcvers)
+{
+    return rcv_state & rcvers;
+}
+
+/* Latest debounced change among the given receivers: when the first pulse
+ * of a beam arrived or when the last pulse before a break ended */
+void ir_rcv_change_time(uint8_t rcvers, nrk_time_t *time)
+{
+    uint8_t rcver;
+
+    TIME_CLEAR(*time);
+    for (rcver = 0; rcver < NUM_IR_RECEIVERS; ++rcver)
+        if ((rcvers & (1 << rcver)) &&
+            time_cmp(&rcv_changed[rcver], time) > 0)
+            *time = rcv_changed[rcver];
+}
+
 void ir_led_on(uint8_t led)
 {
     LOG("led on: ");
@@ -224,6 +258,10 @@ int8_t cmd_irrcv(uint8_t argc, char **argv)
             OUTP("%d", state);
         }
         OUT("\r\n");
+        OUT("raw signals: ");
+        for (rcver = 0; rcver < NUM_IR_RECEIVERS; ++rcver)
+            OUTP("%d", (bool)(read_rcv_pins(1 << rcver)));
+        OUT("\r\n");
     }
     return NRK_OK;
 }
@@ -244,39 +282,172 @@ int8_t cmd_irfreq(uint8_t argc, char **argv)
     return NRK_OK;
 }
 
+static inline void enable_rcv_ints()
+{
+    nrk_ext_int_enable(NRK_PC_INT_1);
+    nrk_ext_int_enable(NRK_PC_INT_2);
+    nrk_ext_int_enable(NRK_PC_INT_3);
+    nrk_ext_int_enable(NRK_EXT_INT_3); /* SSN pin workaround */
+}
+
+static inline void disable_rcv_ints()
+{
+    nrk_ext_int_disable(NRK_PC_INT_1);
+    nrk_ext_int_disable(NRK_PC_INT_2);
+    nrk_ext_int_disable(NRK_PC_INT_3);
+    nrk_ext_int_disable(NRK_EXT_INT_3);
+}
+
+/* A pulse shorter than ir_glitch_time is noise. Only the rise and the end
+ * of real pulses are kept: the monitor task debounces them. */
 static void receiver_isr()
 {
-    /* Can't call nrk_event_signal() from the ISR: the function
-     * is too long. TODO: maybe it enables interrupts too early. */
-    rcv_state_changed = true;
+    nrk_time_t now, pulse;
+    uint8_t pins, edges;
+    uint8_t rcver, bit;
+
+    nrk_time_get(&now);
+    pins = read_rcv_pins(IR_ALL_RECEIVERS);
+    edges = pins ^ pin_state;
+    pin_state = pins;
+
+    for (rcver = 0; rcver < NUM_IR_RECEIVERS; ++rcver) {
+        bit = 1 << rcver;
+        if (!(edges & bit))
+            continue;
+        if (pins & bit) {
+            rise_time[rcver] = now;
+        } else {
+            nrk_time_sub(&pulse, now, rise_time[rcver]);
+            if (time_cmp(&pulse, &ir_glitch_time) >= 0) {
+                pulse_start[rcver] = rise_time[rcver];
+                pulse_end[rcver] = now;
+                pulse_ended |= bit;
+            }
+        }
+    }
+
+    /* The edges of a lit receiver only push its debounce deadline back,
+     * and the monitor task picks them up when that deadline comes. Only
+     * the edges of an unlit one can change its state right away. */
+    if (!(edges & ~rcv_state))
+        return;
+
+    /* nrk_event_signal() enables interrupts on its way out, which used to
+     * nest this ISR into itself on a bouncing pin: keep the receivers
+     * masked until interrupts are off again. */
+    disable_rcv_ints();
+    nrk_event_signal(edge_signal);
+    nrk_int_disable();
+    enable_rcv_ints();
+}
+
+static void set_next(nrk_time_t *next, nrk_time_t *deadline)
+{
+    if (!IS_VALID_TIME(*next) || time_cmp(deadline, next) < 0)
+        *next = *deadline;
+}
+
+/* A receiver counts as lit from the leading edge of its first real pulse
+ * until no pulse has been seen for ir_debounce_time, which must cover the
+ * gaps between the pulses of a beam (see ir_pulse_ticks). Returns the
+ * receivers that changed, and sets the next deadline, if there is one. */
+static uint8_t update_rcv_state(nrk_time_t *now, nrk_time_t *next)
+{
+    uint8_t rcver, bit;
+    uint8_t changed = 0;
+    nrk_time_t deadline;
+
+    TIME_CLEAR(*next);
+
+    /* so that no edge comes in between reading it and acting on it */
+    nrk_int_disable();
+    for (rcver = 0; rcver < NUM_IR_RECEIVERS; ++rcver) {
+        bit = 1 << rcver;
+
+        if (!(rcv_state & bit)) {
+            if (pulse_ended & bit) {
+                rcv_changed[rcver] = pulse_start[rcver];
+            } else if (pin_state & bit) {
+                /* lit without a trailing edge: a steady beam */
+                nrk_time_add(&deadline, rise_time[rcver], ir_glitch_time);
+                if (time_cmp(now, &deadline) < 0) {
+                    set_next(next, &deadline);
+                    continue;
+                }
+                rcv_changed[rcver] = rise_time[rcver];
+            } else {
+                continue;
+            }
+            rcv_state |= bit;
+            changed |= bit;
+        }
+
+        if (pin_state & bit) {
+            /* the pulse ends no earlier than now */
+            nrk_time_add(&deadline, *now, ir_debounce_time);
+        } else {
+            nrk_time_add(&deadline, pulse_end[rcver], ir_debounce_time);
+            if (time_cmp(now, &deadline) >= 0) {
+                rcv_state &= ~bit;
+                rcv_changed[rcver] = pulse_end[rcver];
+                changed |= bit;
+                continue;
+            }
+        }
+        set_next(next, &deadline);
+    }
+    pulse_ended = 0;
+    nrk_int_enable();
+
+    return changed;
 }
 
 static void monitor_task()
 {
     int8_t rc;
-    uint8_t state;
     uint8_t rcver;
+    uint8_t changed;
+    nrk_time_t now, next, wakeup;
+    nrk_sig_mask_t wait_signal_mask;
 
     rc = nrk_signal_register(ir_rcv_signal);
     if (rc != NRK_OK)
         ABORT("failed to register ir rcv signal\r\n");
 
+    rc = nrk_signal_register(edge_signal);
+    if (rc != NRK_OK)
+        ABORT("failed to register ir edge signal\r\n");
+
+    pin_state = read_rcv_pins(IR_ALL_RECEIVERS);
+    nrk_time_get(&now);
+    for (rcver = 0; rcver < NUM_IR_RECEIVERS; ++rcver)
+        rise_time[rcver] = now;
+
+    enable_rcv_ints();
+
     while (1) {
 
-        /* Poor man's event: a periodic polling loop */
-        if (rcv_state_changed) {
-            rcv_state_changed = false;
+        nrk_time_get(&now);
+        changed = update_rcv_state(&now, &next);
 
-            state = ir_rcv_state(IR_ALL_RECEIVERS);
+        if (changed) {
             LOG("rcver signals: ");
             for (rcver = 0; rcver < NUM_IR_RECEIVERS; ++rcver)
-                LOGP("%d", (bool)(state & (1 << rcver)));
-            LOGP("\r\n");
+                LOGP("%d", (bool)(rcv_state & (1 << rcver)));
+            LOGA("\r\n");
 
             nrk_event_signal(ir_rcv_signal);
         }
 
-        nrk_wait_until_next_period();
+        if (IS_VALID_TIME(next) && time_cmp(&next, &now) > 0)
+            nrk_time_sub(&wakeup, next, now);
+        else
+            MS_TO_TIME(wakeup, MONITOR_IDLE_WAKEUP_MS);
+        nrk_set_next_wakeup(wakeup);
+
+        wait_signal_mask = SIG(edge_signal) | SIG(nrk_wakeup_signal);
+        nrk_event_wait(wait_signal_mask);
     }
 }
 
@@ -290,6 +461,10 @@ uint8_t init_ir(uint8_t priority)
     if (ir_rcv_signal == NRK_ERROR)
         ABORT("failed to create ir rcv signal\r\n");
 
+    edge_signal = nrk_signal_create();
+    if (edge_signal == NRK_ERROR)
+        ABORT("failed to create ir edge signal\r\n");
+
     /* Receivers */
 
     nrk_gpio_direction(NRK_PORTB_1, NRK_PIN_INPUT);
@@ -307,10 +482,7 @@ uint8_t init_ir(uint8_t priority)
     nrk_ext_int_configure(NRK_PC_INT_3, NRK_LEVEL_TRIGGER, receiver_isr);
     nrk_ext_int_configure(NRK_EXT_INT_3, NRK_LEVEL_TRIGGER, receiver_isr);
 
-    nrk_ext_int_enable(NRK_PC_INT_1);
-    nrk_ext_int_enable(NRK_PC_INT_2);
-    nrk_ext_int_enable(NRK_PC_INT_3);
-    nrk_ext_int_enable(NRK_EXT_INT_3); /* SSN pin workaround */
+    /* Interrupts are enabled by the monitor task, once it can take edges */
 
     /* Transmitters */
 
@@ -332,7 +504,7 @@ uint8_t init_ir(uint8_t priority)
     MONITOR_TASK.Type = BASIC_TASK;
     MONITOR_TASK.SchType = PREEMPTIVE;
     MONITOR_TASK.period.secs = 0;
-    MONITOR_TASK.period.nano_secs = 500 * NANOS_PER_MS;
+    MONITOR_TASK.period.nano_secs = 0;
     MONITOR_TASK.cpu_reserve.secs = 0;
     MONITOR_TASK.cpu_reserve.nano_secs = 0 * NANOS_PER_MS;
     MONITOR_TASK.offset.secs = 0;
@@ -12,6 +12,7 @@ void ir_led_off();
 void ir_arm(uint8_t rcvers);
 void ir_disarm(uint8_t rcvers);
 uint8_t ir_rcv_state(uint8_t rcvers);
+void ir_rcv_change_time(uint8_t rcvers, nrk_time_t *time);
 
 int8_t cmd_irled(uint8_t argc, char **argv);
 int8_t cmd_irrcv(uint8_t argc, char **argv);
@@ -25,8 +25,31 @@
 #define RPC_IR_PONG_REQ_LEN   0
 #define RPC_IR_PONG_REPLY_LEN 0
 
+/* Batched pong: the receiver names the led it saw the beam from */
+#define RPC_IR_PONG_REQ_LED_OFFSET 0
+#define RPC_IR_PONG_REQ_LED_LEN 1
+#define RPC_IR_PONG_BATCH_REQ_LEN RPC_IR_PONG_REQ_LED_LEN
+
 #define RPC_IR_PROBE_REQ_LEN 0
 
+#define RPC_IR_PROBE_REQ_FLAGS_OFFSET 0
+#define RPC_IR_PROBE_REQ_FLAGS_LEN 1
+#define RPC_IR_PROBE_BATCH_REQ_LEN RPC_IR_PROBE_REQ_FLAGS_LEN
+
+#define IR_PROBE_FLAG_BATCH (1 << 0)
+
+/* Batched probe message: receivers time the led sweep themselves. The
+ * sweep delay is the msg stamp, so it counts from when the frame went out
+ * and has to stay first. */
+#define MSG_PROBE_SWEEP_DELAY_OFFSET 0
+#define MSG_PROBE_SWEEP_DELAY_LEN 2
+#define MSG_PROBE_DIRECTION_TIME_OFFSET 2
+#define MSG_PROBE_DIRECTION_TIME_LEN 2
+
+#define MSG_PROBE_BATCH_LEN (\
+        MSG_PROBE_SWEEP_DELAY_LEN + \
+        MSG_PROBE_DIRECTION_TIME_LEN)
+
 #define IR_PROBE_REPLY_NODE_OFFSET 0
 #define IR_PROBE_REPLY_NODE_LEN 1
 #define IR_PROBE_REPLY_DIST_OFFSET 1
@@ -41,10 +64,10 @@
 
 #define RPC_IR_PROBE_REPLY_LEN MAX_NODES * IR_PROBE_RECORD_SIZE
 
-#define MAX_IRTOP_RPC_REQ_LEN RPC_IR_PONG_REQ_LEN
+#define MAX_IRTOP_RPC_REQ_LEN RPC_IR_PONG_BATCH_REQ_LEN
 #define MAX_IRTOP_RPC_REPLY_LEN RPC_IR_PONG_REPLY_LEN
 
-#define MAX_IRTOP_PROBE_RPC_REQ_LEN RPC_IR_PROBE_REQ_LEN
+#define MAX_IRTOP_PROBE_RPC_REQ_LEN RPC_IR_PROBE_BATCH_REQ_LEN
 #define MAX_IRTOP_PROBE_RPC_REPLY_LEN RPC_IR_PROBE_REPLY_LEN
 
 typedef enum {
@@ -92,6 +115,12 @@ static const char state_names[][MAX_ENUM_NAME_LEN] PROGMEM = {
     [STATE_WAITING_FOR_BEAM] = "waiting_for_beam",
 };
 
+typedef enum {
+    IR_DISCOVER_SEQUENTIAL,
+    IR_DISCOVER_SLOTS_IR, /* slots from the last known IR graph */
+    IR_DISCOVER_SLOTS_RF, /* slots from the RF topology */
+} ir_discover_mode_t;
+
 /* static */ ir_graph_t ir_graph;
 
 static rpc_proc_t proc_ir_pong;
@@ -132,7 +161,8 @@ static rpc_proc_t *probe_procedures[] = {
     [RPC_IR_PROBE] = &proc_ir_probe,
 };
 static msg_t probe_server_queue[IRTOP_RPC_SERVER_QUEUE_SIZE];
-static msg_t probe_client_queue[RPC_CLIENT_QUEUE_SIZE];
+static msg_t probe_client_queue[RPC_ASYNC_CLIENT_QUEUE_SIZE];
+static rpc_pending_t probe_client_calls[IRTOP_MAX_PARALLEL_PROBES];
 static rpc_endpoint_t probe_endpoint = {
     .server = {
         .name = irtop_probe_name,
@@ -149,9 +179,11 @@ static rpc_endpoint_t probe_endpoint = {
         .name = irtop_probe_name,
         .listener = {
             .port = PORT_RPC_CLIENT_IRTOP_PROBE,
-            .queue = { .size = RPC_CLIENT_QUEUE_SIZE },
+            .queue = { .size = RPC_ASYNC_CLIENT_QUEUE_SIZE },
             .queue_data = probe_client_queue,
-        }
+        },
+        .pending = probe_client_calls,
+        .max_pending = IRTOP_MAX_PARALLEL_PROBES,
     }
 };
 
@@ -180,6 +212,15 @@ static nrk_time_t state_entered;
 static int8_t current_direction_led;
 static int8_t prober = INVALID_NODE_ID;
 
+/* Batched probe: the prober sweeps at a time announced in the probe
+ * message and each receiver pongs once, after the sweep, with the led */
+static bool batched;
+static nrk_time_t sweep_start;
+static nrk_time_t pong_time;
+static uint16_t sweep_direction_ms;
+static int8_t beam_led;
+static uint8_t beam_receivers;
+
 /* node id -> neighbor info */
 /* static */ ir_neighbor_t ir_neighbors[MAX_NODES];
 
@@ -199,6 +240,8 @@ static void reset_state()
 {
     ir_disarm(~0);
     prober = INVALID_NODE_ID;
+    batched = false;
+    beam_led = -1;
     nrk_led_clr(led_awaiting_beam);
     set_state(STATE_IDLE);
 }
@@ -214,6 +257,19 @@ static nrk_time_t calc_probe_timeout()
     return probe_timeout;
 }
 
+/* Broadcast window, sweep and the window for the pongs that follow it */
+static nrk_time_t calc_batch_probe_time()
+{
+    nrk_time_t probe_time;
+    uint32_t probe_time_ms;
+
+    probe_time_ms = TIME_TO_MS(ir_probe_time) * (ir_probe_broadcasts + 1) +
+                    TIME_TO_MS(ir_direction_time) * (NUM_IR_LEDS + 1) +
+                    TIME_TO_MS(irtop_rpc_timeout);
+    MS_TO_TIME(probe_time, probe_time_ms);
+    return probe_time;
+}
+
 static void print_ir_graph(ir_graph_t *graph)
 {
     node_id_t out_node, in_node;
@@ -245,12 +301,17 @@ ir_graph_t *get_ir_graph()
     return &ir_graph;
 }
 
-static int8_t rpc_ir_pong(node_id_t prober)
+static int8_t rpc_ir_pong(node_id_t prober, int8_t led)
 {
     int8_t rc = NRK_OK;
     uint8_t reply_len = sizeof(reply_buf);
     uint8_t req_len = 0;
 
+    if (led >= 0) {
+        req_buf[RPC_IR_PONG_REQ_LED_OFFSET] = led;
+        req_len += RPC_IR_PONG_REQ_LED_LEN;
+    }
+
     rc = rpc_call(&endpoint.client, prober, PORT_RPC_SERVER_IRTOP, RPC_IR_PONG,
                   &irtop_rpc_timeout, req_buf, req_len, reply_buf, &reply_len);
     if (rc != NRK_OK) {
@@ -267,14 +328,27 @@ static int8_t proc_ir_pong(node_id_t requester,
                                 uint8_t *reply_len)
 {
     ir_neighbor_t *ir_neighbor;
+    uint8_t led;
 
     if (state != STATE_PROBING) {
         LOG("WARN: unexpectd ir pong rpc\r\n");
         return NRK_ERROR;
     }
+
+    if (req_len >= RPC_IR_PONG_BATCH_REQ_LEN) {
+        led = req_buf[RPC_IR_PONG_REQ_LED_OFFSET];
+        if (led >= NUM_IR_LEDS) {
+            LOG("WARN: invalid led in ir pong: ");
+            LOGP("%u\r\n", led);
+            return NRK_ERROR;
+        }
+    } else {
+        led = current_direction_led;
+    }
+
     ir_neighbor = &ir_neighbors[requester];
     ir_neighbor->valid = true;
-    ir_neighbor->led = current_direction_led;
+    ir_neighbor->led = led;
 
     LOG("added ir neighbor: ");
     LOGP("[%d] -> %d\r\n", ir_neighbor->led, requester);
@@ -284,14 +358,75 @@ static int8_t proc_ir_pong(node_id_t requester,
 
 static void handle_probe(msg_t *msg)
 {
+    nrk_time_t delay, spread;
+    uint16_t sweep_delay_ms;
+    uint32_t sweep_ms;
+
     LOG("ir probe received\r\n");
 
+    if (state == STATE_PROBING) {
+        LOG("WARN: ignoring probe: probing\r\n");
+        return;
+    }
+
+    if (msg->len >= MSG_PROBE_BATCH_LEN) {
+        /* Probers in a slot are not supposed to share receivers: stay with
+         * the first one and keep the beam already seen */
+        if (state == STATE_WAITING_FOR_BEAM && batched) {
+            if (msg->sender != prober) {
+                LOG("WARN: ignoring probe from ");
+                LOGP("%d: waiting for %d\r\n", msg->sender, prober);
+                return;
+            }
+            if (beam_led >= 0)
+                return;
+        }
+
+        sweep_delay_ms = msg->payload[MSG_PROBE_SWEEP_DELAY_OFFSET + 1];
+        sweep_delay_ms <<= 8;
+        sweep_delay_ms |= msg->payload[MSG_PROBE_SWEEP_DELAY_OFFSET];
+
+        sweep_direction_ms = msg->payload[MSG_PROBE_DIRECTION_TIME_OFFSET + 1];
+        sweep_direction_ms <<= 8;
+        sweep_direction_ms |= msg->payload[MSG_PROBE_DIRECTION_TIME_OFFSET];
+
+        MS_TO_TIME(delay, sweep_delay_ms);
+        nrk_time_add(&sweep_start, msg->rx_time, delay);
+
+        /* Spread the pongs of all receivers over one direction time */
+        sweep_ms = (uint32_t)sweep_direction_ms * NUM_IR_LEDS;
+        MS_TO_TIME(delay, sweep_ms);
+        nrk_time_add(&pong_time, sweep_start, delay);
+        MS_TO_TIME(spread, sweep_direction_ms);
+        choose_delay(&delay, &spread);
+        nrk_time_add(&pong_time, pong_time, delay);
+
+        batched = true;
+        beam_led = -1;
+    } else {
+        batched = false;
+    }
+
     prober = msg->sender;
     set_state(STATE_WAITING_FOR_BEAM);
     nrk_led_set(led_awaiting_beam);
     ir_arm(~0);
 }
 
+/* Which led of the prober's sweep was on at the given time */
+static int8_t beam_direction(nrk_time_t *beam_time)
+{
+    nrk_time_t since_start;
+    uint32_t led = 0;
+
+    if (time_cmp(beam_time, &sweep_start) > 0 && sweep_direction_ms != 0) {
+        nrk_time_sub(&since_start, *beam_time, sweep_start);
+        led = TIME_TO_MS(since_start) / sweep_direction_ms;
+    }
+
+    return led < NUM_IR_LEDS ? led : NUM_IR_LEDS - 1;
+}
+
 static void handle_msg(msg_t *msg)
 {
     LOG("received msg: from ");
@@ -309,30 +444,63 @@ static void handle_msg(msg_t *msg)
     }
 }
 
-static int8_t probe()
+/* A batched probe sweeps at a fixed time after the first broadcast, which
+ * every probe message announces, and collects the pongs after the sweep.
+ * The radio stamps the delay left as each copy goes out, so queueing and
+ * the B-MAC preamble do not shift the receivers' idea of the sweep. */
+static int8_t probe(bool batch)
 {
     uint8_t led;
     int8_t rc;
     uint8_t num_neighbors = 0;
     node_id_t node;
     uint8_t broadcast = 0;
-    nrk_time_t delay;
+    nrk_time_t delay, now, start, gather_time;
+    uint16_t sweep_delay_ms;
+    uint16_t direction_ms;
+    uint32_t window_ms;
 
     if (state != STATE_IDLE) {
         LOG("WARN: cannot probe: not IDLE\r\n");
         return NRK_ERROR;
     }
 
-    LOG("probe IR hood\r\n");
+    LOG("probe IR hood");
+    if (batch)
+        LOGA(": batched");
+    LOGA("\r\n");
     set_state(STATE_PROBING);
 
     memset(ir_neighbors, 0, sizeof(ir_neighbors));
+
+    if (batch) {
+        window_ms = TIME_TO_MS(ir_probe_time) * (ir_probe_broadcasts + 1);
+        MS_TO_TIME(delay, window_ms);
+        nrk_time_get(&now);
+        nrk_time_add(&start, now, delay);
+    }
+
+    direction_ms = TIME_TO_MS(ir_direction_time);
     
     do {
         init_message(&msg);
         msg.recipient = BROADCAST_NODE_ID;
         msg.port = PORT_IRTOP;
         msg.type = MSG_TYPE_PROBE;
+
+        if (batch) {
+            nrk_time_get(&now);
+            nrk_time_sub(&delay, start, now);
+            sweep_delay_ms = TIME_TO_MS(delay);
+
+            msg.payload[MSG_PROBE_SWEEP_DELAY_OFFSET] = sweep_delay_ms;
+            msg.payload[MSG_PROBE_SWEEP_DELAY_OFFSET + 1] = sweep_delay_ms >> 8;
+            msg.payload[MSG_PROBE_DIRECTION_TIME_OFFSET] = direction_ms;
+            msg.payload[MSG_PROBE_DIRECTION_TIME_OFFSET + 1] = direction_ms >> 8;
+            msg.len = MSG_PROBE_BATCH_LEN;
+            msg.stamped = true;
+        }
+
         rc = send_message(&msg);
         if (rc != NRK_OK) {
             LOG("WARN: failed to send probe msg\r\n");
@@ -344,6 +512,14 @@ static int8_t probe()
 
     } while (broadcast++ < ir_probe_broadcasts);
 
+    if (batch) {
+        nrk_time_get(&now);
+        if (time_cmp(&now, &start) < 0) {
+            nrk_time_sub(&delay, start, now);
+            nrk_wait(delay);
+        }
+    }
+
     for (led = 0; led < NUM_IR_LEDS; ++led) {
         LOG("probe direction: led "); LOGP("%d\r\n", led);
 
@@ -354,6 +530,12 @@ static int8_t probe()
         ir_led_off();
     }
 
+    /* Receivers pong within one direction time after the sweep */
+    if (batch) {
+        nrk_time_add(&gather_time, ir_direction_time, irtop_rpc_timeout);
+        nrk_wait(gather_time);
+    }
+
     set_state(STATE_IDLE);
 
     for (node = 0; node < MAX_NODES; ++node)
@@ -366,32 +548,14 @@ static int8_t probe()
     return NRK_OK;
 }
 
-static int8_t rpc_probe(node_id_t node, ir_graph_t *ir_graph_out)
+static int8_t parse_probe_reply(node_id_t node, ir_graph_t *ir_graph_out,
+                                uint8_t *reply_buf, uint8_t reply_len)
 {
-    int8_t rc = NRK_OK;
-    uint8_t reply_len = sizeof(probe_reply_buf);
-    uint8_t req_len = 0;
     uint8_t num_neighbors;
     node_id_t neighbor;
     ir_edge_t *edge;
     uint8_t i;
     uint8_t offset;
-    nrk_time_t probe_rpc_timeout;
-    nrk_time_t probe_timeout;
-
-    LOG("ir probe on node ");
-    LOGP("%d\r\n", node);
-
-    probe_timeout = calc_probe_timeout();
-    nrk_time_add(&probe_rpc_timeout, probe_timeout, irtop_rpc_timeout);
-
-    rc = rpc_call(&probe_endpoint.client, node, PORT_RPC_SERVER_IRTOP_PROBE,
-                  RPC_IR_PROBE, &probe_rpc_timeout,
-                  probe_req_buf, req_len, probe_reply_buf, &reply_len);
-    if (rc != NRK_OK) {
-        LOG("WARN: ir probe rpc failed\r\n");
-        return rc;
-    }
 
     if (reply_len % IR_PROBE_RECORD_SIZE != 0) {
         LOG("WARN: invalid ir probe reply size: ");
@@ -406,7 +570,7 @@ static int8_t rpc_probe(node_id_t node, ir_graph_t *ir_graph_out)
     for (i = 0; i < num_neighbors; ++i) {
         offset = i * IR_PROBE_RECORD_SIZE;
 
-        neighbor = probe_reply_buf[offset + IR_PROBE_REPLY_NODE_OFFSET];
+        neighbor = reply_buf[offset + IR_PROBE_REPLY_NODE_OFFSET];
 
         if (!IS_VALID_NODE_ID(neighbor)) {
             LOG("WARN: invalid node id in probe rpc reply: ");
@@ -414,23 +578,48 @@ static int8_t rpc_probe(node_id_t node, ir_graph_t *ir_graph_out)
             continue;
         }
 
-        edge = &ir_graph[node][neighbor];
+        edge = &(*ir_graph_out)[node][neighbor];
         edge->valid = true;
 
-        edge->dist = probe_reply_buf[offset + IR_PROBE_REPLY_DIST_OFFSET + 1];
+        edge->dist = reply_buf[offset + IR_PROBE_REPLY_DIST_OFFSET + 1];
         edge->dist <<= 8;
-        edge->dist |= probe_reply_buf[offset + IR_PROBE_REPLY_DIST_OFFSET];
+        edge->dist |= reply_buf[offset + IR_PROBE_REPLY_DIST_OFFSET];
 
-        edge->angle = probe_reply_buf[offset + IR_PROBE_REPLY_ANGLE_OFFSET + 1];
+        edge->angle = reply_buf[offset + IR_PROBE_REPLY_ANGLE_OFFSET + 1];
         edge->angle <<= 8;
-        edge->angle |= probe_reply_buf[offset + IR_PROBE_REPLY_ANGLE_OFFSET];
+        edge->angle |= reply_buf[offset + IR_PROBE_REPLY_ANGLE_OFFSET];
 
 
         LOG("ir probe rpc reply: ");
         LOGP("%u->%u: %u %u\r\n", node, neighbor, edge->dist, edge->angle);
     }
 
-    return rc;
+    return NRK_OK;
+}
+
+static int8_t rpc_probe(node_id_t node, ir_graph_t *ir_graph_out)
+{
+    int8_t rc = NRK_OK;
+    uint8_t reply_len = sizeof(probe_reply_buf);
+    uint8_t req_len = 0;
+    nrk_time_t probe_rpc_timeout;
+    nrk_time_t probe_timeout;
+
+    LOG("ir probe on node ");
+    LOGP("%d\r\n", node);
+
+    probe_timeout = calc_probe_timeout();
+    nrk_time_add(&probe_rpc_timeout, probe_timeout, irtop_rpc_timeout);
+
+    rc = rpc_call(&probe_endpoint.client, node, PORT_RPC_SERVER_IRTOP_PROBE,
+                  RPC_IR_PROBE, &probe_rpc_timeout,
+                  probe_req_buf, req_len, probe_reply_buf, &reply_len);
+    if (rc != NRK_OK) {
+        LOG("WARN: ir probe rpc failed\r\n");
+        return rc;
+    }
+
+    return parse_probe_reply(node, ir_graph_out, probe_reply_buf, reply_len);
 }
 
 static int8_t proc_ir_probe(node_id_t requester,
@@ -443,10 +632,14 @@ static int8_t proc_ir_probe(node_id_t requester,
     int8_t rc;
     uint8_t i = 0;
     uint8_t offset;
+    bool batch = false;
 
     LOG("probe rpc\r\n");
 
-    rc = probe();
+    if (req_len >= RPC_IR_PROBE_BATCH_REQ_LEN)
+        batch = req_buf[RPC_IR_PROBE_REQ_FLAGS_OFFSET] & IR_PROBE_FLAG_BATCH;
+
+    rc = probe(batch);
     if (rc != NRK_OK) {
         LOG("ir probe failed\r\n");
         return rc;
@@ -484,41 +677,217 @@ static int8_t proc_ir_probe(node_id_t requester,
     return NRK_OK;
 }
 
-static int8_t ir_discover(node_set_t nodes, bool incremental)
+/* Transfer the discovered IR neighbors to the graph */
+static void add_self_edges()
 {
-    int8_t rc;
     node_id_t node;
     ir_neighbor_t *ir_neighbor;
     ir_edge_t *edge;
 
+    for (node = 0; node < MAX_NODES; ++node) {
+        ir_neighbor = &ir_neighbors[node];
+        if (ir_neighbor->valid) {
+            edge = &ir_graph[this_node_id][node];
+            edge->valid = true;
+            edge->dist = get_distance(node);
+            edge->angle = get_led_angle(ir_neighbor->led);
+        }
+    }
+}
+
+static bool rf_adjacent(node_id_t a, node_id_t b)
+{
+    uint8_t i;
+
+    for (i = 0; i < network.degree[a]; ++i)
+        if (network.edges[a][i].v == b)
+            return true;
+    return false;
+}
+
+static bool slot_adjacent(node_id_t a, node_id_t b, bool use_ir)
+{
+    if (use_ir)
+        return ir_graph[a][b].valid || ir_graph[b][a].valid;
+    return rf_adjacent(a, b) || rf_adjacent(b, a);
+}
+
+/* Probers interfere if one sees the other's beam or both reach a common
+ * node. A prober misses the beams around it, which only matters where the
+ * IR graph has an edge, so that check can use it. A receiver follows the
+ * first probe msg it hears, over RF, and loses the beam of any other
+ * prober it could see: the common node check is always on the RF graph. */
+static bool probes_interfere(node_id_t a, node_id_t b, bool use_ir)
+{
+    node_id_t node;
+
+    if (slot_adjacent(a, b, use_ir))
+        return true;
+
+    for (node = 0; node < MAX_NODES; ++node)
+        if (node != a && node != b &&
+            slot_adjacent(a, node, false) && slot_adjacent(node, b, false))
+            return true;
+
+    return false;
+}
+
+static void log_node_set(node_set_t *set)
+{
+    node_id_t node;
+
+    for (node = 0; node < MAX_NODES; ++node)
+        if (NODE_SET_IN(*set, node))
+            LOGP("%d ", node);
+}
+
+static bool ir_graph_covers(node_set_t nodes)
+{
+    node_id_t out_node, in_node;
+
+    for (out_node = 0; out_node < MAX_NODES; ++out_node)
+        for (in_node = 0; in_node < MAX_NODES; ++in_node)
+            if (ir_graph[out_node][in_node].valid &&
+                (NODE_SET_IN(nodes, out_node) || NODE_SET_IN(nodes, in_node)))
+                return true;
+    return false;
+}
+
+/* Greedy coloring of the interference graph, with at most
+ * IRTOP_MAX_PARALLEL_PROBES nodes per color */
+static uint8_t assign_probe_slots(node_set_t nodes, bool use_ir,
+                                  node_set_t slots[])
+{
+    node_id_t node, other;
+    uint8_t slot, num_slots = 0;
+    uint8_t slot_size;
+    bool fits;
+
+    for (node = 0; node < MAX_NODES; ++node) {
+        if (!NODE_SET_IN(nodes, node))
+            continue;
+
+        for (slot = 0; slot < num_slots; ++slot) {
+            slot_size = 0;
+            fits = true;
+            for (other = 0; fits && other < MAX_NODES; ++other) {
+                if (NODE_SET_IN(slots[slot], other)) {
+                    slot_size++;
+                    fits = !probes_interfere(node, other, use_ir);
+                }
+            }
+            if (fits && slot_size < IRTOP_MAX_PARALLEL_PROBES)
+                break;
+        }
+
+        if (slot == num_slots)
+            NODE_SET_INIT(slots[num_slots++]);
+        NODE_SET_ADD(slots[slot], node);
+    }
+
+    return num_slots;
+}
+
+static void probe_reply_handler(node_id_t node, int8_t rc,
+                                uint8_t *reply_buf, uint8_t reply_len,
+                                void *arg)
+{
+    /* This node probes while the requests to the others are out */
+    if (rc == RPC_SELF) {
+        rc = probe(true);
+        if (rc == NRK_OK)
+            add_self_edges();
+        else
+            LOG("WARN: probe on self failed\r\n");
+        return;
+    }
+
+    if (rc != NRK_OK) {
+        LOG("WARN: probe request failed: node ");
+        LOGP("%d\r\n", node);
+        return;
+    }
+
+    parse_probe_reply(node, (ir_graph_t *)arg, reply_buf, reply_len);
+}
+
+/* All nodes in the slot probe at once, self included */
+static void probe_slot(node_set_t slot)
+{
+    uint8_t replies;
+    nrk_time_t probe_rpc_timeout;
+
+    nrk_time_add(&probe_rpc_timeout, calc_batch_probe_time(),
+                 irtop_rpc_timeout);
+
+    probe_req_buf[RPC_IR_PROBE_REQ_FLAGS_OFFSET] = IR_PROBE_FLAG_BATCH;
+
+    LOG("sending probe requests to: "); log_node_set(&slot); LOGA("\r\n");
+
+    replies = rpc_call_all(&probe_endpoint.client, slot,
+                           PORT_RPC_SERVER_IRTOP_PROBE, RPC_IR_PROBE,
+                           &probe_rpc_timeout, probe_req_buf,
+                           RPC_IR_PROBE_BATCH_REQ_LEN,
+                           &probe_reply_handler, &ir_graph);
+
+    LOG("probe replies: "); LOGP("%u\r\n", replies);
+}
+
+static int8_t ir_discover(node_set_t nodes, bool incremental,
+                          ir_discover_mode_t mode)
+{
+    int8_t rc;
+    node_id_t node;
+    node_set_t slots[MAX_NODES];
+    uint8_t num_slots;
+    uint8_t slot;
+
     if (state != STATE_IDLE) {
         LOG("WARN: cannot discover: not IDLE\r\n");
         return NRK_ERROR;
     }
 
-    LOG("discovering ir topology: nodes "); LOGP("0x%x\r\n", nodes);
+    LOG("discovering ir topology: nodes "); log_node_set(&nodes);
+    LOGA("\r\n");
+
+    if (mode == IR_DISCOVER_SLOTS_IR && !ir_graph_covers(nodes)) {
+        LOG("no ir graph for nodes: slots from rf topology\r\n");
+        mode = IR_DISCOVER_SLOTS_RF;
+    }
+
+    /* Slots come from the graph before it is cleared */
+    if (mode != IR_DISCOVER_SEQUENTIAL) {
+        num_slots = assign_probe_slots(nodes, mode == IR_DISCOVER_SLOTS_IR,
+                                       slots);
+        LOG("probe slots: ");
+        for (slot = 0; slot < num_slots; ++slot) {
+            LOGA("{ "); log_node_set(&slots[slot]); LOGA("} ");
+        }
+        LOGA("\r\n");
+    }
 
     if (!incremental)
         memset(&ir_graph, 0, sizeof(ir_graph));
 
+    if (mode != IR_DISCOVER_SEQUENTIAL) {
+        for (slot = 0; slot < num_slots; ++slot) {
+            probe_slot(slots[slot]);
+            print_ir_graph(&ir_graph);
+        }
+
+        LOG("discover completed\r\n");
+        return NRK_OK;
+    }
+
     /* First, probe on self */
     if (NODE_SET_IN(nodes, this_node_id)) {
-        rc = probe();
+        rc = probe(false);
         if (rc != NRK_OK) {
             LOG("WARN: probe on self failed\r\n");
             return rc;
         }
 
-        /* Transfer the discovered IR neighbors to the graph */
-        for (node = 0; node < MAX_NODES; ++node) {
-            ir_neighbor = &ir_neighbors[node];
-            if (ir_neighbor->valid) {
-                edge = &ir_graph[this_node_id][node];
-                edge->valid = true;
-                edge->dist = get_distance(node);
-                edge->angle = get_led_angle(ir_neighbor->led);
-            }
-        }
+        add_self_edges();
 
         print_ir_graph(&ir_graph);
     }
@@ -627,7 +996,7 @@ int8_t cmd_irprobe(uint8_t argc, char **argv)
 {
     int8_t rc;
     
-    rc = probe();
+    rc = probe(false);
     if (rc == NRK_OK)
         print_ir_neighbors(ir_neighbors);
 
@@ -637,15 +1006,16 @@ int8_t cmd_irprobe(uint8_t argc, char **argv)
 int8_t cmd_irdiscover(uint8_t argc, char **argv)
 {
     node_set_t nodes;
-    node_id_t src, dest;
+    node_id_t dest;
     bool all_but_self;
-    route_matrix_t *route_matrix;
+    node_id_t *discovered_routes;
     uint8_t i;
     int8_t rc;
     bool incremental;
+    ir_discover_mode_t mode;
 
     if (!(argc == 2 || argc >= 3)) {
-        OUT("usage: irdiscover n|i [-|<node>...]\r\n");
+        OUT("usage: irdiscover n|i[s|r] [-|<node>...]\r\n");
         return NRK_ERROR;
     }
 
@@ -656,26 +1026,43 @@ int8_t cmd_irdiscover(uint8_t argc, char **argv)
     /* probe on all other nodes in the whole RF graph (or excluding self) */
     if (argc == 2 || all_but_self) {
 
-        route_matrix = get_discovered_routes();
+        discovered_routes = get_discovered_routes();
 
-        for (src = 0; src < MAX_NODES; ++src) {
-            for (dest = 0; dest < MAX_NODES; ++dest) {
-                if (IS_VALID_NODE_ID((*route_matrix)[src][dest]) &&
-                    (!all_but_self || src != this_node_id)) {
-                    NODE_SET_ADD(nodes, src);
-                    break; /* at least one valid route means src in graph */
-                }
+        for (dest = 0; dest < MAX_NODES; ++dest) {
+            if (IS_VALID_NODE_ID(discovered_routes[dest])) {
+                /* a valid route means both ends are in the graph */
+                NODE_SET_ADD(nodes, dest);
+                if (!all_but_self)
+                    NODE_SET_ADD(nodes, this_node_id);
             }
         }
 
     }  else {
-        for (i = 2; i < argc; ++i)
-            NODE_SET_ADD(nodes, atoi(argv[i]));
+        for (i = 2; i < argc; ++i) {
+            dest = atoi(argv[i]);
+            if (!IS_VALID_NODE_ID(dest)) {
+                OUT("ERROR: invalid node id\r\n");
+                return NRK_ERROR;
+            }
+            NODE_SET_ADD(nodes, dest);
+        }
     }
 
     incremental = argv[1][0] == 'i';
+
+    /* slotted: probe non-interfering nodes in parallel */
+    switch (argv[1][1]) {
+        case 's':
+            mode = IR_DISCOVER_SLOTS_IR;
+            break;
+        case 'r':
+            mode = IR_DISCOVER_SLOTS_RF;
+            break;
+        default:
+            mode = IR_DISCOVER_SEQUENTIAL;
+    }
     
-    rc = ir_discover(nodes, incremental);
+    rc = ir_discover(nodes, incremental, mode);
     if (rc == NRK_OK)
         print_ir_graph(&ir_graph);
 
@@ -714,13 +1101,49 @@ void irtop_task()
 
         wait_signal_mask = 0;
 
-        if (state == STATE_WAITING_FOR_BEAM) {
+        if (state == STATE_WAITING_FOR_BEAM && batched) {
+            ASSERT(IS_VALID_NODE_ID(prober));
+
+            if (beam_led < 0) {
+                rcver_state = ir_rcv_state(IR_ALL_RECEIVERS);
+                if (rcver_state) {
+                    ir_rcv_change_time(rcver_state, &now);
+                    beam_led = beam_direction(&now);
+                    beam_receivers = rcver_state;
+                    ir_disarm(~0);
+                    nrk_led_clr(led_awaiting_beam);
+
+                    LOG("received beam: led "); LOGP("%d\r\n", beam_led);
+                }
+            }
+
+            nrk_time_get(&now);
+            if (time_cmp(&now, &pong_time) >= 0) {
+                if (beam_led >= 0) {
+                    LOG("sweep over: replying with ir pong\r\n");
+                    rc = rpc_ir_pong(prober, beam_led);
+                    if (rc != NRK_OK)
+                        LOG("WARN: ir pong rpc failed\r\n");
+
+                    probing_neighbor = &ir_neighbors[prober];
+                    probing_neighbor->valid = true;
+                    probing_neighbor->receivers = beam_receivers;
+                } else {
+                    LOG("no beam: probe sweep over\r\n");
+                }
+                reset_state();
+            } else {
+                nrk_time_sub(&remaining, pong_time, now);
+                nrk_set_next_wakeup(remaining);
+                wait_signal_mask |= SIG(nrk_wakeup_signal);
+            }
+        } else if (state == STATE_WAITING_FOR_BEAM) {
             ASSERT(IS_VALID_NODE_ID(prober));
 
             rcver_state = ir_rcv_state(IR_ALL_RECEIVERS);
             if (rcver_state) {
                 LOG("received beam: replying with ir pong\r\n");
-                rc = rpc_ir_pong(prober);
+                rc = rpc_ir_pong(prober, -1);
                 if (rc != NRK_OK) {
                     LOG("WARN: ir pong rpc failed\r\n");
                     /* fall-through: still update receivers and reset state */
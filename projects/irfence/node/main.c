@@ -72,6 +72,9 @@
 #if ENABLE_BLINKER
 #include "blinker.h"
 #endif
+#if ENABLE_DEFERRED_LOG
+#include "deflog.h"
+#endif
 
 static nrk_task_type MAIN_TASK;
 static NRK_STK main_task_stack[STACKSIZE_MAIN];
@@ -235,6 +238,7 @@ static const cmd_t cmds[] PROGMEM = {
     /* RX/TX cmds */
 #if ENABLE_RXTX
     { "top", "manipulate RF topology mask", &cmd_top},
+    { "mac", "show B-MAC check rate and duty cycle", &cmd_mac},
 #endif
 
 #if ENABLE_WATCHDOG
@@ -247,13 +251,14 @@ static const cmd_t cmds[] PROGMEM = {
     { "hood", "list rf neighborhood", &cmd_hood},
     { "route", "show/change routing table", &cmd_route},
     { "ping", "send a ping", &cmd_ping},
+    { "traffic", "show per-class tx latency", &cmd_traffic},
 #endif
 #if ENABLE_RFTOP
     { "discover", "initiate route discovery", &cmd_discover},
     { "probe", "discover network topology graph", &cmd_probe},
     { "rftop", "print or edit RF network topology graph", &cmd_rftop},
     { "calc-routes", "calculate routing tables", &cmd_calc_routes},
-    { "bc-routes", "broadcast routes", &cmd_bc_routes},
+    { "bc-routes", "distribute routes", &cmd_bc_routes},
     { "set-routes", "apply discovered routes", &cmd_set_routes},
 #endif
 
@@ -402,6 +407,10 @@ int main ()
     prio -= init_periodic(prio, periodic_funcs);
 #endif
 
+#if ENABLE_DEFERRED_LOG
+    prio -= init_deflog(prio);
+#endif
+
     prio -= init_main(prio);
 
     LOG("created tasks: "); LOGP("%u\r\n", NRK_MAX_TASKS - prio);
@@ -1,14 +1,22 @@
 #ifndef NODE_ID_H
 #define NODE_ID_H
 
+#include "cfg.h"
+#include "bitset.h"
+
 typedef uint8_t node_id_t;
-typedef uint8_t node_set_t;
+
+/* A bit per node id up to MAX_NODES. A struct so that sets can be
+ * assigned and passed by value. */
+typedef struct {
+    uint8_t bits[BITSET_BYTES(MAX_NODES)];
+} node_set_t;
 
 #define IS_VALID_NODE_ID(id) (id != 0 && id < MAX_NODES)
 
-#define NODE_SET_INIT(set) do { set = 0; } while (0)
-#define NODE_SET_ADD(set, id) do { set |= (1 << (id)); } while (0)
-#define NODE_SET_REMOVE(set, id) do { set &= ~(1 << (id)); } while (0)
-#define NODE_SET_IN(set, id) (set & (1 << (id)))
+#define NODE_SET_INIT(set) BITSET_INIT((set).bits, MAX_NODES)
+#define NODE_SET_ADD(set, id) BITSET_ADD((set).bits, id)
+#define NODE_SET_REMOVE(set, id) BITSET_REMOVE((set).bits, id)
+#define NODE_SET_IN(set, id) BITSET_IN((set).bits, id)
 
 #endif // NODE_ID_H
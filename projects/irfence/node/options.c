@@ -4,12 +4,66 @@
 #include <nrk_eeprom.h>
 #include <nrk_time.h>
 #include <avr/pgmspace.h>
+#include <util/crc16.h>
 
+#include "cfg.h"
 #include "output.h"
+#include "bitset.h"
 #include "options.h"
 #include "time.h"
 
+/* Options are saved as records appended to a log in one of two eeprom
+ * regions, so that saving an option again writes new cells instead of
+ * wearing out the same ones:
+ *
+ *   region: [magic][gen lo][gen hi][crc] record... [0xff][0xff]
+ *   record: [key lo][key hi][len][value...][crc]
+ *
+ * The key of an option is its eeprom addr in the options table, and its
+ * last record holds its value. When the region fills up, the last records
+ * are copied into the other region, and its header is written last, with
+ * the next generation. The region with the newest valid header is the
+ * active one, so an interrupted compaction leaves the old one in use.
+ *
+ * Regions are reused without erasing them, so past the end there may be
+ * records of older generations. The crc of a record covers the generation
+ * of the region, so these never pass as records of the current one, and
+ * the end mark is moved past new records before they are written.
+ *
+ * A batch starts with a record that holds the count of records in the
+ * batch: a batch that was not written whole is dropped on load.
+ *
+ * Options owned by NRK stay at their fixed addrs. Until the log is first
+ * written, the other options are loaded from their fixed addrs too (the
+ * layout before the log), and are copied into the log from there. */
+
+#define LOG_MAGIC 0xA6 /* 0xA5: crc of records without gen */
+#define LOG_HEADER_LEN 4
+#define RECORD_OVERHEAD 4 /* key, len, crc */
+#define RECORD_VALUE(addr) ((addr) + 3)
+#define KEY_END 0xffff
+#define KEY_BATCH 0xfffe
+
+#define MAX_ENCODED_LEN 2 /* of scalar types */
+
+#define NO_REGION -1
+#define REGION_ADDR(r) (OPTION_LOG_ADDR + (r) * OPTION_LOG_REGION_SIZE)
+#define REGION_END(r) (REGION_ADDR(r) + OPTION_LOG_REGION_SIZE)
+
+#define OPT_IDX(opt) ((opt) - options)
+
 static const option_t *options; /* ptr to prog memory */
+static uint8_t num_options;
+
+/* Eeprom addr of the value of each option in the log, 0 if not saved */
+static uint16_t value_addr[MAX_OPTIONS];
+
+static uint8_t dirty[BITSET_BYTES(MAX_OPTIONS)]; /* to be saved */
+static bool batching;
+
+static int8_t active_region = NO_REGION;
+static uint16_t generation;
+static uint16_t log_end; /* addr of the next record */
 
 /* Only writes if the value has changed */
 void save_to_eeprom(uint16_t addr, uint8_t value)
@@ -134,55 +188,78 @@ void print_option(const option_t *opt)
     OUT("\r\n");
 }
 
-int8_t save_option(const option_t *opt)
+static bool is_fixed(const option_t *opt)
+{
+    return pgm_read_word(&opt->addr) < OPTION_FIXED_ADDR_END;
+}
+
+static const option_t *find_option_by_key(uint16_t key)
+{
+    uint8_t i;
+    for (i = 0; i < num_options; ++i)
+        if (pgm_read_word(&options[i].addr) == key)
+            return &options[i];
+    return NULL;
+}
+
+/* Bytes of the value as stored: scalars are encoded into buf, blobs are
+ * stored as they are in memory. NULL if the type is not supported. */
+static const uint8_t *encode_option(const option_t *opt, uint8_t *buf,
+                                    uint8_t *len)
 {
     nrk_time_t val_time;
     uint32_t val_num;
-    uint8_t size;
 
-    uint16_t addr = pgm_read_word(&opt->addr);
     void *value = pgm_read_word(&opt->value);
     opt_type_t type = pgm_read_byte(&opt->type);
 
     switch (type) {
         case OPT_TYPE_UINT8:
-            save_to_eeprom(addr, *(uint8_t *)value);
-            break;
-        case OPT_TYPE_UINT16:
-            val_num = *(uint16_t *)value;
-            save_to_eeprom(addr + 0, (val_num >> 8 * 0) & 0xff);
-            save_to_eeprom(addr + 1, (val_num >> 8 * 1) & 0xff);
-            break;
         case OPT_TYPE_INT8:
-            save_to_eeprom(addr, *(int8_t *)value);
+            buf[0] = *(uint8_t *)value;
+            *len = 1;
             break;
         case OPT_TYPE_BOOL:
-            save_to_eeprom(addr, *(bool *)value ? 1 : 0);
+            buf[0] = *(bool *)value ? 1 : 0;
+            *len = 1;
+            break;
+        case OPT_TYPE_UINT16:
+            val_num = *(uint16_t *)value;
+            buf[0] = (val_num >> 8 * 0) & 0xff;
+            buf[1] = (val_num >> 8 * 1) & 0xff;
+            *len = 2;
             break;
         case OPT_TYPE_TIME: /* store ms as two bytes */
             val_time = *(nrk_time_t *)value;
             val_num = TIME_TO_MS(val_time);
-            save_to_eeprom(addr + 0, (val_num >> 8 * 0) & 0xff);
-            save_to_eeprom(addr + 1, (val_num >> 8 * 1) & 0xff);
+            buf[0] = (val_num >> 8 * 0) & 0xff;
+            buf[1] = (val_num >> 8 * 1) & 0xff;
+            *len = 2;
             break;
         case OPT_TYPE_BLOB:
-            size = pgm_read_byte(&opt->size);
-            save_buf_to_eeprom(addr, (uint8_t *)value, size);
-            break;
+            *len = pgm_read_byte(&opt->size);
+            return (uint8_t *)value;
         default:
-            LOG("ERROR: save: unsupported option type\r\n");
-            return NRK_ERROR;
+            return NULL;
     }
-    return NRK_OK;
+    return buf;
 }
 
-int8_t load_option(const option_t *opt)
+static uint8_t option_len(const option_t *opt)
+{
+    uint8_t buf[MAX_ENCODED_LEN];
+    uint8_t len = 0;
+
+    encode_option(opt, buf, &len);
+    return len;
+}
+
+static int8_t read_option(const option_t *opt, uint16_t addr)
 {
     uint32_t val_num = 0;
     uint8_t i;
     uint8_t size;
 
-    uint16_t addr = pgm_read_word(&opt->addr);
     void *value = pgm_read_word(&opt->value);
     opt_type_t type = pgm_read_byte(&opt->type);
 
@@ -219,6 +296,329 @@ int8_t load_option(const option_t *opt)
     return NRK_OK;
 }
 
+static bool eeprom_equals(uint16_t addr, const uint8_t *buf, uint8_t len)
+{
+    uint8_t i;
+    for (i = 0; i < len; ++i)
+        if (nrk_eeprom_read_byte(addr + i) != buf[i])
+            return false;
+    return true;
+}
+
+static uint8_t eeprom_crc(uint8_t crc, uint16_t addr, uint8_t len)
+{
+    while (len--)
+        crc = _crc_ibutton_update(crc, nrk_eeprom_read_byte(addr++));
+    return crc;
+}
+
+static uint16_t put_byte(uint16_t addr, uint8_t value, uint8_t *crc)
+{
+    *crc = _crc_ibutton_update(*crc, value);
+    save_to_eeprom(addr, value);
+    return addr + 1;
+}
+
+/* Records of a generation are only valid in that generation */
+static uint8_t record_crc_init(uint16_t gen)
+{
+    uint8_t crc = 0;
+    crc = _crc_ibutton_update(crc, gen & 0xff);
+    crc = _crc_ibutton_update(crc, gen >> 8);
+    return crc;
+}
+
+/* Returns the addr past the record at addr, or 0 if there is no valid
+ * record of generation gen there */
+static uint16_t read_record(uint16_t addr, uint16_t end, uint16_t gen,
+                            uint16_t *key, uint8_t *len)
+{
+    if (addr + RECORD_OVERHEAD > end)
+        return 0;
+
+    *key = nrk_eeprom_read_byte(addr) |
+           ((uint16_t)nrk_eeprom_read_byte(addr + 1) << 8);
+    if (*key == KEY_END)
+        return 0;
+
+    *len = nrk_eeprom_read_byte(addr + 2);
+    if (addr + RECORD_OVERHEAD + *len > end)
+        return 0;
+    if (eeprom_crc(record_crc_init(gen), addr, 3 + *len) !=
+        nrk_eeprom_read_byte(RECORD_VALUE(addr) + *len))
+        return 0;
+    return addr + RECORD_OVERHEAD + *len;
+}
+
+/* The value comes from memory (buf), or from eeprom (src) if buf is NULL.
+ * Returns the addr past the record. */
+static uint16_t write_record(uint16_t addr, uint16_t gen, uint16_t key,
+                             const uint8_t *buf, uint16_t src, uint8_t len)
+{
+    uint8_t crc = record_crc_init(gen);
+    uint8_t i;
+
+    addr = put_byte(addr, key & 0xff, &crc);
+    addr = put_byte(addr, key >> 8, &crc);
+    addr = put_byte(addr, len, &crc);
+    for (i = 0; i < len; ++i)
+        addr = put_byte(addr, buf ? buf[i] : nrk_eeprom_read_byte(src + i),
+                        &crc);
+    save_to_eeprom(addr, crc);
+    return addr + 1;
+}
+
+/* Marks the end, over what is left there from older generations */
+static void end_log(uint16_t addr, uint16_t end)
+{
+    if (addr + 2 > end)
+        return;
+    save_to_eeprom(addr + 0, KEY_END & 0xff);
+    save_to_eeprom(addr + 1, KEY_END >> 8);
+}
+
+static bool read_header(int8_t region, uint16_t *gen)
+{
+    uint16_t addr = REGION_ADDR(region);
+
+    if (nrk_eeprom_read_byte(addr) != LOG_MAGIC)
+        return false;
+    *gen = nrk_eeprom_read_byte(addr + 1) |
+           ((uint16_t)nrk_eeprom_read_byte(addr + 2) << 8);
+    return eeprom_crc(0, addr, 3) == nrk_eeprom_read_byte(addr + 3);
+}
+
+static void write_header(int8_t region, uint16_t gen)
+{
+    uint16_t addr = REGION_ADDR(region);
+    uint8_t crc = 0;
+
+    addr = put_byte(addr, LOG_MAGIC, &crc);
+    addr = put_byte(addr, gen & 0xff, &crc);
+    addr = put_byte(addr, gen >> 8, &crc);
+    save_to_eeprom(addr, crc);
+}
+
+static bool batch_complete(uint16_t addr, uint16_t end, uint16_t gen,
+                           uint8_t count)
+{
+    uint16_t key;
+    uint8_t len;
+
+    while (count--) {
+        addr = read_record(addr, end, gen, &key, &len);
+        if (!addr || key == KEY_BATCH)
+            return false;
+    }
+    return true;
+}
+
+static void index_record(uint16_t addr, uint16_t key, uint8_t len)
+{
+    const option_t *opt = find_option_by_key(key);
+
+    /* records of removed or resized options are dropped on compaction */
+    if (!opt || is_fixed(opt) || option_len(opt) != len)
+        return;
+    value_addr[OPT_IDX(opt)] = RECORD_VALUE(addr);
+}
+
+static void mount_log()
+{
+    uint16_t gen[2];
+    bool valid[2];
+    const option_t *opt;
+    uint16_t addr, next, end, key;
+    uint8_t i, len;
+
+    valid[0] = read_header(0, &gen[0]);
+    valid[1] = read_header(1, &gen[1]);
+
+    if (valid[0] && valid[1])
+        active_region = (int16_t)(gen[1] - gen[0]) > 0 ? 1 : 0;
+    else if (valid[0] || valid[1])
+        active_region = valid[0] ? 0 : 1;
+    else
+        active_region = NO_REGION;
+
+    for (i = 0; i < num_options; ++i) {
+        opt = &options[i];
+        value_addr[i] = active_region == NO_REGION &&
+                        !is_fixed(opt) && option_len(opt) ?
+                        pgm_read_word(&opt->addr) : 0;
+    }
+
+    if (active_region == NO_REGION) {
+        LOG("options: no log, using fixed addrs\r\n");
+        return;
+    }
+
+    generation = gen[active_region];
+    end = REGION_END(active_region);
+    addr = REGION_ADDR(active_region) + LOG_HEADER_LEN;
+    while ((next = read_record(addr, end, generation, &key, &len))) {
+        if (key == KEY_BATCH) {
+            if (!batch_complete(next, end, generation,
+                                nrk_eeprom_read_byte(RECORD_VALUE(addr))))
+                break;
+        } else {
+            index_record(addr, key, len);
+        }
+        addr = next;
+    }
+    log_end = addr;
+
+    LOG("options: log gen ");
+    LOGP("%u: %u/%u bytes\r\n", generation,
+         log_end - REGION_ADDR(active_region), OPTION_LOG_REGION_SIZE);
+}
+
+/* Copies the value of each option into the other region: from memory if
+ * it is to be saved, otherwise from its last record */
+static int8_t compact_log()
+{
+    int8_t region = active_region == NO_REGION ? 0 : !active_region;
+    uint16_t addr = REGION_ADDR(region) + LOG_HEADER_LEN;
+    uint16_t size = LOG_HEADER_LEN;
+    uint16_t gen = generation + 1;
+    uint8_t buf[MAX_ENCODED_LEN];
+    const uint8_t *bytes;
+    const option_t *opt;
+    uint16_t src;
+    uint8_t i, len;
+
+    for (i = 0; i < num_options; ++i)
+        if (BITSET_IN(dirty, i) || value_addr[i])
+            size += RECORD_OVERHEAD + option_len(&options[i]);
+    if (size > OPTION_LOG_REGION_SIZE) {
+        LOG("ERROR: options do not fit into log region\r\n");
+        return NRK_ERROR;
+    }
+
+    end_log(REGION_ADDR(region) + size, REGION_END(region));
+    for (i = 0; i < num_options; ++i) {
+        opt = &options[i];
+        if (BITSET_IN(dirty, i)) {
+            bytes = encode_option(opt, buf, &len);
+            value_addr[i] = RECORD_VALUE(addr);
+            addr = write_record(addr, gen, pgm_read_word(&opt->addr),
+                                bytes, 0, len);
+        } else if (value_addr[i]) {
+            src = value_addr[i];
+            len = option_len(opt);
+            value_addr[i] = RECORD_VALUE(addr);
+            addr = write_record(addr, gen, pgm_read_word(&opt->addr),
+                                NULL, src, len);
+        }
+    }
+    write_header(region, gen);
+
+    generation = gen;
+    active_region = region;
+    log_end = addr;
+    BITSET_INIT(dirty, MAX_OPTIONS);
+
+    LOG("options: compacted into gen ");
+    LOGP("%u: %u bytes\r\n", generation, size);
+    return NRK_OK;
+}
+
+/* Appends the options to be saved whose values changed, in one batch */
+static int8_t commit_log()
+{
+    uint8_t buf[MAX_ENCODED_LEN];
+    const uint8_t *bytes;
+    const option_t *opt;
+    uint16_t addr, size = 0;
+    uint8_t i, len, count = 0;
+
+    for (i = 0; i < num_options; ++i) {
+        if (!BITSET_IN(dirty, i))
+            continue;
+        bytes = encode_option(&options[i], buf, &len);
+        if (value_addr[i] && eeprom_equals(value_addr[i], bytes, len)) {
+            BITSET_REMOVE(dirty, i);
+            continue;
+        }
+        size += RECORD_OVERHEAD + len;
+        count++;
+    }
+    if (!count)
+        return NRK_OK;
+    if (count > 1)
+        size += RECORD_OVERHEAD + 1;
+
+    if (active_region == NO_REGION ||
+        log_end + size > REGION_END(active_region))
+        return compact_log();
+
+    end_log(log_end + size, REGION_END(active_region));
+    addr = log_end;
+    if (count > 1)
+        addr = write_record(addr, generation, KEY_BATCH, &count, 0, 1);
+    for (i = 0; i < num_options; ++i) {
+        if (!BITSET_IN(dirty, i))
+            continue;
+        opt = &options[i];
+        bytes = encode_option(opt, buf, &len);
+        value_addr[i] = RECORD_VALUE(addr);
+        addr = write_record(addr, generation, pgm_read_word(&opt->addr),
+                            bytes, 0, len);
+    }
+
+    log_end = addr;
+    BITSET_INIT(dirty, MAX_OPTIONS);
+    return NRK_OK;
+}
+
+/* Saves of options until the commit are written as one batch */
+void begin_options_batch()
+{
+    batching = true;
+}
+
+int8_t commit_options_batch()
+{
+    batching = false;
+    return commit_log();
+}
+
+int8_t save_option(const option_t *opt)
+{
+    uint8_t buf[MAX_ENCODED_LEN];
+    const uint8_t *bytes;
+    uint8_t len;
+
+    bytes = encode_option(opt, buf, &len);
+    if (!bytes) {
+        LOG("ERROR: save: unsupported option type\r\n");
+        return NRK_ERROR;
+    }
+
+    if (is_fixed(opt)) {
+        save_buf_to_eeprom(pgm_read_word(&opt->addr), bytes, len);
+        return NRK_OK;
+    }
+
+    BITSET_ADD(dirty, OPT_IDX(opt));
+    if (batching)
+        return NRK_OK;
+    return commit_log();
+}
+
+int8_t load_option(const option_t *opt)
+{
+    uint16_t addr;
+
+    if (is_fixed(opt))
+        return read_option(opt, pgm_read_word(&opt->addr));
+
+    addr = value_addr[OPT_IDX(opt)];
+    if (!addr) /* never saved: keep the default */
+        return NRK_ERROR;
+    return read_option(opt, addr);
+}
+
 void print_options()
 {
     const option_t *opt = &options[0];
@@ -237,13 +637,22 @@ int8_t load_options()
 int8_t save_options()
 {
     const option_t *opt = &options[0];
+
+    begin_options_batch();
     while (pgm_read_word(&opt->value))
         save_option(opt++);
-    return NRK_OK;
+    return commit_options_batch();
 }
 
 /* Ptr to options description array in prog memory */
 void init_options(const option_t *opts)
 {
     options = opts;
+
+    num_options = 0;
+    while (pgm_read_word(&options[num_options].value))
+        if (++num_options > MAX_OPTIONS)
+            ABORT("too many options\r\n");
+
+    mount_log();
 }
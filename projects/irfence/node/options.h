@@ -35,6 +35,10 @@ int8_t save_options();
 int8_t load_options();
 void print_options();
 
+/* Options saved between begin and commit are written to eeprom together */
+void begin_options_batch();
+int8_t commit_options_batch();
+
 void save_to_eeprom(uint16_t addr, uint8_t value);
 void save_buf_to_eeprom(uint16_t addr, const uint8_t *buf, uint8_t len);
 
@@ -5,6 +5,9 @@
 
 #include "cfg.h"
 #include "config.h"
+#if ENABLE_DEFERRED_LOG
+#include "deflog.h"
+#endif
 
 extern const char new_line_str[];
 
@@ -39,8 +42,16 @@ void log_preamble();
 #define STRINGIFY(x) STRINGIFY_INNER(x)
 #define CODE_LOCATION __FILE__ ":" STRINGIFY(__LINE__)
 
+/* Deferred records logged before a halt would be lost otherwise */
+#if ENABLE_DEFERRED_LOG
+#define LOG_FLUSH() deflog_flush()
+#else
+#define LOG_FLUSH()
+#endif
+
 #define ABORT(msg) \
     do { \
+        LOG_FLUSH(); \
         log_preamble(); \
         nrk_kprintf(PSTR(CODE_LOCATION ": ABORT: ")); \
         nrk_kprintf(PSTR(msg)); \
@@ -51,6 +62,7 @@ void log_preamble();
 #define ASSERT(cond) \
     do { \
         if (!(cond)) { \
+            LOG_FLUSH(); \
             log_preamble(); \
             nrk_kprintf(PSTR(CODE_LOCATION ": ASSERT: ")); \
             nrk_kprintf(PSTR(#cond)); \
@@ -65,6 +77,31 @@ void log_preamble();
 
 #define LOG_ENABLED(cat) (logcat & LOG_CATEGORY_MASTER && logcat & cat)
 
+#if ENABLE_DEFERRED_LOG
+
+#define CLOG(cat, msg) \
+    do { \
+        if (LOG_ENABLED(cat)) \
+            deflog(DEFLOG_PREAMBLE, PSTR(__FILE__ ": " msg)); \
+    } while (0)
+
+#define CLOGA(cat, msg) \
+    do { \
+        if (LOG_ENABLED(cat)) deflog(0, PSTR(msg)); \
+    } while (0)
+
+#define CLOGP(cat, fmt, ...) \
+    do { \
+        if (LOG_ENABLED(cat)) deflog(0, PSTR(fmt), ##__VA_ARGS__); \
+    } while (0)
+
+#define CLOGF(cat, msg) \
+    do { \
+        if (LOG_ENABLED(cat)) deflog(0, msg); \
+    } while (0)
+
+#else /* !ENABLE_DEFERRED_LOG */
+
 #define CLOG(cat, msg) \
     do { \
         if (LOG_ENABLED(cat)) { \
@@ -88,6 +125,8 @@ void log_preamble();
         if (LOG_ENABLED(cat)) nrk_kprintf(msg); \
     } while (0)
 
+#endif /* !ENABLE_DEFERRED_LOG */
+
 #define LOG(msg) CLOG(LOG_CATEGORY, msg)
 #define LOGA(msg) CLOGA(LOG_CATEGORY, msg)
 #define LOGP(...) CLOGP(LOG_CATEGORY, __VA_ARGS__)
@@ -11,4 +11,10 @@ const char pkt_names[NUM_PKT_TYPES][MAX_ENUM_NAME_LEN] PROGMEM = {
     [PKT_TYPE_DISCOVER_RESPONSE] = "discover-resp",
     [PKT_TYPE_MSG] = "msg",
     [PKT_TYPE_ROUTES] = "routes",
+    [PKT_TYPE_ROUTES_ACK] = "routes-ack",
+};
+
+const char traffic_class_names[NUM_TRAFFIC_CLASSES][MAX_ENUM_NAME_LEN] PROGMEM = {
+    [TRAFFIC_CLASS_BULK] = "bulk",
+    [TRAFFIC_CLASS_BREACH] = "breach",
 };
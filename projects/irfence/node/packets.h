@@ -13,9 +13,18 @@ typedef enum {
     PKT_TYPE_DISCOVER_RESPONSE,
     PKT_TYPE_MSG,
     PKT_TYPE_ROUTES,
+    PKT_TYPE_ROUTES_ACK,
     NUM_PKT_TYPES,
 } pkt_type_t;
 
+/* Traffic classes: each layer serves the higher class first */
+typedef enum {
+    TRAFFIC_CLASS_BULK = 0,
+    TRAFFIC_CLASS_BREACH,
+    NUM_TRAFFIC_CLASSES,
+} traffic_class_t;
+
 extern const char pkt_names[NUM_PKT_TYPES][MAX_ENUM_NAME_LEN];
+extern const char traffic_class_names[NUM_TRAFFIC_CLASSES][MAX_ENUM_NAME_LEN];
 
 #endif // PACKETS_H
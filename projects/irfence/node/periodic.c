@@ -20,13 +20,154 @@ static periodic_func_t **functions;
 
 static nrk_sig_t func_signal;
 
+/* Funcs with a pending deadline, as a binary min-heap on the deadline, so
+ * that a wakeup only touches the funcs that are due */
+static periodic_func_t *heap[MAX_PERIODIC_FUNCS];
+static uint8_t heap_len;
+
+static void heap_swap(uint8_t i, uint8_t j)
+{
+    periodic_func_t *tmp = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = tmp;
+    heap[i]->heap_idx = i;
+    heap[j]->heap_idx = j;
+}
+
+static bool heap_before(uint8_t i, uint8_t j)
+{
+    return time_cmp(&heap[i]->deadline, &heap[j]->deadline) < 0;
+}
+
+static void heap_sift_up(uint8_t i)
+{
+    uint8_t parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!heap_before(i, parent))
+            break;
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(uint8_t i)
+{
+    uint8_t child, min;
+
+    while (1) {
+        min = i;
+        child = 2 * i + 1;
+        if (child < heap_len && heap_before(child, min))
+            min = child;
+        child++;
+        if (child < heap_len && heap_before(child, min))
+            min = child;
+        if (min == i)
+            break;
+        heap_swap(i, min);
+        i = min;
+    }
+}
+
+static void heap_insert(periodic_func_t *func)
+{
+    ASSERT(heap_len < MAX_PERIODIC_FUNCS);
+
+    heap[heap_len] = func;
+    func->heap_idx = heap_len;
+    heap_sift_up(heap_len++);
+}
+
+static void heap_remove(periodic_func_t *func)
+{
+    periodic_func_t *moved;
+    uint8_t i;
+
+    if (func->heap_idx < 0)
+        return;
+
+    i = func->heap_idx;
+    func->heap_idx = -1;
+    if (i == --heap_len)
+        return;
+
+    /* Fill the hole with the last entry and restore the order around it */
+    moved = heap[heap_len];
+    heap[i] = moved;
+    moved->heap_idx = i;
+    heap_sift_up(i);
+    heap_sift_down(moved->heap_idx);
+}
+
+/* For funcs that leave the next event to the framework: one period after
+ * the last deadline, so that the schedule does not drift by the processing
+ * time, unless that has already passed. */
+static void next_period(periodic_func_t *func, nrk_time_t *next_event)
+{
+    nrk_time_t now, jitter;
+
+    nrk_time_get(&now);
+
+    if (IS_VALID_TIME(func->deadline))
+        nrk_time_add(next_event, func->deadline, *func->period);
+    if (!IS_VALID_TIME(*next_event) || time_cmp(next_event, &now) <= 0)
+        nrk_time_add(next_event, now, *func->period);
+
+    if (func->jitter_ms) {
+        jitter.secs = 0;
+        jitter.nano_secs = (uint32_t)(rand() % (func->jitter_ms + 1)) *
+                           NANOS_PER_MS;
+        nrk_time_compact_nanos(&jitter);
+        nrk_time_add(next_event, *next_event, jitter);
+    }
+}
+
+/* A func run by a signal or an enable toggle before its deadline (not due)
+ * that leaves the next event to the framework keeps its pending deadline */
+static void run_func(periodic_func_t *func, bool due)
+{
+    nrk_time_t next_event;
+    nrk_sig_mask_t wait_mask = 0;
+    bool keep = false;
+
+    TIME_CLEAR(next_event);
+
+    if (func->enabled || func->enabled != func->last_enabled) {
+        LOG("proc: "); LOGF(func->name); LOGNL();
+        ASSERT(func->proc);
+
+        func->proc(func->enabled, &next_event, &wait_mask);
+
+        if (func->enabled && func->period && !IS_VALID_TIME(next_event)) {
+            if (!due && func->heap_idx >= 0)
+                keep = true;
+            else
+                next_period(func, &next_event);
+        }
+    }
+    func->last_enabled = func->enabled;
+    func->wait_mask = wait_mask;
+
+    if (keep)
+        return;
+
+    heap_remove(func);
+    func->deadline = next_event;
+    if (IS_VALID_TIME(func->deadline))
+        heap_insert(func);
+}
+
 static void periodic_task()
 {
-    nrk_sig_mask_t wait_mask, func_wait_mask;
-    nrk_time_t next_event, func_next_event;
+    nrk_sig_mask_t wait_mask, fired;
+    periodic_func_t *due[MAX_PERIODIC_FUNCS];
     periodic_func_t **funcp;
     periodic_func_t *func;
     nrk_time_t now, sleep_time;
+    uint8_t num_due, i;
     int8_t rc;
 
     funcp = &functions[0];
@@ -35,6 +176,8 @@ static void periodic_task()
         LOG("init: "); LOGF(func->name); LOGNL();
         if (func->init)
             func->init();
+        func->heap_idx = -1;
+        TIME_CLEAR(func->deadline);
         funcp++;
     }
 
@@ -42,56 +185,60 @@ static void periodic_task()
     if (rc == NRK_ERROR)
         ABORT("reg sig: func\r\n");
 
-    while (1) {
-
-        LOG("awake\r\n");
+    /* First round: every func gets to schedule itself */
+    for (funcp = &functions[0]; *funcp; funcp++)
+        run_func(*funcp, true);
 
-        TIME_CLEAR(next_event);
+    while (1) {
 
         wait_mask = SIG(func_signal);
+        for (funcp = &functions[0]; *funcp; funcp++)
+            wait_mask |= (*funcp)->wait_mask;
 
-        funcp = &functions[0];
-        while (*funcp) {
-            func = *funcp;
-
-            TIME_CLEAR(func_next_event);
-            func_wait_mask = 0;
-
-            if (func->enabled ||
-                func->enabled != func->last_enabled) {
-
-                LOG("proc: "); LOGF(func->name); LOGNL();
-                ASSERT(func->proc);
-
-                func->proc(func->enabled,
-                           &func_next_event, &func_wait_mask);
-            }
-            func->last_enabled = func->enabled;
-
-            wait_mask |= func_wait_mask;
-            if (IS_VALID_TIME(func_next_event) &&
-                (!IS_VALID_TIME(next_event) ||
-                 time_cmp(&func_next_event, &next_event) < 0)) {
-                next_event = func_next_event;
+        if (heap_len > 0) {
+            nrk_time_get(&now);
+            rc = nrk_time_sub(&sleep_time, heap[0]->deadline, now);
+            if (rc == NRK_OK) {
+                LOG("sleeping for: ");
+                LOGP("%lu ms\r\n", TIME_TO_MS(sleep_time));
+                nrk_set_next_wakeup(sleep_time);
+                wait_mask |= SIG(nrk_wakeup_signal);
+            } else {
+                LOG("next event in the past\r\n");
+                wait_mask = 0;
             }
+        }
 
-            funcp++;
+        fired = 0;
+        if (wait_mask) {
+            LOG("waiting\r\n");
+            fired = nrk_event_wait( wait_mask );
         }
 
-        if (IS_VALID_TIME(next_event)) {
-            nrk_time_get(&now);
-            rc = nrk_time_sub(&sleep_time, next_event, now);
-            if (rc != NRK_OK) {
-                LOG("next event in the past\r\n");
-                continue;
+        LOG("awake\r\n");
+
+        /* Take the due funcs off the heap before running any of them, so
+         * that a func that reschedules itself into the past runs only once
+         * per round */
+        nrk_time_get(&now);
+        num_due = 0;
+        while (heap_len > 0 && time_cmp(&heap[0]->deadline, &now) <= 0) {
+            due[num_due++] = heap[0];
+            heap_remove(heap[0]);
+        }
+        for (i = 0; i < num_due; ++i)
+            run_func(due[i], true);
+
+        /* Enable toggles and signals the funcs wait on are rare, only look
+         * at each func when one of them woke us up */
+        if (fired & ~SIG(nrk_wakeup_signal)) {
+            for (funcp = &functions[0]; *funcp; funcp++) {
+                func = *funcp;
+                if (func->enabled != func->last_enabled ||
+                    (func->wait_mask & fired))
+                    run_func(func, false);
             }
-            LOG("sleeping for: ");
-            LOGP("%lu ms\r\n", TIME_TO_MS(sleep_time));
-            nrk_set_next_wakeup(sleep_time);
-            wait_mask |= SIG(nrk_wakeup_signal);
         }
-        LOG("waiting\r\n");
-        nrk_event_wait( wait_mask );
     }
 
     ABORT("periodic task exited\r\n");
@@ -153,6 +300,7 @@ int8_t cmd_periodic(uint8_t argc, char **argv)
 uint8_t init_periodic(uint8_t priority, periodic_func_t **funcs)
 {
     uint8_t num_tasks = 0;
+    uint8_t num_funcs;
 
     LOG("init: prio "); LOGP("%u\r\n", priority);
 
@@ -162,6 +310,12 @@ uint8_t init_periodic(uint8_t priority, periodic_func_t **funcs)
 
     functions = funcs;
 
+    num_funcs = 0;
+    while (funcs[num_funcs])
+        num_funcs++;
+    if (num_funcs > MAX_PERIODIC_FUNCS)
+        ABORT("too many periodic funcs\r\n");
+
     num_tasks++;
     PERIODIC_TASK.task = periodic_task;
     PERIODIC_TASK.Ptos = (void *) &periodic_task_stack[STACKSIZE_PERIODIC - 1];
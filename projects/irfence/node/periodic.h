@@ -7,6 +7,10 @@ typedef void periodic_func_proc_t(bool enabled,
                                   nrk_sig_mask_t *wait_mask);
 typedef int8_t periodic_func_config_t(uint8_t argc, char **argv);
 
+/* A proc sets next_event to be called again at that time. If it leaves
+ * next_event unset, funcs with a period are called again one period after
+ * the last deadline, delayed by a random 0..jitter_ms to keep nodes with
+ * the same period from waking up in lock step. */
 typedef struct {
     const char *name;
     bool enabled;
@@ -14,6 +18,13 @@ typedef struct {
     periodic_func_init_t *init;
     periodic_func_proc_t *proc;
     periodic_func_config_t *config;
+    const nrk_time_t *period;
+    uint16_t jitter_ms;
+
+    /* private to periodic.c */
+    nrk_time_t deadline;
+    int8_t heap_idx;
+    nrk_sig_mask_t wait_mask;
 } periodic_func_t;
 
 uint8_t init_periodic(uint8_t priority, periodic_func_t **funcs);
@@ -18,6 +18,13 @@ typedef struct {
     uint8_t hops;
     node_id_t path[MAX_PATH_LEN];
     uint8_t path_len;
+    uint8_t class; /* traffic_class_t */
+
+    /* A non-zero stamp_offset has the ms left until stamp_time written
+     * into buf at that offset as the pkt goes on the air */
+    uint8_t stamp_offset;
+    nrk_time_t stamp_time;
+    nrk_time_t rx_time; /* when the radio received it */
 
     /* Points into buf (after header) */
     uint8_t *payload;
@@ -19,5 +19,6 @@
 #define PORT_IRTOP 16
 #define PORT_RPC_SERVER_COMPASS 17
 #define PORT_RPC_CLIENT_COMPASS 18
+#define PORT_RPC_CLIENT_FENCE_ALARM 19
 
 #endif
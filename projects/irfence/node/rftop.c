@@ -61,8 +61,17 @@ static node_id_t route_to_origin;
 
 static node_id_t next_hops[MAX_NODES]; /* by shortest paths */
 
-/* Routing tables for *all* nodes in one matrix */
-static route_matrix_t routes;
+/* Routing table of this node from the last discovery it originated. Tables
+ * of other nodes are calculated one at a time, when sent. */
+static node_id_t routes[MAX_NODES];
+static node_id_t node_routes[MAX_NODES];
+static uint8_t node_depth[MAX_NODES]; /* hops from this node */
+
+/* Last routes chunk acked to this node */
+static nrk_sig_t routes_ack_signal;
+static node_id_t acked_node;
+static uint8_t acked_ver;
+static uint8_t acked_chunk;
 
 static pkt_t tx_pkt;
 
@@ -79,7 +88,10 @@ static void print_graph(graph *g)
     COUTA("}\r\n");
 }
 
-static void print_routes(route_matrix_t *routes)
+static int8_t calc_node_routes(graph *net_graph, node_id_t node,
+                               node_id_t *row);
+
+static void print_routes(graph *net_graph)
 {
     node_id_t src, dest;
 
@@ -89,9 +101,10 @@ static void print_routes(route_matrix_t *routes)
         OUTP("%d ", dest);
     OUT("\r\n");
     for (src = 0; src < MAX_NODES; ++src) {
+        calc_node_routes(net_graph, src, node_routes);
         OUTP("%d: ", src);
         for (dest = 0; dest < MAX_NODES; ++dest)
-            OUTP("%d ", (*routes)[src][dest]);
+            OUTP("%d ", node_routes[dest]);
         OUT("\r\n");
     }
 }
@@ -152,15 +165,41 @@ static void add_path_to_graph(pkt_t *pkt)
     }	
 }
 
-static int8_t calc_routes(graph *net_graph, route_matrix_t *route_matrix)
+/* Routing table of one node: the links are symmetric, so the next hop to
+ * each dest is the first hop on the shortest path tree rooted at the node.
+ * Leaves the tree in next_hops (as parent pointers). */
+static int8_t calc_node_routes(graph *net_graph, node_id_t node,
+                               node_id_t *row)
+{
+    node_id_t dest, hop;
+
+    dijkstra(net_graph, node, (int8_t *)next_hops); /* evil cast node_id_t */
+    for (dest = 0; dest < MAX_NODES; ++dest) {
+        hop = dest;
+        while (IS_VALID_NODE_ID(hop) && next_hops[hop] != node)
+            hop = next_hops[hop];
+        row[dest] = dest != node ? hop : INVALID_NODE_ID;
+    }
+
+    return NRK_OK;
+}
+
+static int8_t calc_routes(graph *net_graph, node_id_t *row)
 {
-    node_id_t source, dest;
+    node_id_t node, hop;
+    uint8_t depth;
 
     LOG("calc routes\r\n");
-    for (source = 0; source < MAX_NODES; ++source) {
-        dijkstra(net_graph, source, (int8_t *)next_hops); /* evil cast node_id_t */
-        for (dest = 0; dest < MAX_NODES; ++dest)
-            (*route_matrix)[dest][source] = next_hops[dest];
+
+    calc_node_routes(net_graph, this_node_id, row);
+
+    /* next_hops is now the tree rooted at this node */
+    for (node = 0; node < MAX_NODES; ++node) {
+        depth = 0;
+        for (hop = node; IS_VALID_NODE_ID(hop) && hop != this_node_id;
+             hop = next_hops[hop])
+            depth++;
+        node_depth[node] = hop == this_node_id ? depth : 0;
     }
 
     return NRK_OK;
@@ -314,29 +353,135 @@ void handle_discover_response(pkt_t *pkt)
     }
 }
 
-static int8_t broadcast_routes(route_matrix_t *route_matrix, uint8_t ver)
+static int8_t send_routes_chunk(node_id_t node, uint8_t ver, uint8_t chunk)
 {
-    uint8_t attempt = 0;
-    int8_t rc;
+    LOG("send routes: node "); LOGP("%u", node);
+    LOGA(" ver "); LOGP("%u", ver);
+    LOGA(" chunk "); LOGP("%u\r\n", chunk);
 
-    do  {
-        LOG("broadcasting routes ver: ");
-        LOGP("%u\r\n", ver);
-
-        init_pkt(&tx_pkt);
-        tx_pkt.type = PKT_TYPE_ROUTES;
-        tx_pkt.dest = BROADCAST_NODE_ID;
-        tx_pkt.payload[PKT_ROUTES_VER_OFFSET] = ver;
-        tx_pkt.len += PKT_ROUTES_VER_LEN;
-        memcpy(tx_pkt.payload + PKT_ROUTES_TABLE_OFFSET, route_matrix,
-               sizeof(route_matrix_t));
-        tx_pkt.len += sizeof(route_matrix_t);
-        rc = send_pkt(&tx_pkt, TX_FLAG_NONE, NULL);
-        if (rc != NRK_OK)
-            LOG("WARN: failed to bcast routes\r\n");
-    } while(++attempt < route_broadcast_attempts);
+    init_pkt(&tx_pkt);
+    tx_pkt.type = PKT_TYPE_ROUTES;
+    tx_pkt.dest = routes[node];
+    tx_pkt.payload[PKT_ROUTES_VER_OFFSET] = ver;
+    tx_pkt.len += PKT_ROUTES_VER_LEN;
+    tx_pkt.payload[PKT_ROUTES_ORIGIN_OFFSET] = this_node_id;
+    tx_pkt.len += PKT_ROUTES_ORIGIN_LEN;
+    tx_pkt.payload[PKT_ROUTES_NODE_OFFSET] = node;
+    tx_pkt.len += PKT_ROUTES_NODE_LEN;
+    tx_pkt.payload[PKT_ROUTES_CHUNK_OFFSET] = chunk;
+    tx_pkt.len += PKT_ROUTES_CHUNK_LEN;
+    memcpy(tx_pkt.payload + PKT_ROUTES_HOPS_OFFSET,
+           &node_routes[chunk * ROUTES_CHUNK_SIZE], PKT_ROUTES_HOPS_LEN(chunk));
+    tx_pkt.len += PKT_ROUTES_HOPS_LEN(chunk);
+    return send_pkt(&tx_pkt, TX_FLAG_NONE, NULL);
+}
 
-    return rc;
+static bool is_chunk_acked(node_id_t node, uint8_t ver, uint8_t chunk)
+{
+    return acked_node == node && acked_ver == ver && acked_chunk == chunk;
+}
+
+/* The chunk and its ack take 2 * depth B-MAC transmissions. send_pkt only
+ * queues, and each transmission can wait up to a check interval for the
+ * next check, up to another in the random pre-wait, and then sends a
+ * preamble one interval long. With an adaptive rate the interval is up
+ * to the max. */
+static int8_t wait_routes_ack(node_id_t node, uint8_t ver, uint8_t chunk)
+{
+    nrk_time_t now, deadline, timeout;
+    uint32_t check_ms, timeout_ms;
+
+    check_ms = TIME_TO_MS(bmac_rx_check_rate);
+    if (TIME_TO_MS(bmac_rx_check_max) > check_ms)
+        check_ms = TIME_TO_MS(bmac_rx_check_max);
+    timeout_ms = 2 * node_depth[node] *
+                 (3 * check_ms + ROUTES_ACK_MARGIN_PER_TX_MS);
+    MS_TO_TIME(timeout, timeout_ms);
+
+    nrk_time_get(&now);
+    nrk_time_add(&deadline, now, timeout);
+
+    while (!is_chunk_acked(node, ver, chunk)) {
+        nrk_time_get(&now);
+        if (nrk_time_sub(&timeout, deadline, now) != NRK_OK ||
+            !IS_VALID_TIME(timeout))
+            return NRK_ERROR;
+        nrk_set_next_wakeup(timeout);
+        nrk_event_wait(SIG(routes_ack_signal) | SIG(nrk_wakeup_signal));
+    }
+    return NRK_OK;
+}
+
+static int8_t send_node_routes(node_id_t node, uint8_t ver)
+{
+    uint8_t chunk, attempt;
+    int8_t rc = NRK_OK;
+
+    calc_node_routes(&network, node, node_routes);
+
+    for (chunk = 0; chunk < NUM_ROUTES_CHUNKS; ++chunk) {
+        attempt = 0;
+        do {
+            rc = send_routes_chunk(node, ver, chunk);
+            if (rc == NRK_OK)
+                rc = wait_routes_ack(node, ver, chunk);
+        } while (rc != NRK_OK && ++attempt < route_broadcast_attempts);
+
+        if (rc != NRK_OK) {
+            LOG("WARN: routes not acked: node "); LOGP("%u", node);
+            LOGA(" chunk "); LOGP("%u\r\n", chunk);
+            return rc;
+        }
+    }
+    return NRK_OK;
+}
+
+/* Nodes farther away are reached through nearer ones, which must have the
+ * new routes by then: serve nodes in order of distance */
+static int8_t distribute_routes(uint8_t ver)
+{
+    node_id_t node;
+    uint8_t depth;
+    bool more;
+    int8_t rc, status = NRK_OK;
+
+    LOG("distributing routes ver: ");
+    LOGP("%u\r\n", ver);
+
+    /* called from the discover task and from the shell */
+    rc = nrk_signal_register(routes_ack_signal);
+    if (rc == NRK_ERROR)
+        ABORT("reg sig: routes ack\r\n");
+
+    depth = 1;
+    do {
+        more = false;
+        for (node = 0; node < MAX_NODES; ++node) {
+            if (node_depth[node] < depth)
+                continue;
+            if (node_depth[node] > depth) {
+                more = true;
+                continue;
+            }
+            if (send_node_routes(node, ver) != NRK_OK)
+                status = NRK_ERROR;
+        }
+        depth++;
+    } while (more);
+
+    return status;
+}
+
+void routes_acked(node_id_t node, uint8_t ver, uint8_t chunk)
+{
+    LOG("routes acked: node "); LOGP("%u", node);
+    LOGA(" ver "); LOGP("%u", ver);
+    LOGA(" chunk "); LOGP("%u\r\n", chunk);
+
+    acked_node = node;
+    acked_ver = ver;
+    acked_chunk = chunk;
+    nrk_event_signal(routes_ack_signal);
 }
 
 static void set_state(discover_state_t new_state)
@@ -389,9 +534,9 @@ void reset_discover_state()
     set_state(DISCOVER_IDLE);
 }
 
-route_matrix_t * get_discovered_routes()
+node_id_t * get_discovered_routes()
 {
-    return &routes;
+    return routes;
 }
 
 static void discover_task ()
@@ -433,12 +578,12 @@ static void discover_task ()
 
                 print_graph(&network);
 
-                rc = calc_routes(&network, &routes);
+                rc = calc_routes(&network, routes);
                 if (rc == NRK_OK) {
-                    print_routes(&routes);
-                    rc = broadcast_routes(&routes, outstanding_seq);
+                    print_routes(&network);
+                    rc = distribute_routes(outstanding_seq);
                     if (rc != NRK_OK)
-                        LOG("WARN: failed to bcast routes\r\n");
+                        LOG("WARN: failed to distribute routes\r\n");
                 } else {
                     LOG("WARN: failed to calc routes\r\n");
                 }
@@ -532,9 +677,9 @@ int8_t cmd_calc_routes(uint8_t argc, char **argv)
 {
     int8_t rc;
     
-    rc = calc_routes(&network, &routes);
+    rc = calc_routes(&network, routes);
     if (rc == NRK_OK)
-        print_routes(&routes);
+        print_routes(&network);
     return rc;
 }
 
@@ -552,7 +697,7 @@ int8_t cmd_bc_routes(uint8_t argc, char **argv)
     else
         ver = outstanding_seq;
 
-    return broadcast_routes(&routes, ver);
+    return distribute_routes(ver);
 }
 
 uint8_t init_rftop(uint8_t priority)
@@ -565,6 +710,10 @@ uint8_t init_rftop(uint8_t priority)
     if (discover_signal == NRK_ERROR)
         ABORT("create sig: discover\r\n");
 
+    routes_ack_signal = nrk_signal_create();
+    if (routes_ack_signal == NRK_ERROR)
+        ABORT("create sig: routes ack\r\n");
+
     num_tasks++;
     DISCOVER_TASK.task = discover_task;
     DISCOVER_TASK.Ptos = (void *) &discover_task_stack[STACKSIZE_DISCOVER - 1];
@@ -20,7 +20,8 @@ int8_t discover();
 discover_state_t get_discover_state();
 void reset_discover_state();
 uint8_t get_discover_sequence();
-route_matrix_t * get_discovered_routes();
+node_id_t * get_discovered_routes();
+void routes_acked(node_id_t node, uint8_t ver, uint8_t chunk);
 
 void handle_discover_request(pkt_t *pkt);
 void handle_discover_response(pkt_t *pkt);
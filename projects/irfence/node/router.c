@@ -17,6 +17,7 @@
 #include "time.h"
 #include "rxtx.h"
 #include "output.h"
+#include "bitset.h"
 #if ENABLE_RFTOP
 #include "rftop.h"
 #endif
@@ -87,6 +88,7 @@ typedef struct {
     uint8_t attempt;
     nrk_time_t next_attempt;
     uint8_t tx_handle;
+    nrk_time_t queued;
 } tx_msg_pkt_t;
 
 typedef struct {
@@ -99,6 +101,11 @@ typedef pkt_t rx_msg_pkt_t; /* so far, rx msg pkts don't need extra fields */
 /* static */ node_id_t routes[MAX_NODES];
 static uint8_t routes_ver = 0;
 
+/* Row being received chunk by chunk, installed once complete */
+static node_id_t next_routes[MAX_NODES];
+static uint8_t next_routes_ver = 0;
+static uint8_t next_routes_chunks[BITSET_BYTES(NUM_ROUTES_CHUNKS)];
+
 static const char peers_name[] PROGMEM = "peers";
 static peer_t peers_data[MAX_PEERS];
 static node_id_t peers_ids[MAX_PEERS];
@@ -114,6 +121,8 @@ static uint8_t msg_sent_seq;
 static tx_msg_pkt_t tx_msg_queue[TX_MSG_QUEUE_SIZE];
 static nrk_sem_t *tx_msg_queue_sem;
 
+static latency_stats_t msg_latency[NUM_TRAFFIC_CLASSES];
+
 static nrk_task_type ROUTER_TASK;
 static NRK_STK router_task_stack[STACKSIZE_ROUTER];
 
@@ -211,6 +220,7 @@ static void log_queued_tx_msg(tx_msg_pkt_t *msg_pkt)
     LOG("queued msg: ");
     LOGP("%u -> %u [%u] ", msg_pkt->sender, msg_pkt->recipient, msg_pkt->seq);
     LOGF(ENUM_TO_STR(msg_pkt->state, tx_msg_state_names));
+    LOGA(" "); LOGF(ENUM_TO_STR(msg_pkt->pkt.class, traffic_class_names));
     LOGA(" tx "); LOGP("%u", msg_pkt->tx_handle);
     LOGA(" attempt "); LOGP("%u", msg_pkt->attempt);
     LOGA("\r\n");
@@ -240,28 +250,40 @@ static listener_t *lookup_listener(port_t port)
     return NULL;
 }
 
-static tx_msg_pkt_t *alloc_tx_msg_pkt()
+/* Bulk msgs leave the last few free slots to breach msgs, so that a backlog
+ * of bulk traffic (e.g. during discovery) cannot lock out an alarm. */
+static tx_msg_pkt_t *alloc_tx_msg_pkt(uint8_t class)
 {
     uint8_t i;
-    tx_msg_pkt_t *msg_pkt;
+    uint8_t free_slots = 0;
+    tx_msg_pkt_t *msg_pkt = NULL;
+
+    nrk_sem_pend(tx_msg_queue_sem);
 
     for (i = 0; i < TX_MSG_QUEUE_SIZE; ++i) {
-        msg_pkt = &tx_msg_queue[i];
+        if (tx_msg_queue[i].state == TX_MSG_STATE_INVALID) {
+            if (!msg_pkt)
+                msg_pkt = &tx_msg_queue[i];
+            free_slots++;
+        }
+    }
 
-        nrk_sem_pend(tx_msg_queue_sem);
-        if (msg_pkt->state == TX_MSG_STATE_INVALID) {
-            msg_pkt->state = TX_MSG_STATE_ALLOCED;
+    if (msg_pkt && class == TRAFFIC_CLASS_BULK &&
+        free_slots <= TX_MSG_BREACH_RESERVE)
+        msg_pkt = NULL;
 
-            if (++msg_sent_seq == 0) /* not a valid seq number */
-                ++msg_sent_seq;
+    if (msg_pkt) {
+        msg_pkt->state = TX_MSG_STATE_ALLOCED;
 
-            msg_pkt->seq = msg_sent_seq;
-            nrk_sem_post(tx_msg_queue_sem);
-            return msg_pkt;
-        }
-        nrk_sem_post(tx_msg_queue_sem);
+        if (++msg_sent_seq == 0) /* not a valid seq number */
+            ++msg_sent_seq;
+
+        msg_pkt->seq = msg_sent_seq;
+        nrk_time_get(&msg_pkt->queued);
     }
-    return NULL;
+
+    nrk_sem_post(tx_msg_queue_sem);
+    return msg_pkt;
 }
 
 static void release_tx_msg_pkt(tx_msg_pkt_t *msg_pkt)
@@ -421,6 +443,9 @@ static void handle_msg(pkt_t *pkt)
         rx_msg->sender = sender;
         rx_msg->recipient = recipient;
         rx_msg->type = type;
+        rx_msg->class = pkt->class;
+        rx_msg->rx_time = pkt->rx_time;
+        rx_msg->stamped = false;
         rx_msg->len = pkt->payload_len - PKT_MSG_HDR_LEN;
         ASSERT(rx_msg->len <= sizeof(rx_msg->payload));
         memcpy(rx_msg->payload, pkt->payload + PKT_MSG_HDR_LEN, rx_msg->len);
@@ -443,7 +468,7 @@ static void handle_msg(pkt_t *pkt)
         LOGP("%d --> %d", sender, recipient);
         LOGA(" seq "); LOGP("%u\r\n", seq);
 
-        tx_msg_pkt = alloc_tx_msg_pkt();
+        tx_msg_pkt = alloc_tx_msg_pkt(pkt->class);
         if (!tx_msg_pkt) {
             LOG("WARN: fwd msg dropped: tx msg queue full\r\n");
             print_tx_queue();
@@ -477,6 +502,8 @@ int8_t send_message(msg_t *msg)
     int8_t rc = NRK_OK;
     tx_msg_pkt_t *msg_pkt;
     pkt_t *pkt;
+    uint16_t delay_ms;
+    nrk_time_t now, delay;
 
     if (!((IS_VALID_NODE_ID(msg->recipient) ||
         msg->recipient == BROADCAST_NODE_ID) &&
@@ -485,7 +512,7 @@ int8_t send_message(msg_t *msg)
         return NRK_ERROR;
     }
 
-    msg_pkt = alloc_tx_msg_pkt();
+    msg_pkt = alloc_tx_msg_pkt(msg->class);
     if (!msg_pkt) {
         LOG("WARN: msg dropped: tx msg queue full\r\n");
         return NRK_ERROR;
@@ -498,10 +525,12 @@ int8_t send_message(msg_t *msg)
     LOG("enqueue msg:");
     LOGA(" rcp "); LOGP("%u", msg_pkt->recipient);
     LOGA(" seq "); LOGP("%u", msg_pkt->seq);
+    LOGA(" class "); LOGP("%u", msg->class);
     LOGNL();
 
     init_pkt(pkt);
     pkt->type = PKT_TYPE_MSG;
+    pkt->class = msg->class;
     pkt->payload[PKT_MSG_SENDER_OFFSET] = msg_pkt->sender;
     pkt->payload[PKT_MSG_RECIPIENT_OFFSET] = msg_pkt->recipient;
     pkt->payload[PKT_MSG_SEQ_OFFSET] = msg_pkt->seq;
@@ -512,6 +541,17 @@ int8_t send_message(msg_t *msg)
     memcpy(pkt->payload + PKT_MSG_HDR_LEN, msg->payload, msg->len);
     pkt->len += msg->len;
 
+    if (msg->stamped) {
+        ASSERT(msg->len >= 2);
+        delay_ms = msg->payload[1];
+        delay_ms <<= 8;
+        delay_ms |= msg->payload[0];
+        MS_TO_TIME(delay, delay_ms);
+        nrk_time_get(&now);
+        nrk_time_add(&pkt->stamp_time, now, delay);
+        pkt->stamp_offset = pkt->payload - pkt->buf + PKT_MSG_HDR_LEN;
+    }
+
     set_tx_msg_state(msg_pkt, TX_MSG_STATE_READY);
     nrk_event_signal(tx_msg_signal);
 
@@ -565,12 +605,11 @@ void deactivate_listener(listener_t *listener)
     listener->active = false;
 }
 
-static void set_routes(route_matrix_t *route_matrix, uint8_t ver)
+static void set_routes(node_id_t *row, uint8_t ver)
 {
     LOG("setting routes to ver "); LOGP("%d\r\n", ver);
 
-    memcpy(routes, &(*route_matrix)[this_node_id],
-           sizeof(node_id_t) * MAX_NODES);
+    memcpy(routes, row, sizeof(node_id_t) * MAX_NODES);
     routes_ver = ver;
 
     print_routes();
@@ -594,34 +633,120 @@ static int8_t do_ping(node_id_t dest, uint8_t token)
     return send_pkt(&tx_pkt, TX_FLAG_NONE, NULL);
 }
 
-static void handle_routes(pkt_t *pkt)
+/* Routes pkts travel to the node that owns the row, and acks to the origin,
+ * along the new routes of the relays */
+static void relay_routes_pkt(pkt_t *pkt, node_id_t dest)
+{
+    int8_t rc;
+
+    LOG("relay ");
+    LOGF(ENUM_TO_STR(pkt->type, pkt_names));
+    LOGA(" for "); LOGP("%u", dest);
+    LOGA(" via "); LOGP("%u\r\n", routes[dest]);
+
+    if (!IS_VALID_NODE_ID(routes[dest])) {
+        LOG("WARN: no route: "); LOGP("%u\r\n", dest);
+        return;
+    }
+
+    pkt->dest = routes[dest];
+    rc = send_pkt(pkt, TX_FLAG_NONE, NULL);
+    if (rc != NRK_OK)
+        LOG("WARN: failed to relay routes pkt\r\n");
+}
+
+static void send_routes_ack(node_id_t next_hop, node_id_t origin,
+                            uint8_t ver, uint8_t chunk)
 {
-    route_matrix_t *route_matrix;
-    uint8_t ver;
     int8_t rc;
 
+    init_pkt(&tx_pkt);
+    tx_pkt.type = PKT_TYPE_ROUTES_ACK;
+    tx_pkt.dest = next_hop;
+    tx_pkt.payload[PKT_ROUTES_ACK_VER_OFFSET] = ver;
+    tx_pkt.len += PKT_ROUTES_ACK_VER_LEN;
+    tx_pkt.payload[PKT_ROUTES_ACK_ORIGIN_OFFSET] = origin;
+    tx_pkt.len += PKT_ROUTES_ACK_ORIGIN_LEN;
+    tx_pkt.payload[PKT_ROUTES_ACK_NODE_OFFSET] = this_node_id;
+    tx_pkt.len += PKT_ROUTES_ACK_NODE_LEN;
+    tx_pkt.payload[PKT_ROUTES_ACK_CHUNK_OFFSET] = chunk;
+    tx_pkt.len += PKT_ROUTES_ACK_CHUNK_LEN;
+    rc = send_pkt(&tx_pkt, TX_FLAG_NONE, NULL);
+    if (rc != NRK_OK)
+        LOG("WARN: failed to send routes ack\r\n");
+}
+
+static void handle_routes(pkt_t *pkt)
+{
+    node_id_t origin, node;
+    uint8_t ver, chunk, i;
+
     ver = pkt->payload[PKT_ROUTES_VER_OFFSET];
+    origin = pkt->payload[PKT_ROUTES_ORIGIN_OFFSET];
+    node = pkt->payload[PKT_ROUTES_NODE_OFFSET];
+    chunk = pkt->payload[PKT_ROUTES_CHUNK_OFFSET];
 
     LOG("got routes: ver ");
-    LOGP("%d -> %d\r\n", routes_ver, ver);
+    LOGP("%d -> %d", routes_ver, ver);
+    LOGA(" node "); LOGP("%u", node);
+    LOGA(" chunk "); LOGP("%u\r\n", chunk);
+
+    if (!IS_VALID_NODE_ID(node) || !IS_VALID_NODE_ID(origin) ||
+        chunk >= NUM_ROUTES_CHUNKS ||
+        pkt->payload_len < PKT_ROUTES_HOPS_OFFSET + PKT_ROUTES_HOPS_LEN(chunk)) {
+        LOG("WARN: malformed routes pkt\r\n");
+        return;
+    }
+
+    if (node != this_node_id) {
+        relay_routes_pkt(pkt, node);
+        return;
+    }
+
+    /* Ack duplicates too: the origin resends when the ack was lost */
+    send_routes_ack(pkt->src, origin, ver, chunk);
 
     if (ver == routes_ver) {
         LOG("ignored routes pkt: up-to-date\r\n");
         return;
     }
 
-    /* Route distribution completes the discovery procedure. Reset the seq
-     * counter so that when origin reboots, pkts with the same seq number are
-     * not regarded as pkts from the old procedure. */
-    reset_discover_state();
+    if (ver != next_routes_ver) {
+        /* Route distribution completes the discovery procedure. Reset the
+         * seq counter so that when origin reboots, pkts with the same seq
+         * number are not regarded as pkts from the old procedure. */
+        reset_discover_state();
 
-    route_matrix = (route_matrix_t *)&pkt->payload[PKT_ROUTES_TABLE_OFFSET];
-    set_routes(route_matrix, ver);
+        next_routes_ver = ver;
+        BITSET_INIT(next_routes_chunks, NUM_ROUTES_CHUNKS);
+    }
 
-    pkt->dest = BROADCAST_NODE_ID;
-    rc = send_pkt(pkt, TX_FLAG_NONE, NULL);
-    if (rc != NRK_OK)
-        LOG("WARN: failed to broadcast routes\r\n");
+    memcpy(&next_routes[chunk * ROUTES_CHUNK_SIZE],
+           &pkt->payload[PKT_ROUTES_HOPS_OFFSET], PKT_ROUTES_HOPS_LEN(chunk));
+    BITSET_ADD(next_routes_chunks, chunk);
+
+    for (i = 0; i < NUM_ROUTES_CHUNKS; ++i)
+        if (!BITSET_IN(next_routes_chunks, i))
+            return;
+    set_routes(next_routes, ver);
+}
+
+static void handle_routes_ack(pkt_t *pkt)
+{
+    node_id_t origin;
+
+    origin = pkt->payload[PKT_ROUTES_ACK_ORIGIN_OFFSET];
+
+    if (origin != this_node_id) {
+        relay_routes_pkt(pkt, origin);
+        return;
+    }
+
+#if ENABLE_RFTOP
+    routes_acked(pkt->payload[PKT_ROUTES_ACK_NODE_OFFSET],
+                 pkt->payload[PKT_ROUTES_ACK_VER_OFFSET],
+                 pkt->payload[PKT_ROUTES_ACK_CHUNK_OFFSET]);
+#endif
 }
 
 static void handle_packet(pkt_t *pkt)
@@ -665,6 +790,9 @@ static void handle_packet(pkt_t *pkt)
         case PKT_TYPE_ROUTES:
             handle_routes(pkt);
             break;
+        case PKT_TYPE_ROUTES_ACK:
+            handle_routes_ack(pkt);
+            break;
         default:
             LOG("unknown pkt type");
     }
@@ -685,14 +813,19 @@ static void reap_tx_queue(nrk_time_t *next_event_time)
             if (msg_pkt->tx_handle && is_tx_done(msg_pkt->tx_handle)) {
                 if (reap_tx(msg_pkt->tx_handle)) {
                     LOG("msg tx succeeded: seq "); LOGP("%d\r\n", msg_pkt->seq);
+                    record_latency(&msg_latency[msg_pkt->pkt.class],
+                                   &msg_pkt->queued, true);
                     release_tx_msg_pkt(msg_pkt);
                 } else {
                     LOG("msg tx failed: seq "); LOGP("%d\r\n", msg_pkt->seq);
 
-                    if (msg_pkt->attempt < MAX_MSG_SEND_ATTEMPTS)
+                    if (msg_pkt->attempt < MAX_MSG_SEND_ATTEMPTS) {
                         set_tx_msg_state(msg_pkt, TX_MSG_STATE_READY);
-                    else
+                    } else {
+                        record_latency(&msg_latency[msg_pkt->pkt.class],
+                                       &msg_pkt->queued, false);
                         release_tx_msg_pkt(msg_pkt);
+                    }
 
                     if (heal_routes)
                         heal_route(msg_pkt->recipient, msg_pkt->pkt.src);
@@ -704,10 +837,13 @@ static void reap_tx_queue(nrk_time_t *next_event_time)
                     LOG("msg tx expired: ");
                     LOGA(" seq "); LOGP("%d", msg_pkt->seq); LOGNL();
 
-                    if (msg_pkt->attempt < MAX_MSG_SEND_ATTEMPTS)
+                    if (msg_pkt->attempt < MAX_MSG_SEND_ATTEMPTS) {
                         set_tx_msg_state(msg_pkt, TX_MSG_STATE_READY);
-                    else
+                    } else {
+                        record_latency(&msg_latency[msg_pkt->pkt.class],
+                                       &msg_pkt->queued, false);
                         release_tx_msg_pkt(msg_pkt);
+                    }
 
                 } else { /* not yet due for retry */
 
@@ -727,51 +863,60 @@ static void reap_tx_queue(nrk_time_t *next_event_time)
     }
 }
 
-static void process_tx_queue(nrk_time_t *next_event_time)
+static void send_tx_msg_pkt(tx_msg_pkt_t *msg_pkt, nrk_time_t *next_event_time)
 {
     int8_t rc;
-    uint8_t i;
-    tx_msg_pkt_t *msg_pkt;
     nrk_time_t now;
 
-    LOG("processing tx queue\r\n");
+    nrk_time_get(&now);
 
-    for (i = 0; i < TX_MSG_QUEUE_SIZE; ++i) {
-        msg_pkt = &tx_msg_queue[i];
-        if (msg_pkt->state == TX_MSG_STATE_READY) {
+    msg_pkt->attempt++;
+    nrk_time_add(&msg_pkt->next_attempt, now, tx_msg_retry_delay);
 
-            nrk_time_get(&now);
+    LOG("sending msg: ");
+    LOGA(" seq "); LOGP("%d", msg_pkt->seq);
+    LOGA(" attempt "); LOGP("%d", msg_pkt->attempt);
+    LOGA(" next ");
+    LOGP("%lu.%lu", msg_pkt->next_attempt.secs,
+         msg_pkt->next_attempt.nano_secs / NANOS_PER_MS);
+    LOGNL();
 
-            msg_pkt->attempt++;
-            nrk_time_add(&msg_pkt->next_attempt, now, tx_msg_retry_delay);
-
-            LOG("sending msg: ");
-            LOGA(" seq "); LOGP("%d", msg_pkt->seq);
-            LOGA(" attempt "); LOGP("%d", msg_pkt->attempt);
-            LOGA(" next ");
-            LOGP("%lu.%lu", msg_pkt->next_attempt.secs,
-                 msg_pkt->next_attempt.nano_secs / NANOS_PER_MS);
-            LOGNL();
-
-            rc = relay_msg_pkt(msg_pkt);
-            if (rc != NRK_OK) {
-                LOG("WARN: failed to relay msg pkt: seq ");
-                LOGP("%d\r\n", msg_pkt->seq);
-            }
+    rc = relay_msg_pkt(msg_pkt);
+    if (rc != NRK_OK) {
+        LOG("WARN: failed to relay msg pkt: seq ");
+        LOGP("%d\r\n", msg_pkt->seq);
+    }
 
-            /* reap loop will pick it up and promote to ready for retry */
-            set_tx_msg_state(msg_pkt, TX_MSG_STATE_SENT);
+    /* reap loop will pick it up and promote to ready for retry */
+    set_tx_msg_state(msg_pkt, TX_MSG_STATE_SENT);
 
-            if (!IS_VALID_TIME(*next_event_time) ||
-                time_cmp(&msg_pkt->next_attempt,
-                         next_event_time) < 0) {
-                *next_event_time = msg_pkt->next_attempt;
+    if (!IS_VALID_TIME(*next_event_time) ||
+        time_cmp(&msg_pkt->next_attempt,
+                 next_event_time) < 0) {
+        *next_event_time = msg_pkt->next_attempt;
 
-                LOG("updated next event time: ");
-                LOGP("%lu.%lu", next_event_time->secs,
-                     next_event_time->nano_secs / NANOS_PER_MS);
-                LOGNL();
-            }
+        LOG("updated next event time: ");
+        LOGP("%lu.%lu", next_event_time->secs,
+             next_event_time->nano_secs / NANOS_PER_MS);
+        LOGNL();
+    }
+}
+
+/* Higher classes are handed to rxtx first */
+static void process_tx_queue(nrk_time_t *next_event_time)
+{
+    uint8_t i;
+    int8_t class;
+    tx_msg_pkt_t *msg_pkt;
+
+    LOG("processing tx queue\r\n");
+
+    for (class = NUM_TRAFFIC_CLASSES - 1; class >= 0; --class) {
+        for (i = 0; i < TX_MSG_QUEUE_SIZE; ++i) {
+            msg_pkt = &tx_msg_queue[i];
+            if (msg_pkt->state == TX_MSG_STATE_READY &&
+                msg_pkt->pkt.class == class)
+                send_tx_msg_pkt(msg_pkt, next_event_time);
         }
     }
 }
@@ -780,7 +925,7 @@ static void process_tx_queue(nrk_time_t *next_event_time)
 static void process_route_discovery()
 {
     discover_state_t discover_state;
-    route_matrix_t *discovered_routes;
+    node_id_t *discovered_routes;
     uint8_t discovered_routes_ver;
 
     discover_state = get_discover_state();
@@ -929,7 +1074,7 @@ int8_t cmd_route(uint8_t argc, char **argv)
 #if ENABLE_RFTOP
 int8_t cmd_set_routes(uint8_t argc, char **argv)
 {
-    route_matrix_t *discovered_routes;
+    node_id_t *discovered_routes;
     uint8_t ver;
 
     if (!(argc == 1 || argc == 2)) {
@@ -964,6 +1109,31 @@ int8_t cmd_ping(uint8_t argc, char **argv)
     return do_ping(dest, token);
 }
 
+int8_t cmd_traffic(uint8_t argc, char **argv)
+{
+    uint8_t class;
+
+    if (argc == 2 && argv[1][0] == 'r') {
+        for (class = 0; class < NUM_TRAFFIC_CLASSES; ++class) {
+            memset(&msg_latency[class], 0, sizeof(latency_stats_t));
+            memset(get_pkt_latency(class), 0, sizeof(latency_stats_t));
+        }
+        return NRK_OK;
+    } else if (argc != 1) {
+        OUT("usage: traffic [r]\r\n");
+        return NRK_ERROR;
+    }
+
+    for (class = 0; class < NUM_TRAFFIC_CLASSES; ++class) {
+        OUTF(ENUM_TO_STR(class, traffic_class_names));
+        OUT(":\r\n\tmsg: ");
+        print_latency(&msg_latency[class]);
+        OUT("\tpkt: ");
+        print_latency(get_pkt_latency(class));
+    }
+    return NRK_OK;
+}
+
 uint8_t init_router(uint8_t priority)
 {
     uint8_t num_tasks = 0;
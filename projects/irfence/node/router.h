@@ -4,6 +4,7 @@
 #include "cfg.h"
 #include "node_id.h"
 #include "queue.h"
+#include "packets.h"
 
 typedef uint8_t port_t;
 
@@ -14,6 +15,13 @@ typedef struct {
     uint8_t type;
     uint8_t payload[MAX_MSG_SIZE];
     uint8_t len;
+    uint8_t class; /* traffic_class_t */
+
+    /* A stamped msg starts with a 16-bit ms delay, which goes on the air
+     * as the delay left at that moment (see bmac_tx_pkt_stamped_to). The
+     * recipient adds it to rx_time. Only meaningful from a neighbor. */
+    bool stamped;
+    nrk_time_t rx_time; /* when the radio received the last hop */
 } msg_t;
 
 typedef struct {
@@ -34,6 +42,7 @@ void deactivate_listener(listener_t *listener);
 int8_t cmd_route(uint8_t argc, char **argv);
 int8_t cmd_set_routes(uint8_t argc, char **argv);
 int8_t cmd_ping(uint8_t argc, char **argv);
+int8_t cmd_traffic(uint8_t argc, char **argv);
 
 /* Persistant private state: exposed only for config.c */
 extern node_id_t routes[MAX_NODES];
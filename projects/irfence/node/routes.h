@@ -4,13 +4,37 @@
 #include "cfg.h"
 #include "node_id.h"
 
-typedef node_id_t route_matrix_t[MAX_NODES][MAX_NODES];
+/* Routes are distributed by the origin of the discovery one node at a time:
+ * each node gets only its own row (next hop by destination), split into
+ * chunks of ROUTES_CHUNK_SIZE entries. The node that owns the row acks each
+ * chunk. Chunks and acks are relayed by nodes that already have the new
+ * routes, so the origin serves nodes in order of their distance. */
+
+#define NUM_ROUTES_CHUNKS ((MAX_NODES + ROUTES_CHUNK_SIZE - 1) / ROUTES_CHUNK_SIZE)
+#define ROUTES_CHUNK_LEN(chunk) \
+    (((chunk) + 1) * ROUTES_CHUNK_SIZE <= MAX_NODES ? \
+        ROUTES_CHUNK_SIZE : MAX_NODES - (chunk) * ROUTES_CHUNK_SIZE)
 
 /* Routes pkt fields (bytes): shared between router and discover modules */
 #define PKT_ROUTES_VER_OFFSET     0
 #define PKT_ROUTES_VER_LEN        1
-#define PKT_ROUTES_TABLE_OFFSET   1
-#define PKT_ROUTES_TABLE_LEN      (MAX_NODES * MAX_NODES * sizeof(node_id_t))
+#define PKT_ROUTES_ORIGIN_OFFSET  1
+#define PKT_ROUTES_ORIGIN_LEN     1
+#define PKT_ROUTES_NODE_OFFSET    2 /* owner of the row */
+#define PKT_ROUTES_NODE_LEN       1
+#define PKT_ROUTES_CHUNK_OFFSET   3
+#define PKT_ROUTES_CHUNK_LEN      1
+#define PKT_ROUTES_HOPS_OFFSET    4
+#define PKT_ROUTES_HOPS_LEN(chunk) (ROUTES_CHUNK_LEN(chunk) * sizeof(node_id_t))
 
-#endif // ROUTES_H
+/* Routes ack pkt fields (bytes) */
+#define PKT_ROUTES_ACK_VER_OFFSET     0
+#define PKT_ROUTES_ACK_VER_LEN        1
+#define PKT_ROUTES_ACK_ORIGIN_OFFSET  1
+#define PKT_ROUTES_ACK_ORIGIN_LEN     1
+#define PKT_ROUTES_ACK_NODE_OFFSET    2
+#define PKT_ROUTES_ACK_NODE_LEN       1
+#define PKT_ROUTES_ACK_CHUNK_OFFSET   3
+#define PKT_ROUTES_ACK_CHUNK_LEN      1
 
+#endif // ROUTES_H
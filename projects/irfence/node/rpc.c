@@ -5,6 +5,7 @@
 #include "output.h"
 #include "enum.h"
 #include "time.h"
+#include "config.h"
 #include "router.h"
 #include "ports.h"
 
@@ -48,11 +49,11 @@ static const char msg_names[][MAX_ENUM_NAME_LEN] PROGMEM = {
         LOGP(":%d: ", server->listener.port); \
     } while (0);
 
-#define LOG_CLT(client, svr_node, port, id) \
+#define LOG_CLT(client, svr_node, svr_port, id) \
     do { \
         LOG("client "); LOGF(client->name); \
         LOGP(":%d", client->listener.port); \
-        LOGA(": req "); LOGP("%d:%d:%d: ", svr_node, port, id); \
+        LOGA(": req "); LOGP("%d:%d:%d: ", svr_node, svr_port, id); \
     } while (0);
 
 static nrk_sig_t create_signal()
@@ -96,99 +97,202 @@ static void init_reply_msg(msg_t *msg, node_id_t recipient, uint8_t port,
     /* type set later to either REPLY or ERROR */
 }
 
-static bool listen_for_reply(rpc_client_t *client, node_id_t node,
-                             uint8_t port, uint8_t id, int8_t *rc,
-                             uint8_t *reply_buf, uint8_t *reply_len)
+typedef struct {
+    int8_t rc;
+    uint8_t *reply_buf;
+    uint8_t *reply_len;
+} sync_reply_t;
+
+typedef struct {
+    rpc_reply_handler_t *handler;
+    void *arg;
+    uint8_t replies;
+} gather_t;
+
+/* Slot index in the low bits, the call's seq above */
+#define HANDLE_SLOT_BITS 4
+#define HANDLE(slot, seq) ((rpc_handle_t)(seq) << HANDLE_SLOT_BITS | (slot))
+#define HANDLE_SLOT(handle) ((handle) & ((1 << HANDLE_SLOT_BITS) - 1))
+#define HANDLE_SEQ(handle) ((uint8_t)((handle) >> HANDLE_SLOT_BITS))
+
+static void init_client_calls(rpc_client_t *client)
+{
+    uint8_t i;
+
+    if (!client->pending) {
+        client->pending = &client->single_pending;
+        client->max_pending = 1;
+    }
+    ASSERT(client->max_pending <= 1 << HANDLE_SLOT_BITS);
+    for (i = 0; i < client->max_pending; ++i)
+        client->pending[i].node = INVALID_NODE_ID;
+    client->num_pending = 0;
+}
+
+static rpc_pending_t *lookup_call(rpc_client_t *client,
+                                  node_id_t node, uint8_t seq)
+{
+    rpc_pending_t *call;
+    uint8_t i;
+
+    for (i = 0; i < client->max_pending; ++i) {
+        call = &client->pending[i];
+        if (call->node == node && call->seq == seq)
+            return call;
+    }
+    return NULL;
+}
+
+/* The slot is freed before the handler runs, so that the handler may issue
+ * the next call */
+static void complete_call(rpc_client_t *client, rpc_pending_t *call,
+                          int8_t rc, uint8_t *reply_buf, uint8_t reply_len)
+{
+    rpc_reply_handler_t *handler = call->handler;
+    void *arg = call->arg;
+    node_id_t node = call->node;
+
+    call->node = INVALID_NODE_ID;
+    if (--client->num_pending == 0)
+        deactivate_listener(&client->listener);
+
+    if (handler)
+        handler(node, rc, reply_buf, reply_len, arg);
+}
+
+static void process_replies(rpc_client_t *client)
 {
     listener_t *listener = &client->listener;
-    bool reply_received = false;
+    rpc_pending_t *call;
     msg_t *reply_msg;
     uint8_t msg_idx;
     uint8_t reply_id, reply_seq;
-    uint8_t reply_payload_len;
-
-    *rc = NRK_ERROR;
 
-    while (!reply_received && !queue_empty(&listener->queue)) {
+    while (!queue_empty(&listener->queue)) {
         msg_idx = queue_peek(&listener->queue);
         reply_msg = &listener->queue_data[msg_idx];
-        if (reply_msg->type == MSG_TYPE_RPC_REPLY) {
-            reply_id = reply_msg->payload[MSG_RPC_ID_OFFSET];
-            reply_seq = reply_msg->payload[MSG_RPC_SEQ_OFFSET];
-            if (reply_id == id && reply_seq == client->seq) {
-                reply_received = true;
-                reply_payload_len = reply_msg->len - MSG_RPC_HEADER_LEN;
-                if (*reply_len >= reply_payload_len) {
-                    LOG_CLT(client, node, port, id);
-                    LOGA("reply: len "); LOGP("%u", reply_payload_len);
-
-                    memcpy(reply_buf,
-                           reply_msg->payload + MSG_RPC_HEADER_LEN,
-                           reply_payload_len);
-                    *reply_len = reply_payload_len;
-                    *rc = NRK_OK;
-                } else {
-                    LOG_CLT(client, node, port, id);
-                    LOGA("WARN: reply buf too small: ");
-                    LOGP("%d/%d\r\n", *reply_len, reply_payload_len);
-                }
-            } else {
-                LOG_CLT(client, node, port, id);
-                LOGA("WARN: unexpected:");
-                LOGA(" id "); LOGP("%d/%d", reply_id, id);
-                LOGA(" seq "); LOGP("%d/%d", reply_seq, client->seq);
-                LOGA("\r\n");
-            }
+        reply_id = reply_msg->payload[MSG_RPC_ID_OFFSET];
+        reply_seq = reply_msg->payload[MSG_RPC_SEQ_OFFSET];
+
+        call = lookup_call(client, reply_msg->sender, reply_seq);
+        if (!call || call->id != reply_id) {
+            LOG_CLT(client, reply_msg->sender, 0, reply_id);
+            LOGA("WARN: unexpected: seq "); LOGP("%d\r\n", reply_seq);
+        } else if (reply_msg->type == MSG_TYPE_RPC_REPLY) {
+            LOG_CLT(client, call->node, call->port, call->id);
+            LOGA("reply: len ");
+            LOGP("%u\r\n", reply_msg->len - MSG_RPC_HEADER_LEN);
+
+            complete_call(client, call, NRK_OK,
+                          reply_msg->payload + MSG_RPC_HEADER_LEN,
+                          reply_msg->len - MSG_RPC_HEADER_LEN);
         } else if (reply_msg->type == MSG_TYPE_RPC_ERROR) {
-            LOG_CLT(client, node, port, id); LOGA("error reply\r\n");
-            reply_received = true ;
+            LOG_CLT(client, call->node, call->port, call->id);
+            LOGA("error reply\r\n");
+
+            complete_call(client, call, NRK_ERROR, NULL, 0);
         } else {
-            LOG_CLT(client, node, port, id);
+            LOG_CLT(client, call->node, call->port, call->id);
             LOGA("WARN: unexpected msg type\r\n");
         }
         queue_dequeue(&listener->queue);
     }
+}
+
+static void expire_calls(rpc_client_t *client)
+{
+    rpc_pending_t *call;
+    nrk_time_t now;
+    uint8_t i;
+
+    nrk_time_get(&now);
+    for (i = 0; i < client->max_pending; ++i) {
+        call = &client->pending[i];
+        if (call->node != INVALID_NODE_ID &&
+            time_cmp(&call->deadline, &now) <= 0) {
+            LOG_CLT(client, call->node, call->port, call->id);
+            LOGA("WARN: timed out\r\n");
+
+            complete_call(client, call, NRK_ERROR, NULL, 0);
+        }
+    }
+}
 
-    return reply_received;
+static void next_deadline(rpc_client_t *client, nrk_time_t *deadline)
+{
+    rpc_pending_t *call;
+    uint8_t i;
+
+    TIME_CLEAR(*deadline);
+    for (i = 0; i < client->max_pending; ++i) {
+        call = &client->pending[i];
+        if (call->node != INVALID_NODE_ID &&
+            (!IS_VALID_TIME(*deadline) ||
+             time_cmp(&call->deadline, deadline) < 0))
+            *deadline = call->deadline;
+    }
 }
 
-static bool wait_for_reply(rpc_client_t *client,
-                           node_id_t node, uint8_t port, uint8_t id,
-                           nrk_time_t *timeout, nrk_time_t *req_time,
-                           nrk_time_t *elapsed)
+uint8_t rpc_poll(rpc_client_t *client)
 {
-    nrk_time_t now, remaining_time;
+    if (client->num_pending == 0)
+        return 0;
 
-    nrk_time_sub(&remaining_time, *timeout, *elapsed);
+    process_replies(client);
+    expire_calls(client);
+    return client->num_pending;
+}
 
-    LOG_CLT(client, node, port, id);
-    LOGA("waiting for reply: ");
-    LOGP("%lu ms\r\n", TIME_TO_MS(remaining_time));
+nrk_sig_mask_t rpc_client_wait_mask(rpc_client_t *client)
+{
+    return SIG(client->listener.signal);
+}
 
-    nrk_set_next_wakeup(remaining_time);
-    nrk_event_wait( SIG(client->listener.signal) | SIG(nrk_wakeup_signal) );
+/* Returns when the given call completed, or when no more than max_left
+ * calls are left in flight */
+static void wait_for_calls(rpc_client_t *client, rpc_handle_t handle,
+                           uint8_t max_left)
+{
+    rpc_pending_t *call = NULL;
+    uint8_t seq = 0;
+    nrk_time_t now, deadline, sleep_time;
 
-    nrk_time_get(&now);
-    nrk_time_sub(elapsed, now, *req_time);
+    if (handle != RPC_ALL_CALLS) {
+        call = &client->pending[HANDLE_SLOT(handle)];
+        seq = HANDLE_SEQ(handle);
+    }
+
+    while (rpc_poll(client) > max_left) {
+        if (call && (call->node == INVALID_NODE_ID || call->seq != seq))
+            break;
 
-    LOG_CLT(client, node, port, id);
-    LOGA("awake, elapsed: ");
-    LOGP("%lu ms\r\n", TIME_TO_MS(*elapsed));
+        next_deadline(client, &deadline);
+        nrk_time_get(&now);
+        if (time_cmp(&deadline, &now) <= 0)
+            continue;
+        nrk_time_sub(&sleep_time, deadline, now);
 
-    return time_cmp(elapsed, timeout) < 0;
+        LOG("client "); LOGF(client->name);
+        LOGA(": waiting for replies: "); LOGP("%u", client->num_pending);
+        LOGA(" max "); LOGP("%lu ms\r\n", TIME_TO_MS(sleep_time));
+
+        nrk_set_next_wakeup(sleep_time);
+        nrk_event_wait(rpc_client_wait_mask(client) | SIG(nrk_wakeup_signal));
+    }
 }
 
-int8_t rpc_call(rpc_client_t *client,
-                node_id_t node, uint8_t port, uint8_t id,
-                nrk_time_t *timeout,
-                uint8_t *req_buf, uint8_t req_len,
-                uint8_t *reply_buf, uint8_t *reply_len)
+rpc_handle_t rpc_call_async(rpc_client_t *client,
+                            node_id_t node, uint8_t port, uint8_t id,
+                            nrk_time_t *timeout,
+                            uint8_t *req_buf, uint8_t req_len,
+                            rpc_reply_handler_t *handler, void *arg)
 {
     int8_t rc;
+    uint8_t slot;
     msg_t *req_msg = &client->msg;
     listener_t *listener = &client->listener;
-    nrk_time_t req_time, elapsed = {0};
-    bool reply_received = false;
+    rpc_pending_t *call;
+    nrk_time_t now;
 
     LOG_CLT(client, node, port, id); LOGA("\r\n");
 
@@ -198,44 +302,144 @@ int8_t rpc_call(rpc_client_t *client,
         return NRK_ERROR;
     }
 
+    for (slot = 0; slot < client->max_pending; ++slot)
+        if (client->pending[slot].node == INVALID_NODE_ID)
+            break;
+    if (slot == client->max_pending) {
+        LOG_CLT(client, node, port, id);
+        LOGA("WARN: calls in flight: "); LOGP("%u\r\n", client->num_pending);
+        return NRK_ERROR;
+    }
+    call = &client->pending[slot];
+
     init_req_msg(req_msg, listener->port, node, port, id, ++(client->seq));
+    req_msg->class = client->class;
 
     ASSERT(req_len <= sizeof(req_msg->payload) - MSG_RPC_HEADER_LEN);
     memcpy(req_msg->payload + MSG_RPC_HEADER_LEN, req_buf, req_len);
     req_msg->len += req_len;
 
+    /* Listen before sending, the reply may come back quickly */
+    if (client->num_pending == 0)
+        activate_listener(listener);
+
     rc = send_message(req_msg);
     if (rc != NRK_OK) {
         LOG("WARN: failed to send rpc req msg\r\n");
+        if (client->num_pending == 0)
+            deactivate_listener(listener);
         return rc;
     }
 
-    nrk_time_get(&req_time);
+    nrk_time_get(&now);
+    nrk_time_add(&call->deadline, now, *timeout);
+    call->node = node;
+    call->port = port;
+    call->id = id;
+    call->seq = client->seq;
+    call->handler = handler;
+    call->arg = arg;
+    client->num_pending++;
+
+    return HANDLE(slot, call->seq);
+}
 
-    activate_listener(listener);
+void rpc_wait(rpc_client_t *client, rpc_handle_t handle)
+{
+    wait_for_calls(client, handle, 0);
+}
 
-    do {
-        LOG_CLT(client, node, port, id); LOGA("checking for reply\r\n");
+static void sync_reply_handler(node_id_t node, int8_t rc,
+                               uint8_t *reply_buf, uint8_t reply_len,
+                               void *arg)
+{
+    sync_reply_t *reply = arg;
 
-        reply_received = listen_for_reply(client, node, port, id,
-                                          &rc, reply_buf, reply_len);
+    if (rc == NRK_OK && reply_len > *reply->reply_len) {
+        LOG("WARN: reply buf too small: ");
+        LOGP("%d/%d\r\n", *reply->reply_len, reply_len);
+        rc = NRK_ERROR;
+    } else if (rc == NRK_OK) {
+        memcpy(reply->reply_buf, reply_buf, reply_len);
+        *reply->reply_len = reply_len;
+    }
+    reply->rc = rc;
+}
+
+int8_t rpc_call(rpc_client_t *client,
+                node_id_t node, uint8_t port, uint8_t id,
+                nrk_time_t *timeout,
+                uint8_t *req_buf, uint8_t req_len,
+                uint8_t *reply_buf, uint8_t *reply_len)
+{
+    rpc_handle_t handle;
+    sync_reply_t reply = {
+        .rc = NRK_ERROR,
+        .reply_buf = reply_buf,
+        .reply_len = reply_len,
+    };
+
+    handle = rpc_call_async(client, node, port, id, timeout, req_buf, req_len,
+                            sync_reply_handler, &reply);
+    if (handle < 0)
+        return NRK_ERROR;
 
-    } while (!reply_received && wait_for_reply(client, node, port, id,
-                                               timeout, &req_time, &elapsed));
+    rpc_wait(client, handle);
+    return reply.rc;
+}
 
-    deactivate_listener(listener);
+static void gather_reply_handler(node_id_t node, int8_t rc,
+                                 uint8_t *reply_buf, uint8_t reply_len,
+                                 void *arg)
+{
+    gather_t *gather = arg;
 
-    if (!reply_received) {
-        LOG_CLT(client, node, port, id);
-        LOGA("WARN: timed out\r\n");
-        rc = NRK_ERROR;
+    if (rc == NRK_OK)
+        gather->replies++;
+    if (gather->handler)
+        gather->handler(node, rc, reply_buf, reply_len, gather->arg);
+}
+
+uint8_t rpc_call_all(rpc_client_t *client,
+                     node_set_t nodes, uint8_t port, uint8_t id,
+                     nrk_time_t *timeout,
+                     uint8_t *req_buf, uint8_t req_len,
+                     rpc_reply_handler_t *handler, void *arg)
+{
+    node_id_t node;
+    rpc_handle_t handle;
+    gather_t gather = {
+        .handler = handler,
+        .arg = arg,
+        .replies = 0,
+    };
+
+    for (node = 0; node < MAX_NODES; ++node) {
+        if (!NODE_SET_IN(nodes, node) || node == this_node_id)
+            continue;
+
+        /* No free slot, or no room in the router's tx queue: wait for
+         * one of the calls in flight to finish and try again */
+        while ((handle = rpc_call_async(client, node, port, id, timeout,
+                                        req_buf, req_len,
+                                        gather_reply_handler, &gather)) < 0 &&
+               client->num_pending > 0)
+            wait_for_calls(client, RPC_ALL_CALLS, client->num_pending - 1);
+
+        if (handle < 0)
+            gather_reply_handler(node, NRK_ERROR, NULL, 0, &gather);
     }
 
-    return rc;
+    if (NODE_SET_IN(nodes, this_node_id) && handler)
+        handler(this_node_id, RPC_SELF, NULL, 0, arg);
+
+    rpc_wait(client, RPC_ALL_CALLS);
+    return gather.replies;
 }
 
 void rpc_init_client(rpc_client_t *client)
 {
+    init_client_calls(client);
     client->listener.signal = create_signal();
     register_listener(&client->listener);
 }
@@ -262,6 +466,8 @@ void rpc_init_endpoint(rpc_endpoint_t *endpoint)
     endpoint->server.listener.signal = signal;
     endpoint->client.listener.signal = signal;
 
+    init_client_calls(&endpoint->client);
+
     register_listener(&endpoint->server.listener);
     register_listener(&endpoint->client.listener);
 }
@@ -310,6 +516,7 @@ void rpc_serve(rpc_server_t *server)
         LOGA("\r\n");
 
         init_reply_msg(reply_msg, req_msg->sender, reply_port, id, seq);
+        reply_msg->class = req_msg->class;
 
         if (id < server->proc_count) {
             LOG_SVR(server); LOGA("calling proc "); LOGP("%d/", id);
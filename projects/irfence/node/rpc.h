@@ -11,12 +11,34 @@ typedef int8_t rpc_proc_t(node_id_t requester,
                                 uint8_t *reply_buf, uint8_t reply_size,
                                 uint8_t *reply_len);
 
+/* Called once per async call, when its reply, error reply or timeout is
+ * processed. The reply buffer is only valid until the handler returns. */
+typedef void rpc_reply_handler_t(node_id_t node, int8_t rc,
+                                 uint8_t *reply_buf, uint8_t reply_len,
+                                 void *arg);
+
+typedef struct {
+    node_id_t node; /* INVALID_NODE_ID while the slot is free */
+    uint8_t port;
+    uint8_t id;
+    uint8_t seq;
+    nrk_time_t deadline;
+    rpc_reply_handler_t *handler;
+    void *arg;
+} rpc_pending_t;
+
 typedef struct {
     const char *name; /* in prog name */
     uint8_t port;
     msg_t msg;
     listener_t listener;
     uint8_t seq;
+    uint8_t class; /* traffic class of requests, replies travel in the same */
+    /* Calls in flight: a client that leaves these unset has room for one */
+    rpc_pending_t *pending;
+    uint8_t max_pending;
+    uint8_t num_pending;
+    rpc_pending_t single_pending;
 } rpc_client_t;
 
 typedef struct {
@@ -42,6 +64,37 @@ int8_t rpc_call(rpc_client_t *client,
                 nrk_time_t *timeout,
                 uint8_t *req_buf, uint8_t req_len,
                 uint8_t *reply_buf, uint8_t *reply_len);
+
+/* Async calls: rpc_call_async returns a handle or NRK_ERROR and the result
+ * goes to the handler from rpc_poll/rpc_wait in the caller's task. A task
+ * that waits on other signals too includes rpc_client_wait_mask and calls
+ * rpc_poll when woken. The handle carries the call's seq, so waiting on a
+ * call that already completed returns even if its slot was reused. */
+typedef int16_t rpc_handle_t;
+
+#define RPC_ALL_CALLS (-1)
+
+rpc_handle_t rpc_call_async(rpc_client_t *client,
+                            node_id_t node, uint8_t port, uint8_t id,
+                            nrk_time_t *timeout,
+                            uint8_t *req_buf, uint8_t req_len,
+                            rpc_reply_handler_t *handler, void *arg);
+uint8_t rpc_poll(rpc_client_t *client);
+void rpc_wait(rpc_client_t *client, rpc_handle_t handle);
+nrk_sig_mask_t rpc_client_wait_mask(rpc_client_t *client);
+
+/* Handler rc for this node when it is in the set of rpc_call_all: it does
+ * its own part from the handler, while the calls to the others are out */
+#define RPC_SELF 2
+
+/* Same request to every node in the set, keeping up to max_pending calls in
+ * flight. Blocks until all replied or timed out, returns the reply count. */
+uint8_t rpc_call_all(rpc_client_t *client,
+                     node_set_t nodes, uint8_t port, uint8_t id,
+                     nrk_time_t *timeout,
+                     uint8_t *req_buf, uint8_t req_len,
+                     rpc_reply_handler_t *handler, void *arg);
+
 void rpc_serve(rpc_server_t *server);
 void rpc_server_loop(rpc_server_t *server);
 nrk_sig_mask_t rpc_wait_mask(rpc_server_t *server);
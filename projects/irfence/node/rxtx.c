@@ -49,6 +49,9 @@ typedef struct {
     pkt_t pkt; /* TODO: make this a pointer */
     uint8_t flags;
     tx_state_t state;
+    uint8_t attempt;
+    bool acked;
+    nrk_time_t queued;
 } tx_pkt_t;
 
 typedef pkt_t rx_pkt_t; /* so far, rx pkt does not need extra fields */
@@ -75,10 +78,6 @@ static nodelist_t neighbors = {
 static uint8_t tx_seq;
 static nrk_sem_t *tx_seq_sem;
 
-static bool tx_pkt_acked;
-static uint8_t exp_ack_seq;
-static node_id_t exp_ack_src;
-
 static nrk_sig_t tx_signal; /* a pkt was enqueued for transmission */
 static nrk_sig_t rx_signal; /* a pkt was received and enqueued for handling */
 static nrk_sig_t tx_reaped_signal; /* pkt transmission result has been picked up */
@@ -98,10 +97,25 @@ static pkt_t ack_pkt;
  *
  * Current design is to have the only consumer of rxtx be the router. So,
  * there are no concurrent send_pkts, and no concurrent handle_pkts.
+ *
+ * There is one tx queue per traffic class. The tx task always serves the
+ * highest class that has a pkt queued, and a pkt queued in a higher class
+ * preempts the retries of a pkt of a lower class: it stays at the head of
+ * its queue and resumes with its remaining attempts later.
  * */
 
-static queue_t tx_queue = { .size = TX_QUEUE_SIZE };
-static tx_pkt_t tx_queue_data[TX_QUEUE_SIZE];
+static queue_t tx_queues[NUM_TRAFFIC_CLASSES] = {
+    [TRAFFIC_CLASS_BULK] = { .size = TX_QUEUE_SIZE },
+    [TRAFFIC_CLASS_BREACH] = { .size = TX_BREACH_QUEUE_SIZE },
+};
+static tx_pkt_t tx_bulk_queue_data[TX_QUEUE_SIZE];
+static tx_pkt_t tx_breach_queue_data[TX_BREACH_QUEUE_SIZE];
+static tx_pkt_t * const tx_queues_data[NUM_TRAFFIC_CLASSES] = {
+    [TRAFFIC_CLASS_BULK] = tx_bulk_queue_data,
+    [TRAFFIC_CLASS_BREACH] = tx_breach_queue_data,
+};
+
+static latency_stats_t pkt_latency[NUM_TRAFFIC_CLASSES];
 
 static queue_t rx_queue = { .size = RX_QUEUE_SIZE };
 static rx_pkt_t rx_queue_data[RX_QUEUE_SIZE];
@@ -162,7 +176,7 @@ neighbor_t *get_neighbor(node_id_t node_id)
     return idx >= 0 ? &neighbors_data[idx] : NULL;
 }
 
-static int8_t send_buf(uint8_t *buf, uint8_t len)
+static int8_t send_buf(pkt_t *pkt, uint16_t mac)
 {
     int8_t rc;
 
@@ -170,7 +184,11 @@ static int8_t send_buf(uint8_t *buf, uint8_t len)
     pulse_led(led_sent_pkt);
 #endif
 
-    rc = bmac_tx_pkt(buf, len);
+    if (pkt->stamp_offset)
+        rc = bmac_tx_pkt_stamped_to(pkt->buf, pkt->len, mac,
+                                    pkt->stamp_offset, &pkt->stamp_time);
+    else
+        rc = bmac_tx_pkt_to(pkt->buf, pkt->len, mac);
     if(rc != NRK_OK) {
         LOG("ERROR: bmac_tx_pkt rc ");
         LOGP("%d\r\n", rc);
@@ -189,20 +207,47 @@ void init_pkt(pkt_t *pkt)
     pkt->type = 0;
 }
 
+static tx_pkt_t *tx_queue_head(uint8_t class)
+{
+    return &tx_queues_data[class][queue_peek(&tx_queues[class])];
+}
+
+/* A pkt that has been sent at least once is at the head of its queue */
+static tx_pkt_t *lookup_tx_head(uint8_t seq)
+{
+    uint8_t class;
+    tx_pkt_t *tx_pkt;
+
+    for (class = 0; class < NUM_TRAFFIC_CLASSES; ++class) {
+        if (queue_empty(&tx_queues[class]))
+            continue;
+        tx_pkt = tx_queue_head(class);
+        if (tx_pkt->pkt.seq == seq)
+            return tx_pkt;
+    }
+    return NULL;
+}
+
 /* Returns a (weak) handle for queued pkt: a seq number */
 int8_t send_pkt(pkt_t *pkt, uint8_t flags, uint8_t *seq)
 {
     uint8_t tx_pkt_idx;
     tx_pkt_t *tx_pkt;
     uint8_t handle;
+    uint8_t class;
+    queue_t *tx_queue;
 
     if (pkt->dest == pkt->src) {
         LOG("invalid pkt dest: "); LOGP("%u\r\n", pkt->dest);
         return NRK_ERROR;
     }
 
-    if (queue_full(&tx_queue)) {
-        LOG("send pkt failed: tx queue full\r\n");
+    class = pkt->class < NUM_TRAFFIC_CLASSES ? pkt->class : TRAFFIC_CLASS_BULK;
+    tx_queue = &tx_queues[class];
+
+    if (queue_full(tx_queue)) {
+        LOG("send pkt failed: tx queue full: class ");
+        LOGP("%u\r\n", class);
         return NRK_ERROR;
     }
 
@@ -215,55 +260,55 @@ int8_t send_pkt(pkt_t *pkt, uint8_t flags, uint8_t *seq)
     if (seq)
         *seq = handle;
 
-    tx_pkt_idx = queue_alloc(&tx_queue);
-    tx_pkt = &tx_queue_data[tx_pkt_idx];
+    tx_pkt_idx = queue_alloc(tx_queue);
+    tx_pkt = &tx_queues_data[class][tx_pkt_idx];
     memset(tx_pkt, 0, sizeof(tx_pkt_t));
     memcpy(&tx_pkt->pkt, pkt, sizeof(pkt_t));
     tx_pkt->flags = flags;
     tx_pkt->pkt.seq = handle;
+    tx_pkt->pkt.class = class;
+    nrk_time_get(&tx_pkt->queued);
 
     /* for the router zero means unqueued (for router) */
     ASSERT(tx_pkt->pkt.seq != 0);
 
-    queue_enqueue(&tx_queue);
+    queue_enqueue(tx_queue);
 
-    LOG("send pkt: enqueued: seq "); LOGP("%d\r\n", handle);
+    LOG("send pkt: enqueued: seq "); LOGP("%d", handle);
+    LOGA(" class "); LOGP("%u\r\n", class);
     nrk_event_signal(tx_signal);
     return NRK_OK;
 }
 
 bool is_tx_done(uint8_t seq)
 {
-    uint8_t tx_pkt_idx;
+    uint8_t class;
     tx_pkt_t *tx_pkt;
 
-    if (queue_empty(&tx_queue)) {
+    for (class = 0; class < NUM_TRAFFIC_CLASSES; ++class)
+        if (!queue_empty(&tx_queues[class]))
+            break;
+    if (class == NUM_TRAFFIC_CLASSES) {
         LOG("tx req not found: seq "); LOGP("%d\r\n", seq);
         ABORT("tx req not in tx queue\r\n");
     }
 
-    /* Completed tx can only be the one at the head */
-    tx_pkt_idx = queue_peek(&tx_queue);
-    tx_pkt = &tx_queue_data[tx_pkt_idx];
-    if (seq == tx_pkt->pkt.seq)
+    /* Completed tx can only be the one at the head of its queue */
+    tx_pkt = lookup_tx_head(seq);
+    if (tx_pkt)
         return tx_pkt->state == TX_STATE_OK || tx_pkt->state == TX_STATE_FAILED;
     return false;
 }
 
 bool reap_tx(uint8_t seq)
 {
-    uint8_t tx_pkt_idx;
     tx_pkt_t *tx_pkt;
     bool succeeded;
 
-    if (queue_empty(&tx_queue))
-        ABORT("failed to reap: tx queue empty\r\n");
-
-    tx_pkt_idx = queue_peek(&tx_queue);
-    tx_pkt = &tx_queue_data[tx_pkt_idx];
-    if (seq != tx_pkt->pkt.seq) {
-        LOG("ERROR: seq mismatch: ");
-        LOGP("%d != %d\r\n", seq, tx_pkt->pkt.seq);
+    tx_pkt = lookup_tx_head(seq);
+    if (!tx_pkt) {
+        LOG("ERROR: not at head of a tx queue: seq ");
+        LOGP("%d\r\n", seq);
         ABORT("failed to reap: seq mismatch\r\n");
     }
 
@@ -287,6 +332,7 @@ bool reap_tx(uint8_t seq)
 static int8_t tx_packet(pkt_t *pkt)
 {
     uint8_t i;
+    uint16_t mac;
 
     if (!IS_REACHEABLE(pkt->dest)) {
         LOG("dropped pkt: dest unreachable by top: ");
@@ -298,6 +344,7 @@ static int8_t tx_packet(pkt_t *pkt)
     pkt->buf[PKT_HDR_SRC_OFFSET] = this_node_id;
     pkt->buf[PKT_HDR_DEST_OFFSET] = pkt->dest;
     pkt->buf[PKT_HDR_SEQ_OFFSET] = pkt->seq;
+    pkt->buf[PKT_HDR_CLASS_OFFSET] = pkt->class;
 
     if (pkt->hops < MAX_PATH_LEN) /* otherwise: further hops are not recorded */
         pkt->buf[PKT_HDR_PATH_OFFSET + pkt->hops] = this_node_id;
@@ -314,7 +361,14 @@ static int8_t tx_packet(pkt_t *pkt)
         CLOGP(LOG_CATEGORY_RXTXDATA, "%02x ", pkt->buf[i]);
     LOGA("\r\n");
 
-    return send_buf(pkt->buf, pkt->len);
+    /* Strobes need the link-layer address of the next hop. It goes with
+     * the frame: the rcv task (acks) and the tx task send concurrently. */
+    if (bmac_strobe && pkt->dest != BROADCAST_NODE_ID)
+        mac = pkt->dest;
+    else
+        mac = 0xFFFF;
+
+    return send_buf(pkt, mac);
 }
 
 // Returns whether a received packet was available and was copied
@@ -334,30 +388,110 @@ bool receive_pkt(pkt_t *pkt)
     return true;
 }
 
+void record_latency(latency_stats_t *stats, nrk_time_t *since, bool ok)
+{
+    nrk_time_t now, elapsed;
+    uint32_t elapsed_ms;
+
+    if (!ok) {
+        stats->failed++;
+        return;
+    }
+
+    nrk_time_get(&now);
+    if (nrk_time_sub(&elapsed, now, *since) != NRK_OK)
+        elapsed.secs = elapsed.nano_secs = 0; /* clock wrapped */
+    elapsed_ms = TIME_TO_MS(elapsed);
+
+    stats->done++;
+    stats->total_ms += elapsed_ms;
+    if (elapsed_ms > stats->max_ms)
+        stats->max_ms = elapsed_ms;
+}
+
+void print_latency(latency_stats_t *stats)
+{
+    OUTP("done %u failed %u preempted %u",
+         stats->done, stats->failed, stats->preempted);
+    if (stats->done)
+        OUTP(" avg %lu max %lu ms",
+             stats->total_ms / stats->done, stats->max_ms);
+    OUT("\r\n");
+}
+
+latency_stats_t *get_pkt_latency(uint8_t class)
+{
+    ASSERT(class < NUM_TRAFFIC_CLASSES);
+    return &pkt_latency[class];
+}
+
+/* Highest class with a pkt queued, or -1 if all tx queues are empty */
+static int8_t next_tx_class()
+{
+    int8_t class;
+
+    for (class = NUM_TRAFFIC_CLASSES - 1; class >= 0; --class)
+        if (!queue_empty(&tx_queues[class]))
+            return class;
+    return -1;
+}
+
+static bool is_preempted(uint8_t class)
+{
+    return next_tx_class() > (int8_t)class;
+}
+
+/* Returns true if a pkt of a higher class cut the wait short */
+static bool wait_for_ack(tx_pkt_t *tx_pkt, uint8_t class)
+{
+    nrk_time_t now, deadline, remaining;
+
+    nrk_time_get(&now);
+    nrk_time_add(&deadline, now, pkt_ack_timeout);
+
+    while (!tx_pkt->acked) {
+        if (is_preempted(class))
+            return true;
+
+        nrk_time_get(&now);
+        if (time_cmp(&now, &deadline) >= 0)
+            break;
+        nrk_time_sub(&remaining, deadline, now);
+
+        nrk_set_next_wakeup(remaining);
+        nrk_event_wait(SIG(ack_signal) | SIG(tx_signal) |
+                       SIG(nrk_wakeup_signal));
+    }
+    return false;
+}
+
 static void process_tx_queue()
 {
-    uint8_t tx_pkt_idx;
+    int8_t class;
     tx_pkt_t *tx_pkt;
     pkt_t *pkt;
-    uint8_t attempt;
+    bool preempted;
     int8_t rc;
 
-    while (!queue_empty(&tx_queue)) {
-        tx_pkt_idx = queue_peek(&tx_queue);
-        tx_pkt = &tx_queue_data[tx_pkt_idx];
+    while ((class = next_tx_class()) >= 0) {
+        tx_pkt = tx_queue_head(class);
         pkt = &tx_pkt->pkt;
-        attempt = 0;
+        preempted = false;
+
+        /* A preempted pkt may have been acked while it waited its turn */
+        while (!tx_pkt->acked && tx_pkt->attempt < MAX_PKT_SEND_ATTEMPTS) {
+            if (is_preempted(class)) {
+                preempted = true;
+                break;
+            }
 
-        do {
             LOG("sending pkt:");
             LOGA(" dest "); LOGP("%d", pkt->dest);
-            LOGA(" attempt "); LOGP("%d", attempt);
+            LOGA(" class "); LOGP("%d", class);
+            LOGA(" attempt "); LOGP("%d", tx_pkt->attempt);
             LOGA("\r\n");
 
-            /* Tell the rcv task what ack to expect */
-            tx_pkt_acked = false;
-            exp_ack_seq = tx_pkt->pkt.seq;
-            exp_ack_src = pkt->dest;
+            tx_pkt->attempt++;
 
             rc = tx_packet(pkt);
             if (rc != NRK_OK) {
@@ -367,18 +501,26 @@ static void process_tx_queue()
 
             if (pkt->dest != BROADCAST_NODE_ID) {
                 LOG("waiting for ack: ");
-                LOGP("src %d seq %d\r\n", exp_ack_src, exp_ack_seq);
+                LOGP("src %d seq %d\r\n", pkt->dest, pkt->seq);
 
-                nrk_set_next_wakeup(pkt_ack_timeout);
-                nrk_event_wait(SIG(ack_signal) | SIG(nrk_wakeup_signal));
+                preempted = wait_for_ack(tx_pkt, class);
+                if (preempted)
+                    break;
             } else {
                 LOG("bcast packet: marking acked\r\n");
-                tx_pkt_acked = true;
+                tx_pkt->acked = true;
             }
+        }
 
-        } while (!tx_pkt_acked && ++attempt < MAX_PKT_SEND_ATTEMPTS);
+        if (preempted) {
+            LOG("tx preempted: seq "); LOGP("%d", pkt->seq);
+            LOGA(" attempt "); LOGP("%d\r\n", tx_pkt->attempt);
+            pkt_latency[class].preempted++;
+            continue;
+        }
 
-        tx_pkt->state = tx_pkt_acked ? TX_STATE_OK : TX_STATE_FAILED;
+        tx_pkt->state = tx_pkt->acked ? TX_STATE_OK : TX_STATE_FAILED;
+        record_latency(&pkt_latency[class], &tx_pkt->queued, tx_pkt->acked);
 
         LOG("tx done:");
         LOGA(" seq "); LOGP("%d ", tx_pkt->pkt.seq);
@@ -399,10 +541,30 @@ static void process_tx_queue()
         }
 
         LOG("send pkt: dequeued: seq "); LOGP("%d\r\n", tx_pkt->pkt.seq);
-        queue_dequeue(&tx_queue);
+        queue_dequeue(&tx_queues[class]);
     }
 }
 
+/* The pkt in flight, or a pkt preempted while it waited for its ack, is at
+ * the head of its queue with at least one attempt made */
+static bool credit_ack(node_id_t src, uint8_t seq)
+{
+    uint8_t class;
+    tx_pkt_t *tx_pkt;
+
+    for (class = 0; class < NUM_TRAFFIC_CLASSES; ++class) {
+        if (queue_empty(&tx_queues[class]))
+            continue;
+        tx_pkt = tx_queue_head(class);
+        if (tx_pkt->attempt > 0 && !tx_pkt->acked &&
+            tx_pkt->pkt.dest == src && tx_pkt->pkt.seq == seq) {
+            tx_pkt->acked = true;
+            return true;
+        }
+    }
+    return false;
+}
+
 static void process_rx_queue()
 {
     int8_t rc;
@@ -433,24 +595,18 @@ static void process_rx_queue()
         LOGA("\r\n");
 
         if (rx_pkt->type == PKT_TYPE_ACK) {
-            if (!tx_pkt_acked &&
-                rx_pkt->src == exp_ack_src && rx_pkt->seq == exp_ack_seq) {
+            if (credit_ack(rx_pkt->src, rx_pkt->seq)) {
 
                 LOG("pkt acked: ");
                 LOGA(" src "); LOGP("%u", rx_pkt->src);
                 LOGA(" seq "); LOGP("%u", rx_pkt->seq);
                 LOGNL();
 
-                tx_pkt_acked = true;
                 nrk_event_signal(ack_signal);
             } else {
                 LOG("WARN: unexpected ack: ");
-                if (tx_pkt_acked) {
-                    LOGA(" src "); LOGP("%u/%u ", rx_pkt->src, exp_ack_src);
-                    LOGA(" seq "); LOGP("%u/%u ", rx_pkt->seq, exp_ack_seq);
-                } else {
-                    LOGA("no pending tx");
-                }
+                LOGA(" src "); LOGP("%u", rx_pkt->src);
+                LOGA(" seq "); LOGP("%u", rx_pkt->seq);
                 LOGA("\r\n");
             }
         } else {
@@ -465,6 +621,7 @@ static void process_rx_queue()
                 ack_pkt.type = PKT_TYPE_ACK;
                 ack_pkt.dest = rx_pkt->src;
                 ack_pkt.seq = rx_pkt->seq;
+                ack_pkt.class = rx_pkt->class;
                 rc = tx_packet(&ack_pkt);
                 if (rc != NRK_OK)
                     LOG("WARN: failed to send ack\r\n");
@@ -521,6 +678,26 @@ static void rx_task ()
     if (rc == NRK_ERROR)
         ABORT("bmac_set_rx_check_rate\r\n");
 
+    /* With a max set, bmac_rx_check_rate is the fastest rate B-MAC
+     * drops to under traffic. Without strobes every pkt would carry a
+     * preamble as long as the max, which costs more than it saves. */
+    if (bmac_rx_check_max.secs || bmac_rx_check_max.nano_secs) {
+        if (!bmac_strobe) {
+            LOG("WARN: bmac_rx_check_max needs bmac_strobe\r\n");
+        } else {
+            rc = bmac_set_rx_check_rate_adaptive(bmac_rx_check_rate,
+                                                 bmac_rx_check_max);
+            if (rc == NRK_ERROR)
+                LOG("WARN: bad bmac_rx_check_max, using fixed rate\r\n");
+        }
+    }
+
+    if (bmac_strobe) {
+        rc = bmac_strobe_enable(this_node_id);
+        if (rc == NRK_ERROR)
+            ABORT("bmac_strobe_enable\r\n");
+    }
+
     rc = bmac_set_rf_power(rf_power);
     if (rc == NRK_ERROR)
         ABORT("bmac_set_rf_power\r\n");
@@ -557,6 +734,8 @@ static void rx_task ()
                 LOG("bmac_rx_pkt_get: no packet\r\n");
                 continue;
             }
+            pkt->rx_time = bmac_rfRxInfo.timestamp;
+            pkt->stamp_offset = 0; /* a relay does not restamp */
 
             if (pkt->rssi < rssi_thres) {
                 LOG("dropped pkt: below RSSI thres: ");
@@ -573,6 +752,9 @@ static void rx_task ()
             pkt->src = pkt->buf[PKT_HDR_SRC_OFFSET];
             pkt->dest = pkt->buf[PKT_HDR_DEST_OFFSET];
             pkt->type = pkt->buf[PKT_HDR_TYPE_OFFSET];
+            pkt->class = pkt->buf[PKT_HDR_CLASS_OFFSET];
+            if (pkt->class >= NUM_TRAFFIC_CLASSES)
+                pkt->class = TRAFFIC_CLASS_BULK;
 
             if (!IS_REACHEABLE(pkt->src)) {
                 LOG("dropped pkt: src unreachable by top: ");
@@ -697,6 +879,27 @@ int8_t cmd_top(uint8_t argc, char **argv)
     return NRK_OK;
 }
 
+int8_t cmd_mac(uint8_t argc, char **argv)
+{
+    nrk_time_t period;
+    uint16_t duty;
+
+    if (argc == 2 && argv[1][0] == 'r') {
+        bmac_duty_cycle_reset();
+        return NRK_OK;
+    } else if (argc != 1) {
+        OUT("usage: mac [r]\r\n");
+        return NRK_ERROR;
+    }
+
+    bmac_rx_check_rate_get(&period);
+    duty = bmac_duty_cycle_get();
+    OUTP("check rate: %lu ms\r\n", TIME_TO_MS(period));
+    OUTP("duty cycle: %u.%u%%\r\n", duty / 10, duty % 10);
+    OUTP("rx ring overflows: %u\r\n", rf_rx_ring_overflow_get());
+    return NRK_OK;
+}
+
 int8_t cmd_hood(uint8_t argc, char **argv)
 {
     uint8_t i;
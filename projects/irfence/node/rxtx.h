@@ -20,6 +20,8 @@
 #define PKT_HDR_HOPS_LEN    1
 #define PKT_HDR_PATH_OFFSET 5
 #define PKT_HDR_PATH_LEN    7
+#define PKT_HDR_CLASS_OFFSET 12
+#define PKT_HDR_CLASS_LEN    1
 
 #define PKT_HDR_LEN ( \
     PKT_HDR_TYPE_LEN + \
@@ -27,13 +29,23 @@
     PKT_HDR_DEST_LEN + \
     PKT_HDR_SEQ_LEN + \
     PKT_HDR_HOPS_LEN + \
-    PKT_HDR_PATH_LEN )
+    PKT_HDR_PATH_LEN + \
+    PKT_HDR_CLASS_LEN )
 
 typedef enum {
     TX_FLAG_NONE = 0,
     TX_FLAG_NOTIFY = 1 << 0,
 } tx_flags_t;
 
+/* Time from enqueue to completion, per traffic class */
+typedef struct {
+    uint16_t done;
+    uint16_t failed;
+    uint16_t preempted;
+    uint32_t total_ms;
+    uint32_t max_ms;
+} latency_stats_t;
+
 typedef struct {
     node_id_t id;
     nrk_time_t last_heard;
@@ -51,10 +63,15 @@ bool is_tx_done(uint8_t seq);
 bool reap_tx(uint8_t seq);
 bool receive_pkt(pkt_t *pkt);
 
+void record_latency(latency_stats_t *stats, nrk_time_t *since, bool ok);
+void print_latency(latency_stats_t *stats);
+latency_stats_t *get_pkt_latency(uint8_t class);
+
 nodelist_t *get_neighbors();
 neighbor_t *get_neighbor(node_id_t node_id);
 
 int8_t cmd_top(uint8_t argc, char **argv);
 int8_t cmd_hood(uint8_t argc, char **argv);
+int8_t cmd_mac(uint8_t argc, char **argv);
 
 #endif // RXTX_H
@@ -19,8 +19,62 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 
 
+static int8_t beacon_hash[BEACON_HASH_SIZE];
+
+static uint32_t _beacon_hash(uint32_t mac)
+{
+// Knuth multiplicative hash, MACs are mostly sequential so the
+// low bits alone would cluster
+return (mac*2654435761u)>>(32-BEACON_HASH_BITS);
+}
+
+static void _beacon_hash_build()
+{
+int i;
+uint32_t h;
+
+memset(beacon_hash,BEACON_HASH_EMPTY,sizeof(beacon_hash));
+for(i=0; i<ap_num; i++ )
+{
+  h=_beacon_hash(ap[i].mac);
+  while(beacon_hash[h]!=BEACON_HASH_EMPTY && ap[beacon_hash[h]].mac!=ap[i].mac)
+	h=(h+1)&(BEACON_HASH_SIZE-1);
+  // A duplicate entry in the file keeps the first one, which is what
+  // the old linear scan found
+  if(beacon_hash[h]==BEACON_HASH_EMPTY) beacon_hash[h]=i;
+}
+}
+
+static void _beacon_weight_build(beacon_cal_t *cal)
+{
+int i,w;
+
+// Index is the raw 8 bit RSSI, so (uint8_t)rssi looks up the weight
+for(i=0; i<BEACON_WEIGHT_ENTRIES; i++ )
+{
+  w=(int8_t)i+50+cal->rssi_offset;
+  cal->weight[i]=pow(w,3)/10;
+}
+}
+
+int loc_beacon_lookup(uint32_t mac)
+{
+uint32_t h;
+int8_t idx;
+
+h=_beacon_hash(mac);
+while((idx=beacon_hash[h])!=BEACON_HASH_EMPTY)
+{
+  if(ap[idx].mac==mac) return idx;
+  h=(h+1)&(BEACON_HASH_SIZE-1);
+}
+return -1;
+}
+
 void loc_beacon_print()
 {
 int i,j;
@@ -30,6 +84,7 @@ for(i=0; i<ap_num; i++ )
 {
 printf( "MAC:  0x%x ",ap[i].mac ); 
 printf( "Coord: %d, %d ",ap[i].x,ap[i].y);
+printf( "RSSI offset: %d ",ap_cal[i].rssi_offset);
 printf( "Desc: %s\n",ap[i].desc); 
 }
 
@@ -41,7 +96,7 @@ void loc_beacon_load(char *filename)
 FILE *fp;
 int v,entry,n;
 uint32_t mac;
-int x,y;
+int x,y,offset;
 char buf[1024];
 
 ap_num=0;
@@ -57,14 +112,26 @@ v=fscanf( fp, "%[^\n]\n", buf);
 if(v!=-1)
   {
   if(strstr(buf,"#")!=0) continue;
-  sscanf( buf,"%X, %d, %d",&mac,&x,&y );
+  if(ap_num>=MAX_BEACONS)
+	{
+	printf( "Beacon database full, ignoring: %s\n",buf );
+	continue;
+	}
+  // Calibration column is optional, old files have no offset
+  offset=0;
+  n=sscanf( buf,"%X, %d, %d, %d",&mac,&x,&y,&offset );
+  if(n<3) continue;
   ap[ap_num].mac=mac;
   ap[ap_num].x=x;
   ap[ap_num].y=y;
+  ap_cal[ap_num].rssi_offset=offset;
+  _beacon_weight_build(&ap_cal[ap_num]);
   ap_num++;
   }
 } while(v!=-1);
+fclose(fp);
 
+_beacon_hash_build();
 printf( "beacon db loaded.\n" );
 }
 
@@ -82,31 +149,26 @@ sum_w=0;
 
 if(input->num<3 && input->num>0)
 {
-for(i=0; i<ap_num; i++ )
- {
- if(ap[i].mac==input->link_mac[0] )
+ j=loc_beacon_lookup(input->link_mac[0]);
+ if(j>=0 )
   {
-   result->x=ap[i].x;
-   result->y=ap[i].y;
+   result->x=ap[j].x;
+   result->y=ap[j].y;
    return 1;
-   }
   }
 }
 
 for(i=0; i<input->num; i++ )
 {
-  for(j=0; j<ap_num; j++ )
-	{
-	if(ap[j].mac==input->link_mac[i] )
+	j=loc_beacon_lookup(input->link_mac[i]);
+	if(j>=0 )
 		{
-		w=input->rssi[i]+50;
-		w=pow(w,3)/10;
+		w=ap_cal[j].weight[(uint8_t)input->rssi[i]];
 		sum_x+=(ap[j].x*w);
 		sum_y+=(ap[j].y*w);
 		sum_w+=w;
 		cnt++;
 		}
-	}
 }
 
 if(cnt>0) {
@@ -118,3 +180,96 @@ return 0;
 }
 
 
+void loc_batch_clear(loc_batch_t *batch)
+{
+batch->num_tags=0;
+batch->num_links=0;
+batch->link_start[0]=0;
+}
+
+// Resolves the neighbor list of one tag into the batch.  Returns the
+// tag index, or -1 if the batch is full.
+int loc_batch_add(loc_batch_t *batch, nlist_t *input)
+{
+int i,j,t,l;
+
+t=batch->num_tags;
+l=batch->num_links;
+if(t>=LOC_BATCH_MAX_TAGS || l+input->num>LOC_BATCH_MAX_LINKS) return -1;
+
+batch->tag_mac[t]=input->mac;
+batch->nearest_valid[t]=0;
+if(input->num<3 && input->num>0)
+{
+ j=loc_beacon_lookup(input->link_mac[0]);
+ if(j>=0 )
+  {
+   batch->nearest_x[t]=ap[j].x;
+   batch->nearest_y[t]=ap[j].y;
+   batch->nearest_valid[t]=1;
+  }
+}
+
+for(i=0; i<input->num; i++ )
+{
+	j=loc_beacon_lookup(input->link_mac[i]);
+	if(j<0) continue;
+	batch->link_x[l]=ap[j].x;
+	batch->link_y[l]=ap[j].y;
+	batch->link_w[l]=ap_cal[j].weight[(uint8_t)input->rssi[i]];
+	l++;
+}
+
+batch->num_links=l;
+batch->num_tags=t+1;
+batch->link_start[t+1]=l;
+return t;
+}
+
+// Localizes every tag in the batch.  result[] and valid[] must hold
+// batch->num_tags entries.  Returns the number of tags located.
+int loc_beacon_centroid_batch(loc_batch_t *batch, beacon_t *result, uint8_t *valid)
+{
+int t,i,s,e,located;
+int32_t sum_x,sum_y,sum_w;
+const int32_t *restrict lx=batch->link_x;
+const int32_t *restrict ly=batch->link_y;
+const int32_t *restrict lw=batch->link_w;
+
+located=0;
+for(t=0; t<batch->num_tags; t++ )
+{
+  result[t].mac=batch->tag_mac[t];
+  if(batch->nearest_valid[t])
+  {
+	result[t].x=batch->nearest_x[t];
+	result[t].y=batch->nearest_y[t];
+	valid[t]=1;
+	located++;
+	continue;
+  }
+
+  s=batch->link_start[t];
+  e=batch->link_start[t+1];
+  sum_x=0;
+  sum_y=0;
+  sum_w=0;
+  // Plain reductions over contiguous arrays, no lookups or branches
+  for(i=s; i<e; i++ )
+  {
+	sum_x+=lx[i]*lw[i];
+	sum_y+=ly[i]*lw[i];
+	sum_w+=lw[i];
+  }
+
+  valid[t]=0;
+  if(e>s)
+  {
+	result[t].x=sum_x/((e-s)+sum_w);
+	result[t].y=sum_y/((e-s)+sum_w);
+	valid[t]=1;
+	located++;
+  }
+}
+return located;
+}
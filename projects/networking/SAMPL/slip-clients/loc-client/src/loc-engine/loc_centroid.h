@@ -23,14 +23,59 @@
 
 #define MAX_BEACONS	32 
 
+// Open addressed MAC -> ap[] index table, must be a power of 2
+// and comfortably larger than MAX_BEACONS to keep probes short
+#define BEACON_HASH_BITS	7
+#define BEACON_HASH_SIZE	(1<<BEACON_HASH_BITS)
+#define BEACON_HASH_EMPTY	-1
+
+// One weight per possible 8 bit RSSI value
+#define BEACON_WEIGHT_ENTRIES	256
+
+// Batched localization limits
+#define LOC_BATCH_MAX_TAGS	MAX_MOBILE_NODES	
+#define LOC_BATCH_MAX_LINKS	(LOC_BATCH_MAX_TAGS*MAX_NEIGHBORS)	
+
+// Per beacon calibration, the optional 4th column of the beacon file.
+// rssi_offset is added to every RSSI heard from that beacon before
+// it is turned into a weight.
+typedef struct beacon_cal
+{
+  int32_t	rssi_offset;
+  int32_t	weight[BEACON_WEIGHT_ENTRIES];
+} beacon_cal_t;
+
+// Structure-of-arrays input for loc_beacon_centroid_batch().
+// The links for tag t are link_x/y/w[link_start[t]..link_start[t+1]-1]
+// and have already been resolved to coordinates and weights, so the
+// accumulate loop only walks flat int32 arrays.
+typedef struct loc_batch
+{
+  uint16_t	num_tags;
+  uint16_t	num_links;
+  uint32_t	tag_mac[LOC_BATCH_MAX_TAGS];
+  uint16_t	link_start[LOC_BATCH_MAX_TAGS+1];
+  int32_t	nearest_x[LOC_BATCH_MAX_TAGS];
+  int32_t	nearest_y[LOC_BATCH_MAX_TAGS];
+  uint8_t	nearest_valid[LOC_BATCH_MAX_TAGS];
+  int32_t	link_x[LOC_BATCH_MAX_LINKS];
+  int32_t	link_y[LOC_BATCH_MAX_LINKS];
+  int32_t	link_w[LOC_BATCH_MAX_LINKS];
+} loc_batch_t;
 
 
 int ap_num;
 beacon_t ap[MAX_BEACONS];
+beacon_cal_t ap_cal[MAX_BEACONS];
 
 
 void loc_beacon_print();
 void loc_beacon_load(char *file_name);
+int loc_beacon_lookup(uint32_t mac);
 int loc_beacon_centroid(nlist_t *input, beacon_t *result);
 
+void loc_batch_clear(loc_batch_t *batch);
+int loc_batch_add(loc_batch_t *batch, nlist_t *input);
+int loc_beacon_centroid_batch(loc_batch_t *batch, beacon_t *result, uint8_t *valid);
+
 #endif
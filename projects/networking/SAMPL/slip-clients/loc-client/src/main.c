@@ -90,7 +90,6 @@ typedef struct seq_num_cache {
 } seq_num_cache_t;
 
 seq_num_cache_t seq_cache[SEQ_CACHE_SIZE];
-volatile RETRY_PARAMS_T retry_state;
 
 
 SAMPL_DOWNSTREAM_PKT_T ds_pkt;
@@ -142,24 +141,16 @@ void load_subscriptions (char *file)
 int tx_msg ()
 {
   int8_t v, i;
-  static uint8_t l_buf[128];
-  static uint8_t r_buf[128];
-  static uint8_t l_size;
+  uint8_t *l_buf;
+  TX_Q_ELEMENT_T *e;
+  uint32_t now;
 
-
-
-  // Check if last retry_state is done!
-  if(retry_state.cnt!=0)
-	{
-	if(time(NULL)<retry_state.next_wakeup) return 1;
-	retry_state.cnt--;
-	}
-   else l_size = tx_q_get (l_buf,&retry_state);
-
-  if(retry_state.cnt!=0)
-	{
-	retry_state.next_wakeup=time(NULL)+retry_state.timeout;
-	}
+  // Due retries come back out of the queue ahead of new packets
+  now = time (NULL);
+  e = tx_q_next (now);
+  if (e == NULL)
+    return 1;
+  l_buf = e->pkt;
 
   // Lets go in and fix the automatic transmit time parameters
   l_buf[SUBNET_MAC_2] = gw_subnet_2;
@@ -187,8 +178,9 @@ int tx_msg ()
   }
 
   do {
-    v = slipstream_acked_send (l_buf, l_size,3);
+    v = slipstream_acked_send (l_buf, e->size,3);
   } while (v == 0);
+  tx_q_sent (e, now);
 
 if (debug_txt_flag == 1)
   printf ("Gateway packet returned correctly.\n");
@@ -222,9 +214,8 @@ sleep(10);
 	void main_loop()
 #endif
 {
-  uint8_t num_script_pkts, script_index;
+  uint8_t script_index;
   uint8_t tx_buf[MAX_BUF];
-  char xml_config_file_buf[MAX_XML_FILE];
   uint8_t rx_buf[MAX_BUF];
   int32_t v, i, len;
   uint8_t nav_time_secs;
@@ -235,8 +226,7 @@ sleep(10);
   char token[64];
   char name[64];
   int slip_drop_cnt;
-  int xml_buf_size;
-  GW_SCRIPT_PKT_T gw_pkts[32];
+  static SAMPL_SCRIPT_T script;
 
 
 
@@ -294,17 +284,13 @@ if(mirror_client_enabled)
   seq_num = 0;
 
   slip_drop_cnt = 0;
-  xml_buf_size = load_xml_file (sampl_file_name, xml_config_file_buf);
-  if (xml_buf_size == -1) {
+  // build packets from xml file, rebuilt only if the file changes
+  v = sampl_script_compile (&script, sampl_file_name);
+  if (v == -1) {
     printf ("error loading config xml file: %s\n", sampl_file_name);
     exit (0);
   }
-
-  // build packet from xml file
-  num_script_pkts =
-    build_sampl_pkts_from_xml (&gw_pkts, 32, xml_config_file_buf,
-                               xml_buf_size);
-  printf ("XML script returned: %d pkts\n", num_script_pkts);
+  printf ("XML script returned: %d pkts\n", script.num_pkts);
 
   script_index = 0;
   while (1) {
@@ -325,10 +311,10 @@ if(mirror_client_enabled)
 #endif
 
     // Load next packet from script to send
-    if (gw_pkts[script_index].type == DS_PKT) {
+    if (script.pkts[script_index].type == DS_PKT) {
 
-      ds_pkt.buf = gw_pkts[script_index].pkt;
-      ds_pkt.buf_len = gw_pkts[script_index].size;
+      ds_pkt.buf = script.pkts[script_index].pkt;
+      ds_pkt.buf_len = script.pkts[script_index].size;
       unpack_downstream_packet (&ds_pkt, 0);
 
       if (debug_txt_flag == 1)
@@ -425,10 +411,10 @@ if (debug_txt_flag == 1) {
 
 
     }
-    else if (gw_pkts[script_index].type == SLEEP) {
-      printf ("Sleep Packet: %d\n", gw_pkts[script_index].nav);
+    else if (script.pkts[script_index].type == SLEEP) {
+      printf ("Sleep Packet: %d\n", script.pkts[script_index].nav);
       t = time (NULL);
-      nav_timeout = t + gw_pkts[script_index].nav;
+      nav_timeout = t + script.pkts[script_index].nav;
     }
 
 
@@ -443,7 +429,7 @@ if (debug_txt_flag == 1) {
         handle_incoming_pkt (rx_buf, v);
         // Check if TX queue has data and send the request
       }
-      if (tx_q_pending () || retry_state.cnt!=0) {
+      if (tx_q_pending () || tx_q_retries_pending ()) {
         v = tx_msg ();
         nav_timeout += 2;
         sleep (1);
@@ -468,8 +454,10 @@ if(mirror_client_enabled)
     }
 
     script_index++;
-    if (script_index == num_script_pkts)
+    if (script_index >= script.num_pkts) {
       script_index = 0;
+      sampl_script_refresh (&script);
+    }
   }
 
 
@@ -541,7 +529,6 @@ int main (int argc, char *argv[])
 
 
 
-  retry_state.cnt=0;
   log_level=ERROR_LEVEL;
   debug_txt_flag = 0;
   xmpp_flag = 1;
@@ -889,13 +876,12 @@ if (debug_txt_flag == 1)
     unpack_gateway_packet (&gw_pkt);
 
     // If the incomming packet is from the last packet in retry
-    // queue, then the message got through.  Remove retry_state
-    // to end the repeating.  
-    if(gw_pkt.src_mac==retry_state.reply_mac) 
+    // queue, then the message got through.  Cancel its remaining
+    // retries to end the repeating.  
+    if(tx_q_ack(gw_pkt.src_mac)) 
 	{
 	if (debug_txt_flag == 1)
-		printf( "Got retry reply src=%d %d\n",gw_pkt.src_mac,retry_state.reply_mac );
-	retry_state.cnt=0;
+		printf( "Got retry reply src=%d\n",gw_pkt.src_mac );
 	}
 
 
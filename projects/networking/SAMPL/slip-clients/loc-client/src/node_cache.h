@@ -3,7 +3,11 @@
 
 
 #define MAX_NODE_LEN	  32
-#define MAX_NODE_ELEMENTS 256 
+// Starting size of the node and registry hash tables, they double
+// whenever they are 3/4 full
+#define NODE_CACHE_INIT_SIZE	256
+// How often the registry file is stat()ed for changes
+#define REGISTRY_CHECK_SECONDS	5
 
 
 int reg_id_get(char *node_name,char *reg_id);
@@ -1,105 +1,270 @@
 #include <time.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include <tx_queue.h>
 
+// Packets live in a fixed slab and are handed out by pointer.  Queued
+// packets are indexed by a binary max-heap on (priority, -seq), packets
+// waiting to be retried hang off a one second timer wheel.
+static TX_Q_ELEMENT_T tx_slab[MAX_Q_LEN];
+static int16_t free_head;
+
+static int16_t tx_heap[MAX_Q_LEN];
+static uint16_t heap_len;
+static uint32_t enqueue_seq;
+
+static int16_t wheel[TX_Q_WHEEL_SLOTS];
+static uint32_t wheel_time;
+static int16_t due_head, due_tail;
+static uint16_t retry_cnt;
+
+static pthread_mutex_t tx_q_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int _tx_q_before (int16_t a, int16_t b)
+{
+  if (tx_slab[a].priority != tx_slab[b].priority)
+    return tx_slab[a].priority > tx_slab[b].priority;
+  // Signed difference so the order survives seq wrapping
+  return (int32_t) (tx_slab[a].seq - tx_slab[b].seq) < 0;
+}
+
+static void _tx_q_heap_push (int16_t e)
+{
+  int i, p;
+
+  i = heap_len++;
+  while (i > 0) {
+    p = (i - 1) / 2;
+    if (!_tx_q_before (e, tx_heap[p]))
+      break;
+    tx_heap[i] = tx_heap[p];
+    i = p;
+  }
+  tx_heap[i] = e;
+}
+
+static int16_t _tx_q_heap_pop ()
+{
+  int16_t top, last;
+  int i, c;
+
+  top = tx_heap[0];
+  last = tx_heap[--heap_len];
+  i = 0;
+  while ((c = 2 * i + 1) < heap_len) {
+    if (c + 1 < heap_len && _tx_q_before (tx_heap[c + 1], tx_heap[c]))
+      c++;
+    if (!_tx_q_before (tx_heap[c], last))
+      break;
+    tx_heap[i] = tx_heap[c];
+    i = c;
+  }
+  tx_heap[i] = last;
+  return top;
+}
+
+static void _tx_q_free (int16_t e)
+{
+  tx_slab[e].ready = TX_Q_FREE;
+  tx_slab[e].next = free_head;
+  free_head = e;
+}
+
+static void _tx_q_due_append (int16_t e)
+{
+  tx_slab[e].next = TX_Q_NONE;
+  if (due_tail == TX_Q_NONE)
+    due_head = e;
+  else
+    tx_slab[due_tail].next = e;
+  due_tail = e;
+}
+
+// Moves every retry whose wakeup has passed onto the due list
+static void _tx_q_wheel_advance (uint32_t now)
+{
+  int16_t e, next, *link;
+
+  if (retry_cnt == 0 || (int32_t) (now - wheel_time) < 0) {
+    if (retry_cnt == 0)
+      wheel_time = now;
+    return;
+  }
+  // Nothing can be scheduled more than one rotation ahead
+  if (now - wheel_time >= TX_Q_WHEEL_SLOTS)
+    wheel_time = now - (TX_Q_WHEEL_SLOTS - 1);
+
+  for (; (int32_t) (now - wheel_time) >= 0; wheel_time++) {
+    link = &wheel[wheel_time & (TX_Q_WHEEL_SLOTS - 1)];
+    for (e = *link; e != TX_Q_NONE; e = next) {
+      next = tx_slab[e].next;
+      if ((int32_t) (tx_slab[e].retry_settings.next_wakeup - now) > 0) {
+        link = &tx_slab[e].next;
+        continue;
+      }
+      *link = next;
+      if (tx_slab[e].ready == TX_Q_CANCELLED) {
+        retry_cnt--;
+        _tx_q_free (e);
+      }
+      else
+        _tx_q_due_append (e);
+    }
+  }
+}
 
 void tx_q_init (void)
 {
   int i;
-  for (i = 0; i < MAX_Q_LEN; i++)
-    tx_q[i].ready = 0;
-  q_index = 0;
+
+  pthread_mutex_lock (&tx_q_lock);
+  for (i = 0; i < MAX_Q_LEN; i++) {
+    tx_slab[i].ready = TX_Q_FREE;
+    tx_slab[i].next = i + 1 < MAX_Q_LEN ? i + 1 : TX_Q_NONE;
+  }
+  free_head = 0;
+  for (i = 0; i < TX_Q_WHEEL_SLOTS; i++)
+    wheel[i] = TX_Q_NONE;
+  heap_len = 0;
+  enqueue_seq = 0;
+  due_head = due_tail = TX_Q_NONE;
+  retry_cnt = 0;
+  wheel_time = time (NULL);
+  pthread_mutex_unlock (&tx_q_lock);
 }
 
+// Returns 1 if a packet can be sent right now
 uint8_t tx_q_pending ()
 {
-  int i;
-  for (i = 0; i < MAX_Q_LEN; i++)
-    if (tx_q[i].ready == 1)
-      return 1;
-  return 0;
+  uint8_t v;
+
+  pthread_mutex_lock (&tx_q_lock);
+  _tx_q_wheel_advance (time (NULL));
+  v = (heap_len > 0 || due_head != TX_Q_NONE);
+  pthread_mutex_unlock (&tx_q_lock);
+  return v;
 }
 
-uint8_t tx_q_get (char *msg, RETRY_PARAMS_T *retry_settings)
+// Returns 1 while any packet is still waiting for a retry or reply
+uint8_t tx_q_retries_pending ()
 {
-  int i, j, found, size;
-  int max_prio, selected_index;
+  uint8_t v;
 
-  selected_index=0;
-  max_prio=0;
-  found = 0;
-  j = q_index;
-  for (i = 0; i < MAX_Q_LEN; i++) {
-    if (tx_q[j].ready == 1) {
-      found = 1;
-      if(tx_q[j].priority>max_prio)
-	{
-      		selected_index=j;
-		max_prio=tx_q[j].priority;
-	}
+  pthread_mutex_lock (&tx_q_lock);
+  v = (retry_cnt != 0);
+  pthread_mutex_unlock (&tx_q_lock);
+  return v;
+}
+
+// Hands out the next packet to send, due retries first and then the
+// highest priority queued packet.  The caller may patch the packet in
+// place and must pass it back to tx_q_sent() once it went out.
+TX_Q_ELEMENT_T *tx_q_next (uint32_t now)
+{
+  int16_t e;
+
+  pthread_mutex_lock (&tx_q_lock);
+  _tx_q_wheel_advance (now);
+  e = TX_Q_NONE;
+  while (due_head != TX_Q_NONE) {
+    e = due_head;
+    due_head = tx_slab[e].next;
+    if (due_head == TX_Q_NONE)
+      due_tail = TX_Q_NONE;
+    retry_cnt--;
+    if (tx_slab[e].ready != TX_Q_CANCELLED)
       break;
-    }
-    j++;
-    if (j >= MAX_Q_LEN)
-      j = 0;
+    _tx_q_free (e);
+    e = TX_Q_NONE;
   }
-  
-  if (found == 0)
-    return 0;
+  if (e == TX_Q_NONE && heap_len > 0)
+    e = _tx_q_heap_pop ();
+  if (e != TX_Q_NONE)
+    tx_slab[e].ready = TX_Q_INFLIGHT;
+  pthread_mutex_unlock (&tx_q_lock);
+  return e == TX_Q_NONE ? NULL : &tx_slab[e];
+}
 
-  j=selected_index;
-// copy pkt and return size
-  size = tx_q[j].size;
-  for (i = 0; i < size; i++)
-    msg[i] = tx_q[j].pkt[i];
-  retry_settings->cnt=tx_q[j].retry_settings.cnt;
-  retry_settings->timeout=tx_q[j].retry_settings.timeout;
-  retry_settings->reply_mac=tx_q[j].retry_settings.reply_mac;
-  retry_settings->reply_seq_num=tx_q[j].retry_settings.reply_seq_num;
-  tx_q[j].ready = 0;
-  return size;
+// Either schedules the next retry of a sent packet or frees it
+void tx_q_sent (TX_Q_ELEMENT_T * elem, uint32_t now)
+{
+  int16_t e, *slot;
+
+  e = elem - tx_slab;
+  pthread_mutex_lock (&tx_q_lock);
+  if (elem->retry_settings.cnt == 0 || elem->ready == TX_Q_CANCELLED) {
+    _tx_q_free (e);
+    pthread_mutex_unlock (&tx_q_lock);
+    return;
+  }
+  elem->retry_settings.cnt--;
+  elem->retry_settings.next_wakeup = now + elem->retry_settings.timeout;
+  elem->ready = TX_Q_RETRY;
+  if (retry_cnt == 0)
+    wheel_time = now;
+  retry_cnt++;
+  // The wheel has already passed the slot of a wakeup that is due now
+  // (timeout 0), it would only be seen after a full rotation
+  if ((int32_t) (elem->retry_settings.next_wakeup - wheel_time) < 0) {
+    _tx_q_due_append (e);
+    pthread_mutex_unlock (&tx_q_lock);
+    return;
+  }
+  slot = &wheel[elem->retry_settings.next_wakeup & (TX_Q_WHEEL_SLOTS - 1)];
+  elem->next = *slot;
+  *slot = e;
+  pthread_mutex_unlock (&tx_q_lock);
 }
 
-uint8_t tx_q_add (char *msg, uint8_t size, uint8_t priority, RETRY_PARAMS_T *retry_settings)
+// A reply arrived from reply_mac, stop retrying packets waiting on it.
+// Cancelled packets are reclaimed lazily when their timer fires.
+uint8_t tx_q_ack (uint8_t reply_mac)
 {
-  int i, j, found;
+  int i;
+  uint8_t found;
 
-// Insert into FIFO queue
-  j = q_index;
   found = 0;
-  for (i = 0; i < MAX_Q_LEN; i++) {
-    if (tx_q[j].ready == 0) {
+  pthread_mutex_lock (&tx_q_lock);
+  for (i = 0; retry_cnt != 0 && i < MAX_Q_LEN; i++) {
+    if (tx_slab[i].ready == TX_Q_RETRY
+        && tx_slab[i].retry_settings.reply_mac == reply_mac) {
+      tx_slab[i].ready = TX_Q_CANCELLED;
       found = 1;
-      break;
     }
-    j++;
-    if (j >= MAX_Q_LEN)
-      j = 0;
   }
-// No room left in queue
-  if (found == 0)
+  pthread_mutex_unlock (&tx_q_lock);
+  return found;
+}
+
+uint8_t tx_q_add (char *msg, uint8_t size, uint8_t priority, RETRY_PARAMS_T *retry_settings)
+{
+  int16_t j;
+
+  if (size > sizeof (tx_slab[0].pkt))
     return 0;
 
-  for (i = 0; i < size; i++)
-    tx_q[j].pkt[i] = msg[i];
-  tx_q[j].size = size;
-  tx_q[j].priority = priority;
-  if(retry_settings==NULL)
-  {
-  tx_q[j].retry_settings.cnt=0;
-  tx_q[j].retry_settings.timeout=0;
-  tx_q[j].retry_settings.reply_mac=0;
-  tx_q[j].retry_settings.reply_seq_num=0;
-  } 
-  else{
-  tx_q[j].retry_settings.cnt=retry_settings->cnt;
-  tx_q[j].retry_settings.timeout=retry_settings->timeout;
-  tx_q[j].retry_settings.reply_mac=retry_settings->reply_mac;
-  tx_q[j].retry_settings.reply_seq_num=retry_settings->reply_seq_num;
+  pthread_mutex_lock (&tx_q_lock);
+  j = free_head;
+// No room left in queue
+  if (j == TX_Q_NONE) {
+    pthread_mutex_unlock (&tx_q_lock);
+    return 0;
   }
+  free_head = tx_slab[j].next;
 
-  tx_q[j].ready = 1;
+  memcpy (tx_slab[j].pkt, msg, size);
+  tx_slab[j].size = size;
+  tx_slab[j].priority = priority;
+  if (retry_settings == NULL)
+    memset (&tx_slab[j].retry_settings, 0, sizeof (RETRY_PARAMS_T));
+  else
+    tx_slab[j].retry_settings = *retry_settings;
+  tx_slab[j].seq = enqueue_seq++;
+  tx_slab[j].ready = TX_Q_QUEUED;
+  _tx_q_heap_push (j);
+  pthread_mutex_unlock (&tx_q_lock);
 
   return 1;
 }
@@ -0,0 +1,104 @@
+// Checks the tx queue retry timing without a radio or gateway.
+// Build and run with 'make tx_queue_test'.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <tx_queue.h>
+
+static int failures;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf ("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+static TX_Q_ELEMENT_T *add_retry (uint8_t cnt, uint8_t timeout, uint32_t now)
+{
+  RETRY_PARAMS_T r;
+  char pkt[8] = { 0 };
+
+  r.cnt = cnt;
+  r.timeout = timeout;
+  r.next_wakeup = 0;
+  r.reply_mac = 1;
+  r.reply_seq_num = 0;
+  if (!tx_q_add (pkt, sizeof (pkt), 0, &r))
+    return NULL;
+  return tx_q_next (now);
+}
+
+// A retry with timeout 0 is due at once, not after a wheel rotation.
+// Another pending retry keeps the wheel from being rewound to now.
+static void test_retry_due_now ()
+{
+  TX_Q_ELEMENT_T *e, *other;
+  uint32_t now;
+
+  tx_q_init ();
+  now = time (NULL);
+  other = add_retry (1, 60, now);
+  CHECK (other != NULL);
+  tx_q_sent (other, now);
+  CHECK (tx_q_next (now) == NULL);
+  e = add_retry (2, 0, now);
+  CHECK (e != NULL);
+  tx_q_sent (e, now);
+  CHECK (tx_q_retries_pending ());
+  CHECK (tx_q_next (now) == e);
+  tx_q_sent (e, now);
+  CHECK (tx_q_next (now) == e);
+  // Out of retries, the packet is freed
+  tx_q_sent (e, now);
+  CHECK (tx_q_next (now) == NULL);
+  CHECK (tx_q_next (now + 60) == other);
+  tx_q_sent (other, now + 60);
+  CHECK (!tx_q_retries_pending ());
+}
+
+static void test_retry_timeout ()
+{
+  TX_Q_ELEMENT_T *e;
+  uint32_t now;
+
+  tx_q_init ();
+  now = time (NULL);
+  e = add_retry (1, 3, now);
+  CHECK (e != NULL);
+  tx_q_sent (e, now);
+  CHECK (tx_q_next (now + 2) == NULL);
+  CHECK (tx_q_next (now + 3) == e);
+  tx_q_sent (e, now + 3);
+  CHECK (!tx_q_retries_pending ());
+}
+
+static void test_retry_ack ()
+{
+  TX_Q_ELEMENT_T *e;
+  uint32_t now;
+
+  tx_q_init ();
+  now = time (NULL);
+  e = add_retry (1, 0, now);
+  CHECK (e != NULL);
+  tx_q_sent (e, now);
+  CHECK (tx_q_ack (1));
+  CHECK (tx_q_next (now) == NULL);
+  CHECK (!tx_q_retries_pending ());
+}
+
+int main ()
+{
+  test_retry_due_now ();
+  test_retry_timeout ();
+  test_retry_ack ();
+  if (failures) {
+    printf ("%d checks failed\n", failures);
+    return 1;
+  }
+  printf ("tx_queue: all checks passed\n");
+  return 0;
+}
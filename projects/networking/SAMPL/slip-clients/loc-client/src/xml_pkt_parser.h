@@ -1,10 +1,12 @@
 #ifndef XML_PKT_PARSER_H_
 #define XML_PKT_PARSER_H_
 
+#include <time.h>
 #include <sampl.h>
 #include <globals.h>
 
 #define MAX_XML_FILE	4096
+#define MAX_SCRIPT_PKTS	32
 
 #define DS_PKT		0
 #define P2P_PKT		1
@@ -19,7 +21,19 @@ int size;
 uint8_t pkt[MAX_PAYLOAD];
 } GW_SCRIPT_PKT_T;
 
+// A script compiled into ready to send packets, rebuilt only when the
+// file's mtime changes
+typedef struct sampl_script
+{
+char filename[128];
+time_t mtime;
+int num_pkts;
+GW_SCRIPT_PKT_T pkts[MAX_SCRIPT_PKTS];
+} SAMPL_SCRIPT_T;
+
 int build_sampl_pkts_from_xml(GW_SCRIPT_PKT_T *pkts, int max_pkts, char *xml_buf, int size);	
 int load_xml_file(char *filename, char *xml_buf);
+int sampl_script_compile(SAMPL_SCRIPT_T *script, char *filename);
+int sampl_script_refresh(SAMPL_SCRIPT_T *script);
 
 #endif
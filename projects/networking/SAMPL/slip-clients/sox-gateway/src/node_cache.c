@@ -1,35 +1,227 @@
 #include <node_cache.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <globals.h>
 
-char nodeIDs[MAX_NODE_ELEMENTS][MAX_NODE_LEN];
-char registry_id[MAX_NODE_ELEMENTS][MAX_NODE_LEN];
+typedef struct str_entry {
+  uint32_t hash;
+  char *key;
+  char *value;
+} str_entry_t;
 
-uint8_t node_id_cnt;
+// Open addressed string table, size is always a power of 2
+typedef struct str_table {
+  str_entry_t *slots;
+  uint32_t size;
+  uint32_t count;
+} str_table_t;
 
-void node_list_init ()
+// Names of nodes created this run
+static str_table_t node_table;
+
+// Snapshot of the registry file, replaced as a whole on reload so that
+// readers never see a half loaded table
+static str_table_t *registry_table;
+static time_t registry_mtime;
+static time_t registry_checked;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t _str_hash (const char *s)
+{
+  uint32_t h = 2166136261u;
+
+  while (*s != '\0') {
+    h ^= (uint8_t) * s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int _str_table_init (str_table_t * t, uint32_t size)
+{
+  t->slots = calloc (size, sizeof (str_entry_t));
+  if (t->slots == NULL)
+    return 0;
+  t->size = size;
+  t->count = 0;
+  return 1;
+}
+
+static void _str_table_free (str_table_t * t)
+{
+  uint32_t i;
+
+  for (i = 0; i < t->size; i++) {
+    free (t->slots[i].key);
+    free (t->slots[i].value);
+  }
+  free (t->slots);
+  t->slots = NULL;
+  t->size = 0;
+  t->count = 0;
+}
+
+static str_entry_t *_str_table_slot (str_table_t * t, const char *key,
+                                     uint32_t hash)
+{
+  uint32_t i;
+
+  i = hash & (t->size - 1);
+  while (t->slots[i].key != NULL) {
+    if (t->slots[i].hash == hash && strcmp (t->slots[i].key, key) == 0)
+      return &t->slots[i];
+    i = (i + 1) & (t->size - 1);
+  }
+  return &t->slots[i];
+}
+
+static str_entry_t *_str_table_find (str_table_t * t, const char *key)
+{
+  str_entry_t *e;
+
+  if (t == NULL || t->size == 0)
+    return NULL;
+  e = _str_table_slot (t, key, _str_hash (key));
+  if (e->key == NULL)
+    return NULL;
+  return e;
+}
+
+static int _str_table_grow (str_table_t * t)
+{
+  str_table_t n;
+  str_entry_t *e;
+  uint32_t i;
+
+  if (_str_table_init (&n, t->size * 2) == 0)
+    return 0;
+  for (i = 0; i < t->size; i++) {
+    if (t->slots[i].key == NULL)
+      continue;
+    e = _str_table_slot (&n, t->slots[i].key, t->slots[i].hash);
+    *e = t->slots[i];
+    n.count++;
+  }
+  free (t->slots);
+  *t = n;
+  return 1;
+}
+
+// Interns key (and replaces value) in the table, growing it at 3/4 load
+static str_entry_t *_str_table_put (str_table_t * t, const char *key,
+                                    const char *value)
+{
+  str_entry_t *e;
+  uint32_t hash;
+  char *v = NULL;
+
+  if ((t->count + 1) * 4 > t->size * 3 && _str_table_grow (t) == 0)
+    return NULL;
+  if (value != NULL && (v = strdup (value)) == NULL)
+    return NULL;
+  hash = _str_hash (key);
+  e = _str_table_slot (t, key, hash);
+  if (e->key == NULL) {
+    e->key = strdup (key);
+    if (e->key == NULL) {
+      free (v);
+      return NULL;
+    }
+    e->hash = hash;
+    t->count++;
+  }
+  free (e->value);
+  e->value = v;
+  return e;
+}
+
+static str_table_t *_registry_load (char *file_name)
+{
+  FILE *fp;
+  str_table_t *t;
+  char name[MAX_NODE_LEN], reg[MAX_NODE_LEN];
+
+  fp = fopen (file_name, "r");
+  if (fp == NULL) {
+    printf ("no registry file: \"%s\"\n", file_name);
+    return NULL;
+  }
+  t = malloc (sizeof (str_table_t));
+  if (t == NULL || _str_table_init (t, NODE_CACHE_INIT_SIZE) == 0) {
+    free (t);
+    fclose (fp);
+    return NULL;
+  }
+  while (fscanf (fp, "%31s %31s\n", name, reg) == 2) {
+    if (_str_table_put (t, name, reg) == NULL) {
+      _str_table_free (t);
+      free (t);
+      fclose (fp);
+      return NULL;
+    }
+  }
+  fclose (fp);
+  if (debug_txt_flag == 1)
+    printf ("Registry loaded %d entries from %s\n", t->count, file_name);
+  return t;
+}
+
+// Reloads the registry if the file changed since it was last read.  The
+// file is stat()ed at most once every REGISTRY_CHECK_SECONDS.
+static void _registry_check ()
 {
-  int i;
-  node_id_cnt = 0;
-  for (i = 0; i < MAX_NODE_ELEMENTS; i++) {
-    nodeIDs[i][0] = '\0';
-    registry_id[i][0] = '\0';
+  struct stat st;
+  str_table_t *t, *old;
+  time_t now;
+
+  now = time (NULL);
+  pthread_mutex_lock (&registry_lock);
+  if (registry_table != NULL && now - registry_checked < REGISTRY_CHECK_SECONDS) {
+    pthread_mutex_unlock (&registry_lock);
+    return;
   }
+  registry_checked = now;
+  if (stat (registry_file_name, &st) != 0
+      || (registry_table != NULL && st.st_mtime == registry_mtime)) {
+    pthread_mutex_unlock (&registry_lock);
+    return;
+  }
+  pthread_mutex_unlock (&registry_lock);
+
+  // Parse outside the lock, then swap the finished table in
+  t = _registry_load (registry_file_name);
+  if (t == NULL)
+    return;
+  pthread_mutex_lock (&registry_lock);
+  old = registry_table;
+  registry_table = t;
+  registry_mtime = st.st_mtime;
+  pthread_mutex_unlock (&registry_lock);
+  if (old != NULL) {
+    _str_table_free (old);
+    free (old);
+  }
+}
+
+void node_list_init ()
+{
+  if (node_table.slots != NULL)
+    _str_table_free (&node_table);
+  _str_table_init (&node_table, NODE_CACHE_INIT_SIZE);
+  _registry_check ();
 }
 
 
 int node_list_exists (char *name)
 {
-  int i;
   if(debug_txt_flag==1 ) 
-			printf ("node_id_cnt=%d\n", node_id_cnt);
-  for (i = 0; i < node_id_cnt; i++)
-    if (strcmp (name, nodeIDs[i]) == 0)
-      return 1;
-  return 0;
+			printf ("node_id_cnt=%d\n", node_table.count);
+  return _str_table_find (&node_table, name) != NULL;
 }
 
 int node_list_add (char *name)
@@ -37,71 +229,54 @@ int node_list_add (char *name)
 
   if(debug_txt_flag==1 ) 
   printf ("Trying to add %s to node cache\n", name);
-  if (node_id_cnt < MAX_NODE_ELEMENTS) {
-    strcpy (nodeIDs[node_id_cnt], name);
-    node_id_cnt++;
-    return 1;
-  }
-  else {
-  if(debug_txt_flag==1 ) 
-    printf ("can't add %s, cache full\n", name);
-    exit (0);
+  if (node_table.slots == NULL
+      && _str_table_init (&node_table, NODE_CACHE_INIT_SIZE) == 0)
+    return 0;
+  if (_str_table_put (&node_table, name, NULL) == NULL) {
+    if(debug_txt_flag==1 ) printf ("can't add %s, out of memory\n", name);
+    return 0;
   }
-
-  return 0;
+  return 1;
 }
 
 int reg_id_get (char *node_name, char *reg_id)
 {
-  int i;
+  str_entry_t *e;
 
   if(debug_txt_flag==1 ) 
   printf ("searching for in cache: %s\n", node_name);
-  for (i = 0; i < node_id_cnt; i++) {
-    if (strcmp (nodeIDs[i], node_name) == 0 && *registry_id[i] != NULL) {
-  if(debug_txt_flag==1 ) printf ("found reg id for %s\n", nodeIDs[i]);
-      strcpy (reg_id, registry_id[i]);
-      return 1;
-    }
-
+  if (node_list_exists (node_name) == 0) {
+    if(debug_txt_flag==1 ) printf ("registry node not found\n");
+    return 0;
+  }
+  _registry_check ();
+  pthread_mutex_lock (&registry_lock);
+  e = _str_table_find (registry_table, node_name);
+  if (e != NULL) {
+    if(debug_txt_flag==1 ) printf ("found reg id for %s\n", node_name);
+    strcpy (reg_id, e->value);
   }
+  pthread_mutex_unlock (&registry_lock);
+  if (e != NULL)
+    return 1;
   if(debug_txt_flag==1 ) 
   	printf ("registry node not found\n");
   return 0;
 }
 
+// Kept for callers that used to trigger a file scan; the registry is
+// now held in memory and only reread when the file changes.
 int reg_id_load_from_file (char *node_name)
 {
-  FILE *fp;
-  char name[32], reg[32];
-  int val, i;
+  int found;
 
-  fp = fopen (registry_file_name, "r");
-  if (fp == NULL) {
-    printf ("no registry file: \"%s\"\n", registry_file_name);
-    return 0;
-  }
-  if(debug_txt_flag==1 ) 
-  printf ("Registry Open search for %s\n", node_name);
-  do {
-    val = fscanf (fp, "%s %s\n", name, reg);
-//  printf( "scanning reg file %s, %s val=%d\n",name,reg,val );
-    if (strcmp (name, node_name) == 0) {
-      for (i = 0; i < node_id_cnt; i++) {
-        if (strcmp (node_name, nodeIDs[i]) == 0) {
-          // found node in list from file
-          strcpy (registry_id[i], reg);
-  				if(debug_txt_flag==1 ) 
-             printf ("Adding reg id <%s> to event node <%s>\n", registry_id[i],
-                  nodeIDs[i]);
-          fclose (fp);
-          return 1;
-        }
-      }
-    }
-  } while (val > 0);
-  fclose (fp);
-  return 0;
+  _registry_check ();
+  pthread_mutex_lock (&registry_lock);
+  found = _str_table_find (registry_table, node_name) != NULL;
+  pthread_mutex_unlock (&registry_lock);
+  if (found && debug_txt_flag == 1)
+    printf ("Registry has reg id for event node <%s>\n", node_name);
+  return found;
 }
 
 void check_and_create_node (char *node_name)
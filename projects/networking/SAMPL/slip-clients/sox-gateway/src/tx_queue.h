@@ -4,7 +4,20 @@
 #include <stdint.h>
 
 
-#define MAX_Q_LEN	10
+#define MAX_Q_LEN	64
+
+// Retry timer wheel, one slot per second.  Must be a power of 2 and
+// larger than the biggest retry timeout (uint8_t seconds).
+#define TX_Q_WHEEL_SLOTS	256
+
+#define TX_Q_NONE	-1
+
+// Element states
+#define TX_Q_FREE	0
+#define TX_Q_QUEUED	1
+#define TX_Q_INFLIGHT	2
+#define TX_Q_RETRY	3
+#define TX_Q_CANCELLED	4
 
 typedef struct retry_params {
   uint8_t  cnt;
@@ -21,14 +34,17 @@ typedef struct queue_element {
   // Higher number is a higher priority
   uint8_t priority;
   RETRY_PARAMS_T retry_settings;
+  // Enqueue order, keeps equal priorities FIFO
+  uint32_t seq;
+  // Free list or timer wheel link
+  int16_t next;
 } TX_Q_ELEMENT_T;
 
-uint8_t q_index;
-
-TX_Q_ELEMENT_T tx_q[MAX_Q_LEN];
-
 void tx_q_init(void);
 uint8_t tx_q_pending();
-uint8_t tx_q_get(char *msg, RETRY_PARAMS_T *retry_settings);
+uint8_t tx_q_retries_pending();
+TX_Q_ELEMENT_T *tx_q_next(uint32_t now);
+void tx_q_sent(TX_Q_ELEMENT_T *e, uint32_t now);
+uint8_t tx_q_ack(uint8_t reply_mac);
 uint8_t tx_q_add(char *msg, uint8_t size, uint8_t priority, RETRY_PARAMS_T *retry_settings);
 #endif
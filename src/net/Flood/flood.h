@@ -0,0 +1,105 @@
+/******************************************************************************
+*  Nano-RK, a real-time operating system for sensor networks.
+*  Copyright (C) 2007, Real-Time and Multimedia Lab, Carnegie Mellon University
+*  All rights reserved.
+*
+*  This is the Open Source Version of Nano-RK included as part of a Dual
+*  Licensing Model. If you are unsure which license to use please refer to:
+*  http://www.nanork.org/nano-RK/wiki/Licensing
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, version 2.0 of the License.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*******************************************************************************/
+
+
+#ifndef _FLOOD_H
+#define _FLOOD_H
+#include <include.h>
+#include <basic_rf.h>
+#include <nrk.h>
+
+/************************************************************************
+
+Flood is a network wide broadcast built on concurrent transmissions
+(Glossy).  When a node receives a flood packet, the radio driver relays
+it from the RX_END interrupt a fixed time after the frame ended.  Every
+node that heard the same frame relays it at the same moment with the
+same bits, so the copies interfere constructively and the next ring of
+nodes receives them as one frame.  A packet crosses the network one hop
+per frame time, without carrier sense or backoff.
+
+Each node sends a flood at most max_tx times (flood_set_max_tx(), set by
+the initiator and carried in the packet), then stays quiet.  The packet
+carries a relay counter that every relay increments.  A receiver uses it
+in flood_ref_time_get() to compute when the initiator started, which
+gives all nodes a common time reference from a single flood.
+
+Only one node may initiate a flood at a time.  Two floods on the air at
+once collide everywhere they meet.  The radio stays in receive mode
+while flooding is active, there is no duty cycling.
+
+The service has no task.  Received floods are queued by the radio driver
+and handed out one at a time through flood_rx_pkt_get(), the buffer
+stays valid until flood_rx_pkt_release().
+
+************************************************************************/
+
+// Payload header behind the driver's glossy header
+#define FLOOD_HDR_SRC		RF_GLOSSY_HDR_SIZE	// initiator, 2 bytes
+#define FLOOD_HDR_SIZE		(RF_GLOSSY_HDR_SIZE + 2)
+
+#define FLOOD_MAX_PKT_SIZE	(RF_MAX_PAYLOAD_SIZE - FLOOD_HDR_SIZE)
+#define FLOOD_DEFAULT_MAX_TX	3
+
+// Time from the end of a received frame of psdu_len bytes (MAC header,
+// payload and FCS) to the start of its relay.  The transceiver part is
+// the RX_AACK_ON to PLL_ON (1us) and PLL_ON to BUSY_TX (16us) transition
+// times from the datasheet.  The CPU part is counted in cycles from the
+// avr-gcc -Os listing of basic_rf.c: interrupt entry and the header
+// checks in _rf_glossy_rx() up to the byte shift, then the shift loop,
+// which moves psdu_len - 2 bytes.  Recount them after changing the RX_END
+// path.
+#ifndef FLOOD_CPU_MHZ
+#define FLOOD_CPU_MHZ			16
+#endif
+#define FLOOD_TURNAROUND_US		(1 + 16)
+#define FLOOD_RX_END_CYCLES		100
+#define FLOOD_SHIFT_BYTE_CYCLES		7
+#define FLOOD_RELAY_DELAY_US(psdu_len) \
+	(FLOOD_TURNAROUND_US + (FLOOD_RX_END_CYCLES \
+	+ FLOOD_SHIFT_BYTE_CYCLES * ((psdu_len) - 2)) / FLOOD_CPU_MHZ)
+
+// Preamble, SFD and PHR sent in front of every frame.  The driver
+// timestamps a received frame at its SFD, the first FLOOD_SFD_BYTES in.
+#define FLOOD_PHY_OVERHEAD	6
+#define FLOOD_SFD_BYTES		5
+#define FLOOD_BYTE_US		32
+
+int8_t flood_init(uint8_t chan, uint16_t my_addr);
+int8_t flood_set_max_tx(uint8_t max_tx);
+int8_t flood_send(uint8_t *buf, uint8_t len);
+
+int8_t flood_rx_on();
+int8_t flood_rx_off();
+
+int8_t flood_rx_pkt_ready();
+uint8_t *flood_rx_pkt_get(uint8_t *len, int8_t *rssi);
+int8_t flood_rx_pkt_release();
+int8_t flood_wait_until_rx_pkt();
+
+// Details of the packet returned by flood_rx_pkt_get()
+uint16_t flood_rx_src_get();
+uint8_t flood_rx_relay_cnt_get();
+int8_t flood_ref_time_get(nrk_time_t *t);
+
+#endif
@@ -0,0 +1,228 @@
+/******************************************************************************
+*  Nano-RK, a real-time operating system for sensor networks.
+*  Copyright (C) 2007, Real-Time and Multimedia Lab, Carnegie Mellon University
+*  All rights reserved.
+*
+*  This is the Open Source Version of Nano-RK included as part of a Dual
+*  Licensing Model. If you are unsure which license to use please refer to:
+*  http://www.nanork.org/nano-RK/wiki/Licensing
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, version 2.0 of the License.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*******************************************************************************/
+
+
+#include <include.h>
+#include <ulib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <nrk.h>
+#include <nrk_events.h>
+#include <nrk_timer.h>
+#include <nrk_error.h>
+#include <flood.h>
+#include <nrk_cfg.h>
+
+static RF_RX_INFO flood_rfRxInfo;
+static RF_TX_INFO flood_rfTxInfo;
+
+static uint8_t flood_rx_buf[RF_MAX_PAYLOAD_SIZE];
+static uint8_t flood_tx_buf[RF_MAX_PAYLOAD_SIZE];
+
+static uint8_t flood_running;
+static uint8_t rx_buf_full;
+static uint8_t flood_max_tx;
+static uint16_t flood_my_addr;
+
+static nrk_sig_t flood_rx_pkt_signal;
+
+static void _flood_rx_end ();
+
+int8_t flood_init (uint8_t chan, uint16_t my_addr)
+{
+  flood_running = 0;
+  rx_buf_full = 0;
+  flood_max_tx = FLOOD_DEFAULT_MAX_TX;
+  flood_my_addr = my_addr;
+
+  flood_rx_pkt_signal = nrk_signal_create ();
+  if (flood_rx_pkt_signal == NRK_ERROR) {
+    nrk_kprintf (PSTR ("FLOOD ERROR: creating rx signal failed\r\n"));
+    nrk_kernel_error_add (NRK_SIGNAL_CREATE_ERROR, nrk_cur_task_TCB->task_ID);
+    return NRK_ERROR;
+  }
+
+  flood_rfRxInfo.pPayload = flood_rx_buf;
+  flood_rfRxInfo.max_length = RF_MAX_PAYLOAD_SIZE;
+  flood_rfRxInfo.ackRequest = 0;
+  rf_init (&flood_rfRxInfo, chan, 0xffff, my_addr);
+
+  // Every relay is a broadcast with the same fixed MAC header, nothing
+  // may be filtered or acked by the radio
+  rf_addr_decode_disable ();
+  rf_auto_ack_disable ();
+  rf_enable_glossy ();
+  rx_end_callback (_flood_rx_end);
+  rf_rx_on ();
+  flood_running = 1;
+  return NRK_OK;
+}
+
+int8_t flood_set_max_tx (uint8_t max_tx)
+{
+  if (max_tx == 0)
+    return NRK_ERROR;
+  flood_max_tx = max_tx;
+  return NRK_OK;
+}
+
+// Starts a new flood.  The sequence number follows the last flood the
+// driver saw, whether or not the application took it from the ring, so
+// nodes keep counting from whoever initiated before them.
+int8_t flood_send (uint8_t * buf, uint8_t len)
+{
+  int8_t v;
+
+  if (!flood_running || len > FLOOD_MAX_PKT_SIZE)
+    return NRK_ERROR;
+
+  flood_tx_buf[RF_GLOSSY_RELAY_CNT] = 0;
+  flood_tx_buf[RF_GLOSSY_MAX_TX] = flood_max_tx;
+  flood_tx_buf[RF_GLOSSY_SEQ] = rf_glossy_next_seq ();
+  flood_tx_buf[FLOOD_HDR_SRC] = flood_my_addr & 0xff;
+  flood_tx_buf[FLOOD_HDR_SRC + 1] = flood_my_addr >> 8;
+  memcpy (flood_tx_buf + FLOOD_HDR_SIZE, buf, len);
+
+  flood_rfTxInfo.pPayload = flood_tx_buf;
+  flood_rfTxInfo.length = len + FLOOD_HDR_SIZE;
+  flood_rfTxInfo.destAddr = 0xffff;
+  flood_rfTxInfo.cca = 0;
+  flood_rfTxInfo.ackRequest = 0;
+
+  v = rf_tx_packet (&flood_rfTxInfo);
+  rf_rx_on ();
+  return v;
+}
+
+int8_t flood_rx_on ()
+{
+  if (!flood_running)
+    return NRK_ERROR;
+  rf_rx_on ();
+  return NRK_OK;
+}
+
+int8_t flood_rx_off ()
+{
+  if (!flood_running)
+    return NRK_ERROR;
+  rf_rx_off ();
+  return NRK_OK;
+}
+
+// Moves the next queued flood from the driver's ring into the receive
+// buffer if the buffer is free
+int8_t flood_rx_pkt_ready ()
+{
+  if (rx_buf_full)
+    return 1;
+  while (rf_rx_packet_nonblock () == NRK_OK)
+    {
+      if (flood_rfRxInfo.length < FLOOD_HDR_SIZE)
+        continue;
+      rx_buf_full = 1;
+      return 1;
+    }
+  return 0;
+}
+
+uint8_t *flood_rx_pkt_get (uint8_t * len, int8_t * rssi)
+{
+  if (flood_rx_pkt_ready () == 0) {
+    *len = 0;
+    *rssi = 0;
+    return NULL;
+  }
+  *len = flood_rfRxInfo.length - FLOOD_HDR_SIZE;
+  *rssi = flood_rfRxInfo.rssi;
+  return flood_rx_buf + FLOOD_HDR_SIZE;
+}
+
+int8_t flood_rx_pkt_release ()
+{
+  rx_buf_full = 0;
+  return NRK_OK;
+}
+
+// Called last in the RX_END interrupt, after the driver queued the frame
+// and started its relay
+static void _flood_rx_end ()
+{
+  if (rf_rx_ring_pending ())
+    nrk_event_signal (flood_rx_pkt_signal);
+}
+
+// Waits for the signal from the RX_END interrupt.  The ring is tested
+// again with interrupts off, and they stay off until nrk_event_wait() has
+// marked the task as waiting, so a frame that arrives in between still
+// wakes it.  The frame is copied out with interrupts on, a relay must not
+// wait for that.
+int8_t flood_wait_until_rx_pkt ()
+{
+  if (!flood_running)
+    return NRK_ERROR;
+  nrk_signal_register (flood_rx_pkt_signal);
+  while (flood_rx_pkt_ready () == 0)
+    {
+      nrk_int_disable ();
+      if (rf_rx_ring_pending ())
+        nrk_int_enable ();
+      else
+        nrk_event_wait (SIG (flood_rx_pkt_signal));	// enables interrupts
+    }
+  return NRK_OK;
+}
+
+uint16_t flood_rx_src_get ()
+{
+  return flood_rx_buf[FLOOD_HDR_SRC] | (flood_rx_buf[FLOOD_HDR_SRC + 1] << 8);
+}
+
+uint8_t flood_rx_relay_cnt_get ()
+{
+  return flood_rx_buf[RF_GLOSSY_RELAY_CNT];
+}
+
+// When the initiator started sending the packet in the receive buffer, on
+// this node's clock.  The driver timestamps the SFD of the frame, and a
+// frame with relay count n is the (n+1)th frame of the flood, with a
+// relay delay between each two.
+int8_t flood_ref_time_get (nrk_time_t * t)
+{
+  nrk_time_t back;
+  uint32_t us;
+  uint8_t n, psdu_len;
+
+  if (!rx_buf_full)
+    return NRK_ERROR;
+  n = flood_rx_buf[RF_GLOSSY_RELAY_CNT];
+  // MAC header and FCS are not in the payload length
+  psdu_len = flood_rfRxInfo.length + 11;
+  us = ((uint32_t) (psdu_len + FLOOD_PHY_OVERHEAD) * FLOOD_BYTE_US
+        + FLOOD_RELAY_DELAY_US (psdu_len)) * n
+    + FLOOD_SFD_BYTES * FLOOD_BYTE_US;
+  back.secs = 0;
+  back.nano_secs = us * 1000;
+  nrk_time_compact_nanos (&back);
+  return nrk_time_sub (t, flood_rfRxInfo.timestamp, back);
+}
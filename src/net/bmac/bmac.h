@@ -35,9 +35,16 @@
 BMAC is a low-power listen CSMA (lpl-csma) protocol.  This implementation
 has no internal transmit or receive buffers.  Applications or higher
 level network layers must provide their own transmit and receive buffers.
-BMAC will pass transmit buffers directly to the basic_rf transmit
-functions where additional information like a CRC checksum is added.  When
-data is received, BMAC will store this data in the last set receive buffer
+BMAC keeps a queue of up to BMAC_TX_QUEUE_SIZE pointers to transmit
+buffers and passes them directly to the basic_rf transmit functions where
+additional information like a CRC checksum is added.  A buffer handed to
+bmac_tx_pkt_nonblocking() must not be changed while bmac_tx_pkt_queued()
+returns 1 for it.  The tx done signal fires after every frame that was
+sent, from any task's queue, so a task waiting on it has to check its
+own buffer with bmac_tx_pkt_queued().  Queued packets for the same
+receiver are sent as a train behind a single long preamble, each one with
+the frame pending bit set while more follow so the receiver keeps its
+radio on.  When data is received, BMAC will store this data in the last set receive buffer
 until the bmac_rx_release() function is called by a higher layer or
 application.  The reception of a packet will generate a signal notifying
 any waiting tasks that the packet is ready.  Received packets can be
@@ -64,8 +71,29 @@ memory location.
 
 #define BMAC_MIN_CHECK_RATE_MS  	20
 #define BMAC_DEFAULT_CHECK_RATE_MS 	100
+
+// Quiet checks in a row before an adaptive check interval doubles
+#define BMAC_ADAPT_QUIET_CHECKS		4
 #define BMAC_TASK_PRIORITY		20
 
+#ifndef BMAC_TX_QUEUE_SIZE
+#define BMAC_TX_QUEUE_SIZE		4
+#endif
+
+// How long a receiver listens for the next frame of a packet train and
+// how many empty listens it allows before going back to duty cycling
+#define BMAC_TRAIN_WAIT_MS		10
+#define BMAC_TRAIN_IDLE_LIMIT		3
+// Listen interval while preamble copies of the train head keep coming
+// or the last frame has not been taken by the application yet.
+// Back to back copies fill the radio RX ring within a few ms, and any
+// train frame that arrives at a full ring is lost.
+#define BMAC_TRAIN_PREAMBLE_WAIT_MS	2
+
+// CCA samples (128us each) a strobe mode channel check may take, enough
+// to span the 864us ack wait between two strobes
+#define BMAC_STROBE_CCA_CHECKS		8
+
 
 
 
@@ -90,6 +118,15 @@ int8_t  bmac_addr_decode_enable();
 int8_t bmac_addr_decode_set_my_mac(uint16_t my_mac);
 int8_t  bmac_addr_decode_dest_mac(uint16_t dest);
 
+// Strobed preamble mode.  Unicast frames are repeated as their own
+// preamble with an ack request, and the destination's hardware auto-ack
+// ends the strobe early.  Address decoding is turned on with my_mac as
+// this node's address, so other nodes drop the strobes in the radio and
+// go back to sleep.  Use bmac_tx_pkt_to() to address frames, 0xFFFF
+// sends a broadcast with the full preamble.
+int8_t bmac_strobe_enable(uint16_t my_mac);
+int8_t bmac_strobe_disable();
+
 int8_t bmac_tx_reserve_set( nrk_time_t *period, uint16_t pkts );
 uint16_t bmac_tx_reserve_get();
 
@@ -105,6 +142,22 @@ void bmac_enable();
 void bmac_disable();
 
 int8_t bmac_set_rx_check_rate(nrk_time_t period);
+
+// Let BMAC pick the check rate between min_period and max_period.  It
+// checks faster while there is traffic or a busy channel and backs off
+// exponentially while the channel is quiet.  min_period bounds the duty
+// cycle and max_period bounds the wakeup latency.  Senders stretch their
+// preamble to max_period, so every node on the channel must use the same
+// max_period.  Enable strobes with it: the receiver's ack then ends a
+// unicast preamble at its next check, while without strobes every frame
+// costs a full max_period preamble.  bmac_set_rx_check_rate() switches
+// back to a fixed rate.
+int8_t bmac_set_rx_check_rate_adaptive(nrk_time_t min_period, nrk_time_t max_period);
+void bmac_rx_check_rate_get(nrk_time_t *period);
+
+// Radio on time in 1/1000 since bmac_init() or the last reset
+uint16_t bmac_duty_cycle_get();
+void bmac_duty_cycle_reset();
 void bmac_task_config ();
 int8_t bmac_set_channel(uint8_t chan);
 int8_t bmac_set_rf_power(uint8_t power);
@@ -113,6 +166,21 @@ uint8_t _b_pow(uint8_t in);
 nrk_sig_t bmac_get_tx_done_signal();
 nrk_sig_t bmac_get_rx_pkt_signal();
 int8_t bmac_tx_pkt_nonblocking(uint8_t *buf, uint8_t len);
+// As above but for dest instead of the bmac_addr_decode_dest_mac()
+// address.  That address is shared by all tasks, tasks that send to
+// different nodes must pass the destination with each frame.
+int8_t bmac_tx_pkt_to(uint8_t *buf, uint8_t len, uint16_t dest);
+int8_t bmac_tx_pkt_nonblocking_to(uint8_t *buf, uint8_t len, uint16_t dest);
+// As bmac_tx_pkt_to() for a frame that announces a time.  Every copy
+// of the frame that goes on the air, preamble copies included, carries
+// the ms left until *stamp_time as a 16-bit little-endian count at
+// stamp_offset in buf, 0 once that time has passed.  A receiver adds the
+// count to the frame's receive timestamp and gets the time in its own
+// clock, without the sender's queueing, backoff and preamble delays.
+int8_t bmac_tx_pkt_stamped_to(uint8_t *buf, uint8_t len, uint16_t dest,
+                              int8_t stamp_offset, nrk_time_t *stamp_time);
+uint8_t bmac_tx_pkt_queued(uint8_t *buf);
+uint8_t bmac_tx_queue_free();
 
 void bmac_set_cca_active(uint8_t active);
 int8_t bmac_set_cca_thresh(int8_t thresh);
@@ -126,6 +194,7 @@ int8_t bmac_init(uint8_t chan);
 
 int8_t _bmac_channel_check();
 int8_t _bmac_rx();
+int8_t _bmac_rx_buffered();
 int8_t _bmac_tx();
 int8_t bmac_rx_pkt_set_buffer(uint8_t *buf, uint8_t size);
 
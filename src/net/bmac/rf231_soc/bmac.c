@@ -53,8 +53,9 @@ static NRK_STK bmac_task_stack[BMAC_STACKSIZE];
 //#define DEBUG
 static uint32_t rx_failure_cnt;
 
-static uint8_t tx_data_ready;
 static uint8_t rx_buf_empty;
+static uint8_t rx_train;
+static uint8_t rx_train_heard;
 static uint8_t bmac_running;
 static uint8_t pkt_got_ack;
 static uint8_t g_chan;
@@ -62,11 +63,62 @@ static uint8_t is_enabled;
 
 static nrk_time_t _bmac_check_period;
 
+// Adaptive check rate, see bmac_set_rx_check_rate_adaptive()
+static uint8_t adapt_active;
+static uint16_t check_min_ms;
+static nrk_time_t check_min_period;
+static uint16_t check_max_ms;
+static uint16_t check_ms;
+static uint8_t quiet_checks;
+
+// Strobed preamble mode, see bmac_strobe_enable()
+static uint8_t strobe_active;
+static uint16_t last_rx_src;
+static uint8_t last_rx_seq;
+static uint8_t last_rx_valid;
+
+// Receiver on time since the last bmac_duty_cycle_reset()
+static uint32_t radio_on_ms;
+static nrk_time_t duty_start;
+static nrk_time_t radio_on_start;
+static uint8_t radio_on;
+
 static uint8_t cca_active;
 static int8_t tx_reserve;
 
 static nrk_time_t dummy_t;
 
+#define BMAC_TX_FREE	0
+#define BMAC_TX_QUEUED	1
+#define BMAC_TX_DONE	2
+
+// Transmit queue entries only point at the caller's buffer, the buffer
+// must stay untouched until the frame has been sent.
+typedef struct {
+  uint8_t *buf;
+  uint8_t len;
+  uint16_t dest;
+  uint8_t seq;
+  uint8_t state;
+  uint8_t blocking;
+  int8_t got_ack;
+  int8_t stamp_offset;          // -1 for frames without a time stamp
+  nrk_time_t stamp_time;
+} bmac_tx_slot_t;
+
+static bmac_tx_slot_t tx_q[BMAC_TX_QUEUE_SIZE];
+
+static void _bmac_rx_train_update ();
+static uint8_t _bmac_rx_is_dup ();
+static void _bmac_check_ms_set (uint16_t ms);
+static void _bmac_check_rate_adapt (uint8_t activity);
+static void _bmac_adapt_wait ();
+static void _bmac_radio_on_add (nrk_time_t * start);
+static void _bmac_rx_on ();
+static void _bmac_rx_off ();
+static uint8_t tx_q_seq;
+static uint16_t tx_dest;
+
 /**
  *  This is a callback if you require immediate response to a packet
  */
@@ -145,7 +197,23 @@ int8_t bmac_addr_decode_set_my_mac (uint16_t my_mac)
 
 int8_t bmac_addr_decode_dest_mac (uint16_t dest)
 {
-  bmac_rfTxInfo.destAddr = dest;
+  tx_dest = dest;
+  return NRK_OK;
+}
+
+int8_t bmac_strobe_enable (uint16_t my_mac)
+{
+  rf_addr_decode_set_my_mac (my_mac);
+  rf_addr_decode_enable ();
+  rf_auto_ack_enable ();
+  last_rx_valid = 0;
+  strobe_active = 1;
+  return NRK_OK;
+}
+
+int8_t bmac_strobe_disable ()
+{
+  strobe_active = 0;
   return NRK_OK;
 }
 
@@ -234,6 +302,8 @@ int8_t bmac_rx_pkt_set_buffer (uint8_t * buf, uint8_t size)
 
 int8_t bmac_init (uint8_t chan)
 {
+  uint8_t i;
+
   bmac_running = 0;
   tx_reserve = -1;
   cca_active = true;
@@ -252,6 +322,9 @@ int8_t bmac_init (uint8_t chan)
 
   _bmac_check_period.secs = 0;
   _bmac_check_period.nano_secs = BMAC_DEFAULT_CHECK_RATE_MS * NANOS_PER_MS;
+  adapt_active = 0;
+  strobe_active = 0;
+  bmac_duty_cycle_reset ();
   bmac_rx_pkt_signal = nrk_signal_create ();
   if (bmac_rx_pkt_signal == NRK_ERROR) {
     nrk_kprintf (PSTR ("BMAC ERROR: creating rx signal failed\r\n"));
@@ -272,7 +345,10 @@ int8_t bmac_init (uint8_t chan)
   }
 
 
-  tx_data_ready = 0;
+  for (i = 0; i < BMAC_TX_QUEUE_SIZE; i++)
+    tx_q[i].state = BMAC_TX_FREE;
+  tx_q_seq = 0;
+  rx_train = 0;
   // Set the one main rx buffer
   rx_buf_empty = 0;
   bmac_rfRxInfo.pPayload = NULL;
@@ -294,13 +370,85 @@ int8_t bmac_init (uint8_t chan)
   return NRK_OK;
 }
 
+// Claim a free queue slot for buf, returns the slot index or -1 if full
+static int8_t _bmac_tx_q_add (uint8_t * buf, uint8_t len, uint16_t dest,
+                              uint8_t blocking, int8_t stamp_offset,
+                              nrk_time_t * stamp_time)
+{
+  int8_t i;
+
+  nrk_int_disable ();
+  for (i = 0; i < BMAC_TX_QUEUE_SIZE; i++)
+    if (tx_q[i].state == BMAC_TX_FREE)
+      break;
+  if (i == BMAC_TX_QUEUE_SIZE) {
+    nrk_int_enable ();
+    return -1;
+  }
+  tx_q[i].buf = buf;
+  tx_q[i].len = len;
+  tx_q[i].dest = dest;
+  tx_q[i].seq = tx_q_seq++;
+  tx_q[i].blocking = blocking;
+  tx_q[i].stamp_offset = stamp_offset;
+  if (stamp_offset >= 0)
+    tx_q[i].stamp_time = *stamp_time;
+  tx_q[i].state = BMAC_TX_QUEUED;
+  nrk_int_enable ();
+  return i;
+}
+
+// Oldest queued frame other than slot skip, optionally only frames for
+// dest.  Returns the slot index or -1 if there is none.
+static int8_t _bmac_tx_q_oldest (int8_t skip, uint8_t match_dest,
+                                 uint16_t dest)
+{
+  int8_t i, best;
+
+  best = -1;
+  for (i = 0; i < BMAC_TX_QUEUE_SIZE; i++) {
+    if (i == skip || tx_q[i].state != BMAC_TX_QUEUED)
+      continue;
+    if (match_dest && tx_q[i].dest != dest)
+      continue;
+    // sequence numbers wrap, compare by distance
+    if (best == -1 || (int8_t) (tx_q[i].seq - tx_q[best].seq) < 0)
+      best = i;
+  }
+  return best;
+}
+
+uint8_t bmac_tx_queue_free ()
+{
+  uint8_t i, cnt;
+
+  cnt = 0;
+  for (i = 0; i < BMAC_TX_QUEUE_SIZE; i++)
+    if (tx_q[i].state == BMAC_TX_FREE)
+      cnt++;
+  return cnt;
+}
+
+// Returns 1 while buf waits in the queue or is being sent
+uint8_t bmac_tx_pkt_queued (uint8_t * buf)
+{
+  uint8_t i;
+
+  for (i = 0; i < BMAC_TX_QUEUE_SIZE; i++)
+    if (tx_q[i].state == BMAC_TX_QUEUED && tx_q[i].buf == buf)
+      return 1;
+  return 0;
+}
+
 int8_t bmac_tx_pkt_nonblocking (uint8_t * buf, uint8_t len)
 {
-  if (tx_data_ready == 1)
+  return bmac_tx_pkt_nonblocking_to (buf, len, tx_dest);
+}
+
+int8_t bmac_tx_pkt_nonblocking_to (uint8_t * buf, uint8_t len, uint16_t dest)
+{
+  if (_bmac_tx_q_add (buf, len, dest, 0, -1, NULL) == -1)
     return NRK_ERROR;
-  tx_data_ready = 1;
-  bmac_rfTxInfo.pPayload = buf;
-  bmac_rfTxInfo.length = len;
   return NRK_OK;
 }
 
@@ -318,9 +466,22 @@ nrk_sig_t bmac_get_tx_done_signal ()
 
 
 int8_t bmac_tx_pkt (uint8_t * buf, uint8_t len)
+{
+  return bmac_tx_pkt_to (buf, len, tx_dest);
+}
+
+int8_t bmac_tx_pkt_to (uint8_t * buf, uint8_t len, uint16_t dest)
+{
+  return bmac_tx_pkt_stamped_to (buf, len, dest, -1, NULL);
+}
+
+int8_t bmac_tx_pkt_stamped_to (uint8_t * buf, uint8_t len, uint16_t dest,
+                               int8_t stamp_offset, nrk_time_t * stamp_time)
 {
   uint32_t mask;
-  if (tx_data_ready == 1)
+  int8_t slot, got_ack;
+
+  if (bmac_tx_queue_free () == 0)
     return NRK_ERROR;
 // If reserve exists check it
 #ifdef NRK_MAX_RESERVES
@@ -331,18 +492,24 @@ int8_t bmac_tx_pkt (uint8_t * buf, uint8_t len)
   }
 #endif
   nrk_signal_register (bmac_tx_pkt_done_signal);
-  tx_data_ready = 1;
-  bmac_rfTxInfo.pPayload = buf;
-  bmac_rfTxInfo.length = len;
+  slot = _bmac_tx_q_add (buf, len, dest, 1, stamp_offset, stamp_time);
+  if (slot == -1)
+    return NRK_ERROR;
 #ifdef DEBUG
   nrk_kprintf (PSTR ("Waiting for tx done signal\r\n"));
 #endif
-  mask = nrk_event_wait (SIG (bmac_tx_pkt_done_signal));
-  if (mask == 0)
-    nrk_kprintf (PSTR ("BMAC TX: Error calling event wait\r\n"));
-  if ((mask & SIG (bmac_tx_pkt_done_signal)) == 0)
-    nrk_kprintf (PSTR ("BMAC TX: Woke up on wrong signal\r\n"));
-  if (pkt_got_ack)
+  // The done signal fires once per frame sent, which may be
+  // another task's frame
+  while (tx_q[slot].state != BMAC_TX_DONE) {
+    mask = nrk_event_wait (SIG (bmac_tx_pkt_done_signal));
+    if (mask == 0)
+      nrk_kprintf (PSTR ("BMAC TX: Error calling event wait\r\n"));
+    if ((mask & SIG (bmac_tx_pkt_done_signal)) == 0)
+      nrk_kprintf (PSTR ("BMAC TX: Woke up on wrong signal\r\n"));
+  }
+  got_ack = tx_q[slot].got_ack;
+  tx_q[slot].state = BMAC_TX_FREE;
+  if (got_ack)
     return NRK_OK;
   return NRK_ERROR;
 }
@@ -390,7 +557,7 @@ void bmac_nw_task ()
 {
   int8_t v, i;
   int8_t e;
-  uint8_t backoff;
+  uint8_t backoff, activity;
   nrk_sig_mask_t event;
 
   while (bmac_started () == 0)
@@ -410,24 +577,69 @@ void bmac_nw_task ()
     rf_power_up ();
     if (is_enabled) {
       v = 1;
+      activity = 0;
+
+      if (rx_train) {
+        // The sender flagged more frames behind the last one and the
+        // radio was left listening, pick them up without a preamble.
+        // Only a wait in which not even a preamble copy arrived counts
+        // as idle, the rest of the train follows the whole preamble.
+        rx_train_heard = 0;
+        if (rx_buf_empty == 1 && _bmac_rx_buffered () == 1)
+          e = nrk_event_signal (bmac_rx_pkt_signal);
+        else {
+          if (rx_buf_empty == 0)
+            e = nrk_event_signal (bmac_rx_pkt_signal);
+          if (!rx_train_heard)
+            rx_train--;
+        }
+      }
+      if (rx_train) {
+        if (_bmac_tx_q_oldest (-1, 0, 0) != -1)
+          _bmac_tx ();
+        dummy_t.secs = 0;
+        if (rx_train_heard || rx_buf_empty == 0)
+          dummy_t.nano_secs = BMAC_TRAIN_PREAMBLE_WAIT_MS * NANOS_PER_MS;
+        else
+          dummy_t.nano_secs = BMAC_TRAIN_WAIT_MS * NANOS_PER_MS;
+        _bmac_rx_on ();
+        nrk_wait (dummy_t);
+        if (adapt_active)
+          _bmac_check_rate_adapt (1);
+        continue;
+      }
 
 #ifdef BMAC_MOD_CCA
       if (rx_buf_empty == 1)
       {
-	 if (_bmac_rx () == 1) e = nrk_event_signal (bmac_rx_pkt_signal);
+	 if (_bmac_rx () == 1) {
+	   e = nrk_event_signal (bmac_rx_pkt_signal);
+	   activity = 1;
+	 }
       }
-      else
+      else {
       e = nrk_event_signal (bmac_rx_pkt_signal);
+      activity = 1;
+      }
 #else
-      if (rx_buf_empty == 1)
+      // Frames that arrived back to back are already waiting in the
+      // radio RX ring, hand them up without sampling the channel.
+      if (rx_buf_empty == 1 && _bmac_rx_buffered () == 1) {
+        e = nrk_event_signal (bmac_rx_pkt_signal);
+        activity = 1;
+      }
+      else if (rx_buf_empty == 1)
         v = _bmac_channel_check ();
       // If the buffer is full, signal the receiving task again.
-      else
+      else {
         e = nrk_event_signal (bmac_rx_pkt_signal);
+        activity = 1;
+      }
       // bmac_channel check turns on radio, don't turn off if
       // data is coming.
 
       if (v == 0) {
+        activity = 1;
         if (_bmac_rx () == 1) {
           e = nrk_event_signal (bmac_rx_pkt_signal);
           //if(e==NRK_ERROR) {
@@ -440,14 +652,27 @@ void bmac_nw_task ()
       }
 
 #endif
-      if (tx_data_ready == 1) {
+      if (_bmac_tx_q_oldest (-1, 0, 0) != -1) {
         _bmac_tx ();
+        activity = 1;
       }
-      rf_rx_off ();
+      // The head of a train just came in.  Listen for the rest right
+      // away instead of sleeping through it for a check period.
+      if (rx_train) {
+        if (adapt_active)
+          _bmac_check_rate_adapt (activity);
+        continue;
+      }
+      _bmac_rx_off ();
       rf_power_down ();
+      if (adapt_active)
+        _bmac_check_rate_adapt (activity);
 
       //do {
-      nrk_wait (_bmac_check_period);
+      if (adapt_active)
+        _bmac_adapt_wait ();
+      else
+        nrk_wait (_bmac_check_period);
       //      if(rx_buf_empty!=1)  nrk_event_signal (bmac_rx_pkt_signal);
       //} while(rx_buf_empty!=1);
     }
@@ -470,11 +695,138 @@ int8_t bmac_set_rx_check_rate (nrk_time_t period)
   if (period.secs == 0
       && period.nano_secs < BMAC_MIN_CHECK_RATE_MS * NANOS_PER_MS)
     return NRK_ERROR;
+  adapt_active = 0;
   _bmac_check_period.secs = period.secs;
   _bmac_check_period.nano_secs = period.nano_secs;
   return NRK_OK;
 }
 
+int8_t bmac_set_rx_check_rate_adaptive (nrk_time_t min_period,
+                                        nrk_time_t max_period)
+{
+  uint32_t min_ms, max_ms;
+
+  min_ms = min_period.secs * 1000 + min_period.nano_secs / NANOS_PER_MS;
+  max_ms = max_period.secs * 1000 + max_period.nano_secs / NANOS_PER_MS;
+  if (min_ms < BMAC_MIN_CHECK_RATE_MS || min_ms > max_ms || max_ms > 65535)
+    return NRK_ERROR;
+  check_min_ms = min_ms;
+  check_min_period = min_period;
+  check_max_ms = max_ms;
+  quiet_checks = 0;
+  // Start quiet, the first traffic pulls the rate down
+  _bmac_check_ms_set (check_max_ms);
+  adapt_active = 1;
+  return NRK_OK;
+}
+
+void bmac_rx_check_rate_get (nrk_time_t * period)
+{
+  period->secs = _bmac_check_period.secs;
+  period->nano_secs = _bmac_check_period.nano_secs;
+}
+
+static void _bmac_check_ms_set (uint16_t ms)
+{
+  check_ms = ms;
+  _bmac_check_period.secs = ms / 1000;
+  _bmac_check_period.nano_secs = (uint32_t) (ms % 1000) * NANOS_PER_MS;
+}
+
+// Any traffic or a busy channel halves the check interval, and after
+// BMAC_ADAPT_QUIET_CHECKS quiet checks in a row it doubles, so the
+// interval settles where a neighborhood's traffic keeps it.
+static void _bmac_check_rate_adapt (uint8_t activity)
+{
+  uint16_t ms;
+
+  ms = check_ms;
+  if (activity) {
+    quiet_checks = 0;
+    ms = ms >> 1;
+    if (ms < check_min_ms)
+      ms = check_min_ms;
+  }
+  else if (++quiet_checks >= BMAC_ADAPT_QUIET_CHECKS) {
+    quiet_checks = 0;
+    if (ms > check_max_ms / 2)
+      ms = check_max_ms;
+    else
+      ms = ms << 1;
+  }
+  if (ms != check_ms)
+    _bmac_check_ms_set (ms);
+}
+
+// The receiver is switched only through these two, so the duty cycle
+// counts the time it is on and not the waits in between
+static void _bmac_rx_on ()
+{
+  if (!radio_on) {
+    nrk_time_get (&radio_on_start);
+    radio_on = 1;
+  }
+  rf_rx_on ();
+}
+
+static void _bmac_rx_off ()
+{
+  rf_rx_off ();
+  if (radio_on) {
+    _bmac_radio_on_add (&radio_on_start);
+    radio_on = 0;
+  }
+}
+
+// Sleep out a long adaptive check interval in min_period steps so a
+// frame queued meanwhile goes out without waiting for the next check.
+static void _bmac_adapt_wait ()
+{
+  uint16_t ms;
+
+  for (ms = 0; ms < check_ms; ms += check_min_ms) {
+    nrk_wait (check_min_period);
+    if (_bmac_tx_q_oldest (-1, 0, 0) != -1)
+      break;
+  }
+}
+
+static void _bmac_radio_on_add (nrk_time_t * start)
+{
+  nrk_time_t now, d;
+
+  nrk_time_get (&now);
+  if (nrk_time_sub (&d, now, *start) == NRK_ERROR)
+    return;
+  radio_on_ms += d.secs * 1000 + d.nano_secs / NANOS_PER_MS;
+}
+
+uint16_t bmac_duty_cycle_get ()
+{
+  nrk_time_t now, d;
+  uint32_t total_ms;
+
+  nrk_time_get (&now);
+  if (nrk_time_sub (&d, now, duty_start) == NRK_ERROR)
+    return 0;
+  total_ms = d.secs * 1000 + d.nano_secs / NANOS_PER_MS;
+  if (total_ms == 0)
+    return 0;
+  if (radio_on_ms >= total_ms)
+    return 1000;
+  // scale down first so the product fits in 32 bits
+  if (total_ms > 4000000UL)
+    return (radio_on_ms / 1000) * 1000 / (total_ms / 1000);
+  return radio_on_ms * 1000 / total_ms;
+}
+
+void bmac_duty_cycle_reset ()
+{
+  radio_on_ms = 0;
+  nrk_time_get (&duty_start);
+  radio_on_start = duty_start;
+}
+
 int8_t bmac_started ()
 {
   return bmac_running;
@@ -483,17 +835,73 @@ int8_t bmac_started ()
 int8_t _bmac_channel_check ()
 {
   int8_t val = 0;
+  uint8_t i;
 
-  rf_rx_on ();
+  _bmac_rx_on ();
+  if (strobe_active) {
+    // Strobes leave a gap for the ack after every frame, keep sampling
+    // across it and stop at the first busy sample
+    for (i = 0; i < BMAC_STROBE_CCA_CHECKS; i++)
+      if (rf_cca_check () == 0)
+        break;
+    _bmac_rx_off ();
+    return i == BMAC_STROBE_CCA_CHECKS;
+  }
   val += rf_cca_check ();
   val += rf_cca_check ();
   val += rf_cca_check ();
   if (val > 1)
     val = 1;
-  rf_rx_off ();
+  _bmac_rx_off ();
   return val;
 }
 
+// Move a frame the radio has already buffered into the bmac rx buffer.
+// Leftover preamble copies are dropped here so they cannot fill the ring.
+int8_t _bmac_rx_buffered ()
+{
+  while (rf_rx_ring_pending () > 0) {
+    if (rf_rx_packet_nonblock () != NRK_OK) {
+      if (rx_failure_cnt < 65535)
+        rx_failure_cnt++;
+      continue;
+    }
+    if (_bmac_rx_is_dup ()) {
+      if (bmac_rfRxInfo.framePending)
+        _bmac_rx_train_update ();
+      continue;
+    }
+    rx_buf_empty = 0;
+    _bmac_rx_train_update ();
+    return 1;
+  }
+  return 0;
+}
+
+// Preamble copies and strobes whose ack got lost all carry the same
+// sequence number, and the RX ring can hold several of them, so only
+// the first copy goes up to the application
+static uint8_t _bmac_rx_is_dup ()
+{
+  if (last_rx_valid && bmac_rfRxInfo.srcAddr == last_rx_src
+      && bmac_rfRxInfo.seqNumber == last_rx_seq)
+    return 1;
+  last_rx_src = bmac_rfRxInfo.srcAddr;
+  last_rx_seq = bmac_rfRxInfo.seqNumber;
+  last_rx_valid = 1;
+  return 0;
+}
+
+// Keep listening for a packet train while senders set frame pending
+static void _bmac_rx_train_update ()
+{
+  if (bmac_rfRxInfo.framePending) {
+    rx_train = BMAC_TRAIN_IDLE_LIMIT;
+    rx_train_heard = 1;
+  } else if (rf_rx_ring_pending () == 0)
+    rx_train = 0;
+}
+
 // Assuming that CCA returned 1 and a packet is on its way
 // Receive the packet or timeout and error
 int8_t _bmac_rx ()
@@ -501,7 +909,7 @@ int8_t _bmac_rx ()
   int8_t n;
   uint8_t cnt;
 
-  rf_rx_on ();
+  _bmac_rx_on ();
   cnt = 0;
 //printf( "calling rx\r\n" );
   dummy_t.secs = 0;
@@ -510,10 +918,20 @@ int8_t _bmac_rx ()
 
   n = rf_rx_packet_nonblock ();
 
+  // In strobe mode the radio filters frames for other nodes, so an
+  // empty listen after a busy channel is expected.  Go back to sleep.
+  if (n == 0 && strobe_active) {
+    _bmac_rx_off ();
+    return 0;
+  }
   if (n != NRK_OK) {
     if (rx_failure_cnt < 65535)
       rx_failure_cnt++;
-    rf_rx_off ();
+    _bmac_rx_off ();
+    return 0;
+  }
+  if (_bmac_rx_is_dup () && _bmac_rx_buffered () == 0) {
+    _bmac_rx_off ();
     return 0;
   }
 
@@ -540,7 +958,9 @@ int8_t _bmac_rx ()
     printf ("%c", bmac_rfRxInfo.pPayload[i]);
   printf ("]\r\n");
 #endif
-  rf_rx_off ();
+  _bmac_rx_train_update ();
+  if (rx_train == 0)
+    _bmac_rx_off ();
   return 1;
 }
 
@@ -558,8 +978,9 @@ uint8_t bmac_rx_failure_count_reset ()
 
 int8_t _bmac_tx ()
 {
-  uint8_t v, backoff, backoff_count;
-  uint16_t b;
+  uint8_t v, backoff, backoff_count, train;
+  int8_t slot, next;
+  uint16_t b, dest;
 
 #ifdef DEBUG
   nrk_kprintf (PSTR ("_bmac_tx()\r\n"));
@@ -567,7 +988,9 @@ int8_t _bmac_tx ()
   if (cca_active) {
 
 // Add random time here to stop nodes from synchronizing with eachother
-    b = _nrk_time_to_ticks (&_bmac_check_period);
+// A long adaptive interval would only add latency, spread over min
+    b = _nrk_time_to_ticks (adapt_active ? &check_min_period :
+                            &_bmac_check_period);
     b = b / ((rand () % 10) + 1);
 //printf( "waiting %d\r\n",b );
     nrk_wait_until_ticks (b);
@@ -597,7 +1020,8 @@ int8_t _bmac_tx ()
       backoff_count++;
       if (backoff_count > 6)
         backoff_count = 6;      // cap it at 64    
-      b = _nrk_time_to_ticks (&_bmac_check_period);
+      b = _nrk_time_to_ticks (adapt_active ? &check_min_period :
+                              &_bmac_check_period);
       b = b / ((rand () % 10) + 1);
 //      printf( "waiting %d\r\n",b );
       nrk_wait_until_ticks (b);
@@ -611,18 +1035,52 @@ int8_t _bmac_tx ()
   bmac_rfTxInfo.cca = 0;
   bmac_rfTxInfo.ackRequest = 0;
 
+  // With an adaptive check rate the receiver may be sleeping for up
+  // to the maximum period, so the preamble has to cover that.
   uint16_t ms = _bmac_check_period.secs * 1000;
   ms += _bmac_check_period.nano_secs / 1000000;
+  if (adapt_active)
+    ms = check_max_ms;
   //printf( "CR ms: %u\n",ms );
   //target_t.nano_secs+=20*NANOS_PER_MS;
-  rf_rx_on ();
-  pkt_got_ack = rf_tx_packet_repeat (&bmac_rfTxInfo, ms);
+  _bmac_rx_on ();
+
+  // The first frame carries the full preamble.  Further frames queued
+  // for the same receiver follow back to back with the frame pending
+  // bit set so the receiver stays awake for them.
+  slot = _bmac_tx_q_oldest (-1, 0, 0);
+  for (train = 0; slot != -1 && train < BMAC_TX_QUEUE_SIZE; train++) {
+    dest = tx_q[slot].dest;
+    next = _bmac_tx_q_oldest (slot, 1, dest);
+    bmac_rfTxInfo.pPayload = tx_q[slot].buf;
+    bmac_rfTxInfo.length = tx_q[slot].len;
+    bmac_rfTxInfo.destAddr = dest;
+    // Unicast frames strobe: the destination's auto-ack cuts the
+    // preamble short.  Broadcasts still need the full preamble.
+    bmac_rfTxInfo.ackRequest = strobe_active && dest != 0xFFFF;
+    rf_tx_frame_pending_set (next != -1 && train + 1 < BMAC_TX_QUEUE_SIZE);
+    rf_tx_stamp_set (tx_q[slot].stamp_offset, &tx_q[slot].stamp_time);
+    if (train == 0)
+      v = rf_tx_packet_repeat (&bmac_rfTxInfo, ms);
+    else
+      v = rf_tx_packet (&bmac_rfTxInfo);
+    // NRK_ERROR means no ack for a strobe, or a transmit timeout
+    pkt_got_ack = (v == NRK_OK);
+    tx_q[slot].got_ack = pkt_got_ack;
+    if (tx_q[slot].blocking)
+      tx_q[slot].state = BMAC_TX_DONE;
+    else
+      tx_q[slot].state = BMAC_TX_FREE;
+    // Once per frame, so each sender learns its buffer is free
+    nrk_event_signal (bmac_tx_pkt_done_signal);
+    slot = next;
+  }
+  rf_tx_frame_pending_set (0);
+  rf_tx_stamp_set (-1, NULL);
 
   // send packet
   // pkt_got_ack=rf_tx_packet (&bmac_rfTxInfo);
-  rf_rx_off ();                 // Just in case auto-ack left radio on
-  tx_data_ready = 0;
-  nrk_event_signal (bmac_tx_pkt_done_signal);
+  _bmac_rx_off ();              // Just in case auto-ack left radio on
   return NRK_OK;
 }
 
@@ -538,22 +538,14 @@ void initialise_buffer_manager()
 	for(i = 0; i < MAX_RX_QUEUE_SIZE; i++)
 	{
 		rx_buf_udp[i].status = UNALLOCATED;		// initially all rx buffers are unallocated 
-		rx_buf_udp[i].next = NULL;					// no links formed as of yet
+		rx_buf_udp[i].rbm = -1;
+		rx_buf_udp[i].next = -1;					// no links formed as of yet
 	}
 	num_bufs_free = MAX_RX_QUEUE_SIZE;			// initially all rx buffers are unallocated 
 	
 	// initialise the receive buffer managers
 	for(i = 0; i < NUM_PORTS; i++)				 
-	{
-		rx_buf_mgr[i].pid = INVALID_PID;			// pid of task associated with the port 
-		rx_buf_mgr[i].pindex = -1;					// indicates absence of rbm/port mapping 
-		rx_buf_mgr[i].head_fq = NULL;
-		rx_buf_mgr[i].tail_fq = NULL;
-		rx_buf_mgr[i].head_pq = NULL;
-		rx_buf_mgr[i].tail_pq = NULL;
-		rx_buf_mgr[i].countTotal = 0;
-		rx_buf_mgr[i].countFree = 0;
-	}
+		release_rx_bufs(i);
 	
 	// initialise the transmit buffer manager 
 	tx_buf_mgr.head_fq = NULL;
@@ -627,7 +619,8 @@ inline void print_tx_buffer()
 void print_rx_buffers(uint8_t port)
 {
 	int8_t rbm_index;
-	ReceiveBufferUDP *buf;
+	int8_t prio;
+	int8_t i;
 	
 	rbm_index = port_to_rbm_index(port);
 	
@@ -635,13 +628,17 @@ void print_rx_buffers(uint8_t port)
 	{
 		nrk_kprintf(PSTR("BM: rbm_index = "));
 		printf("%d\r\n", rbm_index);
+		if(rbm_index == NRK_ERROR)
+			return;
 		
 		nrk_kprintf(PSTR("Port queue:\r\n"));
-		buf = rx_buf_mgr[rbm_index].head_pq;
-		while(buf != NULL)
+		for(prio = MAX_PRIORITY; prio >= 0; prio--)
 		{
-			printf("%d ", buf -> srcAddr);
-			print_seg( &(buf -> seg) );
+			for(i = rx_buf_mgr[rbm_index].head_pq[prio]; i != -1; i = rx_buf_udp[i].next)
+			{
+				printf("%d %d ", prio, rx_buf_udp[i].srcAddr);
+				print_seg( &(rx_buf_udp[i].seg) );
+			}
 		}
 	}
 	
@@ -747,314 +744,216 @@ inline int8_t port_to_port_index(uint8_t port)
 	return NRK_ERROR;
 }
 /**************************************************************************************/
-void insert_rx_pq(Transport_Segment_UDP *seg, int8_t prio, uint16_t addr, int8_t rssi)
+static int8_t highest_prio(uint32_t mask)
 {
-	int8_t rbm_index;						// index of the corresponding rbm element 
-	ReceiveBufferUDP *buf, *ptr, *prev;
-	
-	rbm_index = port_to_rbm_index(seg -> destPort);	
+	int8_t prio = 31;
 	
-	if(DEBUG_BM == 2)
+	// skip empty bytes first, shifts of a uint32_t are slow on the AVR 
+	while( (mask & 0xFF000000UL) == 0 )
 	{
-		nrk_kprintf(PSTR("BM: insert_rx_pq(): DestPort = "));
-		printf("%d\r\n", seg -> destPort);
+		mask <<= 8;
+		prio -= 8;
 	}
-	buf = remove_rx_fq(rbm_index, EMPTY);		// remove an EMPTY buffer from the free queue
-	
-	// pointers for traversing the port queue 
-	ptr = rx_buf_mgr[rbm_index].head_pq;				 
-	prev = NULL; 
-	
-	// find the buffer in the port queue holding the next lower priority segment	
-	while(ptr != NULL)
+	while( (mask & 0x80000000UL) == 0 )
 	{
-		if(ptr -> prio < prio)
-			break;
-			
-		prev = ptr;
-		ptr = ptr -> next;
+		mask <<= 1;
+		prio--;
 	}
+	return prio;
+}
+/**************************************************************************************/
+static int8_t lowest_prio(uint32_t mask)
+{
+	int8_t prio = 0;
 	
-	if(DEBUG_BM == 2)
+	while( (mask & 0xFF) == 0 )
+	{
+		mask >>= 8;
+		prio += 8;
+	}
+	while( (mask & 1) == 0 )
 	{
-		nrk_kprintf(PSTR("BM: insert_rx_pq(): After ptr loop\r\n"));
+		mask >>= 1;
+		prio++;
 	}
+	return prio;
+}
+/**************************************************************************************/
+int8_t reserve_rx_buf(int8_t rbm_index, int8_t prio)
+{
+	ReceiveBufferManager *rbm = &rx_buf_mgr[rbm_index];
+	int8_t low;					// lowest priority level with queued segments 
+	int8_t i, prev;
+	
+	i = remove_rx_fq(rbm_index);
+	if(i != NRK_ERROR)			// an EMPTY buffer is available 
+		return i;
 	
-	if(buf != NULL)	// a buffer is available to hold the newly received segment 
+	// All buffers of the port are queued or held by the task. Only a queued 
+	// segment can be given up, and only for a more important one 
+	if(rbm -> prio_mask == 0)
 	{
 		if(DEBUG_BM == 2)
-		{
-			nrk_kprintf(PSTR("BM: insert_rx_pq(): There is space\r\n"));
-		}		
-		
-		// fill up the members of ReceiveBufferUDP		
-		buf -> seg = *seg;	
-		buf -> status = FULL;
-		buf -> prio = prio;
-		buf -> srcAddr = addr;
-		buf -> rssi = rssi;
-		buf -> next = ptr;
-		
-		
-		if(rx_buf_mgr[rbm_index].head_pq == NULL)			// rx pq is empty
-		{
-			rx_buf_mgr[rbm_index].head_pq = rx_buf_mgr[rbm_index].tail_pq = buf; 
-		}
-		else if(prev == NULL)	// the newly received segment is to be inserted at the head of the port queue 
-					rx_buf_mgr[rbm_index].head_pq = buf;
-			  else
-			  {
-			  		prev -> next = buf;
-			  		if(prev == rx_buf_mgr[rbm_index].tail_pq)
-			  			rx_buf_mgr[rbm_index].tail_pq = buf;
-			  }
-			
-		// newly received segment has been inserted at the proper slot in the port queue
-		if(DEBUG_BM == 2)
-		{
-			nrk_kprintf(PSTR("BM: insert_rx_pq(): Before returning (there is space)\r\n"));
-		}
-		return;  
+			nrk_kprintf(PSTR("BM: reserve_rx_buf(): No space and port queue empty\r\n"));
+		return NRK_ERROR;
 	}
 	
-	// if the code reaches here, it means that a buffer is not available to hold this new segment 
-	// There are three possibilities
-	// 1. The free queue is empty and the port queue is full
-	// 2. The port queue is empty and the free queue is full of 'FULL' buffers
-	// 3. Some combination of the above 2	
+	low = lowest_prio(rbm -> prio_mask);
+	if(low > prio)				// new segment has lower priority 
+		return NRK_ERROR;
+	if( low == prio && ((excessPolicySettings >> prio) & ((uint32_t)1)) == DROP )
+		return NRK_ERROR;
 	
-	if(DEBUG_BM == 2)
+	// evict the most recent segment of the lowest priority level  
+	i = rbm -> head_pq[low];
+	prev = -1;
+	while(rx_buf_udp[i].next != -1)
 	{
-		nrk_kprintf(PSTR("BM: insert_rx_pq(): No space\r\n"));
+		prev = i;
+		i = rx_buf_udp[i].next;
 	}
-	
-	// check for 2 
-	if(rx_buf_mgr[rbm_index].head_pq == NULL)
+	if(prev == -1)				// it was the only segment of its level 
 	{
-		if(rx_buf_mgr[rbm_index].countFree != 0)	// debugging purposes 
-		{
-			nrk_int_disable();
-			nrk_led_set(RED_LED);
-			while(1)
-				nrk_kprintf(PSTR("insert_rx_pq(): Bug found in implementation of countFree in rx_buf_mgr\r\n"));
-		}
-		if(rx_buf_mgr[rbm_index].tail_pq != NULL)	// debugging purposes 
-		{
-			nrk_int_disable();
-			nrk_led_set(RED_LED);
-			while(1)
-				nrk_kprintf(PSTR("insert_rx_pq(): Bug found in implementation of tail_pq in rx_buf_mgr\r\n"));
-		}
-		
-		if(DEBUG_BM == 2)
-		{
-			nrk_kprintf(PSTR("BM: insert_rx_pq(): Before returning. No space but port queue also empty\r\n"));
-		}
-		return;		// drop the new segment
+		rbm -> head_pq[low] = -1;
+		rbm -> tail_pq[low] = -1;
+		rbm -> prio_mask &= ~( (uint32_t)1 << low );
 	}
-	
-	// the situation could be 1 or 3. The behavior is the same. The lowest priority message 
-	// in the port queue has to be replaced	  
-	// check if the last segment in the port queue has a lower priority
+	else
+	{
+		rx_buf_udp[prev].next = -1;
+		rbm -> tail_pq[low] = prev;
+	}
+	rbm -> countQueued--;
 	
 	if(DEBUG_BM == 2)
 	{
-		nrk_kprintf(PSTR("BM: insert_rx_pq(): Possibility of replacement\r\n"));
+		nrk_kprintf(PSTR("BM: reserve_rx_buf(): Replacing a segment of priority "));
+		printf("%d\r\n", low);
 	}
-	if( (rx_buf_mgr[rbm_index].tail_pq) -> prio < prio ) // this last segment should be replaced
-	{
-		// at this point we know that ptr cannot be NULL		
-		// find the last but one segment in the port queue 
-		if(DEBUG_BM == 2)
-		{
-			nrk_kprintf(PSTR("BM: insert_rx_pq(): Inside 1\r\n"));
-		}
-		
-		ReceiveBufferUDP *qtr = rx_buf_mgr[rbm_index].head_pq;
-		// corner case, see if there is only one buffer in the port queue 
-		if(rx_buf_mgr[rbm_index].head_pq == rx_buf_mgr[rbm_index].tail_pq)
-		{
-			// replace the members of this last buffer with those of the new one 
-			if(DEBUG_BM == 2)
-			{
-				nrk_kprintf(PSTR("BM: insert_rx_pq(): Inside 2\r\n"));
-			}
-			qtr -> seg = *seg;
-			qtr -> prio = prio;
-			qtr -> srcAddr = addr;
-			qtr -> rssi = rssi;		// message inserted at the tail of the queue 
-			
-			return;
-		}
-		else	// there is more than one buffer in the port queue 
-		{
-			if(DEBUG_BM == 2)
-			{
-				nrk_kprintf(PSTR("BM: insert_rx_pq(): Before qtr loop\r\n"));
-			}
-						
-			while(qtr -> next != rx_buf_mgr[rbm_index].tail_pq)	// qtr will now point to the last but one segment 
-				qtr = qtr -> next;
-				
-			if(DEBUG_BM == 2)
-			{
-				nrk_kprintf(PSTR("BM: insert_rx_pq(): After qtr loop\r\n"));
-			}
-				
-			// replace the members of the last buffer with those of the new one
-			(rx_buf_mgr[rbm_index].tail_pq) -> seg = *seg;
-			(rx_buf_mgr[rbm_index].tail_pq) -> prio = prio;
-			(rx_buf_mgr[rbm_index].tail_pq) -> srcAddr = addr;
-			(rx_buf_mgr[rbm_index].tail_pq) -> rssi = rssi;
-				
-			// adjust the pointers so that this new segment occupies its correct position in the port queue			
-			(rx_buf_mgr[rbm_index].tail_pq) -> next = ptr;
-			if(prev == NULL)
-				rx_buf_mgr[rbm_index].head_pq = rx_buf_mgr[rbm_index].tail_pq;
-			else
-				prev -> next = rx_buf_mgr[rbm_index].tail_pq;
-					
-			qtr -> next = NULL;				
-			rx_buf_mgr[rbm_index].tail_pq = qtr;	// change the tail of the port queue
-			
-			return;
-		}
-	} // end if 
-	else if( (rx_buf_mgr[rbm_index].tail_pq) -> prio == prio )	
-		  {
-		  		// check the setting of the excess policy for this priority level 
-		  		if(DEBUG_BM == 2)
-				{
-					nrk_kprintf(PSTR("BM: insert_rx_pq(): Inside 3\r\n"));
-				}	
-				
-		  		if( ((excessPolicySettings >> prio) & ((uint32_t)1)) == OVERWRITE)	// new segment is more important 
-		  		{
-		  			if(DEBUG_BM == 2)
-					{
-						nrk_kprintf(PSTR("BM: insert_rx_pq(): Inside 4\r\n"));
-					}
-		  			// replace the members of the last buffer with those of the new one 
-		  			(rx_buf_mgr[rbm_index].tail_pq) -> seg = *seg;
-					(rx_buf_mgr[rbm_index].tail_pq) -> prio = prio;
-					(rx_buf_mgr[rbm_index].tail_pq) -> srcAddr = addr;
-					(rx_buf_mgr[rbm_index].tail_pq) -> rssi = rssi;
-					
-					return;
-				}
-				else			// new segments should be dropped 
-				{
-					if(DEBUG_BM == 2)
-					{
-						nrk_kprintf(PSTR("BM: insert_rx_pq(): Inside 5\r\n"));
-					}
-					return;	// do nothing
-				} 
-		  }
-		  else				// new segment has lower priority 
-		  {
-		  		if(DEBUG_BM == 2)
-				{
-					nrk_kprintf(PSTR("BM: insert_rx_pq(): Inside 6\r\n"));
-				}
-		  		return;		// do nothing 
-		  }
-	//possibility 1 or 3 checked 
+	return i;
+}
+/**************************************************************************************/
+void insert_rx_pq(int8_t buf_index, int8_t prio, uint16_t addr, int8_t rssi)
+{
+	ReceiveBufferUDP *buf = &rx_buf_udp[buf_index];
+	ReceiveBufferManager *rbm = &rx_buf_mgr[buf -> rbm];
 	
-	if(DEBUG_BM == 2)
+	buf -> status = FULL;
+	buf -> prio = prio;
+	buf -> srcAddr = addr;
+	buf -> rssi = rssi;
+	buf -> next = -1;
+	
+	// segments of the same priority are delivered in order of arrival 
+	if(rbm -> tail_pq[prio] == -1)
 	{
-		nrk_kprintf(PSTR("BM: insert_rx_pq(): Inside 7\r\n"));
+		rbm -> head_pq[prio] = buf_index;
+		rbm -> prio_mask |= (uint32_t)1 << prio;
 	}
+	else
+		rx_buf_udp[rbm -> tail_pq[prio]].next = buf_index;
+	rbm -> tail_pq[prio] = buf_index;
+	rbm -> countQueued++;
+	
 	return;
 }
 /*************************************************************************************************/
-ReceiveBufferUDP* remove_rx_pq(int8_t rbm_index)
+int8_t remove_rx_pq(int8_t rbm_index)
 {
-	// The remove is always done from the head of the queue since its a priority queue	
-	ReceiveBufferUDP *ptr;
+	ReceiveBufferManager *rbm = &rx_buf_mgr[rbm_index];
+	int8_t prio;
+	int8_t i;
 	
-	if(rx_buf_mgr[rbm_index].head_pq == NULL)	// no more queued segments
+	if(rbm -> prio_mask == 0)	// no more queued segments
+		return NRK_ERROR;
+	
+	prio = highest_prio(rbm -> prio_mask);
+	i = rbm -> head_pq[prio];
+	rbm -> head_pq[prio] = rx_buf_udp[i].next;
+	if(rbm -> head_pq[prio] == -1)	// that was the last segment of this level 
 	{
-		return NULL;
+		rbm -> tail_pq[prio] = -1;
+		rbm -> prio_mask &= ~( (uint32_t)1 << prio );
 	}
-		
-	if(rx_buf_mgr[rbm_index].head_pq == rx_buf_mgr[rbm_index].tail_pq)	// only one buffer in queue 
-		rx_buf_mgr[rbm_index].tail_pq = NULL;
-		
-	ptr = rx_buf_mgr[rbm_index].head_pq;
+	rbm -> countQueued--;
 	
-	rx_buf_mgr[rbm_index].head_pq = rx_buf_mgr[rbm_index].head_pq -> next;
-		
-	return ptr;
+	rx_buf_udp[i].status = HELD;
+	rx_buf_udp[i].next = -1;
+	rbm -> countHeld++;
+	
+	return i;
 }
 /*************************************************************************************************/
 
-void insert_rx_fq(ReceiveBufferUDP *buf, int8_t rbm_index, int8_t status)
+void insert_rx_fq(int8_t buf_index, int8_t rbm_index)
 {
-	// the insert is always done at the tail of the queue 
-	if(rx_buf_mgr[rbm_index].head_fq == NULL)	// the free queue is empty 
-	{
-		rx_buf_mgr[rbm_index].head_fq = rx_buf_mgr[rbm_index].tail_fq = buf;
-		buf -> next = NULL;
-	}	
-	else
-	{
-		rx_buf_mgr[rbm_index].tail_fq -> next = buf;
-		buf -> next = NULL;
-		rx_buf_mgr[rbm_index].tail_fq = buf;
-	}
-
-	if(status == EMPTY)	// this function was called from bind() / setReceiveQueueSize()
-	{
-		rx_buf_mgr[rbm_index].countFree++;
-		buf -> status = EMPTY;
-	}
+	// the free queue is a stack, any EMPTY buffer is as good as another 
+	rx_buf_udp[buf_index].status = EMPTY;
+	rx_buf_udp[buf_index].rbm = rbm_index;
+	rx_buf_udp[buf_index].next = rx_buf_mgr[rbm_index].head_fq;
+	rx_buf_mgr[rbm_index].head_fq = buf_index;
+	rx_buf_mgr[rbm_index].countFree++;
 	
 	return;
 }
 
 /***************************************************************************************************/
-ReceiveBufferUDP* remove_rx_fq(int8_t rbm_index, int8_t status)
+int8_t remove_rx_fq(int8_t rbm_index)
 {
-	// This function removes the next receive buffer from the free queue having a given status 	
-	ReceiveBufferUDP *ptr;
-	ReceiveBufferUDP *prev = NULL;
+	int8_t i = rx_buf_mgr[rbm_index].head_fq;
 	
-	if(rx_buf_mgr[rbm_index].head_fq == NULL)	// no buffers remaining in free queue	
-		return NULL;
+	if(i == -1)				// no buffers remaining in free queue	
+		return NRK_ERROR;
 		
-	ptr = rx_buf_mgr[rbm_index].head_fq;
-	while(ptr != NULL)
+	rx_buf_mgr[rbm_index].head_fq = rx_buf_udp[i].next;
+	rx_buf_mgr[rbm_index].countFree--;
+	rx_buf_udp[i].next = -1;
+	
+	return i;
+}
+/***************************************************************************************************/
+int8_t release_rx_bufs(int8_t rbm_index)
+{
+	int8_t i;
+	int8_t count = 0;
+	
+	for(i = 0; i < MAX_RX_QUEUE_SIZE; i++)
 	{
-		if(status == EMPTY)
+		if(rx_buf_udp[i].rbm == rbm_index)
 		{
-			if(ptr -> status == EMPTY)
-				break;
+			rx_buf_udp[i].status = UNALLOCATED;
+			rx_buf_udp[i].rbm = -1;
+			rx_buf_udp[i].next = -1;
+			count++;
 		}
-		else if(ptr -> status == FULL)	// status = FULL 
-				break;
-		prev = ptr;		
-		ptr = ptr -> next;
-	}	
-	if(ptr == NULL)	// the EMPTY / FULL buffer was not found in the free queue
-		return NULL;
+	}
 	
-	if(prev == NULL)	// the EMPTY / FULL buffer is at the head of the queue
+	rx_buf_mgr[rbm_index].pid = INVALID_PID;
+	rx_buf_mgr[rbm_index].pindex = -1;			// indicates absence of rbm/port mapping 
+	rx_buf_mgr[rbm_index].head_fq = -1;
+	for(i = 0; i < NUM_RX_PRIO_LEVELS; i++)
 	{
-		if(rx_buf_mgr[rbm_index].head_fq == rx_buf_mgr[rbm_index].tail_fq)	// only one buffer in free queue
-			rx_buf_mgr[rbm_index].tail_fq = NULL;
-			
-		rx_buf_mgr[rbm_index].head_fq = rx_buf_mgr[rbm_index].head_fq -> next;
-		if(status == EMPTY)
-			rx_buf_mgr[rbm_index].countFree--;
-		return ptr;
+		rx_buf_mgr[rbm_index].head_pq[i] = -1;
+		rx_buf_mgr[rbm_index].tail_pq[i] = -1;
 	}
+	rx_buf_mgr[rbm_index].prio_mask = 0;
+	rx_buf_mgr[rbm_index].countTotal = 0;
+	rx_buf_mgr[rbm_index].countFree = 0;
+	rx_buf_mgr[rbm_index].countQueued = 0;
+	rx_buf_mgr[rbm_index].countHeld = 0;
 	
-	// EMPTY / FREE buffer is somewhere in the free queue 
-	prev -> next = ptr -> next;
-	if(status == EMPTY)
-		rx_buf_mgr[rbm_index].countFree--;
-	return ptr;
+	return count;
+}
+/***************************************************************************************************/
+int8_t data_to_rx_buf_index(uint8_t *ptr)
+{
+	int8_t i;
+	
+	for(i = 0; i < MAX_RX_QUEUE_SIZE; i++)
+		if(ptr == rx_buf_udp[i].seg.data)
+			return i;
+			
+	return NRK_ERROR;
 }
 /*********************************************************************************************/
 
@@ -1181,19 +1080,7 @@ TransmitBuffer* remove_tx_fq()
 
 int8_t get_in_process_buf_count(int8_t rbm_index)
 {
-	int8_t count = 0;
-	
-	ReceiveBufferUDP *ptr = rx_buf_mgr[rbm_index].head_fq;
-	
-	while(ptr != NULL)
-	{
-		if(ptr -> status == FULL)
-			count++;
-		
-		ptr = ptr -> next;
-	}
-	
-	return count;
+	return rx_buf_mgr[rbm_index].countHeld;
 }
 /***************************************************************************************************/
 int8_t get_num_bufs_free()
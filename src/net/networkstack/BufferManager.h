@@ -47,6 +47,7 @@
 #define UNALLOCATED 			1	// has not been given to any user task 
 #define EMPTY					2 	// allocated and free to receive the next segment from the network layer 
 #define FULL					3	// allocated and contains a segment received from the network layer 
+#define HELD					4	// returned by receive(), belongs to the task until release_buffer() 
 
 // the constants 'FULL' and 'EMPTY' also apply to the 'status' field of the TransmitBuffer
 // with the obvious meanings 
@@ -57,6 +58,13 @@
 
 // priority level of task ....SHIFT this to Anthony's code 
 #define MAX_TASK_PRIORITY 19   
+
+// number of receive priority FIFOs per port, one per segment priority 
+#define NUM_RX_PRIO_LEVELS (MAX_PRIORITY + 1)
+
+#if MAX_PRIORITY > 31
+#error "MAX_PRIORITY must fit in the 32 bit prio_mask of ReceiveBufferManager"
+#endif
  
 /***************************** DATA STRUCTURES ****************************************/
 
@@ -68,19 +76,22 @@ typedef struct ReceiveBufferUDP
 												// this is set by the sending node 
 	int8_t rssi;							// signal strength with which the underlying packet was received
 	uint16_t srcAddr;						// node from which this segment was sent  
-	struct ReceiveBufferUDP *next;	// pointer for link list creation 
+	int8_t rbm;								// index of the rbm element owning this buffer, -1 if UNALLOCATED 
+	int8_t next;							// index of the next buffer in the same queue, -1 ends the queue 
 }ReceiveBufferUDP;
 
 typedef struct
 {
 	int8_t pid;								// pid of task associated with the port
 	int8_t pindex;							// index of associated port element 
-	ReceiveBufferUDP *head_fq;			// pointer to head of free queue (EMPTY or FULL buffers)
-	ReceiveBufferUDP *tail_fq;			// pointer to tail of free queue (EMPTY or FULL buffers) 
-	ReceiveBufferUDP *head_pq; 		// pointer to head of port queue (FULL buffers)	
-	ReceiveBufferUDP *tail_pq; 		// pointer to tail of port queue (FULL buffers) 
+	int8_t head_fq;						// index of the first EMPTY buffer of this port, -1 if none 
+	int8_t head_pq[NUM_RX_PRIO_LEVELS];	// head of the FIFO of FULL buffers of each priority 
+	int8_t tail_pq[NUM_RX_PRIO_LEVELS];	// tail of the FIFO of FULL buffers of each priority 
+	uint32_t prio_mask;					// bit 'prio' is set while the FIFO of priority 'prio' is not empty 
 	int8_t countTotal;					// total number of buffers reserved for this port 
 	int8_t countFree;						// number of buffers EMPTY at any time 
+	int8_t countQueued;					// number of FULL buffers waiting in the priority FIFOs 
+	int8_t countHeld;						// number of HELD buffers not yet released by the task 
 }ReceiveBufferManager;					// one for every port in the system 
 
 typedef struct TransmitBuffer
@@ -180,12 +191,27 @@ This function finds the index of the port element corresponding to a given port
 	Comments:	private function
 */
 
-void insert_rx_pq(Transport_Segment_UDP *seg, int8_t prio, uint16_t addr, int8_t rssi);
+int8_t reserve_rx_buf(int8_t rbm_index, int8_t prio);
 /*
-This function inserts a given transport layer segment into the port queue of a given port 
-as per its priority level
+This function finds a receive buffer of a given port to hold a new segment of a given 
+priority. An EMPTY buffer is taken if there is one. Otherwise the most recent segment of 
+the lowest queued priority is evicted if it is less important than the new one, or of 
+the same priority with the excess policy set to OVERWRITE 
 
-	PARAMS:		seg:	pointer to the segment to be added to the queue
+	PARAMS:		rbm_index: the index of the relevant receive buffer manager
+					prio: priority level of the new segment 
+					
+	RETURNS:		index of the buffer to fill in, to be passed to insert_rx_pq() 
+					NRK_ERROR if the new segment has to be dropped 
+	COMMENTS:	private function 
+*/
+
+void insert_rx_pq(int8_t buf_index, int8_t prio, uint16_t addr, int8_t rssi);
+/*
+This function appends a filled receive buffer to the FIFO of its priority level in the 
+port queue of the port that owns it 
+
+	PARAMS:		buf_index: index of the buffer returned by reserve_rx_buf() 
 					prio: priority level of this segment. Set by the sending node
 					addr: address of sending node
 					rssi: signal strength with which the underlying packet was received over the radio 
@@ -194,36 +220,52 @@ as per its priority level
 	COMMENTS:	private function 
 */
 
-ReceiveBufferUDP* remove_rx_pq(int8_t rbm_index);
+int8_t remove_rx_pq(int8_t rbm_index);
 /*
-This function removes the receive buffer at the head of a given port queue
+This function removes the oldest segment of the highest priority from a given port queue 
+and marks its buffer HELD 
 
 	PARAMS:		rbm_index: the index of the relevant receive buffer manager
-	RETURNS:		pointer to the receive buffer or NULL if the port queue is empty 
+	RETURNS:		index of the receive buffer or NRK_ERROR if the port queue is empty 
 	COMMENTS: 	private function
 */ 
 
-void insert_rx_fq(ReceiveBufferUDP *buf, int8_t rbm_index, int8_t status);
+void insert_rx_fq(int8_t buf_index, int8_t rbm_index);
 /* 
-This function inserts a given receive buffer into the free queue of a given port
-and sets its status field
+This function gives a receive buffer to the free queue of a given port and marks it EMPTY 
 
-	PARAMS:		buf:	pointer to the receive buffer
+	PARAMS:		buf_index: index of the receive buffer 
 					rbm_index: the index of the relevant receive buffer manager
-					status: EMPTY or FULL
 					
 	RETURNS:		None
 	COMMENTS:	private function 
 */ 
 
-ReceiveBufferUDP* remove_rx_fq(int8_t rbm_index, int8_t status);
+int8_t remove_rx_fq(int8_t rbm_index);
 /*
-This function removes a receive buffer from the free queue with the given status
+This function removes an EMPTY receive buffer from the free queue of a given port 
 
 	PARAMS:		rbm_index: the index of the relevant receive buffer manager
-					status: EMPTY or FULL
-					
-	RETURNS:		pointer to the receive buffer or NULL if no such buffer is found
+	RETURNS:		index of the receive buffer or NRK_ERROR if the free queue is empty 
+	COMMENTS:	private function
+*/	
+
+int8_t release_rx_bufs(int8_t rbm_index);
+/*
+This function returns every receive buffer owned by a given port to the pool and resets 
+the receive buffer manager 
+
+	PARAMS:		rbm_index: the index of the relevant receive buffer manager
+	RETURNS:		number of buffers returned to the pool 
+	COMMENTS:	private function
+*/	
+
+int8_t data_to_rx_buf_index(uint8_t *ptr);
+/*
+This function finds the receive buffer whose segment data starts at a given address 
+
+	PARAMS:		ptr: pointer returned by receive()
+	RETURNS:		index of the receive buffer or NRK_ERROR if there is no such buffer 
 	COMMENTS:	private function
 */	
 
@@ -270,10 +312,10 @@ This function removes a transmit buffer from the free queue
 
 int8_t get_in_process_buf_count(int8_t rbm_index);
 /*
-This function returns the number of FULL buffers in the free queue associated with a given port
+This function returns the number of HELD buffers associated with a given port
 
 	PARAMS:		rbm_index: the index of the relevant receive buffer manager
-	RETURNS:		number of FULL buffers in the free queue 
+	RETURNS:		number of HELD buffers 
 	COMMENTS:	private function
 */ 
 
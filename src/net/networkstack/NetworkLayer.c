@@ -57,8 +57,11 @@ extern void print_seg(Transport_Segment_UDP*);
 //From BufferManager.c 
 extern nrk_sem_t *bm_sem;
 extern ReceiveBufferManager rx_buf_mgr[];
+extern ReceiveBufferUDP rx_buf_udp[];
 
-extern void insert_rx_pq(Transport_Segment_UDP*, int8_t, uint16_t, int8_t);
+extern int8_t reserve_rx_buf(int8_t, int8_t);
+extern void insert_rx_pq(int8_t, int8_t, uint16_t, int8_t);
+extern int8_t port_to_rbm_index(uint8_t);
 extern TransmitBuffer* remove_tx_aq();
 extern void insert_tx_fq(TransmitBuffer*);
 extern void enter_cr(nrk_sem_t *, int8_t);
@@ -366,57 +369,21 @@ void process_app_pkt(NW_Packet *pkt, int8_t rssi)
 		
 	if(tl_type(pkt -> type) == UDP)				// the TL protocol is UDP 
 	{
+		int8_t port_index, rbm_index, buf_index;
+		
 		// unpack the UDP header					
 		unpack_TL_UDP_header(&udp_seg, pkt -> data); 
-		// copy the application payload into the data section of the UDP segment					
-		memcpy(udp_seg.data, pkt -> data + SIZE_TRANSPORT_UDP_HEADER, MAX_APP_PAYLOAD);  
+		
+		enter_cr(bm_sem, 28);
+		enter_cr(tl_sem, 28);
+		port_index = port_to_port_index(udp_seg.destPort);
+		rbm_index = port_to_rbm_index(udp_seg.destPort);
+		leave_cr(tl_sem, 28);
 		
 		// check to see if the destination port in the header is associated with any socket 
-		if(is_port_associated(udp_seg.destPort) == TRUE)	// yes there is 
-		{
-			int8_t port_index;
-			
-			enter_cr(bm_sem, 28);
-			enter_cr(tl_sem, 28);
-				
-			
-			if(DEBUG_NL == 2)
-			{
-				;
-				//nrk_kprintf(PSTR("NL: process_app_pkt(): Received segment = "));
-				//print_seg(&udp_seg);
-				nrk_kprintf(PSTR("NL: process_app_pkt(): Before inserting into port queue\r\n"));
-			}			
-			insert_rx_pq(&udp_seg, pkt -> prio, pkt -> src, rssi);
-			if(DEBUG_NL == 2)
-			{
-				nrk_kprintf(PSTR("NL: process_app_pkt(): After inserting into port queue\r\n"));
-			}				
-			
-			port_index = port_to_port_index(udp_seg.destPort); // extract the relevant port element 
-			if(port_index == NRK_ERROR)	//sanity check for debugging
-			{
-				nrk_int_disable();
-				nrk_led_set(RED_LED);
-				while(1)
-					nrk_kprintf(PSTR("NL: process_app_pkt(): Bug detected in implementation of port/rbm element array\r\n"));
-			}			
-			ret = nrk_event_signal(ports[port_index].data_arrived_signal);	// signal 'data arrived'
-						
-			if(ret == NRK_ERROR)
-			{
-				if(nrk_errno_get() == 1)	// this means the signal was not created. This is a bug
-				{
-					nrk_int_disable();
-					nrk_led_set(RED_LED);
-					while(1)
-						nrk_kprintf(PSTR("NL: process_app_pkt(): Bug detected in implementation of port signals\r\n"));
-				}				
-			} // end if(ret == NRK_ERROR)
-		} // end if(is_port_associated())
-	
-		else // if there is no socket associated with this port, simply drop the packet
+		if(rbm_index == NRK_ERROR)	// no, simply drop the packet
 		{
+			leave_cr(bm_sem, 28);
 			if(DEBUG_NL == 0)
 			{
 				nrk_kprintf(PSTR("Unassociated port found: "));
@@ -424,11 +391,49 @@ void process_app_pkt(NW_Packet *pkt, int8_t rssi)
 			}
 				
 			record_unassociated_socket_pkt(pkt);	// record this fact 
+			return;
 		}
 		
-		leave_cr(tl_sem, 28);	
+		if(DEBUG_NL == 2)
+			nrk_kprintf(PSTR("NL: process_app_pkt(): Before inserting into port queue\r\n"));
+		
+		// the segment is unpacked straight into the receive buffer it is queued in 
+		buf_index = reserve_rx_buf(rbm_index, pkt -> prio);
+		if(buf_index != NRK_ERROR)
+		{
+			rx_buf_udp[buf_index].seg.srcPort = udp_seg.srcPort;
+			rx_buf_udp[buf_index].seg.destPort = udp_seg.destPort;
+			rx_buf_udp[buf_index].seg.length = udp_seg.length;
+			memcpy(rx_buf_udp[buf_index].seg.data, pkt -> data + SIZE_TRANSPORT_UDP_HEADER, MAX_APP_PAYLOAD);
+			insert_rx_pq(buf_index, pkt -> prio, pkt -> src, rssi);
+		}
 		leave_cr(bm_sem, 28);
 		
+		if(DEBUG_NL == 2)
+			nrk_kprintf(PSTR("NL: process_app_pkt(): After inserting into port queue\r\n"));
+		
+		if(buf_index == NRK_ERROR)	// dropped as per the excess policy 
+			return;
+		
+		if(port_index == NRK_ERROR)	//sanity check for debugging
+		{
+			nrk_int_disable();
+			nrk_led_set(RED_LED);
+			while(1)
+				nrk_kprintf(PSTR("NL: process_app_pkt(): Bug detected in implementation of port/rbm element array\r\n"));
+		}			
+		ret = nrk_event_signal(ports[port_index].data_arrived_signal);	// signal 'data arrived'
+					
+		if(ret == NRK_ERROR)
+		{
+			if(nrk_errno_get() == 1)	// this means the signal was not created. This is a bug
+			{
+				nrk_int_disable();
+				nrk_led_set(RED_LED);
+				while(1)
+					nrk_kprintf(PSTR("NL: process_app_pkt(): Bug detected in implementation of port signals\r\n"));
+			}				
+		} // end if(ret == NRK_ERROR)
 	} // end if(tl_layer == UDP)
 	else // as of now UDP is the only supported transport layer, hence print an error
 	{
@@ -66,10 +66,15 @@ extern nrk_sem_t *bm_sem;
 extern void enter_cr(nrk_sem_t *, int8_t);
 extern void leave_cr(nrk_sem_t *, int8_t);
 extern int8_t get_num_bufs_free();
-extern void insert_rx_fq(ReceiveBufferUDP*, int8_t, int8_t);
+extern void insert_rx_fq(int8_t, int8_t);
 extern int8_t insert_tx_aq(NW_Packet *);
 extern int8_t get_in_process_buf_count(int8_t);
-extern ReceiveBufferUDP* remove_rx_pq(int8_t);
+extern int8_t remove_rx_pq(int8_t);
+extern int8_t reserve_rx_buf(int8_t, int8_t);
+extern void insert_rx_pq(int8_t, int8_t, uint16_t, int8_t);
+extern int8_t release_rx_bufs(int8_t);
+extern int8_t data_to_rx_buf_index(uint8_t *);
+extern int8_t port_to_rbm_index(uint8_t);
 extern void print_tx_buffer();
 
 // From NetworkLayer.c
@@ -474,7 +479,7 @@ int8_t bind(int8_t sock_num, int16_t port)
 				nrk_kprintf(PSTR("bind(): Bug found in implementation of num_bufs_free\r\n"));
 		}
 		
-		insert_rx_fq(&rx_buf_udp[buf_index], rbm_index, EMPTY);	// insert the buffer in the free queue of the port
+		insert_rx_fq(buf_index, rbm_index);	// insert the buffer in the free queue of the port
 		rx_buf_mgr[rbm_index].countTotal++; 						// increment the countTotal for this port 
 		num_bufs_free--;		
 	}
@@ -665,7 +670,7 @@ int8_t set_rx_queue_size(int8_t sock_num, int8_t size)
 			while(1)
 				nrk_kprintf(PSTR("set_rx_queue_size(): Bug found in implementation of num_bufs_free\r\n"));
 		}		
-		insert_rx_fq(&rx_buf_udp[buf_index], rbm_index, EMPTY);	// insert the buffer in the free queue of the port
+		insert_rx_fq(buf_index, rbm_index);	// insert the buffer in the free queue of the port
 		rx_buf_mgr[rbm_index].countTotal++; 
 		num_bufs_free--;		
 	}
@@ -681,7 +686,8 @@ int8_t set_rx_queue_size(int8_t sock_num, int8_t size)
 /**************************************************************************************************/
 int8_t release_buffer(int8_t sock_num, uint8_t *ptr)
 {
-	ReceiveBufferUDP *buf;			// pointer to traverse the buffer list of the free queue 
+	int8_t buf_index;				// index of the receive buffer holding 'ptr' 
+	int8_t rbm_index;
 	
 	enter_cr(bm_sem, 11);	
 	enter_cr(tl_sem, 11);	
@@ -731,14 +737,10 @@ int8_t release_buffer(int8_t sock_num, uint8_t *ptr)
 	}
 	
 	// check to see if the pointer passed is valid
-	buf = rx_buf_mgr[sock[sock_num].rbmindex].head_fq;
-	while(buf != NULL)
-	{
-		if( (ptr == (buf -> seg).data) && (buf -> status == FULL) )	
-			break;
-		buf = buf -> next;
-	}
-	if(buf == NULL)		// the buffer was not found
+	rbm_index = sock[sock_num].rbmindex;
+	buf_index = data_to_rx_buf_index(ptr);
+	if( buf_index == NRK_ERROR || rx_buf_udp[buf_index].rbm != rbm_index ||
+		 rx_buf_udp[buf_index].status != HELD )		// the buffer was not found
 	{
 		_nrk_errno_set(INVALID_ARGUMENT);
 		
@@ -747,8 +749,8 @@ int8_t release_buffer(int8_t sock_num, uint8_t *ptr)
 		return NRK_ERROR;
 	}
 		
-	buf -> status = EMPTY;		// mark the buffer as available now
-	rx_buf_mgr[sock[sock_num].rbmindex].countFree++; 
+	rx_buf_mgr[rbm_index].countHeld--;
+	insert_rx_fq(buf_index, rbm_index);		// mark the buffer as available now
 	
 	leave_cr(tl_sem, 11);	
 	leave_cr(bm_sem, 11);
@@ -757,8 +759,6 @@ int8_t release_buffer(int8_t sock_num, uint8_t *ptr)
 /*************************************************************************************************/
 int8_t close_socket(int8_t sock_num)
 {
-	ReceiveBufferUDP *ptr;	// temp variable 
-		
 	enter_cr(bm_sem, 12);
 	enter_cr(tl_sem, 12);
 	
@@ -801,22 +801,8 @@ int8_t close_socket(int8_t sock_num)
 			while(1)
 				nrk_kprintf(PSTR("close_socket(): Bug discovered in implementation of port /rbm element array\r\n"));
 		}		
-		// remove all the FULL buffers from the port queue 			
-		while( (ptr = remove_rx_pq(sock[sock_num].rbmindex)) != NULL )		
-			ptr -> status = UNALLOCATED;		
-			
-		// remove all the EMPTY buffers from the free queue 		
-		while( (ptr = remove_rx_fq(sock[sock_num].rbmindex, EMPTY)) != NULL ) 
-			ptr -> status = UNALLOCATED;
-			
-		// remove all the FULL buffers from the free queue 		
-		while( (ptr = remove_rx_fq(sock[sock_num].rbmindex,FULL)) != NULL )
-			ptr -> status = UNALLOCATED;
-			
-		rx_buf_mgr[sock[sock_num].rbmindex].pid = INVALID_PID;
-		rx_buf_mgr[sock[sock_num].rbmindex].pindex = -1;
-		rx_buf_mgr[sock[sock_num].rbmindex].countTotal = 0;
-		rx_buf_mgr[sock[sock_num].rbmindex].countFree = 0;
+		// give the EMPTY, queued and held buffers of the port back to the pool 
+		num_bufs_free += release_rx_bufs(sock[sock_num].rbmindex);
 		
 		release_port(sock[sock_num].pindex);
 	}  
@@ -1018,7 +1004,7 @@ int8_t send(int8_t sock_num, int8_t *ptr, int8_t len, int32_t dest_addr, int16_t
 		rx_buf_mgr[rbm_index].pid = nrk_get_pid();
 		
 		// insert a rx buffer in the free queue 
-		insert_rx_fq(&rx_buf_udp[buf_index], rbm_index, EMPTY);
+		insert_rx_fq(buf_index, rbm_index);
 		rx_buf_mgr[rbm_index].countTotal++; 	// increment the countTotal for this port 
 		num_bufs_free--;
 	
@@ -1077,10 +1063,30 @@ int8_t send(int8_t sock_num, int8_t *ptr, int8_t len, int32_t dest_addr, int16_t
 			break;
 			
 		case SOCK_IPC:
-			insert_rx_pq(&udp_seg, prio, NODE_ADDR, INVALID_RSSI);
+		{
+			int8_t buf_index, rbm_index;
+			
+			rbm_index = port_to_rbm_index(udp_seg.destPort);
 			leave_cr(tl_sem, 14);
+			if(rbm_index == NRK_ERROR)	// nobody is listening on the destination port 
+			{
+				leave_cr(bm_sem, 14);
+				break;
+			}
+			
+			// fill the receiving port's buffer in place 
+			buf_index = reserve_rx_buf(rbm_index, prio);
+			if(buf_index != NRK_ERROR)
+			{
+				rx_buf_udp[buf_index].seg.srcPort = udp_seg.srcPort;
+				rx_buf_udp[buf_index].seg.destPort = udp_seg.destPort;
+				rx_buf_udp[buf_index].seg.length = len;
+				memcpy(rx_buf_udp[buf_index].seg.data, ptr, len);
+				insert_rx_pq(buf_index, prio, NODE_ADDR, INVALID_RSSI);
+			}
 			leave_cr(bm_sem, 14);
 			break;
+		}
 			
 		default:		// this should never happen
 			nrk_int_disable();
@@ -1141,8 +1147,9 @@ int8_t set_timeout(int8_t sock_num, int8_t secs, int8_t nano_secs)
 uint8_t* receive(int8_t sock_num, int8_t *len, uint16_t *srcAddr, uint8_t *srcPort, int8_t *rssi)
 {
 	nrk_sig_mask_t my_sigs; 	// to hold the return value of network layer signals 
-	ReceiveBufferUDP *buf;		// temporary variable 
+	ReceiveBufferUDP *buf;		// buffer handed to the calling task 
 	Transport_Segment_UDP *seg;// pointer to received segment from the network layer 
+	int8_t buf_index;				// index of that buffer 
 	int8_t rbm_index;				// to store the index of the corresponding receive buffer manager
 	int8_t port_index;			// to store the index of the port element  
 	
@@ -1201,7 +1208,7 @@ uint8_t* receive(int8_t sock_num, int8_t *len, uint16_t *srcAddr, uint8_t *srcPo
 			nrk_kprintf(PSTR("receive(): Inside the section that relates to 'without timeout' receive\r\n"));
 		
 		// check the receive buffer manager for this port to see if there are any queued segments
-		if(rx_buf_mgr[rbm_index].countFree == rx_buf_mgr[rbm_index].countTotal)	// no queued segments 
+		if(rx_buf_mgr[rbm_index].countQueued == 0)	// no queued segments 
 		{
 			if(DEBUG_TL == 2)
 			{
@@ -1260,7 +1267,7 @@ uint8_t* receive(int8_t sock_num, int8_t *len, uint16_t *srcAddr, uint8_t *srcPo
 				nrk_kprintf(PSTR("receive(): Error returned by nrk_set_next_wakeup\r\n"));
 		}		
 		// check the receive manager for this port to see if there are any queued segments
-		if(rx_buf_mgr[rbm_index].countFree == rx_buf_mgr[rbm_index].countTotal)	// no queued segments 
+		if(rx_buf_mgr[rbm_index].countQueued == 0)	// no queued segments 
 		{
 			if(DEBUG_TL == 2)
 			{
@@ -1321,15 +1328,15 @@ uint8_t* receive(int8_t sock_num, int8_t *len, uint16_t *srcAddr, uint8_t *srcPo
    // 2. The rx queue was not empty and no wait() was done
    // In either case, retrieve the segment and return back to user task 
    
-   buf = remove_rx_pq(rbm_index);	// remove the buffer from the port queue 
-   if(buf == NULL)	// this should not happen 
+   buf_index = remove_rx_pq(rbm_index);	// take the buffer out of the port queue, it is now HELD 
+   if(buf_index == NRK_ERROR)	// this should not happen 
    {
    	nrk_int_disable();
 		nrk_led_set(RED_LED);
 		while(1)
 			nrk_kprintf(PSTR("receive(): Bug found in implementation of data_arrived_signal / rx buffer mgmt\r\n"));
 	}
-   insert_rx_fq(buf, rbm_index, FULL);	// insert the buffer into the free queue with status = FULL 
+   buf = &rx_buf_udp[buf_index];
    seg = &(buf -> seg);
    
    // fill up the values to be returned to the calling task 
@@ -1350,7 +1357,7 @@ uint8_t* receive(int8_t sock_num, int8_t *len, uint16_t *srcAddr, uint8_t *srcPo
 int8_t check_receive_queue(int8_t sock_num)
 {
 	int8_t rbm_index;			// to store the index of rbm element associated with the socket	
-	int8_t count1, count2, count3;
+	int8_t count;
 	
 	enter_cr(bm_sem, 17);
 	enter_cr(tl_sem, 17);
@@ -1375,13 +1382,11 @@ int8_t check_receive_queue(int8_t sock_num)
 	}
 	
 	rbm_index = sock[sock_num].rbmindex;
-	count1 = rx_buf_mgr[rbm_index].countTotal;
-	count2 = rx_buf_mgr[rbm_index].countFree;
-	count3 = get_in_process_buf_count(rbm_index);
+	count = rx_buf_mgr[rbm_index].countQueued;
 	
 	leave_cr(tl_sem, 17);
 	leave_cr(bm_sem, 17);
-	return count1 - count2 - count3;
+	return count;
 }
 /*****************************************************************************************************/
 int8_t wait_until_send_done(int8_t sock_num)
@@ -499,7 +499,6 @@ rtl_rfRxInfo.pPayload[GLOBAL_SLOT+1]=0xFF;
 	} 
 */
      rtl_set_abs_wakeup (last_sync_slot, 0);
-    _rtl_clear_sched_cache ();
 #ifdef GPIO_RX_DEBUG
     nrk_gpio_clr(NRK_DEBUG_1);
 #endif
@@ -866,6 +865,7 @@ for (i = 0; i < 16; i++) {
         rtl_sched[i] = 0;
         rtl_sched[i] = 0;
     }
+    _rtl_sched_update ();
     rtl_tdma_rx_mask = 0;
     rtl_tdma_tx_mask = 0;
     rtl_rx_data_ready = 0;
@@ -902,7 +902,6 @@ void rtl_start ()
 	}
 
     //_nrk_reset_os_timer ();
-    _rtl_clear_sched_cache ();
     _rtl_ready = 2;
 
 }
@@ -949,7 +948,6 @@ void rtl_nw_task ()
             global_cycle++;
             if (cycle_callback != NULL)
                 cycle_callback (global_cycle);
-            _rtl_clear_sched_cache ();
 
 	    if (rtl_node_mode == RTL_COORDINATOR) {
                 _rtl_sync_ok = 1;
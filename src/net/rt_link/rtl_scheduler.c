@@ -73,6 +73,7 @@ int8_t rtl_set_schedule (rtl_rx_tx_t rx_tx, uint8_t slot, uint8_t sched)
         rtl_sched[dslot] = rtl_sched[dslot] & 0x0F;
         rtl_sched[dslot] = rtl_sched[dslot] | ((sched << 4) & 0xF0);
     }
+    _rtl_sched_update ();
 return NRK_OK;
 /*
    printf( "slot = %d sched = %d\n", slot,sched );
@@ -130,7 +131,7 @@ int8_t rtl_clr_schedule (rtl_rx_tx_t rx_tx, uint8_t slot)
     if (slot > 31)
         return NRK_ERROR;
     t_mask = 0;
-    t_mask = 1 << slot;
+    t_mask = ((uint32_t) 1) << slot;
     if (rx_tx == RTL_RX)
         rtl_tdma_rx_mask &= ~t_mask;
     else
@@ -140,6 +141,8 @@ int8_t rtl_clr_schedule (rtl_rx_tx_t rx_tx, uint8_t slot)
         rtl_sched[dslot] = rtl_sched[dslot] & 0xF0;
     else
         rtl_sched[dslot] = rtl_sched[dslot] & 0x0F;
+    _rtl_sched_update ();
+    return NRK_OK;
 }
 
 /**
@@ -267,85 +270,114 @@ uint16_t _rtl_get_next_abs_wakeup (uint16_t global_slot)
 }
 
 /**
- * _rtl_clear_sched_cache()
+ * _rtl_sched_update()
  *
- * This function is called by the timer interrupt at the
- * start of each TDMA cycle to remove any cached scheduling
- * values.  Only call this if you are reseting the TDMA frames.
+ * This function rebuilds the per level frame masks from rtl_sched.
+ * It has to be called whenever rtl_sched changes.  A slot with schedule
+ * value s first shows up at level s-1 and stays in all higher levels,
+ * so rtl_sched_frame_mask[l] holds every slot used in a frame whose
+ * number has l trailing zeros.
  */
-void _rtl_clear_sched_cache ()
+void _rtl_sched_update ()
 {
-    uint8_t i;
-// FIXME compress this shit later...
-    for (i = 0; i < 32; i++) {
-        rtl_sched_cache[i] = 0;
+    uint8_t slot, level;
+    int8_t s;
+
+    for (level = 0; level < RTL_SCHED_LEVELS; level++)
+        rtl_sched_frame_mask[level] = 0;
+    rtl_sched_min_level = RTL_SCHED_LEVELS;
+
+    for (slot = 0; slot < TDMA_FRAME_SLOTS; slot++) {
+        s = rtl_get_schedule (slot);
+        if (s == 0)
+            continue;
+        s--;
+        if (s >= RTL_SCHED_LEVELS)
+            s = RTL_SCHED_LEVELS - 1;   // every 32 frames or less, only frame 0
+        if (s < rtl_sched_min_level)
+            rtl_sched_min_level = s;
+        for (level = s; level < RTL_SCHED_LEVELS; level++)
+            rtl_sched_frame_mask[level] |= ((uint32_t) 1) << slot;
     }
 }
 
-
 /**
- * rtl_get_slots_until_next_wakeup()
+ * _rtl_first_slot()
  *
- * This function returns the absolute number of slots between the current_slot
- * and the next RX/TX related wakeup.  It uses an internal cache to allow for
- * faster computation.
- *
- * Argument: current_slot is the current slot
- * Return: uint16_t number of slots until the next wakeup
+ * Returns the number of the lowest set bit in mask, which must not be 0.
+ * Looks at a byte at a time and finishes with a nibble table.
  */
-uint16_t rtl_get_slots_until_next_wakeup (uint16_t current_slot)
+static const uint8_t _rtl_nibble_first[16] =
+    { 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+
+uint8_t _rtl_first_slot (uint32_t mask)
 {
-    uint16_t abs_slot;
-    uint16_t min_slot;
-    uint8_t test_slot;
-    uint8_t test_frame;
-    uint8_t frame_inc;
+    uint8_t bit, b;
 
-//total_slot = (((uint16_t)current_frame)<<5) + current_slot; 
-    min_slot = MAX_SLOTS + 1;
-    for (test_slot = 0; test_slot < 32; test_slot++) {
-        uint8_t s;
-        s = rtl_get_schedule (test_slot);
-        if (s == 0)
-            continue;
-        s--;
-        //test_frame=0;   
-        test_frame = rtl_sched_cache[test_slot];
-        frame_inc = _rtl_pow (2, s);
-        do {
-            abs_slot = (((uint16_t) test_frame) << 5) + test_slot;
-            if (abs_slot <= current_slot)
-                test_frame += frame_inc;
-            //printf_u( "." );
-        } while (abs_slot <= current_slot);
-        rtl_sched_cache[test_slot] = test_frame;
-         //printf( "current_slot = %d,  test_slot = %d, abs_slot=%d\n",current_slot, test_slot, abs_slot );
-        if (abs_slot - current_slot < min_slot && abs_slot < MAX_SLOTS + 1)
-            min_slot = abs_slot - current_slot;
+    bit = 0;
+    while ((mask & 0xFF) == 0) {
+        mask >>= 8;
+        bit += 8;
     }
-// If next slot is in the next TDMA cycle, return 0 to wakeup at the start if the frame.
-    if (min_slot > MAX_SLOTS)
-        return 0;
-    return min_slot;
+    b = mask & 0xFF;
+    if ((b & 0x0F) == 0) {
+        b >>= 4;
+        bit += 4;
+    }
+    return bit + _rtl_nibble_first[b & 0x0F];
 }
 
 /**
- * _rtl_pow()
+ * _rtl_frame_level()
+ *
+ * Number of trailing zeros of a frame number, frame 0 being the top level.
+ */
+static uint8_t _rtl_frame_level (uint8_t frame)
+{
+    if (frame == 0)
+        return RTL_SCHED_LEVELS - 1;
+    return _rtl_first_slot (frame);
+}
+
+
+/**
+ * rtl_get_slots_until_next_wakeup()
  *
- * This is a little helper function to do powers in order to 
- * resolve the schedules.  This is all 8 bit and should not
- * be forced to overflow.
+ * This function returns the absolute number of slots between the current_slot
+ * and the next RX/TX related wakeup.  It looks at the rest of the current
+ * frame first and then jumps straight to the next frame that uses any slot,
+ * so the cost does not depend on the number of scheduled slots.
  *
- * Arguments: x and y to compute x^y
- * Return: x^y
+ * Argument: current_slot is the current slot
+ * Return: uint16_t number of slots until the next wakeup, 0 if there is
+ *         none before the end of the TDMA cycle
  */
-uint8_t _rtl_pow (uint8_t x, uint8_t y)
+uint16_t rtl_get_slots_until_next_wakeup (uint16_t current_slot)
 {
-    uint8_t acc, i;
-    if (y == 0)
-        return 1;
-    acc = x;
-    for (i = 0; i < y - 1; i++)
-        acc = acc * x;
-    return acc;
+    uint32_t mask;
+    uint8_t frame, slot, step;
+
+    if (rtl_sched_min_level >= RTL_SCHED_LEVELS || current_slot >= MAX_SLOTS)
+        return 0;
+    frame = current_slot / TDMA_FRAME_SLOTS;
+    slot = current_slot % TDMA_FRAME_SLOTS;
+
+    // later slots in this frame
+    if (slot < TDMA_FRAME_SLOTS - 1) {
+        mask = rtl_sched_frame_mask[_rtl_frame_level (frame)];
+        mask &= ~((uint32_t) 0) << (slot + 1);
+        if (mask != 0)
+            return _rtl_first_slot (mask) - slot;
+    }
+
+    // Frames that use a slot at all are multiples of 2^min_level
+    if (rtl_sched_min_level == RTL_SCHED_LEVELS - 1)
+        return 0;               // only frame 0 is used
+    step = 1 << rtl_sched_min_level;
+    frame = (frame + step) & ~(step - 1);
+    if (frame >= RTL_FRAMES)
+        return 0;
+    mask = rtl_sched_frame_mask[_rtl_frame_level (frame)];
+    return (((uint16_t) frame) * TDMA_FRAME_SLOTS) + _rtl_first_slot (mask)
+        - current_slot;
 }
@@ -28,8 +28,16 @@
 #define _RTL_SCHEDULER_H_
 
 
+// A slot with schedule value s is used in every 2^(s-1)th frame, so which
+// slots are used in a frame only depends on the trailing zeros of the frame
+// number.  Frames per cycle is 32, so there are 6 such levels (0-4 and
+// frame 0, which uses every scheduled slot).
+#define RTL_SCHED_LEVELS	6
+#define RTL_FRAMES		(MAX_SLOTS / TDMA_FRAME_SLOTS)
+
 uint8_t rtl_sched[16];            // only one since you can TX and RX on the same slot
-uint8_t rtl_sched_cache[32];
+uint32_t rtl_sched_frame_mask[RTL_SCHED_LEVELS];  // slots used at each frame level
+uint8_t rtl_sched_min_level;      // lowest level with a slot, RTL_SCHED_LEVELS if none
 uint16_t rtl_abs_wakeup[MAX_ABS_WAKEUP];  // MSB is the repeat flag
 
 
@@ -37,7 +45,7 @@ void _rtl_clr_abs_all_wakeup ();
 uint16_t _rtl_get_next_abs_wakeup (uint16_t global_slot);
 uint8_t _rtl_match_abs_wakeup (uint16_t global_slot);
 
-uint8_t _rtl_pow (uint8_t x, uint8_t y);
-void _rtl_clear_sched_cache ();
+void _rtl_sched_update ();
+uint8_t _rtl_first_slot (uint32_t mask);
 
 #endif
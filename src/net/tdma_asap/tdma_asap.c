@@ -166,6 +166,28 @@ uint16_t minipkt_id = 0;
 uint8_t tdma_channel   = TDMA_DEFAULT_CHANNEL;
 int8_t tdma_cca_thresh = TDMA_DEFAULT_CCA_THRESH;
 
+// channel hopping state
+uint8_t tdma_hop_active = 0;
+// cycle counter, a cell moves one channel down the hop list per cycle
+uint8_t tdma_cycle;
+// channels the master may hop on
+uint16_t tdma_hop_allowed;
+// hop set in use, and the one nodes switch to at tdma_hop_switch_cycle
+uint16_t tdma_hop_mask;
+uint16_t tdma_hop_next_mask;
+uint8_t tdma_hop_switch_cycle;
+uint8_t tdma_hop_list[TDMA_HOP_NUM_CHANNELS];
+uint8_t tdma_hop_len;
+// channel the current slot runs on
+uint8_t tdma_hop_chan = TDMA_DEFAULT_CHANNEL;
+// evaluations left until a blacklisted channel is tried again
+uint8_t tdma_hop_bl_age[TDMA_HOP_NUM_CHANNELS];
+tdma_chan_stats_t tdma_chan_stats[TDMA_HOP_NUM_CHANNELS];
+
+// default TSCH hopping sequence; the hop set keeps this order
+static const uint8_t tdma_hop_seq[TDMA_HOP_NUM_CHANNELS] =
+    {16, 17, 23, 18, 26, 15, 25, 22, 19, 11, 12, 13, 24, 14, 20, 21};
+
 nrk_time_t current_time;
 nrk_time_t slot_start_time;
 nrk_time_t guard_time;
@@ -373,6 +395,237 @@ int8_t tdma_get_cca_thresh()
   return tdma_cca_thresh;
 }
 
+/**************************************
+ * Channel hopping
+ **************************************/
+
+static uint8_t _tdma_hop_count(uint16_t mask)
+{
+    uint8_t n = 0;
+
+    while (mask)
+    {
+        mask &= mask - 1;
+        n++;
+    }
+    return n;
+}
+
+// Channel masks always include the channel given to tdma_init()
+static uint16_t _tdma_hop_base(uint16_t mask)
+{
+    return mask | ((uint16_t) 1 << (tdma_channel - 11));
+}
+
+static void _tdma_hop_build()
+{
+    uint8_t i;
+
+    tdma_hop_len = 0;
+    for (i = 0; i < TDMA_HOP_NUM_CHANNELS; i++)
+        if (tdma_hop_mask & ((uint16_t) 1 << (tdma_hop_seq[i] - 11)))
+            tdma_hop_list[tdma_hop_len++] = tdma_hop_seq[i];
+}
+
+// Announce a new hop set, everyone switches TDMA_HOP_SWITCH_CYCLES later
+static void _tdma_hop_schedule(uint16_t mask)
+{
+    if (mask == tdma_hop_next_mask)
+        return;
+    tdma_hop_next_mask = mask;
+    tdma_hop_switch_cycle = tdma_cycle + TDMA_HOP_SWITCH_CYCLES;
+}
+
+// Master only: blacklist channels from the statistics of the last window
+static void _tdma_hop_evaluate()
+{
+    tdma_chan_stats_t *st;
+    uint16_t mask, bit;
+    uint8_t i;
+
+    mask = tdma_hop_allowed;
+    for (i = 0; i < TDMA_HOP_NUM_CHANNELS; i++)
+    {
+        bit = (uint16_t) 1 << i;
+        if (!(mask & bit) || i + 11 == tdma_channel)
+            continue;
+
+        st = &tdma_chan_stats[i];
+        if (tdma_hop_bl_age[i] > 0)
+            tdma_hop_bl_age[i]--;
+        else if (st->attempts >= TDMA_HOP_MIN_SAMPLES &&
+                 (uint32_t) st->ok * 100 < (uint32_t) st->attempts * TDMA_HOP_BLACKLIST_PRR)
+        {
+            tdma_hop_bl_age[i] = TDMA_HOP_BLACKLIST_EVALS;
+#ifdef TDMA_TEXT_DEBUG
+            printf("hop: blacklist %d (%u/%u)\r\n", i + 11, st->ok, st->attempts);
+#endif
+        }
+
+        if (tdma_hop_bl_age[i] > 0)
+            mask &= ~bit;
+    }
+    memset(tdma_chan_stats, 0, sizeof(tdma_chan_stats));
+
+    // too many bad channels, the subtrees would share channels.  Keep the
+    // current set and hope the next window looks better.
+    if (_tdma_hop_count(mask) < TDMA_HOP_MIN_CHANNELS)
+        return;
+    _tdma_hop_schedule(mask);
+}
+
+// Called whenever the slot counter wraps around
+static void _tdma_hop_cycle_next()
+{
+    tdma_cycle++;
+    if (!tdma_hop_active)
+        return;
+
+    if (tdma_hop_next_mask != tdma_hop_mask && tdma_cycle == tdma_hop_switch_cycle)
+    {
+        tdma_hop_mask = tdma_hop_next_mask;
+        _tdma_hop_build();
+    }
+    if (tdma_node_mode == TDMA_MASTER && (tdma_cycle % TDMA_HOP_EVAL_CYCLES) == 0)
+        _tdma_hop_evaluate();
+}
+
+// Tune the radio for a slot.  The radio is off between slots, so the new
+// channel is in place before it turns on.  Sync slots stay on the
+// tdma_init() channel, where nodes out of sync listen.  Other cells step
+// one channel per cycle, which is coprime with any hop list length, so
+// each of them visits every channel of the set.
+static void _tdma_hop_tune(tdma_slot_t slot, tdma_slot_type_t type, uint8_t ch_offset)
+{
+    uint16_t idx;
+
+    if (!tdma_hop_active)
+        return;
+
+    if (type == TDMA_TXSYNC || type == TDMA_RXSYNC)
+    {
+        tdma_hop_chan = tdma_channel;
+    }
+    else
+    {
+        idx = (uint16_t) tdma_cycle + slot + ch_offset;
+        tdma_hop_chan = tdma_hop_list[idx % tdma_hop_len];
+    }
+    rf_set_channel(tdma_hop_chan);
+}
+
+// Record whether the packet or handshake of this slot got through
+static void _tdma_chan_stat(uint8_t ok)
+{
+    tdma_chan_stats_t *st = &tdma_chan_stats[tdma_hop_chan - 11];
+
+    if (st->attempts == 0xFFFF)
+    {
+        st->attempts >>= 1;
+        st->ok >>= 1;
+    }
+    st->attempts++;
+    if (ok)
+        st->ok++;
+}
+
+// Put the hop state behind the header of an explicit sync packet.
+// Returns the length of the sync packet.
+static uint8_t _tdma_hop_sync_fill(uint8_t *buf)
+{
+    if (!tdma_hop_active)
+        return TDMA_DATA_START;
+
+    buf[TDMA_HOP_CYCLE] = tdma_cycle;
+    buf[TDMA_HOP_MASK] = tdma_hop_mask >> 8;
+    buf[TDMA_HOP_MASK + 1] = tdma_hop_mask & 0xFF;
+    buf[TDMA_HOP_NEXT_MASK] = tdma_hop_next_mask >> 8;
+    buf[TDMA_HOP_NEXT_MASK + 1] = tdma_hop_next_mask & 0xFF;
+    buf[TDMA_HOP_SWITCH_CYCLE] = tdma_hop_switch_cycle;
+    return TDMA_HOP_INFO_END;
+}
+
+// Take over the hop state of the sync packet in the RX buffer.  A slave
+// starts hopping the first time it hears one.
+static void _tdma_hop_sync_rx()
+{
+    uint8_t *buf = tdma_rfRxInfo.pPayload;
+    uint16_t mask;
+
+    if ((buf[TDMA_TIME_TOKEN] & 0x80) == 0 || tdma_rfRxInfo.length < TDMA_HOP_INFO_END)
+        return;
+
+    tdma_cycle = buf[TDMA_HOP_CYCLE];
+    mask = ((uint16_t) buf[TDMA_HOP_MASK] << 8) | buf[TDMA_HOP_MASK + 1];
+    tdma_hop_next_mask = ((uint16_t) buf[TDMA_HOP_NEXT_MASK] << 8) | buf[TDMA_HOP_NEXT_MASK + 1];
+    tdma_hop_switch_cycle = buf[TDMA_HOP_SWITCH_CYCLE];
+
+    if (!tdma_hop_active || mask != tdma_hop_mask)
+    {
+        tdma_hop_mask = mask;
+        _tdma_hop_build();
+    }
+    tdma_hop_active = 1;
+}
+
+/* tdma_hop_enable
+** Called on the master after tdma_init() and before the TDMA task builds
+** the tree.  chan_mask selects the channels to hop on (bit n is channel
+** 11+n), the channel given to tdma_init() is always added.
+*/
+int8_t tdma_hop_enable(uint16_t chan_mask)
+{
+    if (!tdma_init_done || tdma_node_mode != TDMA_MASTER)
+        return NRK_ERROR;
+
+    chan_mask = _tdma_hop_base(chan_mask);
+    if (_tdma_hop_count(chan_mask) < TDMA_HOP_MIN_CHANNELS)
+        return NRK_ERROR;
+
+    tdma_cycle = 0;
+    tdma_hop_allowed = chan_mask;
+    tdma_hop_mask = chan_mask;
+    tdma_hop_next_mask = chan_mask;
+    _tdma_hop_build();
+    memset(tdma_chan_stats, 0, sizeof(tdma_chan_stats));
+    memset(tdma_hop_bl_age, 0, sizeof(tdma_hop_bl_age));
+    tdma_hop_active = 1;
+    return NRK_OK;
+}
+
+// Master only: restrict the channels to hop on.  The network switches to
+// the new set TDMA_HOP_SWITCH_CYCLES cycles later.
+int8_t tdma_hop_mask_set(uint16_t chan_mask)
+{
+    if (!tdma_hop_active || tdma_node_mode != TDMA_MASTER)
+        return NRK_ERROR;
+
+    chan_mask = _tdma_hop_base(chan_mask);
+    if (_tdma_hop_count(chan_mask) < TDMA_HOP_MIN_CHANNELS)
+        return NRK_ERROR;
+
+    tdma_hop_allowed = chan_mask;
+    memset(tdma_hop_bl_age, 0, sizeof(tdma_hop_bl_age));
+    _tdma_hop_schedule(chan_mask);
+    return NRK_OK;
+}
+
+uint16_t tdma_hop_mask_get()
+{
+    if (!tdma_hop_active)
+        return 0;
+    return tdma_hop_mask;
+}
+
+int8_t tdma_hop_stats_get(uint8_t chan, tdma_chan_stats_t *stats)
+{
+    if (chan < 11 || chan >= 11 + TDMA_HOP_NUM_CHANNELS)
+        return NRK_ERROR;
+
+    *stats = tdma_chan_stats[chan - 11];
+    return NRK_OK;
+}
+
 int8_t tdma_rx_pkt_check()
 {
     return tdma_rx_data_ready;
@@ -532,6 +785,7 @@ uint8_t _tdma_setup()
 
     // Setup the cc2420 chip
     rf_init (&tdma_rfRxInfo, tdma_channel, 0xffff, my_addr16);
+    tdma_hop_chan = tdma_channel;
  
     //FASTSPI_SETREG(CC2420_RSSI, 0xE580); // CCA THR=-25
     //FASTSPI_SETREG(CC2420_TXCTRL, 0x80FF); // TX TURNAROUND = 128 us
@@ -1014,6 +1268,7 @@ else // if a rxsync slot
             if (hst_rx_wait > hst_rx_timeout)
             {
                 //nrk_kprintf(PSTR("m"));
+                _tdma_chan_stat(0);
 #ifdef TDMA_STATS_COLLECT
                 stats_stop_rdo();
                 #ifdef SYNC_HIST
@@ -1098,6 +1353,7 @@ else // if a rxsync slot
 #endif
 
     rf_rx_off ();
+    _tdma_chan_stat(n == 1);
 
 #ifdef GPIO_BASIC_DEBUG
     nrk_gpio_clr(NRK_DEBUG_1);
@@ -1149,6 +1405,7 @@ else // if a rxsync slot
 
             //update my token
             tdma_time_token = tmp_token;
+            _tdma_hop_sync_rx();
 
             // lastly, wait a time to exactly the next slot
             // then reset the OS timer so that
@@ -1180,7 +1437,10 @@ else // if a rxsync slot
 
             sync_slot+=1;
             if (sync_slot >= TDMA_SLOTS_PER_CYCLE)
+            {
                 sync_slot=0;
+                _tdma_hop_cycle_next();
+            }
 
             // we waited until the next slot
             time_of_slot = sync_time;
@@ -1652,6 +1912,8 @@ if (cur_slot.type!=TDMA_TXSYNC)
     #endif
 #endif
 
+        _tdma_chan_stat(!v);
+
         // if channel was clear all the way, master is 
         // NOT giving the OK to send the packet
         if (v)
@@ -2036,6 +2298,14 @@ if (tdma_node_mode == TDMA_MASTER)
                 rf_rx_off();
                 rf_data_mode();
 
+                // out of sync, so the hop sequence is unknown; wait on the
+                // channel that is never blacklisted
+                if (tdma_hop_active)
+                {
+                    tdma_hop_chan = tdma_channel;
+                    rf_set_channel(tdma_channel);
+                }
+
 #ifdef TDMA_STATS_COLLECT
     stats_start_rdo();
 #endif
@@ -2153,6 +2423,7 @@ if (tdma_node_mode == TDMA_MASTER)
                     continue;
                 } 
                 tdma_time_token = tmp_token; //0x7F & tdma_rfRxInfo.pPayload[TDMA_TIME_TOKEN];
+                _tdma_hop_sync_rx();
 
 #ifdef TDMA_SYNC_DEBUG
                 sync_count++;
@@ -2200,7 +2471,10 @@ if (tdma_node_mode == TDMA_MASTER)
 
                 sync_slot+=1;
                 if(sync_slot >= TDMA_SLOTS_PER_CYCLE)
+                {
                     sync_slot = 0;
+                    _tdma_hop_cycle_next();
+                }
 
                 // we waited until the next slot
                 time_of_slot = sync_time;
@@ -2291,6 +2565,10 @@ if (tdma_node_mode == TDMA_MASTER)
         //time_of_slot = get_time_of_next_wakeup(time_of_slot, 
         //                            cur_slot.slot, sync_slot, sync_time);
 
+        // same test as gnw_relative(): the next wakeup is in the next cycle
+        if (tdma_slot >= cur_slot.slot)
+            _tdma_hop_cycle_next();
+
         time_of_slot = gnw_relative(time_of_slot, tdma_slot, cur_slot.slot);
         nrk_time_compact_nanos(&time_of_slot);
 
@@ -2374,6 +2652,7 @@ if (tdma_node_mode == TDMA_MASTER)
         //nrk_led_set(BLUE_LED);
         // the current slot is when I was supposed to wake up
         tdma_slot = cur_slot.slot;
+        _tdma_hop_tune(cur_slot.slot, cur_slot.type, cur_slot.ch_offset);
 
 #ifdef GPIO_NEWTMR_SLT_DEBUG
         PORTA |= BM(GPIO_NEWTMR_SLT_DEBUG);
@@ -2495,7 +2774,7 @@ if (tdma_node_mode == TDMA_MASTER)
             tdma_tx_buf[TDMA_DATA_START] = '\0';
             
             tdma_rfTxInfo.pPayload = tdma_tx_buf;
-            tdma_rfTxInfo.length = TDMA_DATA_START;
+            tdma_rfTxInfo.length = _tdma_hop_sync_fill(tdma_tx_buf);
 
             // This needs to be BEFORE the TX! Otherwise it becomes after the guard time and
             // screws everything up!!
@@ -2590,10 +2869,14 @@ if (tdma_node_mode == TDMA_MASTER)
 
                 if (tx_sync)
                 {
-                    // send a sync packet (use the existing buffer but do not modify it)
+                    // send a sync packet from the internal buffer, so a
+                    // queued data packet is left alone
                     uint8_t tmp_length = tdma_rfTxInfo.length; 
-                    tdma_rfTxInfo.length = TDMA_DATA_START;
+                    uint8_t *tmp_payload = tdma_rfTxInfo.pPayload;
+                    tdma_rfTxInfo.pPayload = tdma_tx_buf;
+                    tdma_rfTxInfo.length = _tdma_hop_sync_fill(tdma_tx_buf);
                     _tdma_tx(cur_slot.slot); // send sync
+                    tdma_rfTxInfo.pPayload = tmp_payload;
                     tdma_rfTxInfo.length = tmp_length;
 #ifdef TDMA_TEXT_DEBUG_ALL
                     nrk_kprintf(PSTR("Sent sync\r\n"));
@@ -223,6 +223,29 @@ This implementation currently provides one RX and one TX buffer, and works with
 
 #define TDMA_DEFAULT_CCA_THRESH        (-35) 
 #define TDMA_DEFAULT_CHANNEL           (18) 
+
+// CHANNEL HOPPING
+// When hopping, the channel of a slot is taken from the hop set at
+// (cycle + slot + channel offset), where the channel offset comes with
+// the schedule entry.  Bit n of a channel mask stands for channel 11+n.
+// The channel passed to tdma_init() is never blacklisted.  Sync slots
+// always run on it, nodes that lost sync listen for sync packets there.
+#define TDMA_HOP_ALL_CHANNELS          0xFFFF
+#define TDMA_HOP_NUM_CHANNELS          16
+// the tree gives every subtree of the root its own offset and lets the
+// subtrees share data slots, so there always have to be enough channels
+// left to keep all of them apart
+#define TDMA_HOP_MIN_CHANNELS          (TREE_MAX_CHILDREN+1)
+// the master looks at its link statistics every so many cycles and
+// drops channels that delivered less than TDMA_HOP_BLACKLIST_PRR percent
+// of at least TDMA_HOP_MIN_SAMPLES packets.  A dropped channel is tried
+// again after TDMA_HOP_BLACKLIST_EVALS evaluations.
+#define TDMA_HOP_EVAL_CYCLES           64
+#define TDMA_HOP_MIN_SAMPLES           16
+#define TDMA_HOP_BLACKLIST_PRR         70
+#define TDMA_HOP_BLACKLIST_EVALS       4
+// a new hop set is announced this many cycles before nodes switch to it
+#define TDMA_HOP_SWITCH_CYCLES         8
                        
 #define TDMA_MAX_PKT_SIZE		116
 
@@ -262,6 +285,23 @@ typedef enum {
 	TDMA_DATA_START=3
 } tdma_pkt_field_t;
 
+// Explicit sync packets carry the hop state behind the header while
+// hopping is on.
+typedef enum {
+	TDMA_HOP_CYCLE=TDMA_DATA_START,
+	TDMA_HOP_MASK=TDMA_DATA_START+1,
+	TDMA_HOP_NEXT_MASK=TDMA_DATA_START+3,
+	TDMA_HOP_SWITCH_CYCLE=TDMA_DATA_START+5,
+	TDMA_HOP_INFO_END=TDMA_DATA_START+6
+} tdma_hop_pkt_field_t;
+
+// per channel link statistics: packets expected in RX slots and
+// handshakes started in TX slots, and how many of them worked
+typedef struct {
+	uint16_t attempts;
+	uint16_t ok;
+} tdma_chan_stats_t;
+
 typedef struct {
 	int8_t length;
 	uint8_t *pPayload;
@@ -308,6 +348,16 @@ int8_t tdma_schedule_method_set(tdma_sched_method_t m);
 int8_t tdma_mode_set(tdma_node_mode_t mode);
 int8_t tdma_set_channel(uint8_t chan);
 
+// Channel hopping.  Only the master needs to enable it, before the tree
+// is built; slaves follow the hop set in the sync packets.  The master
+// blacklists channels from its own statistics, an application that
+// collects tdma_hop_stats_get() from the slaves can override that with
+// tdma_hop_mask_set().
+int8_t tdma_hop_enable(uint16_t chan_mask);
+int8_t tdma_hop_mask_set(uint16_t chan_mask);
+uint16_t tdma_hop_mask_get();
+int8_t tdma_hop_stats_get(uint8_t chan, tdma_chan_stats_t *stats);
+
 // tree-related
 uint8_t tdma_tree_level_get();
 uint16_t tdma_mac_get();
@@ -34,64 +34,82 @@ inline uint8_t is_sync_slot(tdma_slot_type_t st)
 void tdma_schedule_clr()
 {
     tdma_schedule_size = 0;
+    cur_schedule_entry = 0;
 }
 
 int8_t tdma_schedule_add(tdma_slot_t slot, tdma_slot_type_t slot_type, int8_t priority)
 {
+    return tdma_schedule_add_cell(slot, slot_type, priority, 0);
+}
+
+// The schedule is kept sorted by slot.  Entries with equal slots stay in
+// the order they were added, so the first one added is found first.
+int8_t tdma_schedule_add_cell(tdma_slot_t slot, tdma_slot_type_t slot_type, int8_t priority,
+                              uint8_t ch_offset)
+{
+    int8_t i;
+
     if (tdma_schedule_size >= TDMA_SCHEDULE_MAX_SIZE)
         return NRK_ERROR;
 
-    tdma_schedule[tdma_schedule_size].slot = slot;
-    tdma_schedule[tdma_schedule_size].type = slot_type;
-    tdma_schedule[tdma_schedule_size].priority = priority;
+    i = tdma_schedule_size - 1;
+    while (i >= 0 && tdma_schedule[i].slot > slot)
+    {
+        tdma_schedule[i + 1] = tdma_schedule[i];
+        i--;
+    }
+    i++;
+
+    tdma_schedule[i].slot = slot;
+    tdma_schedule[i].type = slot_type;
+    tdma_schedule[i].priority = priority;
+    tdma_schedule[i].ch_offset = ch_offset;
 
 #ifdef TDMA_SCHED_DEBUG
-    printf("Added slot: %d , %d\r\n", slot, tdma_schedule[tdma_schedule_size].slot);
+    printf("Added slot: %d , %d\r\n", slot, tdma_schedule[i].slot);
 #endif
     tdma_schedule_size++;
+    cur_schedule_entry = 0;
 
     return NRK_OK; 
 }
 
+/*******
+ * Returns the entry with the smallest slot larger than slot, or the
+ * first entry of the superframe if there is none.  The slot loop asks
+ * for the entry after the one it got last time, so that case is checked
+ * first against cur_schedule_entry before falling back to a binary search.
+ */
 tdma_schedule_entry_t tdma_schedule_get_next(tdma_slot_t slot)
 {
+    uint8_t lo, hi, mid;
 
-    int8_t smallest;
-    int8_t smallest_larger;
-
-    //get the smallest slot bigger than this one
-    tdma_schedule_entry_t result;
-
-    result = tdma_schedule[0];
-    smallest = -1;
-    smallest_larger = -1;
-
-    for (int8_t i = 0; i < tdma_schedule_size; i++)
+    lo = cur_schedule_entry + 1;
+    if (lo < tdma_schedule_size && tdma_schedule[lo].slot > slot
+            && tdma_schedule[lo - 1].slot <= slot)
     {
-        if ((smallest == -1) || tdma_schedule[i].slot < tdma_schedule[smallest].slot)
-        {
-            smallest = i;
-
-        }
-        if (slot < tdma_schedule[i].slot) /* ADDED NOT TO STAY  && tdma_schedule[i].priority <= 0)*/
-        {
-            if ((smallest_larger == -1 ) || tdma_schedule[i].slot < tdma_schedule[smallest_larger].slot)
-                smallest_larger = i;
-            //result =  tdma_schedule[i];
-            //break;
-        }
+        cur_schedule_entry = lo;
+        return tdma_schedule[lo];
     }
 
-    if (smallest_larger == -1)
-        smallest_larger = smallest;
+    // first entry with a larger slot
+    lo = 0;
+    hi = tdma_schedule_size;
+    while (lo < hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (tdma_schedule[mid].slot > slot)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
 
-    //printf("getting entry %d\r\n", i);
-    //tdma_schedule_entry_t entry = tdma_schedule[cur_schedule_entry];
-    //cur_schedule_entry = (cur_schedule_entry + 1) % tdma_schedule_size;
-    //printf("next slot: %d cur %d\r\n", tdma_schedule[smallest_larger].slot, slot);
+    // wrap around to the start of the next superframe
+    if (lo == tdma_schedule_size)
+        lo = 0;
 
-    //return result;
-    return tdma_schedule[smallest_larger];
+    cur_schedule_entry = lo;
+    return tdma_schedule[lo];
 }
 
 void tdma_schedule_print()
@@ -102,10 +120,11 @@ void tdma_schedule_print()
 
     for (cur_entry = 0; cur_entry < tdma_schedule_size; cur_entry++)
     {
-        printf("-s %d t %d p %d\r\n", 
+        printf("-s %d t %d p %d o %d\r\n", 
                 tdma_schedule[cur_entry].slot,
                 tdma_schedule[cur_entry].type,
-                tdma_schedule[cur_entry].priority);
+                tdma_schedule[cur_entry].priority,
+                tdma_schedule[cur_entry].ch_offset);
     }
 
 }
@@ -34,17 +34,23 @@ typedef struct {
     tdma_slot_t slot;
     tdma_slot_type_t type;
     int8_t priority;
+    // channel offset of the cell, only used when hopping (see tdma_hop_enable)
+    uint8_t ch_offset;
 } tdma_schedule_entry_t;
 
+// Sorted by slot, see tdma_schedule_add()
 tdma_schedule_entry_t tdma_schedule[TDMA_SCHEDULE_MAX_SIZE] ;
 uint8_t tdma_schedule_size;
+// Index of the entry tdma_schedule_get_next() returned last
 uint8_t cur_schedule_entry;
 
 inline uint8_t is_rx_slot(tdma_slot_type_t st);
 inline uint8_t is_sync_slot(tdma_slot_type_t st);
 
 void tdma_schedule_print();
+void tdma_schedule_clr();
 int8_t tdma_schedule_add(tdma_slot_t slot, tdma_slot_type_t type, int8_t priority);
+int8_t tdma_schedule_add_cell(tdma_slot_t slot, tdma_slot_type_t type, int8_t priority, uint8_t ch_offset);
 tdma_schedule_entry_t tdma_schedule_get_next(tdma_slot_t slot);
 
 int8_t nrk_time_cmp(nrk_time_t t1, nrk_time_t t2);
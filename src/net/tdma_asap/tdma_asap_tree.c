@@ -56,6 +56,7 @@ extern uint8_t tdma_init_done;
 extern int8_t _tdma_channel_check();
 extern tdma_node_mode_t tdma_node_mode;
 extern int8_t tdma_get_cca_thresh();
+extern uint8_t tdma_hop_active;
 
 // PRIVATE STUFF
 uint8_t tree_init_done=0;
@@ -340,6 +341,35 @@ tdma_slot_t _tdma_tree_color_to_slot(tdma_color_t color, tdma_slot_type_t type)
     }
 }
 
+// A node's slot of the given type, data slots use the data color
+tdma_slot_t _tdma_tree_node_slot(uint8_t node, tdma_slot_type_t type)
+{
+    if (type == TDMA_TXDATA)
+        return _tdma_tree_color_to_slot(sensorsInfo[node].data_color, type);
+    return _tdma_tree_color_to_slot(sensorsInfo[node].color, type);
+}
+
+// The slot of a node's cell as sent in schedule packets, with the node's
+// channel offset in the upper bits
+int16_t _tdma_tree_cell(uint8_t node, tdma_slot_type_t type)
+{
+    tdma_slot_t slot = _tdma_tree_node_slot(node, type);
+
+    if (slot < 0)
+        return -1;
+    return slot | ((int16_t) sensorsInfo[node].ch_offset << TREE_CELL_OFFSET_SHIFT);
+}
+
+// Split a cell from a schedule packet into slot and channel offset
+void _tdma_tree_cell_split(tdma_slot_t *slot, uint8_t *ch_offset)
+{
+    *ch_offset = 0;
+    if (*slot < 0)
+        return;
+    *ch_offset = *slot >> TREE_CELL_OFFSET_SHIFT;
+    *slot &= TREE_CELL_SLOT_MASK;
+}
+
 int8_t _tdma_tree_add_neighbor(node_addr_t neighbor_addr, int8_t rssi)
 {
     for (uint8_t i = 0; i < num_neighbors; i++)
@@ -750,12 +780,14 @@ void _tdma_tree_print_sensors()
         }
         else
         {
-            printf("  addr %d par: %d lvl: %d ch: %d clr: %d\r\n",
+            printf("  addr %d par: %d lvl: %d ch: %d clr: %d/%d off: %d\r\n",
                 sensorsInfo[i].address,
                 sensorsInfo[i].parent,
                 sensorsInfo[i].level,
                 sensorsInfo[i].totalChildren,
-                sensorsInfo[i].color);
+                sensorsInfo[i].color,
+                sensorsInfo[i].data_color,
+                sensorsInfo[i].ch_offset);
             //printf("  color: %d\r\n", sensorsInfo[i].color);
                 //graphColors[sensorsInfo[i].color]);
                 //graphColors[colors_used_level[ sensorsInfo[i].level  ]
@@ -1001,7 +1033,7 @@ void _tdma_tree_send_schedule()
             
 #if TDMA_TREE_DEBUG>=2
             printf(" Slot %d for %d, offset %d\r\n", 
-                _tdma_tree_color_to_slot(sensorsInfo[i].color,TDMA_TXDATA), i,pkt_offset);
+                _tdma_tree_node_slot(i,TDMA_TXDATA), i,pkt_offset);
 #endif
 
             // put in the address
@@ -1012,9 +1044,9 @@ void _tdma_tree_send_schedule()
 
             // put in their priority 0 slot
             tree_rfTxInfo.pPayload[pkt_offset] =
-                (_tdma_tree_color_to_slot(sensorsInfo[i].color,TDMA_TXDATA) >> 8);
+                (_tdma_tree_cell(i,TDMA_TXDATA) >> 8);
             tree_rfTxInfo.pPayload[pkt_offset+1] = 
-                (_tdma_tree_color_to_slot(sensorsInfo[i].color,TDMA_TXDATA) & 0xFF);
+                (_tdma_tree_cell(i,TDMA_TXDATA) & 0xFF);
 
             priority = 1;
 
@@ -1025,10 +1057,11 @@ void _tdma_tree_send_schedule()
             {
                 if ((!sensorsInfo[j].isDead) && sensorsInfo[i].parent == sensorsInfo[j].parent)
                 {
+                    // stealing happens on the owner's cell
                     tree_rfTxInfo.pPayload[pkt_offset+(2*priority)] = 
-                        (_tdma_tree_color_to_slot(sensorsInfo[j].color,TDMA_TXDATA) >> 8);
+                        (_tdma_tree_cell(j,TDMA_TXDATA) >> 8);
                     tree_rfTxInfo.pPayload[pkt_offset+(2*priority)+1] = 
-                        (_tdma_tree_color_to_slot(sensorsInfo[j].color,TDMA_TXDATA) & 0xFF);
+                        (_tdma_tree_cell(j,TDMA_TXDATA) & 0xFF);
                     priority++;
                 }
             }     
@@ -1048,9 +1081,9 @@ void _tdma_tree_send_schedule()
 
             // Put in their tx slot to children, last
             tree_rfTxInfo.pPayload[pkt_offset] = 
-                 (_tdma_tree_color_to_slot(sensorsInfo[i].color, TDMA_TXSYNC) >> 8);
+                 (_tdma_tree_cell(i, TDMA_TXSYNC) >> 8);
             tree_rfTxInfo.pPayload[pkt_offset+1] = 
-                 (_tdma_tree_color_to_slot(sensorsInfo[i].color, TDMA_TXSYNC) & 0xFF);
+                 (_tdma_tree_cell(i, TDMA_TXSYNC) & 0xFF);
 
             pkt_offset += 2;
 
@@ -1127,7 +1160,8 @@ void _tdma_tree_master_get_schedule()
             {
                 // if me, add my slots
                 //tdma_schedule_add(_tdma_tree_color_to_slot(sensorsInfo[i].color, TDMA_TX_PARENT), TDMA_TX, 0);
-                tdma_schedule_add(_tdma_tree_color_to_slot(sensorsInfo[i].color, TDMA_TXSYNC) , TDMA_TXSYNC, 0);
+                tdma_schedule_add_cell(_tdma_tree_node_slot(i, TDMA_TXSYNC) , TDMA_TXSYNC, 0,
+                                       sensorsInfo[i].ch_offset);
             }
             else
             {
@@ -1136,7 +1170,8 @@ void _tdma_tree_master_get_schedule()
                     if (sensorsInfo[i].address == child_addrs[child_index])
                     {
                         //is an immediate child;  add RX slots
-                        tdma_schedule_add(_tdma_tree_color_to_slot(sensorsInfo[i].color, TDMA_TXDATA), TDMA_RXDATA, -1);
+                        tdma_schedule_add_cell(_tdma_tree_node_slot(i, TDMA_TXDATA), TDMA_RXDATA, -1,
+                                               sensorsInfo[i].ch_offset);
                     }
                 }
             }
@@ -1227,6 +1262,7 @@ void _tdma_tree_obtain_schedule()
     uint8_t num_nodes;
     node_addr_t current_node_addr;
     tdma_slot_t new_slot;
+    uint8_t new_offset;
     uint8_t have_schedule = 0;
     uint8_t current_pkt   = 0;
     uint8_t pkts_to_expect = 0;
@@ -1368,6 +1404,7 @@ void _tdma_tree_obtain_schedule()
                     new_slot = tree_rfRxInfo.pPayload[pkt_offset];
                     new_slot <<= 8;
                     new_slot |= tree_rfRxInfo.pPayload[pkt_offset+1];
+                    _tdma_tree_cell_split(&new_slot, &new_offset);
 
 #if TDMA_TREE_DEBUG>=2
                     printf("Slot %d at offset %d\r\n", new_slot, pkt_offset);
@@ -1382,10 +1419,10 @@ void _tdma_tree_obtain_schedule()
                     // otherwise, just add the 0 priority slots (my TX slots)
 #ifdef SLOT_STEALING_SCHED
                     else if (new_slot >= 0)
-                        tdma_schedule_add(new_slot, TDMA_TXDATA, j);
+                        tdma_schedule_add_cell(new_slot, TDMA_TXDATA, j, new_offset);
 #else
                     else if (new_slot >= 0 && j == 0)
-                        tdma_schedule_add(new_slot, TDMA_TXDATA, j);
+                        tdma_schedule_add_cell(new_slot, TDMA_TXDATA, j, new_offset);
 #endif
 
                     pkt_offset+=2;
@@ -1396,9 +1433,10 @@ void _tdma_tree_obtain_schedule()
                 new_slot = tree_rfRxInfo.pPayload[pkt_offset];
                 new_slot <<= 8;
                 new_slot |= tree_rfRxInfo.pPayload[pkt_offset+1];
+                _tdma_tree_cell_split(&new_slot, &new_offset);
             
                 if (new_slot >= 0)
-                    tdma_schedule_add(new_slot, TDMA_TXSYNC, 0);
+                    tdma_schedule_add_cell(new_slot, TDMA_TXSYNC, 0, new_offset);
 
                 pkt_offset+=2;
 
@@ -1414,9 +1452,10 @@ void _tdma_tree_obtain_schedule()
                 new_slot = tree_rfRxInfo.pPayload[pkt_offset];
                 new_slot <<= 8;
                 new_slot |= tree_rfRxInfo.pPayload[pkt_offset+1];
+                _tdma_tree_cell_split(&new_slot, &new_offset);
 
                 if (new_slot >= 0)
-                    tdma_schedule_add(new_slot, TDMA_RXSYNC, 1); //p1 to distinguish that it is sync
+                    tdma_schedule_add_cell(new_slot, TDMA_RXSYNC, 1, new_offset); //p1 to distinguish that it is sync
 
                 pkt_offset+=2;
             }
@@ -1430,12 +1469,13 @@ void _tdma_tree_obtain_schedule()
                         new_slot = tree_rfRxInfo.pPayload[pkt_offset];
                         new_slot <<= 8;
                         new_slot |= tree_rfRxInfo.pPayload[pkt_offset+1];
+                        _tdma_tree_cell_split(&new_slot, &new_offset);
                         // add this as a RX
 #if TDMA_TREE_DEBUG>=2
                         printf("Slot %d\r\n", new_slot);
 #endif
                         if (new_slot >= 0)
-                            tdma_schedule_add(new_slot, TDMA_RXDATA, -1);
+                            tdma_schedule_add_cell(new_slot, TDMA_RXDATA, -1, new_offset);
                         
                         break;
                     }
@@ -1529,6 +1569,75 @@ void _tdma_tree_color_discrete()
     }
 }
 
+// Channel offsets: the root uses 0, every subtree of the root gets the
+// next one.  A cell uses the offset of the node that owns the slot, so
+// siblings stealing a slot stay on the owner's channel.
+void _tdma_tree_assign_ch_offsets()
+{
+    uint8_t i, k, hops;
+    node_addr_t top;
+    sensorInfo *root = &sensorsInfo[tree_addr16];
+
+    for (i = 0; i < DIM; i++)
+    {
+        sensorsInfo[i].ch_offset = 0;
+        if (sensorsInfo[i].isDead || i == tree_addr16)
+            continue;
+
+        // walk up to the child of the root above this node
+        top = i;
+        for (hops = 0; hops < DIM && sensorsInfo[top].parent != tree_addr16; hops++)
+            top = sensorsInfo[top].parent;
+
+        for (k = 0; k < root->totalChildren; k++)
+            if (root->children[k] == top)
+                sensorsInfo[i].ch_offset = k + 1;
+    }
+}
+
+// Colors of the data slots, once the sync colors are set.  Without
+// hopping every node sends data in the slot of its own color.  With
+// hopping, data colors only have to be unique within a subtree of the
+// root, since the subtrees send on different channel offsets.  Levels
+// get separate ranges so children still send before their parents, and
+// the children of the root, which all send to the root, keep colors of
+// their own.
+void _tdma_tree_color_data()
+{
+    uint8_t colors = 0;
+    uint8_t used[TREE_MAX_CHILDREN+1];
+    uint8_t max;
+    int8_t lvl,j;
+
+    for (j = 0; j < DIM; j++)
+        sensorsInfo[j].data_color = sensorsInfo[j].color;
+
+    if (!tdma_hop_active)
+        return;
+
+    for (lvl = depth_of_tree; lvl >= 2; lvl--)
+    {
+        memset(used, 0, sizeof(used));
+        max = 0;
+        for (j = 0; j < DIM; j++)
+        {
+            if (!sensorsInfo[j].isDead && sensorsInfo[j].level == lvl)
+            {
+                sensorsInfo[j].data_color = colors + used[sensorsInfo[j].ch_offset]++;
+                if (used[sensorsInfo[j].ch_offset] > max)
+                    max = used[sensorsInfo[j].ch_offset];
+            }
+        }
+        colors += max;
+    }
+
+    for (j = 0; j < DIM; j++)
+    {
+        if (!sensorsInfo[j].isDead && sensorsInfo[j].level == 1)
+            sensorsInfo[j].data_color = colors++;
+    }
+}
+
 #ifdef TDMA_SLOT_SPREADING
 void _tdma_tree_schedule_spread()
 {
@@ -1592,12 +1701,14 @@ int8_t _tdma_tree_make_master()
            child_info_offset, child_info_size);
 #endif
 
+    _tdma_tree_assign_ch_offsets();
 #ifdef DISCRETE_COLORING
     _tdma_tree_color_discrete();
 #else
     color_graph();
 #endif
     //discrete_color();
+    _tdma_tree_color_data();
 
 #if TDMA_TREE_DEBUG>=1
     nrk_kprintf(PSTR("-SENSORS-\r\n\r\n"));
@@ -1627,12 +1738,14 @@ int8_t _tdma_tree_static_make_master()
 {
     // fill the sensorsInfo structure with topology information
     _tdma_tree_static_create();
+    _tdma_tree_assign_ch_offsets();
     // figure out the colors of the nodes
 #ifdef TDMA_SLOT_SPREADING
     _tdma_tree_schedule_spread();
 #else
     _tdma_tree_color_discrete();
 #endif
+    _tdma_tree_color_data();
 
     // show the topology/colors
 #if TDMA_TREE_DEBUG>=1
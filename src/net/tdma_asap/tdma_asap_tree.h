@@ -52,6 +52,13 @@ typedef struct
   uint8_t level;
   uint8_t isDead;
   tdma_color_t color;
+  // color of the data slot to the parent.  Same as color, except when
+  // hopping: sync slots stay on one channel and need the unique color,
+  // data slots of different subtrees are on different channels and share
+  tdma_color_t data_color;
+  // channel offset of this node's cells: 0 for the root, one per subtree
+  // of the root below it
+  uint8_t ch_offset;
 #if 0
   tdma_color_t color2;
   tdma_color_t color4;
@@ -96,6 +103,11 @@ sensorInfo sensorsInfo[DIM];
 // tree creation buffers
 #define TREE_BUF_SIZE 115
 
+// Schedule packets carry the channel offset of a cell in the upper bits
+// of its slot number.  -1 still marks an unused entry.
+#define TREE_CELL_SLOT_MASK     0x03FF
+#define TREE_CELL_OFFSET_SHIFT  10
+
 RF_TX_INFO tree_rfTxInfo;
 RF_RX_INFO tree_rfRxInfo;
 
@@ -68,6 +68,8 @@
 
 #include <stdbool.h>
 #include <nrk_events.h>
+#include <nrk_time.h>
+#include <nrk_cfg.h>
 
 
 
@@ -76,16 +78,19 @@ void rf_auto_ack_disable();
 void rf_addr_decode_set_my_mac(uint16_t my_mac);
 void rf_addr_decode_enable();
 void rf_addr_decode_disable();
+void rf_set_cca_thresh(int8_t t);
+
+/* Stubs, the driver does no encryption */
+uint8_t rf_security_last_pkt_status();
+void rf_security_set_key(uint8_t *key);
+void rf_security_set_ctr_counter(uint8_t *counter);
+void rf_security_disable();
 
 /* NOT IMPLEMENTED
 void halRfWaitForCrystalOscillator(void);
 void halRfSetChannel(uint8_t channel);
 
-uint8_t rf_security_last_pkt_status();
-void rf_security_set_key(uint8_t *key);
-void rf_security_set_ctr_counter(uint8_t *counter);
 void rf_security_enable();
-void rf_security_disable();
 
 nrk_sem_t* rf_get_sem();
 */
@@ -163,7 +168,6 @@ void rf_tx_set_serial();
 void rf_flush_rx_fifo();
 void rf_carrier_on();
 void rf_carrier_off();
-void rf_set_cca_thresh(int8_t t);
 */
 
 
@@ -188,6 +192,12 @@ void rf_set_cca_thresh(int8_t t);
 //-------------------------------------------------------------------------------------------------------
 
 uint8_t rf_tx_packet(RF_TX_INFO *pRTI);
+void rf_tx_frame_pending_set(uint8_t pending);
+// Stamps the ms left until time into the 16-bit field at offset in the payload of the frames that
+// follow, for every copy that goes on the air.  A negative offset turns stamping off.
+void rf_tx_stamp_set(int8_t offset, nrk_time_t *time);
+// Repeats the frame for ms milliseconds.  When pRTI->ackRequest is set the repetition stops at
+// the first acknowledgment, which lets a MAC use the frame as a strobed preamble.
 uint8_t rf_tx_packet_repeat(RF_TX_INFO *pRTI, uint16_t ms);
 int8_t rf_cca_check();
 
@@ -234,16 +244,71 @@ typedef struct {
 	int8_t max_length;
   uint8_t *pPayload;
 	bool ackRequest;
+	bool framePending;
 	int8_t rssi;
 	int8_t actualRssi;
 	int8_t energyDetectionLevel;
 	int8_t linkQualityIndication;
+	nrk_time_t timestamp;
 } RF_RX_INFO;
 //-------------------------------------------------------------------------------------------------------
 
+
+//-------------------------------------------------------------------------------------------------------
+// The receive ring:
+//
+// The RX_END interrupt copies every CRC-valid frame out of the single TRXFBST frame buffer into
+// one slot of a ring, together with its RSSI, energy detection level, LQI and the time its SFD
+// was received, and then releases the frame buffer to the transceiver.  rf_rx_packet_nonblock()
+// hands frames to the MAC layer in arrival order.  When the ring is full the new frame is dropped
+// and counted.
+//
+// RF_RX_RING_SIZE may be set in nrk_cfg.h and must be a power of two.  One slot is kept empty,
+// so a ring of size N buffers N-1 frames.
+#ifndef RF_RX_RING_SIZE
+#define RF_RX_RING_SIZE		4
+#endif
+
+#if (RF_RX_RING_SIZE & (RF_RX_RING_SIZE - 1)) != 0
+#error RF_RX_RING_SIZE must be a power of two
+#endif
+
+typedef struct {
+	uint8_t length;			// frame length including the 2 byte FCS
+	int8_t rssi;
+	int8_t ed;
+	int8_t lqi;
+	nrk_time_t timestamp;
+	uint8_t data[RF_LENGTH_MASK];
+} rf_rx_frame_t;
+//-------------------------------------------------------------------------------------------------------
+
 #define rf_polling_rx_packet rf_rx_packet_nonblock
 int8_t rf_rx_packet_nonblock();
 
+uint8_t rf_rx_ring_pending();
+uint16_t rf_rx_ring_overflow_get();
+void rf_rx_ring_overflow_reset();
+void rf_rx_ring_flush();
+
+//-------------------------------------------------------------------------------------------------------
+// Glossy mode (synchronous flooding)
+//
+// Every frame is sent with the same MAC header (seq 0xFF, src 0xAAAA, broadcast), so relays of the
+// same frame are bit identical.  The payload starts with the header below.  The RX_END interrupt
+// relays a frame straight from the frame buffer with the relay counter incremented, at most
+// RF_GLOSSY_MAX_TX times per flood, and only the first copy of each flood goes into the RX ring.
+// Sending a frame in glossy mode counts as the first transmission of its flood.
+//-------------------------------------------------------------------------------------------------------
+#define RF_GLOSSY_RELAY_CNT	0		// hops the frame has taken
+#define RF_GLOSSY_MAX_TX	1		// transmissions per node
+#define RF_GLOSSY_SEQ		2		// flood sequence number
+#define RF_GLOSSY_HDR_SIZE	3
+
+void rf_enable_glossy();
+void rf_disable_glossy();
+uint8_t rf_glossy_next_seq();
+
 /* NOT IMPLEMENTED
 uint8_t rf_rx_check_sfd();
 uint8_t rf_rx_check_fifop();
@@ -35,7 +35,6 @@
 
 #define OSC_STARTUP_DELAY	1000
 //#define RADIO_CC2591
-//#define GLOSSY_TESTING
 
 //#define RADIO_VERBOSE
 #ifdef RADIO_VERBOSE
@@ -73,11 +72,10 @@ typedef struct ieee_mac_frame_header{
 
 
 static void rf_cmd(uint8_t cmd);
-void rf_glossy_interrupt();
-
-#ifdef GLOSSLY_TESTING
-	void clear_packet_flags();
-#endif
+static rf_rx_frame_t *_rf_rx_ring_put(uint8_t *psdu, uint8_t len, uint8_t lqi);
+static void _rf_rx_ring_push();
+static void _rf_rx_ring_pop();
+static void _rf_glossy_rx();
 
 nrk_sem_t *radio_sem;
 //uint8_t auto_ack_enable;
@@ -91,13 +89,40 @@ volatile RF_SETTINGS rfSettings;
 uint8_t rf_ready;
 volatile uint8_t rx_ready;
 volatile uint8_t tx_done;
+uint8_t tx_frame_pending;
 uint8_t use_glossy;
 
+/* Time stamp field of the frames that follow, see rf_tx_stamp_set() */
+static int8_t tx_stamp_offset;
+static nrk_time_t tx_stamp_time;
+
+/* Glossy flood state: sequence number of the current flood and how often
+ * this node has sent it.  glossy_relaying is set while a relay started by
+ * the RX_END ISR is on the air. */
+static uint8_t glossy_seq;
+static uint8_t glossy_seq_valid;
+static uint8_t glossy_tx_cnt;
+static volatile uint8_t glossy_relaying;
+
+/* When the RX_START ISR saw the SFD of the frame being received.  Taken
+ * there rather than in RX_END, where the frame length, the debug output
+ * and a glossy relay would all shift it. */
+static nrk_time_t rx_sfd_time;
+
 nrk_time_t curr_t, target_t, dummy_t;
 
 volatile void (*rx_start_func)(void) = 0;
 volatile void (*rx_end_func)(void) = 0;
 
+/* Receive ring.  The RX_END ISR is the only producer (it moves rx_ring_head)
+ * and rf_rx_packet_nonblock() is the only consumer (it moves rx_ring_tail),
+ * so neither index needs a lock.  One slot is always left empty so that
+ * head == tail means the ring is empty. */
+static rf_rx_frame_t rx_ring[RF_RX_RING_SIZE];
+static volatile uint8_t rx_ring_head;
+static volatile uint8_t rx_ring_tail;
+static volatile uint16_t rx_ring_overflow;
+
 /* AES encryption and decryption key buffers */
 uint8_t ekey[16];
 uint8_t dkey[16];
@@ -107,6 +132,8 @@ uint8_t dkey[16];
 
 void rf_enable_glossy()
 {
+	glossy_seq_valid = 0;
+	glossy_relaying = 0;
 	use_glossy = 1;
 }
 
@@ -115,6 +142,13 @@ void rf_disable_glossy()
 	use_glossy = 0;
 }
 
+/* One past the last flood this node sent or received, so that a new flood
+ * never reuses the seq the RX_END ISR drops duplicates by */
+uint8_t rf_glossy_next_seq()
+{
+	return glossy_seq + 1;
+}
+
 void rf_power_down()
 {
 	uint8_t status;
@@ -196,6 +230,37 @@ void rf_auto_ack_disable()
 }
 
 
+/* Set the frame pending bit in the FCF of the frames that follow.  A MAC
+ * uses this to tell the receiver that another frame is right behind. */
+void rf_tx_frame_pending_set(uint8_t pending)
+{
+	tx_frame_pending = pending;
+}
+
+/* Frames that follow carry at payload offset the ms left until time as a
+ * 16-bit little-endian count, written again for every copy a repeated
+ * frame sends.  A negative offset turns the stamp off. */
+void rf_tx_stamp_set(int8_t offset, nrk_time_t *time)
+{
+	tx_stamp_offset = offset;
+	if (offset >= 0)
+		tx_stamp_time = *time;
+}
+
+static void rf_tx_stamp(uint8_t *field)
+{
+	nrk_time_t now, left;
+	uint32_t ms = 0;
+
+	nrk_time_get(&now);
+	if (nrk_time_sub(&left, tx_stamp_time, now) != NRK_ERROR)
+		ms = left.secs * 1000 + left.nano_secs / NANOS_PER_MS;
+	if (ms > 0xFFFF)
+		ms = 0xFFFF;
+	field[0] = ms;
+	field[1] = ms >> 8;
+}
+
 void rf_addr_decode_set_my_mac(uint16_t my_mac)
 {
 	/* Set short MAC address */
@@ -295,6 +360,11 @@ void rf_init(RF_RX_INFO *pRRI, uint8_t channel, uint16_t panId, uint16_t myAddr)
 	rf_ready = 1;
 	rx_ready = 0;
 	tx_done = 0;
+	tx_frame_pending = 0;
+	tx_stamp_offset = -1;
+	rx_ring_head = 0;
+	rx_ring_tail = 0;
+	rx_ring_overflow = 0;
 
 	use_glossy = 0;
 
@@ -323,9 +393,6 @@ void rf_rx_on(void)
 
 #ifdef RADIO_CC2591
 	rf_cc2591_rx_on();
-#endif
-#ifdef GLOSSY_TESTING
-	clear_packet_flags();
 #endif
 	rf_cmd(RX_AACK_ON);
 }
@@ -372,8 +439,9 @@ void rf_rx_off(void)
 #endif
   //	DISABLE_FIFOP_INT();
 */
+	/* Frames already copied into the RX ring stay there until the
+	 * MAC layer reads them, only the transceiver is switched off. */
 	rf_cmd(TRX_OFF);
-	rx_ready = 0;
 }
 
 
@@ -427,7 +495,7 @@ uint8_t rf_tx_packet_repeat(RF_TX_INFO *pRTI, uint16_t ms)
 	/* TODO: Setting FCF bits is probably slow. Optimize later. */
 	fcf.frame_type = 1;
 	fcf.sec_en = 0;
-	fcf.frame_pending = 0;
+	fcf.frame_pending = use_glossy ? 0 : tx_frame_pending;
 	fcf.ack_request = pRTI->ackRequest;
 	fcf.intra_pan = 1;
 	fcf.res = 0;
@@ -454,6 +522,13 @@ uint8_t rf_tx_packet_repeat(RF_TX_INFO *pRTI, uint16_t ms)
 	/* Copy data payload into packet */
 	data_start = frame_start + sizeof(ieee_mac_frame_header_t) + 1;
 	memcpy(data_start, pRTI->pPayload, pRTI->length);
+
+	/* Starting a flood counts as this node's first transmission of it */
+	if (use_glossy && pRTI->length >= RF_GLOSSY_HDR_SIZE) {
+		glossy_seq = pRTI->pPayload[RF_GLOSSY_SEQ];
+		glossy_seq_valid = 1;
+		glossy_tx_cnt = 1;
+	}
 	/* Set the size of the packet */
 	*frame_start = sizeof(ieee_mac_frame_header_t) + pRTI->length + 2;
 	
@@ -500,6 +575,8 @@ uint8_t rf_tx_packet_repeat(RF_TX_INFO *pRTI, uint16_t ms)
 #endif
 
 		tx_done = 0;
+		if (tx_stamp_offset >= 0 && tx_stamp_offset + 2 <= pRTI->length)
+			rf_tx_stamp(data_start + tx_stamp_offset);
 		/* Send the packet. 0x2 is equivalent to TX_START */
 		rf_cmd(0x2);
 
@@ -508,6 +585,11 @@ uint8_t rf_tx_packet_repeat(RF_TX_INFO *pRTI, uint16_t ms)
 			continue;
 		if(ms == 0)
 			break;
+		/* A repeated frame that requests an ack works as a strobe,
+		 * the first ack from the destination ends the repetition */
+		if(pRTI->ackRequest && (i < 65000)
+				&& (((TRX_STATE >> TRAC_STATUS0) & 0x7) == 0))
+			break;
 		nrk_time_get(&curr_t);
 	}while(nrk_time_sub(&dummy_t, target_t, curr_t) != NRK_ERROR);
 
@@ -571,50 +653,179 @@ int8_t rf_rx_packet_nonblock()
 	#endif
 	*/
 	
-	uint8_t *frame_start = &TRXFBST;
+	rf_rx_frame_t *frame;
+	ieee_mac_frame_header_t *machead;
+	int8_t length;
 
 	if(!rf_ready)
 		return NRK_ERROR;
 
-	if(!rx_ready)
+	if(rx_ring_head == rx_ring_tail)
 		return 0;
-	else if((TST_RX_LENGTH - 2) > rfSettings.pRxInfo->max_length)
-		return NRK_ERROR;
-
-	ieee_mac_frame_header_t *machead = frame_start;
 
-	rfSettings.pRxInfo->seqNumber = machead->seq_num;
-	rfSettings.pRxInfo->srcAddr = machead->src_addr;
-	rfSettings.pRxInfo->length = TST_RX_LENGTH - sizeof(ieee_mac_frame_header_t) - 2;
+	frame = &rx_ring[rx_ring_tail];
+	machead = (ieee_mac_frame_header_t *) frame->data;
+	length = frame->length - sizeof(ieee_mac_frame_header_t) - 2;
 
-	if((rfSettings.pRxInfo->length > rfSettings.pRxInfo->max_length)
-			|| (rfSettings.pRxInfo->length < 0)){
-		rx_ready = 0;
-		TRX_CTRL_2 &= ~(1 << RX_SAFE_MODE);
-		TRX_CTRL_2 |= (1 << RX_SAFE_MODE);
+	if((length > rfSettings.pRxInfo->max_length) || (length < 0)){
+		_rf_rx_ring_pop();
 		return NRK_ERROR;
 	}
 
-	memcpy(rfSettings.pRxInfo->pPayload, frame_start 
-			+ sizeof(ieee_mac_frame_header_t), rfSettings.pRxInfo->length);
+	rfSettings.pRxInfo->seqNumber = machead->seq_num;
+	rfSettings.pRxInfo->srcAddr = machead->src_addr;
+	rfSettings.pRxInfo->length = length;
+	memcpy(rfSettings.pRxInfo->pPayload, frame->data 
+			+ sizeof(ieee_mac_frame_header_t), length);
 	
 	/* I am assuming that ackRequest is supposed to
 	 * be set, not read, by rf_basic */
 	rfSettings.pRxInfo->ackRequest = machead->fcf.ack_request;
-	//rfSettings.pRxInfo->rssi = *(frame_start + TST_RX_LENGTH);
-	rfSettings.pRxInfo->rssi = PHY_ED_LEVEL;
-	rfSettings.pRxInfo->actualRssi = PHY_RSSI >> 3;
-	rfSettings.pRxInfo->energyDetectionLevel = PHY_ED_LEVEL;
-	rfSettings.pRxInfo->linkQualityIndication = *(frame_start + TST_RX_LENGTH);
+	rfSettings.pRxInfo->framePending = machead->fcf.frame_pending;
+	rfSettings.pRxInfo->rssi = frame->ed;
+	rfSettings.pRxInfo->actualRssi = frame->rssi;
+	rfSettings.pRxInfo->energyDetectionLevel = frame->ed;
+	rfSettings.pRxInfo->linkQualityIndication = frame->lqi;
+	rfSettings.pRxInfo->timestamp = frame->timestamp;
 
-	/* Reset frame buffer protection */
-	rx_ready = 0;
-	TRX_CTRL_2 &= ~(1 << RX_SAFE_MODE);
-	TRX_CTRL_2 |= (1 << RX_SAFE_MODE);
+	_rf_rx_ring_pop();
 
 	return NRK_OK;
 }
 
+/* Release the oldest ring slot and keep rx_ready in step with the ring.
+ * Interrupts are held off so the RX_END ISR can not set rx_ready between
+ * the occupancy test and the store. */
+static void _rf_rx_ring_pop()
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	rx_ring_tail = (rx_ring_tail + 1) & (RF_RX_RING_SIZE - 1);
+	rx_ready = (rx_ring_head != rx_ring_tail);
+	SREG = sreg;
+}
+
+/* Copy a received frame into the next free ring slot.  Called from the
+ * RX_END ISR only.  Returns the slot, or NULL if the ring was full. */
+static rf_rx_frame_t *_rf_rx_ring_put(uint8_t *psdu, uint8_t len, uint8_t lqi)
+{
+	uint8_t next;
+	rf_rx_frame_t *frame;
+
+	next = (rx_ring_head + 1) & (RF_RX_RING_SIZE - 1);
+	if(next == rx_ring_tail){
+		if(rx_ring_overflow < 65535)
+			rx_ring_overflow++;
+		return NULL;
+	}
+
+	frame = &rx_ring[rx_ring_head];
+	frame->length = len;
+	memcpy(frame->data, psdu, len);
+	frame->ed = PHY_ED_LEVEL;
+	frame->rssi = PHY_RSSI >> 3;
+	frame->lqi = lqi;
+	frame->timestamp = rx_sfd_time;
+
+	rx_ring_head = next;
+	rx_ready = 1;
+	return frame;
+}
+
+/* Copy the frame sitting in TRXFBST into the ring */
+static void _rf_rx_ring_push()
+{
+	uint8_t len;
+	uint8_t *frame_start = &TRXFBST;
+
+	len = TST_RX_LENGTH & RF_LENGTH_MASK;
+	_rf_rx_ring_put(frame_start, len, *(frame_start + len));
+}
+
+/* RX_END handling in glossy mode.  The relay has to leave a fixed time
+ * after the end of the received frame on every node, or the copies sent
+ * by neighbours do not interfere constructively.  So the relay is started
+ * first, and the work that only some nodes do (queueing the first copy of
+ * a flood) comes after TX_START.
+ *
+ * The frame buffer holds the received PSDU at TRXFBST, while a transmission
+ * needs the PHR length byte in front of it.  The PSDU is moved up one byte
+ * in place; that costs the same on every node for the same frame.  The FCS
+ * is not moved, the radio computes a new one. */
+static void _rf_glossy_rx()
+{
+	uint8_t i, len, lqi, fresh, relayed;
+	uint8_t *p = &TRXFBST;
+	uint8_t *hdr;
+	rf_rx_frame_t *frame;
+
+	len = TST_RX_LENGTH & RF_LENGTH_MASK;
+	if(len < sizeof(ieee_mac_frame_header_t) + RF_GLOSSY_HDR_SIZE + 2){
+		_rf_rx_ring_push();
+		return;
+	}
+	lqi = p[len];
+	hdr = p + sizeof(ieee_mac_frame_header_t);
+	fresh = !glossy_seq_valid || hdr[RF_GLOSSY_SEQ] != glossy_seq;
+	if(fresh){
+		glossy_seq = hdr[RF_GLOSSY_SEQ];
+		glossy_seq_valid = 1;
+		glossy_tx_cnt = 0;
+	}
+
+	relayed = 0;
+	if(glossy_tx_cnt < hdr[RF_GLOSSY_MAX_TX]){
+		for(i = len - 2; i > 0; i--)
+			p[i] = p[i - 1];
+		p[0] = len;
+		hdr = p + 1 + sizeof(ieee_mac_frame_header_t);
+		hdr[RF_GLOSSY_RELAY_CNT]++;
+		rf_cmd(PLL_ON);
+		glossy_relaying = 1;
+		rf_cmd(0x2);		/* TX_START */
+		glossy_tx_cnt++;
+		relayed = 1;
+	}
+
+	if(!fresh)
+		return;
+	if(relayed){
+		/* Queue the frame as it was received */
+		frame = _rf_rx_ring_put(p + 1, len, lqi);
+		if(frame != NULL)
+			frame->data[sizeof(ieee_mac_frame_header_t) + RF_GLOSSY_RELAY_CNT]--;
+	} else
+		_rf_rx_ring_push();
+}
+
+uint8_t rf_rx_ring_pending()
+{
+	return (rx_ring_head - rx_ring_tail) & (RF_RX_RING_SIZE - 1);
+}
+
+uint16_t rf_rx_ring_overflow_get()
+{
+	return rx_ring_overflow;
+}
+
+void rf_rx_ring_overflow_reset()
+{
+	rx_ring_overflow = 0;
+}
+
+void rf_rx_ring_flush()
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	rx_ring_tail = rx_ring_head;
+	rx_ready = 0;
+	SREG = sreg;
+}
+
 
 SIGNAL(TRX24_RX_END_vect)
 {	
@@ -630,15 +841,19 @@ SIGNAL(TRX24_RX_END_vect)
 	vprintf("\r\n");
 
 	if((PHY_RSSI >> RX_CRC_VALID) & 0x1) {
-		rx_ready = 1;
+		if (use_glossy)
+			_rf_glossy_rx();
+		else
+			_rf_rx_ring_push();
 	} else {
 		printf("RX end failed checksum!\r\n");
 	}
 	IRQ_STATUS = (1 << RX_END);
-	
-	if((PHY_RSSI >> RX_CRC_VALID) & 0x1) {
-		if (use_glossy) rf_glossy_interrupt();
-	}
+
+	/* The frame now lives in the ring, so hand the frame buffer
+	 * straight back to the transceiver for the next arrival */
+	TRX_CTRL_2 &= ~(1 << RX_SAFE_MODE);
+	TRX_CTRL_2 |= (1 << RX_SAFE_MODE);
 
 	if(rx_end_func)
 		rx_end_func();
@@ -664,6 +879,12 @@ SIGNAL(TRX24_TX_END_vect)
 	tx_done = 1;
 	IRQ_STATUS = (1 << TX_END);
 
+	/* A glossy relay was started from the RX_END ISR, listen again */
+	if(glossy_relaying){
+		glossy_relaying = 0;
+		rf_cmd(RX_AACK_ON);
+	}
+
 #ifdef RADIO_CC2591
 	rf_cc2591_rx_on();
 #endif
@@ -689,6 +910,7 @@ SIGNAL(TRX24_CCA_ED_DONE_vect)
 
 SIGNAL(TRX24_RX_START_vect)
 {
+	nrk_time_get(&rx_sfd_time);
 	vprintf("RX_START IRQ!\r\n");
 	IRQ_STATUS = (1 << RX_START);
 
@@ -936,130 +1158,6 @@ void rf_cc2591_rx_on()
 }
 
 
-#ifdef GLOSSY_TESTING
-uint8_t packet_flags[128];
-uint8_t delay_flags[26];
-uint16_t curr_count;
-
-int calculate_checksum(uint8_t * buf) {
-	uint8_t i, checksum = 0;
-	for (i = 1; i < 99; i++) checksum ^= buf[i];
-	return checksum == buf[99];
-}
-
-uint16_t calculate_reception_rate()
-{
-	uint8_t i, j;
-	uint16_t packets_received = 0;
-	for (i = 0; i < 128; i++) {
-		for (j = 0; j < 8; j++) {
-			packets_received += (packet_flags[i] >> j) & 1;
-		}
-	}
-	return packets_received;
-}
-
-void mark_delay(uint8_t delay)
-{
-	delay_flags[delay/8] |= 1 << (delay % 8);
-}
-
-uint8_t check_delay(uint8_t delay)
-{
-	return ((delay_flags[delay/8]) >> (delay % 8)) & 1;
-}
-
-void mark_recieved(uint16_t packet_id, uint8_t delay)
-{
-	if (check_delay(delay)) return;
-	if (packet_id > 999) {
-		mark_delay(delay);
-		uint16_t reception_rate = calculate_reception_rate();
-		printf("\n\n%4d\t%4d\r\n\n\n", delay, reception_rate);
-		clear_packet_flags();
-	} else {
-		packet_flags[packet_id/8] |= 1 << (packet_id % 8);
-	}
-}
-void clear_packet_flags()
-{
-	int i;
-	for (i = 0; i < 128; i++) {
-		packet_flags[i] = 0;
-	}
-	curr_count = 0;
-}
-#endif
-
-void rf_glossy_interrupt()
-{
-	nrk_int_disable();
-
-	RF_RX_INFO rfRxInfo = *(rfSettings.pRxInfo);
-	RF_TX_INFO rfTxInfo;
-
-	/* Grab packet */
-	int err = rf_rx_packet_nonblock();
-	if (err < 1) {
-		printf("rf_rx_packet_nonblock failed]\r\n");
-		nrk_int_enable();
-		return;
-	}
-
-	/* TTL should be the first byte of the payload */
-	uint8_t ttl = rfRxInfo.pPayload[0];
-	if (ttl == 0) {
-#ifndef GLOSSY_TESTING
-		printf("Packet is done bouncing around!\r\n\n");
-#endif
-		nrk_int_enable();
-		return;
-	} else if (ttl == 5) {
-#ifndef GLOSSY_TESTING
-		printf("\n");
-#endif
-	}
-
-	/* Print packet information */
-#ifndef GLOSSY_TESTING
-	int8_t rssi = rfRxInfo.rssi;
-	uint8_t snum = rfRxInfo.seqNumber;
-	printf("SEQ:%4u\tTTL:%2d\tRSSI:%4d\tPayload: [%s]\r\n", 
-					snum, ttl, rssi, rfRxInfo.pPayload + 1);
-#endif
-	/* Copy pointer to payload and length */
-	rfTxInfo.pPayload = rfRxInfo.pPayload;
-	rfTxInfo.pPayload[0] = ttl - 1;
-	rfTxInfo.length = rfRxInfo.length;
-	rfTxInfo.cca = 0;
-	rfTxInfo.ackRequest = 0;
-	rfTxInfo.destAddr = 0xFFFF;
-
-	/* Code for testing glossy reception rate*/
-#ifdef GLOSSY_TESTING
-	uint16_t send_num = (((uint16_t)rfRxInfo.pPayload[1]) << 8) + rfRxInfo.pPayload[2];
-	uint8_t us_jam = rfRxInfo.pPayload[3];
-	if (calculate_checksum(rfRxInfo.pPayload)) {
-		mark_recieved(send_num, us_jam);
-		if (send_num < 1000) {
-			curr_count++;
-			printf("SEND NUM   %04d   %04d\r", send_num, curr_count);
-			fflush(stdout);
-			//nrk_spin_wait_us(((uint16_t)us_jam) * 10);
-		}
-		nrk_int_enable();
-		rf_tx_packet(&rfTxInfo);
-	} else {
-		nrk_int_enable();
-	}
-#else
-	nrk_int_enable();
-	rf_tx_packet(&rfTxInfo);
-#endif
-	return;
-}
-
-
 /* AES encryption and decryption */
 
 void aes_setkey(uint8_t *key)
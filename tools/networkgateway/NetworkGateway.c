@@ -114,6 +114,8 @@ uint8_t receiveFromSerial(uint8_t *p, int8_t len)
   
   do
   {
+  	 generate_graph();	// an update held back by the render rate limit, its 
+  	 					// alarm interrupts the receive 
   	 ret = slipstream_receive(p);
   	 printf("Received buffer length = %d\r\n", ret);
   	 sleep(2);
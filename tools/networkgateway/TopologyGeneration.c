@@ -1,9 +1,214 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "TopologyGeneration.h" 
 
+/*********************************** Global data structures ****************************/
+// every node seen so far, with its position
+static TopologyNode tg_nodes[TG_MAX_NODES];
+static int16_t tg_node_count;
+// links of the last completed update
+static TopologyLink tg_links[TG_MAX_LINKS];
+static int16_t tg_link_count;
+// links of the update being collected
+static TopologyLink tg_new_links[TG_MAX_LINKS];
+static int16_t tg_new_link_count;
+// nodes placed for the first time this update
+static int8_t tg_new_nodes;
+// an update is waiting to be rendered
+static int8_t tg_dirty;
+static time_t tg_last_render;
+// a trailing render is scheduled, cleared by the SIGALRM handler
+static volatile sig_atomic_t tg_alarm_set;
+
+/*********************************** Private functions *********************************/
+static int16_t _tg_node_index(uint16_t addr)
+{
+	int16_t i;
+	
+	for(i = 0; i < tg_node_count; i++)
+		if(tg_nodes[i].addr == addr)
+			return i;
+	
+	if(tg_node_count == TG_MAX_NODES)
+		return -1;
+	
+	// new nodes start at a random spot so the forces can pull them into place
+	tg_nodes[i].addr = addr;
+	tg_nodes[i].x = (float)(rand() % TG_CANVAS);
+	tg_nodes[i].y = (float)(rand() % TG_CANVAS);
+	tg_nodes[i].active = 0;
+	tg_nodes[i].seen = 0;
+	tg_node_count++;
+	tg_new_nodes = 1;
+	return i;
+}
+/**************************************************************************************/
+// Only interrupts the blocking receive, the caller renders from the main loop
+static void _tg_alarm(int sig)
+{
+	tg_alarm_set = 0;
+}
+/**************************************************************************************/
+// Fruchterman-Reingold layout, warm started from the previous positions. When no
+// node is new the temperature starts low so the drawing only settles, not reshuffles.
+static void _tg_layout()
+{
+	int16_t i, j, l, n;
+	float k, t, dx, dy, d, f;
+	
+	n = 0;
+	for(i = 0; i < tg_node_count; i++)
+		n += tg_nodes[i].active;
+	if(n == 0)
+		return;
+	
+	k = 0.5f * sqrtf((float)TG_CANVAS * TG_CANVAS / n);
+	t = tg_new_nodes ? TG_CANVAS / 10.0f : TG_CANVAS / 50.0f;
+	
+	for(l = 0; l < TG_LAYOUT_ITERATIONS; l++)
+	{
+		for(i = 0; i < tg_node_count; i++)
+			tg_nodes[i].dx = tg_nodes[i].dy = 0;
+		
+		// every pair of active nodes repels
+		for(i = 0; i < tg_node_count; i++)
+		{
+			if(!tg_nodes[i].active)
+				continue;
+			for(j = i + 1; j < tg_node_count; j++)
+			{
+				if(!tg_nodes[j].active)
+					continue;
+				dx = tg_nodes[i].x - tg_nodes[j].x;
+				dy = tg_nodes[i].y - tg_nodes[j].y;
+				d = sqrtf(dx * dx + dy * dy) + 0.01f;
+				f = k * k / d;
+				tg_nodes[i].dx += dx / d * f;
+				tg_nodes[i].dy += dy / d * f;
+				tg_nodes[j].dx -= dx / d * f;
+				tg_nodes[j].dy -= dy / d * f;
+			}
+		}
+		
+		// links attract
+		for(j = 0; j < tg_link_count; j++)
+		{
+			i = tg_links[j].from;
+			n = tg_links[j].to;
+			dx = tg_nodes[i].x - tg_nodes[n].x;
+			dy = tg_nodes[i].y - tg_nodes[n].y;
+			d = sqrtf(dx * dx + dy * dy) + 0.01f;
+			f = d * d / k;
+			tg_nodes[i].dx -= dx / d * f;
+			tg_nodes[i].dy -= dy / d * f;
+			tg_nodes[n].dx += dx / d * f;
+			tg_nodes[n].dy += dy / d * f;
+		}
+		
+		// move by at most the temperature and stay on the canvas
+		for(i = 0; i < tg_node_count; i++)
+		{
+			if(!tg_nodes[i].active)
+				continue;
+			d = sqrtf(tg_nodes[i].dx * tg_nodes[i].dx + tg_nodes[i].dy * tg_nodes[i].dy) + 0.01f;
+			f = d < t ? d : t;
+			tg_nodes[i].x += tg_nodes[i].dx / d * f;
+			tg_nodes[i].y += tg_nodes[i].dy / d * f;
+			if(tg_nodes[i].x < 20) tg_nodes[i].x = 20;
+			if(tg_nodes[i].y < 20) tg_nodes[i].y = 20;
+			if(tg_nodes[i].x > TG_CANVAS - 20) tg_nodes[i].x = TG_CANVAS - 20;
+			if(tg_nodes[i].y > TG_CANVAS - 20) tg_nodes[i].y = TG_CANVAS - 20;
+		}
+		t *= 0.95f;
+	}
+	tg_new_nodes = 0;
+	
+	return;
+}
+/**************************************************************************************/
+static void _tg_write_svg(FILE *fp)
+{
+	int16_t i;
+	TopologyNode *a, *b;
+	
+	fprintf(fp, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\">\n", TG_CANVAS, TG_CANVAS);
+	fputs("<defs><marker id=\"arrow\" viewBox=\"0 0 10 10\" refX=\"22\" refY=\"5\" markerWidth=\"6\" markerHeight=\"6\" orient=\"auto\">"
+		"<path d=\"M0,0 L10,5 L0,10 z\"/></marker></defs>\n", fp);
+	for(i = 0; i < tg_link_count; i++)
+	{
+		a = &tg_nodes[tg_links[i].from];
+		b = &tg_nodes[tg_links[i].to];
+		fprintf(fp, "<line x1=\"%.0f\" y1=\"%.0f\" x2=\"%.0f\" y2=\"%.0f\" stroke=\"black\" marker-end=\"url(#arrow)\"><title>rssi %d</title></line>\n",
+			a->x, a->y, b->x, b->y, tg_links[i].rssi);
+	}
+	for(i = 0; i < tg_node_count; i++)
+	{
+		if(!tg_nodes[i].active)
+			continue;
+		fprintf(fp, "<circle cx=\"%.0f\" cy=\"%.0f\" r=\"14\" fill=\"white\" stroke=\"black\"/>"
+			"<text x=\"%.0f\" y=\"%.0f\" text-anchor=\"middle\" font-size=\"12\">%u</text>\n",
+			tg_nodes[i].x, tg_nodes[i].y, tg_nodes[i].x, tg_nodes[i].y + 4, tg_nodes[i].addr);
+	}
+	fputs("</svg>\n", fp);
+	
+	return;
+}
+/**************************************************************************************/
+static void _tg_write_json(FILE *fp)
+{
+	int16_t i;
+	const char *sep;
+	
+	fputs("{\"nodes\":[", fp);
+	sep = "";
+	for(i = 0; i < tg_node_count; i++)
+	{
+		if(!tg_nodes[i].active)
+			continue;
+		fprintf(fp, "%s{\"id\":%u,\"x\":%.1f,\"y\":%.1f}", sep, tg_nodes[i].addr, tg_nodes[i].x, tg_nodes[i].y);
+		sep = ",";
+	}
+	fputs("],\"links\":[", fp);
+	for(i = 0; i < tg_link_count; i++)
+	{
+		fprintf(fp, "%s{\"source\":%u,\"target\":%u,\"rssi\":%d}", i ? "," : "",
+			tg_nodes[tg_links[i].from].addr, tg_nodes[tg_links[i].to].addr, tg_links[i].rssi);
+	}
+	fputs("]}\n", fp);
+	
+	return;
+}
+/**************************************************************************************/
+// Writes to a temporary file and renames it over the target, so a viewer never
+// reads a half written drawing
+static int8_t _tg_write_atomic(const char *name, void (*writer)(FILE *))
+{
+	char tmp[64];
+	FILE *fp;
+	
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+	fp = fopen(tmp, "w");
+	if(fp == NULL)
+	{
+		printf("Could not open %s\n", tmp);
+		return -1;
+	}
+	writer(fp);
+	if(fclose(fp) != 0 || rename(tmp, name) != 0)
+	{
+		printf("Could not write %s\n", name);
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
 /************************************* FUNCTION DEFINITIONS ****************************/
 void toString(char *str, uint16_t addr)
 {
@@ -15,6 +220,7 @@ void add_link_to_topology_file(FILE *fp, uint16_t f, uint16_t t, int8_t rssi)
 {
 	char from[ADDR_LENGTH];
 	char to[ADDR_LENGTH];
+	int16_t fi, ti;
 	
 	toString(from, f);
 	toString(to, t);
@@ -23,33 +229,89 @@ void add_link_to_topology_file(FILE *fp, uint16_t f, uint16_t t, int8_t rssi)
 	
 	if(DEBUG_TG >= 1)
 		printf("\t%s -> %s [rssi = %d]\n", from, to, rssi);
+	
+	// keep the link in memory for the native renderer
+	fi = _tg_node_index(f);
+	ti = _tg_node_index(t);
+	if(fi < 0 || ti < 0 || tg_new_link_count == TG_MAX_LINKS)
+		return;
+	tg_nodes[fi].seen = 1;
+	tg_nodes[ti].seen = 1;
+	tg_new_links[tg_new_link_count].from = fi;
+	tg_new_links[tg_new_link_count].to = ti;
+	tg_new_links[tg_new_link_count].rssi = rssi;
+	tg_new_link_count++;
 		
 	return;
 }
 /*************************************************************************************/
 void begin_topology_file(FILE *fp)
 {
+	int16_t i;
+	
 	fputs("\ndigraph Topology\n{\nconcentrate=true;\n", fp);
 	
 	if(DEBUG_TG >= 1)
 		printf("digraph Topology\n{\nconcentrate=true;\n");
+	
+	// positions survive, only the set of links is rebuilt. The last completed
+	// update stays untouched until this one ends, it may not be drawn yet.
+	tg_new_link_count = 0;
+	for(i = 0; i < tg_node_count; i++)
+		tg_nodes[i].seen = 0;
 		
 	return;
 }
 /*************************************************************************************/
 void end_topology_file(FILE *fp)
 {
+	int16_t i;
+	
 	fputs("}\n", fp); // close the topology format
 	
 	if(DEBUG_TG >= 1)
 		printf("}\n");
+	
+	memcpy(tg_links, tg_new_links, tg_new_link_count * sizeof(TopologyLink));
+	tg_link_count = tg_new_link_count;
+	for(i = 0; i < tg_node_count; i++)
+		tg_nodes[i].active = tg_nodes[i].seen;
+	tg_dirty = 1;
 		
 	return;
 }
 /**************************************************************************************/
+// Lays out and renders the last completed topology in process. Renders are rate
+// limited to one per TG_RENDER_INTERVAL. A skipped update sets an alarm, so that
+// it is drawn once the interval is over even if no other update follows: the
+// alarm interrupts the blocking receive, which calls here again.
 void generate_graph()
 {
-	system("dot -Tgif SensorTopology.dot -o SensorTopology.gif");	// create the .gif file 
+	struct sigaction sa;
+	time_t now;
+	
+	now = time(NULL);
+	if(!tg_dirty)
+		return;
+	if(now - tg_last_render < TG_RENDER_INTERVAL)
+	{
+		if(!tg_alarm_set)
+		{
+			// no SA_RESTART, the receive has to return
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_handler = _tg_alarm;
+			sigaction(SIGALRM, &sa, NULL);
+			tg_alarm_set = 1;
+			alarm(TG_RENDER_INTERVAL - (now - tg_last_render));
+		}
+		return;
+	}
+	
+	_tg_layout();
+	_tg_write_atomic(TG_SVG_FILE, _tg_write_svg);
+	_tg_write_atomic(TG_JSON_FILE, _tg_write_json);
+	tg_last_render = now;
+	tg_dirty = 0;
 			
 	return;
 }
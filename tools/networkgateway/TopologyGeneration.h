@@ -7,12 +7,37 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 /************************************* CONSTANTS *************************************/
-#define ADDR_LENGTH 5					 // length of a node address formatted as a character string 
+#define ADDR_LENGTH 6					 // length of a node address formatted as a character string 
 #define DEBUG_TG 2 
 
+#define TG_MAX_NODES 128				 // nodes whose layout positions are remembered
+#define TG_MAX_LINKS 1024				 // links drawn per update 
+#define TG_CANVAS 800					 // width and height of the rendered drawing
+#define TG_LAYOUT_ITERATIONS 50			 // force directed iterations per update 
+#define TG_RENDER_INTERVAL 2				 // minimum seconds between two renders 
 
+#define TG_SVG_FILE "SensorTopology.svg"
+#define TG_JSON_FILE "SensorTopology.json"
+
+/********************************** DATA STRUCTURES **********************************/
+typedef struct
+{
+	uint16_t addr;						// address of the node 
+	float x, y;							// layout position, kept between updates 
+	float dx, dy;						// displacement of the current iteration 
+	int8_t active;						// node appears in the last completed update 
+	int8_t seen;						// node appears in the update being collected 
+}TopologyNode;
+
+typedef struct
+{
+	int16_t from;						// index into the node table 
+	int16_t to;
+	int8_t rssi;
+}TopologyLink;
 
 /********************************** FUNCTION PROTOTYPES ******************************/
 void toString(char* str, uint16_t addr);
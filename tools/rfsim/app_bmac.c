@@ -0,0 +1,208 @@
+/******************************************************************************
+*  rfsim: B-MAC traffic application
+*
+*  Linked into node.so next to the firmware's bmac.c.  Every node receives
+*  everything B-MAC hands up and sends packets with exponentially
+*  distributed gaps, either broadcast or unicast to a neighbor, all the
+*  time or only during bursts that every node sees at once.  A send is
+*  one packet, or a train of packets queued back to back for B-MAC to
+*  send after one preamble.
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <include.h>
+#include <nrk.h>
+#include <nrk_events.h>
+#include <bmac.h>
+
+#include "sim.h"
+
+#define APP_PRIORITY	2
+
+typedef struct
+{
+  uint16_t src;
+  uint16_t seq;
+  uint64_t sent_ns;
+} app_hdr_t;
+
+static nrk_task_type rx_task;
+static nrk_task_type tx_task;
+static NRK_STK rx_task_stack[1];
+static NRK_STK tx_task_stack[1];
+
+static uint8_t rx_buf[RF_MAX_PAYLOAD_SIZE];
+static uint8_t tx_buf[BMAC_TX_QUEUE_SIZE][RF_MAX_PAYLOAD_SIZE];
+static int my_node;
+
+static void
+rx_task_func ()
+{
+  app_hdr_t hdr;
+  nrk_time_t t, t2;
+  uint8_t len;
+  int8_t rssi;
+
+  bmac_init (26);
+  bmac_rx_pkt_set_buffer (rx_buf, RF_MAX_PAYLOAD_SIZE);
+  bmac_addr_decode_set_my_mac (my_node);
+  if (sim_param.adapt_min_ms)
+    {
+      t.secs = sim_param.adapt_min_ms / 1000;
+      t.nano_secs = (sim_param.adapt_min_ms % 1000) * NANOS_PER_MS;
+      t2.secs = sim_param.adapt_max_ms / 1000;
+      t2.nano_secs = (sim_param.adapt_max_ms % 1000) * NANOS_PER_MS;
+      if (bmac_set_rx_check_rate_adaptive (t, t2) == NRK_ERROR)
+	nrk_kprintf ("adaptive check rate rejected\r\n");
+    }
+  else
+    {
+      t.secs = sim_param.check_ms / 1000;
+      t.nano_secs = (sim_param.check_ms % 1000) * NANOS_PER_MS;
+      bmac_set_rx_check_rate (t);
+    }
+  if (sim_param.strobe)
+    bmac_strobe_enable (my_node);
+
+  while (1)
+    {
+      bmac_wait_until_rx_pkt ();
+      bmac_rx_pkt_get (&len, &rssi);
+      if (len >= sizeof (app_hdr_t))
+	{
+	  memcpy (&hdr, rx_buf, sizeof (hdr));
+	  sim_stat_app_rx (my_node, sim_now () - hdr.sent_ns);
+	}
+      bmac_rx_pkt_release ();
+    }
+}
+
+// Queue a train of packets and wait until B-MAC sent all of them
+static void
+send_train (app_hdr_t * hdr, uint8_t len, uint8_t cnt, uint16_t dest)
+{
+  uint8_t i, queued;
+
+  for (i = 0; i < cnt; i++)
+    {
+      hdr->sent_ns = sim_now ();
+      memset (tx_buf[i], 0, len);
+      memcpy (tx_buf[i], hdr, sizeof (*hdr));
+      if (bmac_tx_pkt_nonblocking_to (tx_buf[i], len, dest) == NRK_ERROR)
+	break;
+      sim_stat_app_tx (my_node);
+      hdr->seq++;
+    }
+  cnt = i;
+
+  bmac_get_tx_done_signal ();
+  do
+    {
+      queued = 0;
+      for (i = 0; i < cnt; i++)
+	queued += bmac_tx_pkt_queued (tx_buf[i]);
+      if (queued)
+	nrk_event_wait (SIG (bmac_tx_pkt_done_signal));
+    }
+  while (queued);
+}
+
+static void
+tx_task_func ()
+{
+  app_hdr_t hdr;
+  uint16_t dest;
+  uint8_t len, train;
+  uint16_t sends;
+  int nb;
+  double cycle, pos;
+
+  while (!bmac_started ())
+    nrk_wait_until_next_period ();
+
+  len = sim_param.payload;
+  if (len < sizeof (app_hdr_t))
+    len = sizeof (app_hdr_t);
+  if (len > RF_MAX_PAYLOAD_SIZE)
+    len = RF_MAX_PAYLOAD_SIZE;
+  hdr.src = my_node;
+  hdr.seq = 0;
+  sends = 0;
+  train = sim_param.train;
+  if (train > BMAC_TX_QUEUE_SIZE)
+    train = BMAC_TX_QUEUE_SIZE;
+
+  while (1)
+    {
+      sim_sleep ((uint64_t) (-log (1.0 - drand48 ()) / sim_param.pkt_rate
+			     * NANOS_PER_SEC));
+      if (sim_param.burst_on > 0)
+	{
+	  cycle = sim_param.burst_on + sim_param.burst_off;
+	  pos = fmod (sim_now () / 1e9, cycle);
+	  if (pos >= sim_param.burst_on)
+	    {
+	      sim_sleep ((uint64_t) ((cycle - pos) * NANOS_PER_SEC));
+	      continue;
+	    }
+	}
+      if (sim_param.broadcast)
+	dest = 0xFFFF;
+      else
+	{
+	  // Pick by send, a train advances seq by more than one
+	  nb = sim_medium_neighbor (my_node, sends++);
+	  if (nb < 0)
+	    continue;
+	  dest = nb;
+	}
+      if (train > 1)
+	{
+	  send_train (&hdr, len, train, dest);
+	  continue;
+	}
+      hdr.sent_ns = sim_now ();
+      memset (tx_buf[0], 0, len);
+      memcpy (tx_buf[0], &hdr, sizeof (hdr));
+      sim_stat_app_tx (my_node);
+      bmac_tx_pkt_to (tx_buf[0], len, dest);
+      hdr.seq++;
+    }
+}
+
+// Entry point the simulator calls once per node copy
+void
+sim_node_init (int node)
+{
+  my_node = node;
+  bmac_task_config ();
+
+  nrk_task_set_entry_function (&rx_task, rx_task_func);
+  nrk_task_set_stk (&rx_task, rx_task_stack, 1);
+  rx_task.prio = APP_PRIORITY + 1;
+  rx_task.FirstActivation = TRUE;
+  rx_task.Type = BASIC_TASK;
+  rx_task.SchType = PREEMPTIVE;
+  rx_task.period.secs = 0;
+  rx_task.period.nano_secs = 10 * NANOS_PER_MS;
+  rx_task.offset.secs = 0;
+  rx_task.offset.nano_secs = 0;
+  nrk_activate_task (&rx_task);
+
+  if (sim_param.pkt_rate <= 0)
+    return;
+  nrk_task_set_entry_function (&tx_task, tx_task_func);
+  nrk_task_set_stk (&tx_task, tx_task_stack, 1);
+  tx_task.prio = APP_PRIORITY;
+  tx_task.FirstActivation = TRUE;
+  tx_task.Type = BASIC_TASK;
+  tx_task.SchType = PREEMPTIVE;
+  tx_task.period.secs = 0;
+  tx_task.period.nano_secs = 10 * NANOS_PER_MS;
+  tx_task.offset.secs = 0;
+  tx_task.offset.nano_secs = 0;
+  nrk_activate_task (&tx_task);
+}
@@ -0,0 +1,277 @@
+/******************************************************************************
+*  rfsim: irfence network stack application
+*
+*  Linked into irfence.so next to bmac.c and the irfence node's rxtx.c,
+*  router.c and rftop.c, the same files the firmware builds.  This file
+*  stands in for the node's main.c and config.c: it sets the options
+*  those modules read from EEPROM, starts their tasks in the order main.c
+*  does and installs shortest path routes over links B-MAC can wake up
+*  on, so no discovery has to run first.  Every node sends messages with
+*  exponentially distributed gaps to a random other node, which the
+*  router relays hop by hop.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <include.h>
+#include <nrk.h>
+#include <nrk_events.h>
+#include <bmac.h>
+
+#include "cfg.h"
+#include "config.h"
+#include "router.h"
+#include "rftop.h"
+#include "rxtx.h"
+#include "random.h"
+#include "led.h"
+
+#include "sim.h"
+
+#define APP_PORT	20
+#define APP_QUEUE_SIZE	4
+
+typedef struct
+{
+  uint16_t src;
+  uint16_t seq;
+  uint64_t sent_ns;
+} app_hdr_t;
+
+/* Options from config.c, with its defaults unless noted */
+uint16_t logcat;
+uint8_t rf_chan = 26;
+node_id_t this_node_id;
+bool is_gateway;
+uint8_t rf_power = 0;
+uint8_t rssi_thres = 0;
+int8_t chan_clear_thres = -45;
+uint8_t topology_mask;
+bool auto_discover = false;
+uint8_t discover_period_s = 30;
+nrk_time_t discover_time_out = { 20, 0 * NANOS_PER_MS };
+nrk_time_t discover_req_delay = { 1, 0 * NANOS_PER_MS };
+uint8_t route_broadcast_attempts = 3;
+uint8_t discover_send_attempts = 2;
+bool heal_routes = false;
+bool bmac_strobe = false;
+uint8_t rssi_avg_count = 5;
+nrk_time_t pkt_ack_timeout = { 2, 0 * NANOS_PER_MS };
+nrk_time_t rx_queue_slot_wait = { 0, 100 * NANOS_PER_MS };
+nrk_time_t tx_msg_retry_delay = { 2, 0 * NANOS_PER_MS };
+nrk_time_t pong_delay = { 1, 0 * NANOS_PER_MS };
+nrk_time_t bmac_rx_check_rate = { 0, 200 * NANOS_PER_MS };
+nrk_time_t bmac_rx_check_max = { 0, 0 * NANOS_PER_MS };
+uint8_t led_sent_pkt = GREEN_LED;
+uint8_t led_received_pkt = BLUE_LED;
+uint8_t led_awaiting_pong = ORANGE_LED;
+uint8_t led_proc_ping = ORANGE_LED;
+uint8_t led_discover = ORANGE_LED;
+
+static nrk_task_type rx_task;
+static nrk_task_type tx_task;
+static NRK_STK rx_task_stack[1];
+static NRK_STK tx_task_stack[1];
+
+static msg_t app_queue[APP_QUEUE_SIZE];
+static listener_t app_listener = {
+  .port = APP_PORT,
+  .queue = {.size = APP_QUEUE_SIZE},
+  .queue_data = app_queue,
+};
+
+static int my_node;
+static int num_nodes;
+
+/* Seqs heard from each source, bit n for last_seq - n */
+static uint16_t last_seq[MAX_NODES];
+static uint32_t seen[MAX_NODES];
+
+/* random.c seeds from the ADC, the simulator's generator is seeded by -s */
+void
+seed_rand ()
+{
+  srand (lrand48 ());
+}
+
+/* A router retry whose ack got lost delivers a message twice, count it
+ * once.  Returns 1 for a message not seen before. */
+static int
+app_rx_new (app_hdr_t * hdr)
+{
+  int16_t d;
+
+  d = hdr->seq - last_seq[hdr->src];
+  if (seen[hdr->src] == 0 || d > 0)
+    {
+      seen[hdr->src] = d >= 32 || seen[hdr->src] == 0 ? 1
+	: seen[hdr->src] << d | 1;
+      last_seq[hdr->src] = hdr->seq;
+      return 1;
+    }
+  if (-d >= 32 || seen[hdr->src] & 1UL << -d)
+    return 0;
+  seen[hdr->src] |= 1UL << -d;
+  return 1;
+}
+
+/* led.c drives the LEDs from its own task, there are none to drive here */
+int8_t
+pulse_led (uint8_t led)
+{
+  return NRK_OK;
+}
+
+static void
+ms_to_time (nrk_time_t * t, uint32_t ms)
+{
+  t->secs = ms / 1000;
+  t->nano_secs = (ms % 1000) * NANOS_PER_MS;
+}
+
+static void
+rx_task_func ()
+{
+  app_hdr_t hdr;
+  msg_t *msg;
+
+  register_listener (&app_listener);
+  activate_listener (&app_listener);
+
+  while (1)
+    {
+      nrk_event_wait (SIG (app_listener.signal));
+      while (!queue_empty (&app_listener.queue))
+	{
+	  msg = &app_listener.queue_data[queue_peek (&app_listener.queue)];
+	  if (msg->len >= sizeof (app_hdr_t))
+	    {
+	      memcpy (&hdr, msg->payload, sizeof (hdr));
+	      if (hdr.src < MAX_NODES && app_rx_new (&hdr))
+		sim_stat_app_rx (my_node, sim_now () - hdr.sent_ns);
+	    }
+	  queue_dequeue (&app_listener.queue);
+	}
+    }
+}
+
+static void
+tx_task_func ()
+{
+  app_hdr_t hdr;
+  msg_t msg;
+  uint8_t len;
+  int dest;
+  double cycle, pos;
+
+  while (!bmac_started ())
+    nrk_wait_until_next_period ();
+
+  len = sim_param.payload;
+  if (len < sizeof (app_hdr_t))
+    len = sizeof (app_hdr_t);
+  if (len > MAX_MSG_SIZE)
+    len = MAX_MSG_SIZE;
+  hdr.src = my_node;
+  hdr.seq = 0;
+
+  while (1)
+    {
+      sim_sleep ((uint64_t) (-log (1.0 - drand48 ()) / sim_param.pkt_rate
+			     * NANOS_PER_SEC));
+      if (sim_param.burst_on > 0)
+	{
+	  cycle = sim_param.burst_on + sim_param.burst_off;
+	  pos = fmod (sim_now () / 1e9, cycle);
+	  if (pos >= sim_param.burst_on)
+	    {
+	      sim_sleep ((uint64_t) ((cycle - pos) * NANOS_PER_SEC));
+	      continue;
+	    }
+	}
+      dest = lrand48 () % (num_nodes - 1);
+      if (dest >= my_node)
+	dest++;
+
+      init_message (&msg);
+      msg.recipient = sim_param.broadcast ? BROADCAST_NODE_ID : dest + 1;
+      msg.port = APP_PORT;
+      msg.class = TRAFFIC_CLASS_BULK;
+      msg.len = len;
+      hdr.sent_ns = sim_now ();
+      memcpy (msg.payload, &hdr, sizeof (hdr));
+      /* A message the router has no room for counts as lost */
+      sim_stat_app_tx (my_node);
+      send_message (&msg);
+      hdr.seq++;
+    }
+}
+
+static void
+app_task_config (nrk_task_type * task, void (*func) (), NRK_STK * stk,
+		 uint8_t prio)
+{
+  nrk_task_set_entry_function (task, func);
+  nrk_task_set_stk (task, stk, 1);
+  task->prio = prio;
+  task->FirstActivation = TRUE;
+  task->Type = BASIC_TASK;
+  task->SchType = PREEMPTIVE;
+  task->period.secs = 0;
+  task->period.nano_secs = 10 * NANOS_PER_MS;
+  task->offset.secs = 0;
+  task->offset.nano_secs = 0;
+  nrk_activate_task (task);
+}
+
+// Entry point the simulator calls once per node copy
+void
+sim_node_init (int node)
+{
+  uint8_t prio = NRK_MAX_TASKS;
+  int dest, hop;
+
+  my_node = node;
+  num_nodes = sim_medium_nodes ();
+  if (num_nodes >= MAX_NODES)
+    {
+      printf ("irfence.so is built for at most %d nodes\n", MAX_NODES - 1);
+      exit (1);
+    }
+
+  /* Node ids start at 1, 0 is INVALID_NODE_ID */
+  this_node_id = node + 1;
+  is_gateway = node == 0;
+  logcat = sim_param.verbose ? ~0 : 0;
+  bmac_strobe = sim_param.strobe;
+  if (sim_param.adapt_min_ms)
+    {
+      ms_to_time (&bmac_rx_check_rate, sim_param.adapt_min_ms);
+      ms_to_time (&bmac_rx_check_max, sim_param.adapt_max_ms);
+    }
+  else
+    ms_to_time (&bmac_rx_check_rate, sim_param.check_ms);
+
+  bmac_task_config ();
+  prio -= init_rxtx (prio);
+  prio -= init_router (prio);
+  prio -= init_rftop (prio);
+
+  /* B-MAC only wakes up for senders above the CCA threshold, so routes
+   * stay on links that strong */
+  for (dest = 0; dest < num_nodes; dest++)
+    {
+      hop = sim_medium_next_hop (node, dest,
+				 rf_sim_cca_dbm (chan_clear_thres));
+      if (dest != node && hop >= 0)
+	routes[dest + 1] = hop + 1;
+    }
+
+  app_listener.signal = nrk_signal_create ();
+  app_task_config (&rx_task, rx_task_func, rx_task_stack, prio--);
+  if (sim_param.pkt_rate > 0)
+    app_task_config (&tx_task, tx_task_func, tx_task_stack, prio--);
+}
@@ -0,0 +1 @@
+/* rfsim shim: nothing to emulate */
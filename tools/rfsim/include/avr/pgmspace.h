@@ -0,0 +1,24 @@
+/* rfsim shim: program memory is ordinary memory on the host */
+#ifndef _AVR_PGMSPACE_H
+#define _AVR_PGMSPACE_H
+
+#include <string.h>
+
+#define PSTR(s)	(s)
+#define PROGMEM
+
+#define pgm_read_byte(p)	(*(const uint8_t *) (p))
+#define pgm_read_word(p)	(*(const uint16_t *) (p))
+#define pgm_read_dword(p)	(*(const uint32_t *) (p))
+#define pgm_read_ptr(p)		(*(void * const *) (p))
+
+#define strcmp_P	strcmp
+#define strncmp_P	strncmp
+#define strlen_P	strlen
+#define strcpy_P	strcpy
+#define memcpy_P	memcpy
+#define printf_P	printf
+#define sprintf_P	sprintf
+#define snprintf_P	snprintf
+
+#endif
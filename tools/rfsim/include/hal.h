@@ -0,0 +1,16 @@
+/* rfsim shim: board LEDs, the simulator has nothing to light */
+#ifndef _HAL_H
+#define _HAL_H
+
+#include <stdint.h>
+
+#define RED_LED		0
+#define GREEN_LED	1
+#define BLUE_LED	2
+#define ORANGE_LED	3
+
+int8_t nrk_led_set(int led);
+int8_t nrk_led_clr(int led);
+int8_t nrk_led_toggle(int led);
+
+#endif
@@ -0,0 +1,15 @@
+/* rfsim shim: stands in for the platform include.h */
+#ifndef _INCLUDE_H
+#define _INCLUDE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <hal.h>
+
+#define TRUE	1
+#define FALSE	0
+
+#endif
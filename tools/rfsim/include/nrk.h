@@ -0,0 +1,54 @@
+/* rfsim shim: the part of the Nano-RK task API that MAC code uses */
+#ifndef NRK_H
+#define NRK_H
+
+#include <include.h>
+#include <nrk_cfg.h>
+#include <nrk_time.h>
+#include <nrk_events.h>
+
+#define NRK_OK		1
+#define NRK_ERROR	(-1)
+
+#define BASIC_TASK	1
+#define PREEMPTIVE	1
+
+typedef uint8_t NRK_STK;
+
+typedef struct {
+  void (*task)(void);
+  void *Ptos;
+  void *Pbos;
+  uint8_t prio;
+  uint8_t FirstActivation;
+  uint8_t Type;
+  uint8_t SchType;
+  nrk_time_t period;
+  nrk_time_t cpu_reserve;
+  nrk_time_t offset;
+} nrk_task_type;
+
+typedef struct {
+  int8_t task_ID;
+} nrk_tcb_t;
+
+extern nrk_tcb_t *nrk_cur_task_TCB;
+
+void nrk_task_set_entry_function(nrk_task_type *task, void *func);
+void nrk_task_set_stk(nrk_task_type *task, NRK_STK stk_base[], uint16_t stk_size);
+int8_t nrk_activate_task(nrk_task_type *task);
+
+int8_t nrk_wait(nrk_time_t t);
+int8_t nrk_wait_until(nrk_time_t t);
+int8_t nrk_wait_until_next_period();
+int8_t nrk_wait_until_next_n_periods(uint16_t p);
+int8_t nrk_wait_until_ticks(uint16_t ticks);
+int8_t nrk_set_next_wakeup(nrk_time_t t);
+
+void nrk_int_disable();
+void nrk_int_enable();
+
+void nrk_kprintf(const char *s);
+void nrk_halt();
+
+#endif
@@ -0,0 +1,8 @@
+/* rfsim shim: simulated node configuration */
+#ifndef _NRK_CFG_H
+#define _NRK_CFG_H
+
+#define NRK_MAX_TASKS		8
+#define BMAC_STACKSIZE		128
+
+#endif
@@ -0,0 +1,11 @@
+/* rfsim shim: kernel error reporting */
+#ifndef NRK_ERROR_H
+#define NRK_ERROR_H
+
+#include <nrk.h>
+
+#define NRK_SIGNAL_CREATE_ERROR	1
+
+void nrk_kernel_error_add(uint8_t n, uint8_t task);
+
+#endif
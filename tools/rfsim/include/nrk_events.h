@@ -0,0 +1,31 @@
+/* rfsim shim: Nano-RK signals, one signal space per simulated node */
+#ifndef NRK_EVENTS_H
+#define NRK_EVENTS_H
+
+#include <nrk_time.h>
+
+#define SIG(x)  ((uint32_t)1)<<x
+
+typedef int8_t nrk_sig_t;
+typedef uint32_t nrk_sig_mask_t;
+
+typedef struct semaphore_type {
+  int8_t count;
+  int8_t resource_ceiling;
+  int8_t value;
+} nrk_sem_t;
+
+// Signal 0 on every node, as nrk_init() creates it first
+extern nrk_sig_t nrk_wakeup_signal;
+
+int8_t nrk_signal_register(int8_t sig_id);
+int8_t nrk_signal_unregister(int8_t sig_id);
+int8_t nrk_signal_create();
+int8_t nrk_event_signal(int8_t event_num);
+uint32_t nrk_event_wait(uint32_t event_num);
+
+nrk_sem_t *nrk_sem_create(uint8_t count, uint8_t ceiling_prio);
+int8_t nrk_sem_pend(nrk_sem_t *rsrc);
+int8_t nrk_sem_post(nrk_sem_t *rsrc);
+
+#endif
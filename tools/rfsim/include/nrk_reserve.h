@@ -0,0 +1 @@
+/* rfsim shim: reservations are not simulated, leave NRK_MAX_RESERVES unset */
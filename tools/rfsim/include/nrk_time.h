@@ -0,0 +1,28 @@
+/* rfsim shim: Nano-RK time API on the simulator's virtual clock */
+#ifndef NRK_TIME_H
+#define NRK_TIME_H
+
+#include <include.h>
+
+#define NANOS_PER_SEC       1000000000
+#define US_PER_SEC          1000000
+#define NANOS_PER_MS        1000000
+#define NANOS_PER_US        1000
+
+#define NANOS_PER_TICK      976563
+#define US_PER_TICK         977
+#define TICKS_PER_SEC       1024
+
+typedef struct {
+   uint32_t secs;
+   uint32_t nano_secs;
+} nrk_time_t;
+
+void nrk_time_get(nrk_time_t *t);
+uint16_t _nrk_time_to_ticks(nrk_time_t *t);
+uint32_t _nrk_time_to_ticks_long(nrk_time_t *t);
+int8_t nrk_time_sub(nrk_time_t *result,nrk_time_t high, nrk_time_t low);
+int8_t nrk_time_add(nrk_time_t *result,nrk_time_t a, nrk_time_t b);
+void nrk_time_compact_nanos(nrk_time_t *t);
+
+#endif
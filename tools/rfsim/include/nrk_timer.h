@@ -0,0 +1,7 @@
+/* rfsim shim: no hardware timers in the simulator */
+#ifndef NRK_TIMER_H
+#define NRK_TIMER_H
+
+#include <nrk.h>
+
+#endif
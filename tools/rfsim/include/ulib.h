@@ -0,0 +1,8 @@
+/* rfsim shim: stands in for the Nano-RK ulib.h */
+#ifndef _ULIB_H
+#define _ULIB_H
+
+#include <stdlib.h>
+#include <hal.h>
+
+#endif
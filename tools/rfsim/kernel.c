@@ -0,0 +1,559 @@
+/******************************************************************************
+*  rfsim: virtual time Nano-RK task API
+*
+*  Tasks run as ucontext coroutines on a single host thread.  A task runs
+*  until it blocks in nrk_wait*, nrk_event_wait, nrk_sem_pend or a radio
+*  call, so code takes no virtual time to execute.  Sleeping tasks sit in a
+*  binary heap ordered by wakeup time, then by Nano-RK priority (higher
+*  runs first).
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include <nrk.h>
+#include <nrk_error.h>
+
+#include "sim.h"
+
+typedef struct sim_task
+{
+  ucontext_t ctx;
+  void *stack;
+  void (*task) (void);
+  nrk_tcb_t tcb;
+  int node;
+  uint8_t prio;
+  uint64_t period;
+  uint64_t release;		// start of the current period
+  uint32_t registered;		// signals the task registered for
+  uint32_t wait_mask;		// signals an nrk_event_wait is blocked on
+  uint32_t fired;		// signal that ended the wait
+  uint64_t next_wakeup;		// nrk_set_next_wakeup() deadline
+  nrk_sem_t *sem_wait;		// semaphore an nrk_sem_pend is blocked on
+  uint64_t wake;
+  uint32_t seq;
+  int heap_pos;			// -1 when not sleeping on a timer
+} sim_task_t;
+
+typedef struct
+{
+  sim_task_t *tasks[SIM_MAX_TASKS_PER_NODE];
+  uint8_t num_tasks;
+  uint8_t num_signals;
+} sim_node_kernel_t;
+
+nrk_tcb_t *nrk_cur_task_TCB;
+nrk_sig_t nrk_wakeup_signal = 0;
+
+static sim_node_kernel_t *nodes;
+static int num_nodes;
+static int init_node;
+
+static sim_task_t **heap;
+static int heap_len;
+static uint32_t heap_seq;
+
+static ucontext_t sched_ctx;
+static sim_task_t *cur;
+static uint64_t now_ns;
+
+/****************************************************************************/
+static int
+_task_before (sim_task_t * a, sim_task_t * b)
+{
+  if (a->wake != b->wake)
+    return a->wake < b->wake;
+  if (a->prio != b->prio)
+    return a->prio > b->prio;
+  return (int32_t) (a->seq - b->seq) < 0;
+}
+
+static void
+_heap_swap (int i, int j)
+{
+  sim_task_t *t = heap[i];
+
+  heap[i] = heap[j];
+  heap[j] = t;
+  heap[i]->heap_pos = i;
+  heap[j]->heap_pos = j;
+}
+
+static void
+_heap_push (sim_task_t * t, uint64_t wake)
+{
+  int i, p;
+
+  t->wake = wake;
+  t->seq = heap_seq++;
+  i = heap_len++;
+  heap[i] = t;
+  t->heap_pos = i;
+  while (i > 0)
+    {
+      p = (i - 1) / 2;
+      if (!_task_before (heap[i], heap[p]))
+	break;
+      _heap_swap (i, p);
+      i = p;
+    }
+}
+
+// Take t off the heap, wherever it is
+static void
+_heap_remove (sim_task_t * t)
+{
+  int i, p, l, r, m;
+
+  i = t->heap_pos;
+  t->heap_pos = -1;
+  if (--heap_len == i)
+    return;
+  heap[i] = heap[heap_len];
+  heap[i]->heap_pos = i;
+  while (i > 0)
+    {
+      p = (i - 1) / 2;
+      if (!_task_before (heap[i], heap[p]))
+	break;
+      _heap_swap (i, p);
+      i = p;
+    }
+  for (;;)
+    {
+      l = 2 * i + 1;
+      r = l + 1;
+      m = i;
+      if (l < heap_len && _task_before (heap[l], heap[m]))
+	m = l;
+      if (r < heap_len && _task_before (heap[r], heap[m]))
+	m = r;
+      if (m == i)
+	break;
+      _heap_swap (i, m);
+      i = m;
+    }
+}
+
+static sim_task_t *
+_heap_pop ()
+{
+  sim_task_t *top;
+
+  top = heap[0];
+  _heap_remove (top);
+  return top;
+}
+
+/****************************************************************************/
+static uint64_t
+_time_ns (nrk_time_t * t)
+{
+  return (uint64_t) t->secs * NANOS_PER_SEC + t->nano_secs;
+}
+
+// Hand control back to the scheduler until something wakes the task
+static void
+_block ()
+{
+  sim_task_t *self = cur;
+
+  swapcontext (&self->ctx, &sched_ctx);
+}
+
+static void
+_task_start ()
+{
+  cur->task ();
+  fprintf (stderr, "rfsim: node %d task %d returned\n", cur->node,
+	   cur->tcb.task_ID);
+  _block ();
+}
+
+/****************************************************************************/
+uint64_t
+sim_now ()
+{
+  return now_ns;
+}
+
+int
+sim_node_self ()
+{
+  return cur ? cur->node : init_node;
+}
+
+void
+sim_sleep (uint64_t ns)
+{
+  _heap_push (cur, now_ns + ns);
+  _block ();
+}
+
+void
+sim_kernel_init (int n)
+{
+  int i;
+
+  num_nodes = n;
+  nodes = calloc (n, sizeof (sim_node_kernel_t));
+  heap = calloc (n * SIM_MAX_TASKS_PER_NODE, sizeof (sim_task_t *));
+  if (nodes == NULL || heap == NULL)
+    {
+      fprintf (stderr, "rfsim: out of memory\n");
+      exit (1);
+    }
+  for (i = 0; i < n; i++)
+    nodes[i].num_signals = nrk_wakeup_signal + 1;
+}
+
+// Tasks activated from now on belong to node
+void
+sim_kernel_set_node (int node)
+{
+  init_node = node;
+}
+
+void
+sim_kernel_run (uint64_t until)
+{
+  while (heap_len > 0 && heap[0]->wake <= until)
+    {
+      cur = _heap_pop ();
+      now_ns = cur->wake;
+      nrk_cur_task_TCB = &cur->tcb;
+      swapcontext (&sched_ctx, &cur->ctx);
+    }
+  cur = NULL;
+  now_ns = until;
+}
+
+/*************************** Nano-RK task API *******************************/
+void
+nrk_task_set_entry_function (nrk_task_type * task, void *func)
+{
+  task->task = func;
+}
+
+void
+nrk_task_set_stk (nrk_task_type * task, NRK_STK stk_base[],
+		  uint16_t stk_size)
+{
+  // Tasks run on host stacks of SIM_TASK_STACK bytes
+}
+
+int8_t
+nrk_activate_task (nrk_task_type * task)
+{
+  sim_node_kernel_t *k = &nodes[sim_node_self ()];
+  sim_task_t *t;
+
+  if (k->num_tasks == SIM_MAX_TASKS_PER_NODE)
+    return NRK_ERROR;
+  t = calloc (1, sizeof (sim_task_t));
+  if (t == NULL)
+    return NRK_ERROR;
+  t->stack = malloc (SIM_TASK_STACK);
+  if (t->stack == NULL)
+    {
+      free (t);
+      return NRK_ERROR;
+    }
+  t->task = task->task;
+  t->node = sim_node_self ();
+  t->prio = task->prio;
+  t->tcb.task_ID = k->num_tasks + 1;
+  t->period = _time_ns (&task->period);
+  t->release = now_ns + _time_ns (&task->offset);
+  getcontext (&t->ctx);
+  t->ctx.uc_stack.ss_sp = t->stack;
+  t->ctx.uc_stack.ss_size = SIM_TASK_STACK;
+  t->ctx.uc_link = NULL;
+  makecontext (&t->ctx, _task_start, 0);
+  k->tasks[k->num_tasks++] = t;
+  _heap_push (t, t->release);
+  return NRK_OK;
+}
+
+int8_t
+nrk_wait (nrk_time_t t)
+{
+  sim_sleep (_time_ns (&t));
+  return NRK_OK;
+}
+
+int8_t
+nrk_wait_until (nrk_time_t t)
+{
+  uint64_t at = _time_ns (&t);
+
+  sim_sleep (at > now_ns ? at - now_ns : 0);
+  return NRK_OK;
+}
+
+int8_t
+nrk_wait_until_next_n_periods (uint16_t p)
+{
+  uint64_t period = cur->period ? cur->period : NANOS_PER_TICK;
+
+  if (p == 0)
+    p = 1;
+  cur->release += p * period;
+  if (cur->release <= now_ns)
+    cur->release = now_ns + period - (now_ns - cur->release) % period;
+  sim_sleep (cur->release - now_ns);
+  return NRK_OK;
+}
+
+int8_t
+nrk_wait_until_next_period ()
+{
+  return nrk_wait_until_next_n_periods (1);
+}
+
+int8_t
+nrk_wait_until_ticks (uint16_t ticks)
+{
+  sim_sleep ((uint64_t) ticks * NANOS_PER_TICK);
+  return NRK_OK;
+}
+
+int8_t
+nrk_set_next_wakeup (nrk_time_t t)
+{
+  cur->next_wakeup = now_ns + _time_ns (&t);
+  return NRK_OK;
+}
+
+void
+nrk_int_disable ()
+{
+}
+
+void
+nrk_int_enable ()
+{
+}
+
+void
+nrk_kprintf (const char *s)
+{
+  if (sim_param.verbose)
+    printf ("[%d] %s", sim_node_self (), s);
+}
+
+void
+nrk_halt ()
+{
+  fprintf (stderr, "rfsim: node %d halted\n", sim_node_self ());
+  exit (1);
+}
+
+int8_t
+nrk_led_set (int led)
+{
+  return NRK_OK;
+}
+
+int8_t
+nrk_led_clr (int led)
+{
+  return NRK_OK;
+}
+
+int8_t
+nrk_led_toggle (int led)
+{
+  return NRK_OK;
+}
+
+void
+nrk_kernel_error_add (uint8_t n, uint8_t task)
+{
+  fprintf (stderr, "rfsim: node %d kernel error %u task %u\n",
+	   sim_node_self (), n, task);
+}
+
+/************************** Nano-RK signal API ******************************/
+int8_t
+nrk_signal_create ()
+{
+  sim_node_kernel_t *k = &nodes[sim_node_self ()];
+
+  if (k->num_signals == SIM_MAX_SIGNALS)
+    return NRK_ERROR;
+  return k->num_signals++;
+}
+
+int8_t
+nrk_signal_register (int8_t sig_id)
+{
+  if (sig_id < 0 || sig_id >= nodes[cur->node].num_signals)
+    return NRK_ERROR;
+  cur->registered |= SIG (sig_id);
+  return NRK_OK;
+}
+
+int8_t
+nrk_signal_unregister (int8_t sig_id)
+{
+  if (sig_id < 0 || sig_id >= nodes[cur->node].num_signals)
+    return NRK_ERROR;
+  cur->registered &= ~SIG (sig_id);
+  return NRK_OK;
+}
+
+int8_t
+nrk_event_signal (int8_t sig_id)
+{
+  sim_node_kernel_t *k = &nodes[sim_node_self ()];
+  sim_task_t *t;
+  uint8_t i, woke;
+
+  woke = 0;
+  for (i = 0; i < k->num_tasks; i++)
+    {
+      t = k->tasks[i];
+      if (t->wait_mask & SIG (sig_id))
+	{
+	  t->wait_mask = 0;
+	  t->fired = SIG (sig_id);
+	  // Waits that include the wakeup signal also sit on the heap
+	  if (t->heap_pos >= 0)
+	    _heap_remove (t);
+	  _heap_push (t, now_ns);
+	  woke = 1;
+	}
+    }
+  return woke ? NRK_OK : NRK_ERROR;
+}
+
+uint32_t
+nrk_event_wait (uint32_t event_mask)
+{
+  if ((event_mask & cur->registered) == 0)
+    return 0;
+  cur->wait_mask = event_mask;
+  cur->fired = 0;
+  if (event_mask & SIG (nrk_wakeup_signal))
+    _heap_push (cur, cur->next_wakeup > now_ns ? cur->next_wakeup : now_ns);
+  _block ();
+  if (cur->fired == 0)
+    {
+      // The nrk_set_next_wakeup() deadline passed first
+      cur->wait_mask = 0;
+      cur->fired = SIG (nrk_wakeup_signal);
+    }
+  return cur->fired;
+}
+
+/************************ Nano-RK semaphore API *****************************/
+nrk_sem_t *
+nrk_sem_create (uint8_t count, uint8_t ceiling_prio)
+{
+  nrk_sem_t *s = calloc (1, sizeof (nrk_sem_t));
+
+  if (s == NULL)
+    return NULL;
+  s->count = count;
+  s->resource_ceiling = ceiling_prio;
+  s->value = count;
+  return s;
+}
+
+int8_t
+nrk_sem_pend (nrk_sem_t * rsrc)
+{
+  if (rsrc == NULL)
+    return NRK_ERROR;
+  while (rsrc->value == 0)
+    {
+      cur->sem_wait = rsrc;
+      _block ();
+    }
+  rsrc->value--;
+  return NRK_OK;
+}
+
+// Hands the semaphore to the highest priority task pending on it
+int8_t
+nrk_sem_post (nrk_sem_t * rsrc)
+{
+  sim_node_kernel_t *k = &nodes[sim_node_self ()];
+  sim_task_t *t, *best;
+  uint8_t i;
+
+  if (rsrc == NULL || rsrc->value >= rsrc->count)
+    return NRK_ERROR;
+  rsrc->value++;
+  best = NULL;
+  for (i = 0; i < k->num_tasks; i++)
+    {
+      t = k->tasks[i];
+      if (t->sem_wait == rsrc && (best == NULL || t->prio > best->prio))
+	best = t;
+    }
+  if (best != NULL)
+    {
+      best->sem_wait = NULL;
+      _heap_push (best, now_ns);
+    }
+  return NRK_OK;
+}
+
+/*************************** Nano-RK time API *******************************/
+void
+nrk_time_get (nrk_time_t * t)
+{
+  t->secs = now_ns / NANOS_PER_SEC;
+  t->nano_secs = now_ns % NANOS_PER_SEC;
+}
+
+void
+nrk_time_compact_nanos (nrk_time_t * t)
+{
+  while (t->nano_secs >= NANOS_PER_SEC)
+    {
+      t->nano_secs -= NANOS_PER_SEC;
+      t->secs++;
+    }
+}
+
+int8_t
+nrk_time_sub (nrk_time_t * result, nrk_time_t high, nrk_time_t low)
+{
+  uint64_t h = _time_ns (&high), l = _time_ns (&low);
+
+  if (h < l)
+    return NRK_ERROR;
+  result->secs = (h - l) / NANOS_PER_SEC;
+  result->nano_secs = (h - l) % NANOS_PER_SEC;
+  return NRK_OK;
+}
+
+int8_t
+nrk_time_add (nrk_time_t * result, nrk_time_t a, nrk_time_t b)
+{
+  uint64_t s = _time_ns (&a) + _time_ns (&b);
+
+  result->secs = s / NANOS_PER_SEC;
+  result->nano_secs = s % NANOS_PER_SEC;
+  return NRK_OK;
+}
+
+uint32_t
+_nrk_time_to_ticks_long (nrk_time_t * t)
+{
+  return _time_ns (t) / NANOS_PER_TICK;
+}
+
+uint16_t
+_nrk_time_to_ticks (nrk_time_t * t)
+{
+  uint32_t ticks = _nrk_time_to_ticks_long (t);
+
+  return ticks > 65535 ? 65535 : ticks;
+}
@@ -0,0 +1,271 @@
+/******************************************************************************
+*  rfsim: host side 802.15.4 medium simulator for Nano-RK MAC code
+*
+*  Loads one copy of node.so per simulated node, connects the nodes through
+*  the medium in medium.c and runs them in virtual time.  At the end it
+*  prints application delivery, latency, MAC duty cycle and medium counters.
+*
+*  Example:
+*    ./rfsim -n 200 -g 12 -r 0.2 -c 100 -t 120
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <math.h>
+
+#include "sim.h"
+
+typedef struct
+{
+  uint32_t tx;
+  uint32_t rx;
+  uint64_t latency_sum;
+  uint64_t latency_max;
+} app_stats_t;
+
+typedef void (*node_init_fn) (int node);
+
+sim_param_t sim_param;
+
+static app_stats_t *app_stats;
+static char tmp_dir[] = "/tmp/rfsimXXXXXX";
+
+void
+sim_stat_app_tx (int node)
+{
+  app_stats[node].tx++;
+}
+
+void
+sim_stat_app_rx (int node, uint64_t latency_ns)
+{
+  app_stats[node].rx++;
+  app_stats[node].latency_sum += latency_ns;
+  if (latency_ns > app_stats[node].latency_max)
+    app_stats[node].latency_max = latency_ns;
+}
+
+void
+print_usage (char *name)
+{
+  printf ("Usage: %s [options]\n", name);
+  printf ("  -n nodes      number of nodes (default 25, max %d)\n",
+	  SIM_MAX_NODES);
+  printf ("  -t secs       simulated time (default 60)\n");
+  printf ("  -l file       link file, lines of \"src dst prr rssi\"\n");
+  printf ("  -g meters     grid spacing when no link file is given (default 10)\n");
+  printf ("  -r pkts/s     packets per second per node (default 0.1)\n");
+  printf ("  -p bytes      payload size (default 16)\n");
+  printf ("  -T pkts       queue this many packets per send as a train\n");
+  printf ("  -c ms         fixed B-MAC check rate (default 100)\n");
+  printf ("  -a min:max    adaptive B-MAC check rate in ms\n");
+  printf ("  -S            B-MAC strobed preambles\n");
+  printf ("  -b            broadcast instead of unicast to a neighbor\n");
+  printf ("  -B on:off     send in bursts of on secs every on+off secs\n");
+  printf ("  -s seed       random seed (default 1)\n");
+  printf ("  -o file       node image, ./node.so (default) or ./irfence.so\n");
+  printf ("  -v            per node results and MAC messages\n");
+}
+
+// dlopen() returns the already loaded image for a path it has seen, so
+// every node needs its own file to get its own copy of the MAC state
+static void *
+load_node (const char *image, int node)
+{
+  char path[256], cmd[600];
+  void *h;
+
+  snprintf (path, sizeof (path), "%s/node%d.so", tmp_dir, node);
+  snprintf (cmd, sizeof (cmd), "cp '%s' '%s'", image, path);
+  if (system (cmd) != 0)
+    return NULL;
+  h = dlopen (path, RTLD_NOW | RTLD_LOCAL);
+  if (h == NULL)
+    printf ("%s\n", dlerror ());
+  unlink (path);
+  return h;
+}
+
+int
+main (int argc, char *argv[])
+{
+  char *image = "./node.so", *link_file = NULL;
+  double spacing = 10.0, secs = 60.0;
+  int num_nodes = 25, seed = 1;
+  int c, i, links;
+  void *h;
+  node_init_fn init;
+  sim_deliver_fn deliver;
+  sim_radio_stats_t rs, total;
+  uint32_t tx, rx;
+  uint64_t lat_sum, lat_max;
+  double duty;
+
+  sim_param.check_ms = 100;
+  sim_param.pkt_rate = 0.1;
+  sim_param.payload = 16;
+  sim_param.train = 1;
+
+  while ((c = getopt (argc, argv, "n:t:l:g:r:p:T:c:a:SbB:s:o:vh")) != -1)
+    switch (c)
+      {
+      case 'n':
+	num_nodes = atoi (optarg);
+	break;
+      case 't':
+	secs = atof (optarg);
+	break;
+      case 'l':
+	link_file = optarg;
+	break;
+      case 'g':
+	spacing = atof (optarg);
+	break;
+      case 'r':
+	sim_param.pkt_rate = atof (optarg);
+	break;
+      case 'p':
+	sim_param.payload = atoi (optarg);
+	break;
+      case 'T':
+	sim_param.train = atoi (optarg);
+	if (sim_param.train < 1)
+	  {
+	    print_usage (argv[0]);
+	    return 1;
+	  }
+	break;
+      case 'c':
+	sim_param.check_ms = atoi (optarg);
+	break;
+      case 'a':
+	if (sscanf (optarg, "%u:%u", &sim_param.adapt_min_ms,
+		    &sim_param.adapt_max_ms) != 2)
+	  {
+	    print_usage (argv[0]);
+	    return 1;
+	  }
+	break;
+      case 'S':
+	sim_param.strobe = 1;
+	break;
+      case 'b':
+	sim_param.broadcast = 1;
+	break;
+      case 'B':
+	if (sscanf (optarg, "%lf:%lf", &sim_param.burst_on,
+		    &sim_param.burst_off) != 2 || sim_param.burst_on <= 0
+	    || sim_param.burst_off < 0)
+	  {
+	    print_usage (argv[0]);
+	    return 1;
+	  }
+	break;
+      case 's':
+	seed = atoi (optarg);
+	break;
+      case 'o':
+	image = optarg;
+	break;
+      case 'v':
+	sim_param.verbose = 1;
+	break;
+      default:
+	print_usage (argv[0]);
+	return 1;
+      }
+  if (num_nodes < 2 || num_nodes > SIM_MAX_NODES || secs <= 0)
+    {
+      print_usage (argv[0]);
+      return 1;
+    }
+
+  srand48 (seed);
+  sim_kernel_init (num_nodes);
+  sim_medium_init (num_nodes);
+  app_stats = calloc (num_nodes, sizeof (app_stats_t));
+  if (link_file != NULL)
+    {
+      links = sim_medium_load_links (link_file);
+      if (links < 0)
+	return 1;
+    }
+  else
+    sim_medium_grid_links (spacing, 3.0);
+
+  if (mkdtemp (tmp_dir) == NULL)
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+  for (i = 0; i < num_nodes; i++)
+    {
+      h = load_node (image, i);
+      if (h == NULL)
+	{
+	  printf ("Could not load %s for node %d\n", image, i);
+	  rmdir (tmp_dir);
+	  return 1;
+	}
+      deliver = (sim_deliver_fn) dlsym (h, "rf_sim_deliver");
+      init = (node_init_fn) dlsym (h, "sim_node_init");
+      if (deliver == NULL || init == NULL)
+	{
+	  printf ("%s is not a node image\n", image);
+	  rmdir (tmp_dir);
+	  return 1;
+	}
+      sim_medium_node (i, deliver);
+      sim_kernel_set_node (i);
+      init (i);
+    }
+  rmdir (tmp_dir);
+
+  sim_kernel_run ((uint64_t) (secs * 1e9));
+
+  memset (&total, 0, sizeof (total));
+  tx = rx = 0;
+  lat_sum = lat_max = 0;
+  duty = 0;
+  for (i = 0; i < num_nodes; i++)
+    {
+      sim_medium_stats (i, &rs);
+      total.tx_frames += rs.tx_frames;
+      total.rx_frames += rs.rx_frames;
+      total.collisions += rs.collisions;
+      total.lost += rs.lost;
+      total.acks += rs.acks;
+      duty += (double) rs.on_ns / (secs * 1e9);
+      tx += app_stats[i].tx;
+      rx += app_stats[i].rx;
+      lat_sum += app_stats[i].latency_sum;
+      if (app_stats[i].latency_max > lat_max)
+	lat_max = app_stats[i].latency_max;
+      if (sim_param.verbose)
+	printf ("node %3d: app tx %u rx %u, radio tx %u rx %u col %u, "
+		"duty %.2f%%\n", i, app_stats[i].tx, app_stats[i].rx,
+		rs.tx_frames, rs.rx_frames, rs.collisions,
+		100.0 * rs.on_ns / (secs * 1e9));
+    }
+
+  printf ("nodes %d, %.0f s simulated\n", num_nodes, secs);
+  printf ("app packets sent     %u\n", tx);
+  printf ("app packets received %u", rx);
+  if (!sim_param.broadcast && tx > 0)
+    printf (" (%.1f%% delivered)", 100.0 * rx / tx);
+  printf ("\n");
+  printf ("throughput           %.1f B/s\n",
+	  (double) rx * sim_param.payload / secs);
+  if (rx > 0)
+    printf ("latency              mean %.1f ms, max %.1f ms\n",
+	    lat_sum / 1e6 / rx, lat_max / 1e6);
+  printf ("radio duty cycle     %.2f%%\n", 100.0 * duty / num_nodes);
+  printf ("radio frames         tx %u, rx %u, acks %u\n", total.tx_frames,
+	  total.rx_frames, total.acks);
+  printf ("receiver drops       collisions %u, link loss %u\n",
+	  total.collisions, total.lost);
+  return 0;
+}
@@ -0,0 +1,392 @@
+/******************************************************************************
+*  rfsim: shared 802.15.4 radio medium
+*
+*  Links are directed and carry a packet reception ratio and an RSSI.  A
+*  frame is received when the receiver listened through the whole frame,
+*  was not transmitting itself, every overlapping transmission it hears is
+*  at least SIM_CAPTURE_DB weaker, and the link's loss draw succeeds.
+*  Acknowledgments take airtime but are not checked for collisions.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sim.h"
+
+typedef struct
+{
+  float prr;
+  int8_t rssi;			// dBm at full transmit power
+  uint8_t valid;
+} sim_link_t;
+
+typedef struct
+{
+  uint8_t rx_on;
+  uint64_t rx_since;		// when the receiver was last turned on
+  uint16_t addr;
+  uint8_t decode;
+  uint8_t auto_ack;
+  int8_t cca_dbm;
+  int8_t power_dbm;		// transmit power relative to full power
+  sim_deliver_fn deliver;
+  sim_radio_stats_t stats;
+} sim_radio_t;
+
+// A transmission is remembered until it can no longer overlap a new one
+typedef struct
+{
+  int node;
+  uint64_t start;
+  uint64_t end;
+  int8_t power_dbm;
+} sim_air_t;
+
+#define SIM_AIR_MAX	(SIM_MAX_NODES * 4)
+#define SIM_AIR_KEEP_NS	(2 * (127 + SIM_PHY_OVERHEAD) * SIM_BYTE_NS)
+
+static int num_nodes;
+static sim_radio_t *radios;
+static sim_link_t *links;
+static sim_air_t air[SIM_AIR_MAX];
+static int air_len;
+
+#define LINK(i, j)	(links[(i) * num_nodes + (j)])
+#define ROUTE_LINK(i, j, min_rssi) \
+  (LINK (i, j).valid && LINK (i, j).prr > 0.5 && LINK (i, j).rssi >= (min_rssi))
+
+/****************************************************************************/
+void
+sim_medium_init (int n)
+{
+  int i;
+
+  num_nodes = n;
+  radios = calloc (n, sizeof (sim_radio_t));
+  links = calloc ((size_t) n * n, sizeof (sim_link_t));
+  if (radios == NULL || links == NULL)
+    {
+      fprintf (stderr, "rfsim: out of memory\n");
+      exit (1);
+    }
+  for (i = 0; i < n; i++)
+    {
+      radios[i].decode = 1;
+      radios[i].auto_ack = 1;
+      radios[i].cca_dbm = -81;
+    }
+}
+
+// Each line is "src dst prr rssi", '#' starts a comment
+int
+sim_medium_load_links (const char *file)
+{
+  FILE *fp;
+  char line[128];
+  int src, dst, rssi, cnt;
+  float prr;
+
+  fp = fopen (file, "r");
+  if (fp == NULL)
+    {
+      printf ("Could not open link file %s\n", file);
+      return -1;
+    }
+  cnt = 0;
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      if (line[0] == '#')
+	continue;
+      if (sscanf (line, "%d %d %f %d", &src, &dst, &prr, &rssi) != 4)
+	continue;
+      if (src < 0 || src >= num_nodes || dst < 0 || dst >= num_nodes
+	  || src == dst)
+	{
+	  printf ("Ignoring link %d -> %d\n", src, dst);
+	  continue;
+	}
+      LINK (src, dst).prr = prr;
+      LINK (src, dst).rssi = rssi;
+      LINK (src, dst).valid = 1;
+      cnt++;
+    }
+  fclose (fp);
+  return cnt;
+}
+
+// Nodes on a square grid, log-distance path loss at 0 dBm and a logistic
+// reception curve around the -92 dBm sensitivity
+void
+sim_medium_grid_links (double spacing, double exponent)
+{
+  int i, j, side;
+  double dx, dy, d, rssi;
+
+  side = (int) ceil (sqrt (num_nodes));
+  for (i = 0; i < num_nodes; i++)
+    for (j = 0; j < num_nodes; j++)
+      {
+	if (i == j)
+	  continue;
+	dx = (i % side - j % side) * spacing;
+	dy = (i / side - j / side) * spacing;
+	d = sqrt (dx * dx + dy * dy);
+	rssi = -40.0 - 10.0 * exponent * log10 (d < 1.0 ? 1.0 : d);
+	if (rssi < SIM_NOISE_DBM)
+	  continue;
+	LINK (i, j).rssi = (int8_t) rssi;
+	LINK (i, j).prr = 1.0 / (1.0 + exp (-(rssi + 92.0) / 1.5));
+	LINK (i, j).valid = 1;
+      }
+}
+
+void
+sim_medium_node (int node, sim_deliver_fn deliver)
+{
+  radios[node].deliver = deliver;
+}
+
+int
+sim_medium_nodes ()
+{
+  return num_nodes;
+}
+
+// The pick'th outgoing link of node, wrapping around.  -1 if it has none.
+int
+sim_medium_neighbor (int node, int pick)
+{
+  int j, cnt;
+
+  cnt = 0;
+  for (j = 0; j < num_nodes; j++)
+    if (LINK (node, j).valid && LINK (node, j).prr > 0.5)
+      cnt++;
+  if (cnt == 0)
+    return -1;
+  pick %= cnt;
+  for (j = 0; j < num_nodes; j++)
+    if (LINK (node, j).valid && LINK (node, j).prr > 0.5 && pick-- == 0)
+      return j;
+  return -1;
+}
+
+// First hop of a shortest path over links that are good and at least
+// min_rssi strong at full power, for static routes.  -1 if there is none.
+int
+sim_medium_next_hop (int node, int dest, int8_t min_rssi)
+{
+  int *dist, *fifo;
+  int head, tail, i, j, hop;
+
+  if (node == dest)
+    return dest;
+  dist = malloc (num_nodes * sizeof (int));
+  fifo = malloc (num_nodes * sizeof (int));
+  for (i = 0; i < num_nodes; i++)
+    dist[i] = -1;
+  // Hops to dest, following links backwards
+  dist[dest] = 0;
+  head = tail = 0;
+  fifo[tail++] = dest;
+  while (head < tail)
+    {
+      j = fifo[head++];
+      for (i = 0; i < num_nodes; i++)
+	if (dist[i] < 0 && ROUTE_LINK (i, j, min_rssi))
+	  {
+	    dist[i] = dist[j] + 1;
+	    fifo[tail++] = i;
+	  }
+    }
+  hop = -1;
+  if (dist[node] > 0)
+    for (j = 0; j < num_nodes && hop < 0; j++)
+      if (dist[j] == dist[node] - 1 && ROUTE_LINK (node, j, min_rssi))
+	hop = j;
+  free (dist);
+  free (fifo);
+  return hop;
+}
+
+void
+sim_medium_stats (int node, sim_radio_stats_t * s)
+{
+  *s = radios[node].stats;
+  if (radios[node].rx_on)
+    s->on_ns += sim_now () - radios[node].rx_since;
+}
+
+/****************************************************************************/
+void
+sim_radio_rx (int node, uint8_t on)
+{
+  sim_radio_t *r = &radios[node];
+
+  if (on && !r->rx_on)
+    r->rx_since = sim_now ();
+  else if (!on && r->rx_on)
+    r->stats.on_ns += sim_now () - r->rx_since;
+  r->rx_on = on;
+}
+
+void
+sim_radio_addr (int node, uint16_t addr, uint8_t decode, uint8_t auto_ack)
+{
+  radios[node].addr = addr;
+  radios[node].decode = decode;
+  radios[node].auto_ack = auto_ack;
+}
+
+void
+sim_radio_cca_thresh (int node, int8_t dbm)
+{
+  radios[node].cca_dbm = dbm;
+}
+
+void
+sim_radio_power (int node, int8_t dbm)
+{
+  radios[node].power_dbm = dbm;
+}
+
+// Returns 1 if the energy on the channel is below the CCA threshold.
+// The radio integrates energy over the CCA period that just ended, so any
+// transmission overlapping that window counts, not only ones still on air.
+uint8_t
+sim_radio_cca (int node)
+{
+  uint64_t now = sim_now ();
+  double mw = 0;
+  int i;
+
+  for (i = 0; i < air_len; i++)
+    {
+      if (air[i].node == node || air[i].start >= now
+	  || air[i].end + SIM_CCA_NS <= now)
+	continue;
+      if (!LINK (air[i].node, node).valid)
+	continue;
+      mw += pow (10.0, (LINK (air[i].node, node).rssi + air[i].power_dbm)
+		 / 10.0);
+    }
+  if (mw == 0)
+    return 1;
+  return 10.0 * log10 (mw) < radios[node].cca_dbm;
+}
+
+static void
+_air_expire (uint64_t now)
+{
+  int i;
+
+  for (i = 0; i < air_len;)
+    if (air[i].end + SIM_AIR_KEEP_NS < now)
+      air[i] = air[--air_len];
+    else
+      i++;
+}
+
+// Does receiver rx lose the frame on tx to another transmission?
+static int
+_collides (int rx, sim_air_t * tx, int8_t rssi)
+{
+  int i;
+
+  for (i = 0; i < air_len; i++)
+    {
+      if (&air[i] == tx || air[i].end <= tx->start || air[i].start >= tx->end)
+	continue;
+      if (air[i].node == rx)
+	return 1;		// half duplex
+      if (!LINK (air[i].node, rx).valid)
+	continue;
+      if (rssi - (LINK (air[i].node, rx).rssi + air[i].power_dbm)
+	  < SIM_CAPTURE_DB)
+	return 1;
+    }
+  return 0;
+}
+
+// Puts the frame on the air and blocks the calling task for its airtime.
+// Returns NRK_OK (1), or -1 when an ack was requested and none came back.
+int8_t
+sim_radio_tx (int node, const sim_frame_t * f)
+{
+  sim_radio_t *r = &radios[node], *rr;
+  sim_air_t *tx;
+  uint64_t airtime;
+  int8_t rssi;
+  uint8_t acked;
+  int j, slot;
+
+  airtime = (f->len + SIM_PHY_OVERHEAD) * SIM_BYTE_NS;
+  _air_expire (sim_now ());
+  if (air_len == SIM_AIR_MAX)
+    {
+      fprintf (stderr, "rfsim: too many frames on the air\n");
+      exit (1);
+    }
+  slot = air_len++;
+  air[slot].node = node;
+  air[slot].start = sim_now ();
+  air[slot].end = sim_now () + airtime;
+  air[slot].power_dbm = r->power_dbm;
+  r->stats.tx_frames++;
+  if (!r->rx_on)
+    r->stats.on_ns += airtime;
+
+  sim_sleep (airtime);
+
+  // The air table may have been compacted while this task slept
+  for (tx = NULL, slot = 0; slot < air_len; slot++)
+    if (air[slot].node == node && air[slot].end == sim_now ())
+      tx = &air[slot];
+
+  acked = 0;
+  for (j = 0; j < num_nodes; j++)
+    {
+      if (j == node || !LINK (node, j).valid)
+	continue;
+      rr = &radios[j];
+      if (!rr->rx_on || rr->rx_since > tx->start)
+	continue;
+      rssi = LINK (node, j).rssi + r->power_dbm;
+      if (_collides (j, tx, rssi))
+	{
+	  rr->stats.collisions++;
+	  continue;
+	}
+      if (drand48 () >= LINK (node, j).prr)
+	{
+	  rr->stats.lost++;
+	  continue;
+	}
+      if (rr->decode && f->dest != 0xFFFF && f->dest != rr->addr)
+	continue;
+      rr->stats.rx_frames++;
+      if (rr->deliver)
+	rr->deliver (f->data, f->len, rssi,
+		     (uint8_t) (LINK (node, j).prr * 255));
+      if (f->ack_request && rr->auto_ack && f->dest == rr->addr
+	  && LINK (j, node).valid && drand48 () < LINK (j, node).prr)
+	{
+	  rr->stats.acks++;
+	  acked = 1;
+	}
+    }
+
+  if (f->ack_request)
+    {
+      if (!acked)
+	{
+	  sim_sleep (SIM_ACK_WAIT_NS);
+	  return -1;
+	}
+      sim_sleep (SIM_TURNAROUND_NS
+		 + (SIM_ACK_LEN + SIM_PHY_OVERHEAD) * SIM_BYTE_NS);
+    }
+  return 1;
+}
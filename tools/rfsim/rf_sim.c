@@ -0,0 +1,372 @@
+/******************************************************************************
+*  rfsim: basic_rf.h implemented on the simulated medium
+*
+*  This file is linked into node.so, so every simulated node gets its own
+*  copy of the driver state below.  Frames are laid out exactly like the
+*  rf231_soc driver lays them out, and received frames go through the same
+*  kind of RX ring, so MAC code sees the same behaviour as on hardware.
+*  rx_start_callback()/rx_end_callback() functions are stored but never
+*  called, because delivery runs in the sending node's task.
+*******************************************************************************/
+
+#include <include.h>
+#include <nrk.h>
+#include <basic_rf.h>
+
+#include "sim.h"
+
+#define RF_HDR_LEN	9		// FCF, seq, dest PAN, dest, src
+#define RF_FCS_LEN	2
+
+volatile RF_SETTINGS rfSettings;
+
+static rf_rx_frame_t rx_ring[RF_RX_RING_SIZE];
+static uint8_t rx_ring_head;
+static uint8_t rx_ring_tail;
+static uint16_t rx_ring_overflow;
+
+static uint8_t rf_ready;
+static uint8_t addr_decode = 1;
+static uint8_t auto_ack = 1;
+static uint8_t tx_frame_pending;
+static int8_t tx_stamp_offset = -1;
+static uint64_t tx_stamp_ns;
+
+static void (*rx_start_func) (void);
+static void (*rx_end_func) (void);
+
+/****************************************************************************/
+static void
+_rf_sim_addr_update ()
+{
+  sim_radio_addr (sim_node_self (), rfSettings.myAddr, addr_decode, auto_ack);
+}
+
+// Called by the medium, in the sender's task, for every frame this node
+// receives
+void
+rf_sim_deliver (const uint8_t * frame, uint8_t len, int8_t rssi_dbm,
+		uint8_t lqi)
+{
+  uint8_t next;
+  rf_rx_frame_t *slot;
+  uint64_t sfd_ns;
+  int ed;
+
+  next = (rx_ring_head + 1) & (RF_RX_RING_SIZE - 1);
+  if (next == rx_ring_tail)
+    {
+      if (rx_ring_overflow < 65535)
+	rx_ring_overflow++;
+      return;
+    }
+  // ED level is 0 at the -91 dBm sensitivity, one step per dB
+  ed = rssi_dbm + 91;
+  ed = ed < 0 ? 0 : (ed > 84 ? 84 : ed);
+  slot = &rx_ring[rx_ring_head];
+  slot->length = len;
+  memcpy (slot->data, frame, len);
+  slot->ed = ed;
+  slot->rssi = ed / 3;
+  slot->lqi = lqi;
+  // The driver stamps the SFD, the PHR and PSDU came after it
+  sfd_ns = sim_now () - (len + 1) * SIM_BYTE_NS;
+  slot->timestamp.secs = sfd_ns / NANOS_PER_SEC;
+  slot->timestamp.nano_secs = sfd_ns % NANOS_PER_SEC;
+  rx_ring_head = next;
+}
+
+/****************************************************************************/
+void
+rf_init (RF_RX_INFO * pRRI, uint8_t channel, uint16_t panId, uint16_t myAddr)
+{
+  rfSettings.pRxInfo = pRRI;
+  rfSettings.txSeqNumber = 0;
+  rfSettings.ackReceived = 0;
+  rfSettings.panId = panId;
+  rfSettings.myAddr = myAddr;
+  rfSettings.receiveOn = 0;
+  rx_ring_head = rx_ring_tail = 0;
+  rx_ring_overflow = 0;
+  tx_frame_pending = 0;
+  tx_stamp_offset = -1;
+  rf_ready = 1;
+  _rf_sim_addr_update ();
+  sim_radio_cca_thresh (sim_node_self (), -81);
+}
+
+void
+rf_set_rx (RF_RX_INFO * pRRI, uint8_t channel)
+{
+  rfSettings.pRxInfo = pRRI;
+}
+
+void
+rx_start_callback (void (*func) (void))
+{
+  rx_start_func = func;
+}
+
+void
+rx_end_callback (void (*func) (void))
+{
+  rx_end_func = func;
+}
+
+void
+rf_power_up ()
+{
+}
+
+void
+rf_power_down ()
+{
+  sim_radio_rx (sim_node_self (), 0);
+}
+
+void
+rf_rx_on ()
+{
+  sim_radio_rx (sim_node_self (), 1);
+}
+
+void
+rf_polling_rx_on ()
+{
+  sim_radio_rx (sim_node_self (), 1);
+}
+
+void
+rf_rx_off ()
+{
+  sim_radio_rx (sim_node_self (), 0);
+}
+
+void
+rf_addr_decode_enable ()
+{
+  addr_decode = 1;
+  _rf_sim_addr_update ();
+}
+
+void
+rf_addr_decode_disable ()
+{
+  addr_decode = 0;
+  _rf_sim_addr_update ();
+}
+
+void
+rf_auto_ack_enable ()
+{
+  auto_ack = 1;
+  _rf_sim_addr_update ();
+}
+
+void
+rf_auto_ack_disable ()
+{
+  auto_ack = 0;
+  _rf_sim_addr_update ();
+}
+
+void
+rf_addr_decode_set_my_mac (uint16_t my_mac)
+{
+  rfSettings.myAddr = my_mac;
+  _rf_sim_addr_update ();
+}
+
+// Same register scale as the rf231: 0 is +3 dBm, one step is 1 dB down
+void
+rf_tx_power (uint8_t pwr)
+{
+  sim_radio_power (sim_node_self (), 3 - (int8_t) (pwr & 0x1F));
+}
+
+// Threshold is -91 dBm plus 2 dB per step, as in the CCA_THRES register
+int8_t
+rf_sim_cca_dbm (int8_t t)
+{
+  return -91 + 2 * (t & 0xF);
+}
+
+void
+rf_set_cca_thresh (int8_t t)
+{
+  sim_radio_cca_thresh (sim_node_self (), rf_sim_cca_dbm (t));
+}
+
+void
+rf_tx_frame_pending_set (uint8_t pending)
+{
+  tx_frame_pending = pending;
+}
+
+void
+rf_tx_stamp_set (int8_t offset, nrk_time_t * time)
+{
+  tx_stamp_offset = offset;
+  if (offset >= 0)
+    tx_stamp_ns = (uint64_t) time->secs * NANOS_PER_SEC + time->nano_secs;
+}
+
+// Same as the radio: every copy gets the ms left when it goes out
+static void
+_rf_sim_stamp (uint8_t * field)
+{
+  uint64_t ms = 0;
+
+  if (tx_stamp_ns > sim_now ())
+    ms = (tx_stamp_ns - sim_now ()) / NANOS_PER_MS;
+  if (ms > 0xFFFF)
+    ms = 0xFFFF;
+  field[0] = ms;
+  field[1] = ms >> 8;
+}
+
+/****************************************************************************/
+uint8_t
+rf_tx_packet_repeat (RF_TX_INFO * pRTI, uint16_t ms)
+{
+  sim_frame_t f;
+  uint16_t src = rfSettings.myAddr;
+  uint64_t until;
+  int8_t rc;
+
+  if (!rf_ready)
+    return NRK_ERROR;
+
+  rfSettings.txSeqNumber++;
+  f.dest = pRTI->destAddr;
+  f.ack_request = pRTI->ackRequest;
+  f.len = RF_HDR_LEN + pRTI->length + RF_FCS_LEN;
+  // FCF: data frame, PAN ID compression, short addresses
+  f.data[0] = 0x41 | (tx_frame_pending ? 0x10 : 0)
+    | (pRTI->ackRequest ? 0x20 : 0);
+  f.data[1] = 0x88;
+  f.data[2] = rfSettings.txSeqNumber;
+  f.data[3] = rfSettings.panId & 0xFF;
+  f.data[4] = rfSettings.panId >> 8;
+  f.data[5] = pRTI->destAddr & 0xFF;
+  f.data[6] = pRTI->destAddr >> 8;
+  f.data[7] = src & 0xFF;
+  f.data[8] = src >> 8;
+  memcpy (f.data + RF_HDR_LEN, pRTI->pPayload, pRTI->length);
+  f.data[f.len - 2] = f.data[f.len - 1] = 0;
+
+  until = sim_now () + (uint64_t) ms * NANOS_PER_MS;
+  do
+    {
+      if (tx_stamp_offset >= 0 && tx_stamp_offset + 2 <= pRTI->length)
+	_rf_sim_stamp (f.data + RF_HDR_LEN + tx_stamp_offset);
+      rc = sim_radio_tx (sim_node_self (), &f);
+      if (ms == 0)
+	break;
+      // A repeated frame with an ack request is a strobe
+      if (pRTI->ackRequest && rc == NRK_OK)
+	break;
+      sim_sleep (SIM_TX_GAP_NS);
+    }
+  while (sim_now () < until);
+  return rc == NRK_OK ? NRK_OK : NRK_ERROR;
+}
+
+uint8_t
+rf_tx_packet (RF_TX_INFO * pRTI)
+{
+  return rf_tx_packet_repeat (pRTI, 0);
+}
+
+// Returns 1 if the channel is clear, 0 if it is in use
+int8_t
+rf_cca_check ()
+{
+  if (!rf_ready)
+    return NRK_ERROR;
+  sim_sleep (SIM_CCA_NS);
+  return sim_radio_cca (sim_node_self ());
+}
+
+int8_t
+rf_rx_packet_nonblock ()
+{
+  rf_rx_frame_t *frame;
+  RF_RX_INFO *info = rfSettings.pRxInfo;
+  int8_t length;
+
+  if (!rf_ready)
+    return NRK_ERROR;
+  if (rx_ring_head == rx_ring_tail)
+    return 0;
+
+  frame = &rx_ring[rx_ring_tail];
+  rx_ring_tail = (rx_ring_tail + 1) & (RF_RX_RING_SIZE - 1);
+  length = frame->length - RF_HDR_LEN - RF_FCS_LEN;
+  if (length > info->max_length || length < 0)
+    return NRK_ERROR;
+
+  info->seqNumber = frame->data[2];
+  info->srcAddr = frame->data[7] | (frame->data[8] << 8);
+  info->length = length;
+  memcpy (info->pPayload, frame->data + RF_HDR_LEN, length);
+  info->ackRequest = (frame->data[0] & 0x20) != 0;
+  info->framePending = (frame->data[0] & 0x10) != 0;
+  info->rssi = frame->ed;
+  info->actualRssi = frame->rssi;
+  info->energyDetectionLevel = frame->ed;
+  info->linkQualityIndication = frame->lqi;
+  info->timestamp = frame->timestamp;
+  return NRK_OK;
+}
+
+uint8_t
+rf_rx_ring_pending ()
+{
+  return (rx_ring_head - rx_ring_tail) & (RF_RX_RING_SIZE - 1);
+}
+
+uint16_t
+rf_rx_ring_overflow_get ()
+{
+  return rx_ring_overflow;
+}
+
+void
+rf_rx_ring_overflow_reset ()
+{
+  rx_ring_overflow = 0;
+}
+
+void
+rf_rx_ring_flush ()
+{
+  rx_ring_tail = rx_ring_head;
+}
+
+/******************** not simulated: security, CC2591 ***********************/
+uint8_t
+rf_security_last_pkt_status ()
+{
+  return 0;
+}
+
+void
+rf_security_set_key (uint8_t * key)
+{
+}
+
+void
+rf_security_set_ctr_counter (uint8_t * counter)
+{
+}
+
+void
+rf_cc2591_tx_on ()
+{
+}
+
+void
+rf_cc2591_rx_on ()
+{
+}
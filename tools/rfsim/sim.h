@@ -0,0 +1,106 @@
+/******************************************************************************
+*  rfsim: host side 802.15.4 medium simulator for Nano-RK MAC code
+*
+*  The simulator executable owns the virtual clock, the task scheduler and
+*  the radio medium.  Every simulated node is a private copy of a node image
+*  (MAC + application + rf_sim.c), so the static state in the MAC code
+*  is per node without touching the MAC sources.  Node code reaches the
+*  simulator only through the functions declared here.
+*******************************************************************************/
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdint.h>
+
+#define SIM_MAX_NODES		512
+#define SIM_MAX_TASKS_PER_NODE	8
+#define SIM_MAX_SIGNALS		32
+#define SIM_TASK_STACK		(64 * 1024)
+#define SIM_NEVER		UINT64_MAX
+
+/* 250 kb/s O-QPSK: one byte every 32 us, turnaround 12 symbols */
+#define SIM_BYTE_NS		32000ULL
+#define SIM_PHY_OVERHEAD	6		// preamble, SFD and length byte
+#define SIM_TURNAROUND_NS	192000ULL
+#define SIM_TX_GAP_NS		16000ULL	// TX_START again from PLL_ON
+#define SIM_CCA_NS		128000ULL
+#define SIM_ACK_LEN		5
+#define SIM_ACK_WAIT_NS		864000ULL	// TX_ARET gives up after 54 symbols
+
+#define SIM_CAPTURE_DB		3		// a frame survives interference this much weaker
+#define SIM_NOISE_DBM		(-100)
+
+/********************************* run parameters *********************************/
+typedef struct
+{
+  uint32_t check_ms;		// fixed B-MAC check rate
+  uint32_t adapt_min_ms;	// adaptive check rate, 0 for fixed
+  uint32_t adapt_max_ms;
+  uint8_t strobe;		// B-MAC strobed preambles
+  uint8_t broadcast;		// broadcast instead of unicast to a neighbor
+  double pkt_rate;		// packets per second per node
+  double burst_on;		// send only burst_on of every burst_on + burst_off
+  double burst_off;		// seconds, all nodes at once; 0 to send all the time
+  uint8_t payload;		// application payload bytes
+  uint8_t train;		// packets queued back to back per send, 1 for single sends
+  uint8_t verbose;
+} sim_param_t;
+
+extern sim_param_t sim_param;
+
+/*********************************** scheduler ************************************/
+uint64_t sim_now ();
+int sim_node_self ();
+void sim_sleep (uint64_t ns);
+
+void sim_kernel_init (int nodes);
+void sim_kernel_set_node (int node);
+void sim_kernel_run (uint64_t until);
+
+/********************************* radio medium **********************************/
+typedef struct
+{
+  uint16_t dest;
+  uint8_t ack_request;
+  uint8_t len;			// MAC frame length including the FCS
+  uint8_t data[127];
+} sim_frame_t;
+
+typedef void (*sim_deliver_fn) (const uint8_t * frame, uint8_t len,
+				int8_t rssi_dbm, uint8_t lqi);
+
+typedef struct
+{
+  uint32_t tx_frames;
+  uint32_t rx_frames;
+  uint32_t collisions;		// frames lost to interference at this receiver
+  uint32_t lost;		// frames lost to link errors at this receiver
+  uint32_t acks;
+  uint64_t on_ns;		// radio on time
+} sim_radio_stats_t;
+
+void sim_medium_init (int nodes);
+int sim_medium_load_links (const char *file);
+void sim_medium_grid_links (double spacing, double exponent);
+void sim_medium_node (int node, sim_deliver_fn deliver);
+int sim_medium_nodes ();
+int sim_medium_neighbor (int node, int pick);
+int sim_medium_next_hop (int node, int dest, int8_t min_rssi);
+void sim_medium_stats (int node, sim_radio_stats_t * s);
+
+void sim_radio_rx (int node, uint8_t on);
+void sim_radio_addr (int node, uint16_t addr, uint8_t decode, uint8_t auto_ack);
+void sim_radio_cca_thresh (int node, int8_t dbm);
+void sim_radio_power (int node, int8_t dbm);
+uint8_t sim_radio_cca (int node);
+int8_t sim_radio_tx (int node, const sim_frame_t * f);
+
+/***************************** node side, rf_sim.c ******************************/
+int8_t rf_sim_cca_dbm (int8_t thresh);
+
+/****************************** application statistics ******************************/
+void sim_stat_app_tx (int node);
+void sim_stat_app_rx (int node, uint64_t latency_ns);
+
+#endif